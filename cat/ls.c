@@ -452,29 +452,31 @@ do_ls_R (const char *dir)
   return 0;
 }
 
-static int show_file (const char *dir, const char *name, const struct guestfs_statns *stat, const struct guestfs_xattr_list *xattrs, void *unused);
+static int show_file (const char *dir, const char *name, const struct guestfs_statns *stat, const struct guestfs_xattr_list *xattrs, const char *link, const char *csum, void *unused);
 
 static int
 do_ls_lR (const char *dir)
 {
-  return visit (g, dir, show_file, NULL);
+  return visit (g, dir, checksum, show_file, NULL);
 }
 
 /* This is the function which is called to display all files and
  * directories, and it's where the magic happens.  We are called with
- * full stat and extended attributes for each file, so there is no
- * penalty for displaying anything in those structures.  However if we
- * need other things (eg. checksum) we may have to go back to the
+ * full stat and extended attributes for each file, the link target
+ * for symbolic links and (if --checksum was given) the checksum for
+ * regular files, so there is no penalty for displaying any of those.
+ * However if we need other things we may have to go back to the
  * appliance and then there can be a very large penalty.
  */
 static int
 show_file (const char *dir, const char *name,
            const struct guestfs_statns *stat,
            const struct guestfs_xattr_list *xattrs,
+           const char *link, const char *csum,
            void *unused)
 {
   const char *filetype;
-  CLEANUP_FREE char *path = NULL, *csum = NULL, *link = NULL;
+  CLEANUP_FREE char *path = NULL;
 
   /* Display the basic fields. */
   output_start_line ();
@@ -529,9 +531,11 @@ show_file (const char *dir, const char *name,
 
   if (checksum) {
     if (is_reg (stat->st_mode)) {
-      csum = guestfs_checksum (g, checksum, path);
-      if (!csum)
+      if (!csum) {
+        fprintf (stderr, _("%s: %s: cannot compute checksum\n"),
+                 guestfs_int_program_name, path);
         exit (EXIT_FAILURE);
+      }
 
       output_string (csum);
     } else if (csv)
@@ -540,9 +544,7 @@ show_file (const char *dir, const char *name,
 
   output_string (path);
 
-  if (is_lnk (stat->st_mode))
-    /* XXX Fix this for NTFS. */
-    link = guestfs_readlink (g, path);
+  /* XXX Fix this for NTFS. */
   if (link)
     output_string_link (link);
 
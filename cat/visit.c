@@ -26,6 +26,7 @@ https://rwmj.wordpress.com/2010/12/15/tip-audit-virtual-machine-for-setuid-files
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 #include <assert.h>
 #include <libintl.h>
 
@@ -34,103 +35,233 @@ https://rwmj.wordpress.com/2010/12/15/tip-audit-virtual-machine-for-setuid-files
 
 #include "visit.h"
 
-static int _visit (guestfs_h *g, int depth, const char *dir, visitor_function f, void *opaque);
+static int read_record (FILE *fp, char **rel, struct guestfs_statns *stat, struct guestfs_xattr_list *xattrs, char **link, char **csum);
+static void free_xattrs (struct guestfs_xattr_list *xattrs);
 
+/* Visit every file and directory under 'dir'.
+ *
+ * The whole tree is fetched in a single call to guestfs_walk_out,
+ * which writes a record for each entry to a temporary file.  The
+ * records are in the same order as the old recursive implementation
+ * (using guestfs_ls, guestfs_lstatnslist etc. on each directory)
+ * used to visit them.
+ *
+ * If 'checksum' is not NULL, then it is the type of checksum to
+ * compute for regular files, and it is passed to 'f' as 'csum'.
+ */
 int
-visit (guestfs_h *g, const char *dir, visitor_function f, void *opaque)
+visit (guestfs_h *g, const char *dir, const char *checksum,
+       visitor_function f, void *opaque)
 {
-  return _visit (g, 0, dir, f, opaque);
-}
+  CLEANUP_FREE char *tmpdir = guestfs_get_tmpdir (g);
+  CLEANUP_FREE char *localfile = NULL;
+  CLEANUP_FREE char *parent_rel = NULL, *parent_dir = NULL;
+  char dev_fd[64];
+  int fd, r;
+  FILE *fp;
+
+  if (tmpdir == NULL)
+    return -1;
+  if (asprintf (&localfile, "%s/visitXXXXXX", tmpdir) == -1) {
+    perror ("asprintf");
+    return -1;
+  }
+  if ((fd = mkstemp (localfile)) == -1) {
+    perror ("mkstemp");
+    return -1;
+  }
+  unlink (localfile);
 
-static int
-_visit (guestfs_h *g, int depth, const char *dir,
-        visitor_function f, void *opaque)
-{
-  /* Call 'f' with the top directory.  Note that ordinary recursive
-   * visits will not otherwise do this, so we have to have a special
-   * case.
-   */
-  if (depth == 0) {
-    CLEANUP_FREE_STATNS struct guestfs_statns *stat = NULL;
-    CLEANUP_FREE_XATTR_LIST struct guestfs_xattr_list *xattrs = NULL;
-    int r;
+  snprintf (dev_fd, sizeof dev_fd, "/dev/fd/%d", fd);
 
-    stat = guestfs_lstatns (g, dir);
-    if (stat == NULL)
-      return -1;
+  if (checksum)
+    r = guestfs_walk_out (g, dir, dev_fd,
+                          GUESTFS_WALK_OUT_CHECKSUM, checksum, -1);
+  else
+    r = guestfs_walk_out (g, dir, dev_fd, -1);
+  if (r == -1) {
+    close (fd);
+    return -1;
+  }
 
-    xattrs = guestfs_lgetxattrs (g, dir);
-    if (xattrs == NULL)
-      return -1;
+  if (lseek (fd, 0, SEEK_SET) == -1) {
+    perror ("lseek");
+    close (fd);
+    return -1;
+  }
+  fp = fdopen (fd, "r");
+  if (fp == NULL) {
+    perror ("fdopen");
+    close (fd);
+    return -1;
+  }
 
-    r = f (dir, NULL, stat, xattrs, opaque);
+  for (;;) {
+    CLEANUP_FREE char *rel = NULL, *link = NULL, *csum = NULL;
+    struct guestfs_statns stat;
+    struct guestfs_xattr_list xattrs;
+    const char *name, *entry_dir;
+    char *p;
+
+    r = read_record (fp, &rel, &stat, &xattrs, &link, &csum);
+    if (r <= 0)
+      break;
+
+    /* The record path is relative to 'dir', and empty for 'dir'
+     * itself.  Split it into the containing directory and name.
+     */
+    if (STREQ (rel, "")) {
+      entry_dir = dir;
+      name = NULL;
+    }
+    else if ((p = strrchr (rel, '/')) == NULL) {
+      entry_dir = dir;
+      name = rel;
+    }
+    else {
+      *p = '\0';
+      name = p+1;
+      if (parent_rel == NULL || STRNEQ (parent_rel, rel)) {
+        free (parent_rel);
+        free (parent_dir);
+        parent_rel = strdup (rel);
+        if (parent_rel == NULL) {
+          perror ("strdup");
+          abort ();
+        }
+        parent_dir = full_path (dir, rel);
+      }
+      entry_dir = parent_dir;
+    }
 
+    r = f (entry_dir, name, &stat, &xattrs,
+           STREQ (link, "") ? NULL : link, STREQ (csum, "") ? NULL : csum,
+           opaque);
+    free_xattrs (&xattrs);
     if (r == -1)
-      return -1;
+      break;
   }
 
-  size_t i, xattrp;
-  CLEANUP_FREE_STRING_LIST char **names = NULL;
-  CLEANUP_FREE_STAT_LIST struct guestfs_statns_list *stats = NULL;
-  CLEANUP_FREE_XATTR_LIST struct guestfs_xattr_list *xattrs = NULL;
+  fclose (fp);
+  return r;
+}
 
-  names = guestfs_ls (g, dir);
-  if (names == NULL)
-    return -1;
+static int
+read_uint32 (FILE *fp, uint32_t *v)
+{
+  unsigned char b[4];
 
-  stats = guestfs_lstatnslist (g, dir, names);
-  if (stats == NULL)
+  if (fread (b, 1, sizeof b, fp) != sizeof b)
     return -1;
+  *v = (uint32_t) b[0] << 24 | (uint32_t) b[1] << 16 |
+    (uint32_t) b[2] << 8 | b[3];
+  return 0;
+}
+
+static int
+read_int64 (FILE *fp, int64_t *v)
+{
+  uint32_t hi, lo;
 
-  xattrs = guestfs_lxattrlist (g, dir, names);
-  if (xattrs == NULL)
+  if (read_uint32 (fp, &hi) == -1 || read_uint32 (fp, &lo) == -1)
     return -1;
+  *v = (int64_t) ((uint64_t) hi << 32 | lo);
+  return 0;
+}
+
+static int
+read_string (FILE *fp, char **strp)
+{
+  size_t n = 0;
 
-  /* Call function on everything in this directory. */
-  for (i = 0, xattrp = 0; names[i] != NULL; ++i, ++xattrp) {
-    CLEANUP_FREE char *path = NULL;
-    struct guestfs_xattr_list file_xattrs;
-    size_t nr_xattrs;
+  *strp = NULL;
+  if (getdelim (strp, &n, '\0', fp) == -1) {
+    free (*strp);
+    *strp = NULL;
+    return -1;
+  }
+  return 0;
+}
 
-    assert (stats->len >= i);
-    assert (xattrs->len >= xattrp);
+/* Read one record written by guestfs_walk_out.  Returns 1 if a
+ * record was read, 0 at the end of the file, or -1 on error.
+ */
+static int
+read_record (FILE *fp, char **rel, struct guestfs_statns *stat,
+             struct guestfs_xattr_list *xattrs, char **link, char **csum)
+{
+  int64_t *fields[] = {
+    &stat->st_dev, &stat->st_ino, &stat->st_mode, &stat->st_nlink,
+    &stat->st_uid, &stat->st_gid, &stat->st_rdev, &stat->st_size,
+    &stat->st_blksize, &stat->st_blocks,
+    &stat->st_atime_sec, &stat->st_atime_nsec,
+    &stat->st_mtime_sec, &stat->st_mtime_nsec,
+    &stat->st_ctime_sec, &stat->st_ctime_nsec,
+  };
+  size_t i;
+  uint32_t nr_xattrs, len;
+
+  memset (stat, 0, sizeof *stat);
+  xattrs->len = 0;
+  xattrs->val = NULL;
+
+  if (read_string (fp, rel) == -1) {
+    if (feof (fp))
+      return 0;
+    goto error;
+  }
 
-    /* Find the list of extended attributes for this file. */
-    assert (strlen (xattrs->val[xattrp].attrname) == 0);
+  for (i = 0; i < sizeof fields / sizeof fields[0]; ++i)
+    if (read_int64 (fp, fields[i]) == -1)
+      goto error;
 
-    if (xattrs->val[xattrp].attrval_len == 0) {
-      fprintf (stderr, _("%s: error getting extended attrs for %s %s\n"),
-               guestfs_int_program_name, dir, names[i]);
-      return -1;
-    }
-    /* attrval is not \0-terminated. */
-    char attrval[xattrs->val[xattrp].attrval_len+1];
-    memcpy (attrval, xattrs->val[xattrp].attrval,
-            xattrs->val[xattrp].attrval_len);
-    attrval[xattrs->val[xattrp].attrval_len] = '\0';
-    if (sscanf (attrval, "%zu", &nr_xattrs) != 1) {
-      fprintf (stderr, _("%s: error: cannot parse xattr count for %s %s\n"),
-               guestfs_int_program_name, dir, names[i]);
-      return -1;
+  if (read_uint32 (fp, &nr_xattrs) == -1)
+    goto error;
+  xattrs->val = calloc (nr_xattrs, sizeof (struct guestfs_xattr));
+  if (xattrs->val == NULL && nr_xattrs > 0) {
+    perror ("calloc");
+    abort ();
+  }
+  for (i = 0; i < nr_xattrs; ++i) {
+    struct guestfs_xattr *xa = &xattrs->val[i];
+
+    xattrs->len++;
+    if (read_string (fp, &xa->attrname) == -1 ||
+        read_uint32 (fp, &len) == -1)
+      goto error;
+    xa->attrval = malloc (len > 0 ? len : 1);
+    if (xa->attrval == NULL) {
+      perror ("malloc");
+      abort ();
     }
+    xa->attrval_len = len;
+    if (len > 0 && fread (xa->attrval, 1, len, fp) != len)
+      goto error;
+  }
 
-    file_xattrs.len = nr_xattrs;
-    file_xattrs.val = &xattrs->val[xattrp+1];
-    xattrp += nr_xattrs;
+  if (read_string (fp, link) == -1 ||
+      read_string (fp, csum) == -1)
+    goto error;
 
-    /* Call the function. */
-    if (f (dir, names[i], &stats->val[i], &file_xattrs, opaque) == -1)
-      return -1;
+  return 1;
 
-    /* Recursively call visit, but only on directories. */
-    if (is_dir (stats->val[i].st_mode)) {
-      path = full_path (dir, names[i]);
-      if (_visit (g, depth + 1, path, f, opaque) == -1)
-        return -1;
-    }
-  }
+ error:
+  fprintf (stderr, _("%s: error reading the output of guestfs_walk_out\n"),
+           guestfs_int_program_name);
+  free_xattrs (xattrs);
+  return -1;
+}
 
-  return 0;
+static void
+free_xattrs (struct guestfs_xattr_list *xattrs)
+{
+  size_t i;
+
+  for (i = 0; i < xattrs->len; ++i) {
+    free (xattrs->val[i].attrname);
+    free (xattrs->val[i].attrval);
+  }
+  free (xattrs->val);
 }
 
 char *
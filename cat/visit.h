@@ -19,9 +19,9 @@
 #ifndef VISIT_H
 #define VISIT_H
 
-typedef int (*visitor_function) (const char *dir, const char *name, const struct guestfs_statns *stat, const struct guestfs_xattr_list *xattrs, void *opaque);
+typedef int (*visitor_function) (const char *dir, const char *name, const struct guestfs_statns *stat, const struct guestfs_xattr_list *xattrs, const char *link, const char *csum, void *opaque);
 
-extern int visit (guestfs_h *g, const char *dir, visitor_function f, void *opaque);
+extern int visit (guestfs_h *g, const char *dir, const char *checksum, visitor_function f, void *opaque);
 
 extern char *full_path (const char *dir, const char *name);
 
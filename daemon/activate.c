@@ -0,0 +1,79 @@
+/* libguestfs - the guestfsd daemon
+ * Copyright (C) 2015 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "guestfs_protocol.h"
+#include "daemon.h"
+#include "actions.h"
+
+GUESTFSD_EXT_CMD(str_mdadm, mdadm);
+GUESTFSD_EXT_CMD(str_lvm, lvm);
+GUESTFSD_EXT_CMD(str_ldmtool, ldmtool);
+
+/* Assembling MD devices, activating LVM volume groups and creating
+ * Windows dynamic disk volumes used to be done by the appliance
+ * /init script before the daemon started.  That takes a noticeable
+ * time even when there is nothing to find, and many callers only
+ * ever look at plain disks and partitions.  So instead it is done the
+ * first time a call needs it: when a device name cannot be found
+ * (see device_name_translation), or when a call lists MD, LVM, LDM
+ * or device-mapper devices.  Calls which activate or deactivate
+ * volume groups, or rescan them, also do it first, so that it cannot
+ * undo their changes later.
+ *
+ * Errors are ignored here, as they were in /init.
+ */
+static pthread_once_t activate_once = PTHREAD_ONCE_INIT;
+
+static void
+activate (void)
+{
+  int r;
+
+  if (verbose)
+    printf ("activating MD, LVM and LDM devices\n");
+
+  if (prog_exists (str_mdadm)) {
+    r = command (NULL, NULL, str_mdadm, "-As", "--auto=yes", "--run", NULL);
+    if (r == -1 && verbose)
+      fprintf (stderr, "activate: mdadm -As failed\n");
+  }
+
+  r = command (NULL, NULL, str_lvm, "vgchange", "-aay", "--sysinit", NULL);
+  if (r == -1 && verbose)
+    fprintf (stderr, "activate: lvm vgchange failed\n");
+
+  if (prog_exists (str_ldmtool)) {
+    r = command (NULL, NULL, str_ldmtool, "create", "all", NULL);
+    if (r == -1 && verbose)
+      fprintf (stderr, "activate: ldmtool create all failed\n");
+  }
+
+  udev_settle ();
+}
+
+void
+activate_volumes (void)
+{
+  pthread_once (&activate_once, activate);
+}
@@ -0,0 +1,130 @@
+/* libguestfs - the guestfsd daemon
+ * Copyright (C) 2015 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#include "guestfs_protocol.h"
+#include "daemon.h"
+#include "actions.h"
+
+/* The library adds a virtio-balloon device with free page reporting
+ * to the appliance.  Pages which the guest kernel frees are then
+ * returned to the host.  However the guest kernel frees almost
+ * nothing by itself: after a call has read a lot of data, the page
+ * cache keeps it.  So when the appliance has been idle for a while
+ * (see main_loop), we drop the caches and compact memory, so that
+ * whole free blocks can be reported.  If the memory is needed again
+ * the guest just allocates it, and the host gives it back.
+ *
+ * Without free page reporting dropping the caches would make later
+ * calls slower and gain nothing, so this is only done if the balloon
+ * device offers the feature.
+ */
+
+#define BALLOON_DRIVER_DIR "/sys/bus/virtio/drivers/virtio_balloon"
+
+/* VIRTIO_BALLOON_F_REPORTING, from <linux/virtio_balloon.h>. */
+#define VIRTIO_BALLOON_F_REPORTING 5
+
+/* Does the appliance have a balloon device which reports free pages?
+ * The 'features' file in sysfs contains one '0' or '1' for each
+ * feature bit.
+ */
+static bool
+have_free_page_reporting (void)
+{
+  static int have = -1;
+  DIR *dir;
+  struct dirent *d;
+
+  if (have >= 0)
+    return have;
+
+  have = 0;
+  dir = opendir (BALLOON_DRIVER_DIR);
+  if (dir == NULL)
+    return have;
+
+  while ((d = readdir (dir)) != NULL) {
+    CLEANUP_FREE char *path = NULL;
+    char features[128];
+    FILE *fp;
+
+    if (!STRPREFIX (d->d_name, "virtio"))
+      continue;
+
+    if (asprintf (&path, "%s/%s/features", BALLOON_DRIVER_DIR, d->d_name) == -1)
+      break;
+    fp = fopen (path, "r");
+    if (fp == NULL)
+      continue;
+    if (fgets (features, sizeof features, fp) != NULL &&
+        strlen (features) > VIRTIO_BALLOON_F_REPORTING &&
+        features[VIRTIO_BALLOON_F_REPORTING] == '1')
+      have = 1;
+    fclose (fp);
+  }
+  closedir (dir);
+
+  if (verbose)
+    fprintf (stderr, "guestfsd: free page reporting %s\n",
+             have ? "is available" : "is not available");
+
+  return have;
+}
+
+static void
+write_proc_file (const char *filename, const char *str)
+{
+  int fd;
+
+  fd = open (filename, O_WRONLY|O_CLOEXEC);
+  if (fd == -1)
+    return;
+  if (write (fd, str, strlen (str)) == -1 && verbose)
+    perror (filename);
+  close (fd);
+}
+
+/* Called by the main loop when no call has arrived for a while and
+ * no concurrent call is running.  This must not send a reply, as
+ * there is no call being answered.
+ */
+void
+release_free_memory (void)
+{
+  if (!have_free_page_reporting ())
+    return;
+
+  if (verbose)
+    fprintf (stderr, "guestfsd: idle, releasing memory to the host\n");
+
+  /* Dirty pages can't be dropped, so write them out first. */
+  sync_disks ();
+
+  write_proc_file ("/proc/sys/vm/drop_caches", "3");
+  write_proc_file ("/proc/sys/vm/compact_memory", "1");
+}
@@ -106,7 +106,7 @@ do_base64_out (const char *file)
   int r;
   FILE *fp;
   CLEANUP_FREE char *cmd = NULL;
-  char buffer[GUESTFS_MAX_CHUNK_SIZE];
+  char buffer[GUESTFS_DEFAULT_CHUNK_SIZE];
 
   /* Check the filename exists and is not a directory (RHBZ#908322). */
   buf = sysroot_path (file);
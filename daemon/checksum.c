@@ -22,9 +22,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <inttypes.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
+#include "md5.h"
+#include "sha1.h"
+#include "sha256.h"
+#include "sha512.h"
+
 #include "guestfs_protocol.h"
 #include "daemon.h"
 #include "actions.h"
@@ -39,70 +47,274 @@ GUESTFSD_EXT_CMD(str_sha256sum, sha256sum);
 GUESTFSD_EXT_CMD(str_sha384sum, sha384sum);
 GUESTFSD_EXT_CMD(str_sha512sum, sha512sum);
 
-static const char *
-program_of_csum (const char *csumtype)
+/* Checksums are computed in the daemon using the gnulib crypto
+ * modules (and a table-driven implementation of the POSIX cksum CRC),
+ * instead of running md5sum etc. for every file.  The external
+ * programs are only used by guestfs_checksums_out, which needs the
+ * exact coreutils output format.
+ */
+
+/* CHECKSUM_BUFFER_SIZE (in daemon.h) is a multiple of the block size
+ * of all the hash functions, so the hash update functions never need
+ * to copy partial blocks.
+ */
+
+enum csum_type {
+  CSUM_CRC, CSUM_MD5, CSUM_SHA1, CSUM_SHA224, CSUM_SHA256,
+  CSUM_SHA384, CSUM_SHA512,
+};
+
+static const struct {
+  const char *name;
+  const char *program;          /* Used by checksums_out. */
+} csum_types[] = {
+  [CSUM_CRC] =    { "crc",    str_cksum },
+  [CSUM_MD5] =    { "md5",    str_md5sum },
+  [CSUM_SHA1] =   { "sha1",   str_sha1sum },
+  [CSUM_SHA224] = { "sha224", str_sha224sum },
+  [CSUM_SHA256] = { "sha256", str_sha256sum },
+  [CSUM_SHA384] = { "sha384", str_sha384sum },
+  [CSUM_SHA512] = { "sha512", str_sha512sum },
+};
+
+struct csum_ctx {
+  enum csum_type type;
+  uint64_t len;                 /* Bytes processed so far (for CRC). */
+  union {
+    uint32_t crc;
+    struct md5_ctx md5;
+    struct sha1_ctx sha1;
+    struct sha256_ctx sha256;
+    struct sha512_ctx sha512;
+  } u;
+};
+
+/* Returns the checksum type, or -1 if it is not known (the error
+ * is sent back to the library).
+ */
+int
+csum_type_of_name (const char *csumtype)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof csum_types / sizeof csum_types[0]; ++i)
+    if (STRCASEEQ (csumtype, csum_types[i].name))
+      return (int) i;
+
+  reply_with_error ("unknown checksum type, expecting crc|md5|sha1|sha224|sha256|sha384|sha512");
+  return -1;
+}
+
+/* The CRC used by POSIX cksum: polynomial 0x04C11DB7, most
+ * significant bit first, with the length of the data appended.
+ */
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void
+init_crc_table (void)
+{
+  uint32_t i, j, c;
+
+  for (i = 0; i < 256; ++i) {
+    c = i << 24;
+    for (j = 0; j < 8; ++j)
+      c = c & 0x80000000 ? (c << 1) ^ 0x04C11DB7 : c << 1;
+    crc_table[i] = c;
+  }
+}
+
+static uint32_t
+crc_update (uint32_t crc, const unsigned char *buf, size_t len)
+{
+  while (len > 0) {
+    crc = (crc << 8) ^ crc_table[(crc >> 24) ^ *buf];
+    buf++;
+    len--;
+  }
+  return crc;
+}
+
+static void
+csum_init (struct csum_ctx *ctx, enum csum_type type)
+{
+  ctx->type = type;
+  ctx->len = 0;
+
+  switch (type) {
+  case CSUM_CRC:
+    pthread_once (&crc_table_once, init_crc_table);
+    ctx->u.crc = 0;
+    break;
+  case CSUM_MD5:    md5_init_ctx (&ctx->u.md5); break;
+  case CSUM_SHA1:   sha1_init_ctx (&ctx->u.sha1); break;
+  case CSUM_SHA224: sha224_init_ctx (&ctx->u.sha256); break;
+  case CSUM_SHA256: sha256_init_ctx (&ctx->u.sha256); break;
+  case CSUM_SHA384: sha384_init_ctx (&ctx->u.sha512); break;
+  case CSUM_SHA512: sha512_init_ctx (&ctx->u.sha512); break;
+  }
+}
+
+static void
+csum_update (struct csum_ctx *ctx, const void *buf, size_t len)
+{
+  ctx->len += len;
+
+  switch (ctx->type) {
+  case CSUM_CRC:
+    ctx->u.crc = crc_update (ctx->u.crc, buf, len);
+    break;
+  case CSUM_MD5:    md5_process_bytes (buf, len, &ctx->u.md5); break;
+  case CSUM_SHA1:   sha1_process_bytes (buf, len, &ctx->u.sha1); break;
+  case CSUM_SHA224:
+  case CSUM_SHA256: sha256_process_bytes (buf, len, &ctx->u.sha256); break;
+  case CSUM_SHA384:
+  case CSUM_SHA512: sha512_process_bytes (buf, len, &ctx->u.sha512); break;
+  }
+}
+
+/* Finish the checksum and return it as a printable string, in the
+ * same format as the coreutils programs.  Returns NULL if malloc
+ * fails (without sending an error).
+ */
+static char *
+csum_finish (struct csum_ctx *ctx)
 {
-  if (STRCASEEQ (csumtype, "crc"))
-    return str_cksum;
-  else if (STRCASEEQ (csumtype, "md5"))
-    return str_md5sum;
-  else if (STRCASEEQ (csumtype, "sha1"))
-    return str_sha1sum;
-  else if (STRCASEEQ (csumtype, "sha224"))
-    return str_sha224sum;
-  else if (STRCASEEQ (csumtype, "sha256"))
-    return str_sha256sum;
-  else if (STRCASEEQ (csumtype, "sha384"))
-    return str_sha384sum;
-  else if (STRCASEEQ (csumtype, "sha512"))
-    return str_sha512sum;
-  else {
-    reply_with_error ("unknown checksum type, expecting crc|md5|sha1|sha224|sha256|sha384|sha512");
+  unsigned char digest[SHA512_DIGEST_SIZE];
+  size_t i, digest_len = 0;
+  char *ret;
+
+  switch (ctx->type) {
+  case CSUM_CRC: {
+    unsigned char c;
+    uint64_t n;
+    uint32_t crc = ctx->u.crc;
+
+    for (n = ctx->len; n > 0; n >>= 8) {
+      c = n & 0xff;
+      crc = crc_update (crc, &c, 1);
+    }
+    if (asprintf (&ret, "%" PRIu32, ~crc) == -1)
+      return NULL;
+    return ret;
+  }
+  case CSUM_MD5:
+    md5_finish_ctx (&ctx->u.md5, digest);
+    digest_len = MD5_DIGEST_SIZE;
+    break;
+  case CSUM_SHA1:
+    sha1_finish_ctx (&ctx->u.sha1, digest);
+    digest_len = SHA1_DIGEST_SIZE;
+    break;
+  case CSUM_SHA224:
+    sha224_finish_ctx (&ctx->u.sha256, digest);
+    digest_len = SHA224_DIGEST_SIZE;
+    break;
+  case CSUM_SHA256:
+    sha256_finish_ctx (&ctx->u.sha256, digest);
+    digest_len = SHA256_DIGEST_SIZE;
+    break;
+  case CSUM_SHA384:
+    sha384_finish_ctx (&ctx->u.sha512, digest);
+    digest_len = SHA384_DIGEST_SIZE;
+    break;
+  case CSUM_SHA512:
+    sha512_finish_ctx (&ctx->u.sha512, digest);
+    digest_len = SHA512_DIGEST_SIZE;
+    break;
+  }
+
+  ret = malloc (digest_len * 2 + 1);
+  if (ret == NULL)
     return NULL;
+  for (i = 0; i < digest_len; ++i)
+    sprintf (&ret[i*2], "%02x", digest[i]);
+  return ret;
+}
+
+/* Compute the checksum of the open file 'fd', reading it from the
+ * current position to the end.  'buf' must be CHECKSUM_BUFFER_SIZE
+ * bytes.  If 'total' is > 0, progress messages are sent.
+ *
+ * Returns the checksum, or NULL with errno set on error (no error
+ * is sent back to the library).
+ */
+char *
+checksum_fd (int type, int fd, char *buf, uint64_t total)
+{
+  struct csum_ctx ctx;
+  ssize_t r;
+
+  csum_init (&ctx, type);
+
+  while ((r = read (fd, buf, CHECKSUM_BUFFER_SIZE)) != 0) {
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      return NULL;
+    }
+    csum_update (&ctx, buf, r);
+    if (total > 0 && ctx.len <= total)
+      notify_progress (ctx.len, total);
   }
+
+  return csum_finish (&ctx);
 }
 
 static char *
 checksum (const char *csumtype, int fd)
 {
-  const char *program;
-  char *out;
-  CLEANUP_FREE char *err = NULL;
-  int flags, r;
-  size_t len;
+  int type;
+  CLEANUP_FREE char *buf = NULL;
+  struct stat statbuf;
+  uint64_t total = 0;
+  off_t size;
+  char *ret;
 
-  program = program_of_csum (csumtype);
-  if (program == NULL)
+  type = csum_type_of_name (csumtype);
+  if (type == -1)
     return NULL;
 
-  pulse_mode_start ();
+  /* Work out the size for progress messages.  For block devices
+   * st_size is zero, so seek to the end instead.
+   */
+  if (fstat (fd, &statbuf) == 0) {
+    if (S_ISREG (statbuf.st_mode))
+      total = statbuf.st_size;
+    else if (S_ISBLK (statbuf.st_mode)) {
+      size = lseek (fd, 0, SEEK_END);
+      if (size > 0 && lseek (fd, 0, SEEK_SET) == 0)
+        total = size;
+    }
+  }
+
+  posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 
-  flags = COMMAND_FLAG_CHROOT_COPY_FILE_TO_STDIN | fd;
-  r = commandf (&out, &err, flags, program, NULL);
-  if (r == -1) {
-    pulse_mode_cancel ();
-    reply_with_error ("%s: %s", program, err);
-    free (out);
+  buf = malloc (CHECKSUM_BUFFER_SIZE);
+  if (buf == NULL) {
+    reply_with_perror ("malloc");
     return NULL;
   }
 
-  /* Split it at the first whitespace. */
-  len = strcspn (out, " \t\n");
-  out[len] = '\0';
-
-  pulse_mode_end ();
+  ret = checksum_fd (type, fd, buf, total);
+  if (ret == NULL) {
+    reply_with_perror ("read");
+    return NULL;
+  }
 
-  return out;			/* Caller frees. */
+  return ret;			/* Caller frees. */
 }
 
 char *
 do_checksum (const char *csumtype, const char *path)
 {
+  CLEANUP_CLOSE int dirfd = -1;
+  CLEANUP_FREE char *name = NULL;
   CLEANUP_CLOSE int fd = -1;
 
-  CHROOT_IN;
-  fd = open (path, O_RDONLY|O_CLOEXEC);
-  CHROOT_OUT;
+  dirfd = sysroot_walk (path, 1, &name);
+  if (dirfd >= 0)
+    fd = openat (dirfd, name, O_RDONLY|O_NOFOLLOW|O_CLOEXEC);
 
   if (fd == -1) {
     reply_with_perror ("%s", path);
@@ -131,11 +343,13 @@ int
 do_checksums_out (const char *csumtype, const char *dir)
 {
   struct stat statbuf;
-  int r;
+  int r, type;
+  const char *program;
 
-  const char *program = program_of_csum (csumtype);
-  if (program == NULL)
+  type = csum_type_of_name (csumtype);
+  if (type == -1)
     return -1;
+  program = csum_types[type].program;
 
   CLEANUP_FREE char *sysrootdir = sysroot_path (dir);
   if (!sysrootdir) {
@@ -175,9 +389,9 @@ do_checksums_out (const char *csumtype, const char *dir)
    */
   reply (NULL, NULL);
 
-  char str[GUESTFS_MAX_CHUNK_SIZE];
+  char str[GUESTFS_DEFAULT_CHUNK_SIZE];
 
-  while ((r = fread (str, 1, GUESTFS_MAX_CHUNK_SIZE, fp)) > 0) {
+  while ((r = fread (str, 1, GUESTFS_DEFAULT_CHUNK_SIZE, fp)) > 0) {
     if (send_file_write (str, r) < 0) {
       pclose (fp);
       return -1;
@@ -202,3 +416,72 @@ do_checksums_out (const char *csumtype, const char *dir)
 
   return 0;
 }
+
+/* Compute the checksums of the files 'names' in the directory 'dir'.
+ * This opens the directory once and uses a single buffer for all the
+ * files, so it is a lot cheaper than calling guestfs_checksum on each
+ * file.  Names which are not regular files or cannot be opened return
+ * the empty string.  An error reading a regular file fails the whole
+ * call, since the empty string would hide it.
+ */
+char **
+do_internal_checksums_list (const char *csumtype, const char *dir,
+                            char *const *names)
+{
+  int type;
+  CLEANUP_CLOSE int dirfd = -1;
+  CLEANUP_CLOSE int dfd = -1;
+  CLEANUP_FREE char *name = NULL;
+  CLEANUP_FREE char *buf = NULL;
+  DECLARE_STRINGSBUF (ret);
+  size_t i;
+
+  type = csum_type_of_name (csumtype);
+  if (type == -1)
+    return NULL;
+
+  dirfd = sysroot_walk (dir, 1, &name);
+  if (dirfd >= 0)
+    dfd = openat (dirfd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+  if (dfd == -1) {
+    reply_with_perror ("%s", dir);
+    return NULL;
+  }
+
+  buf = malloc (CHECKSUM_BUFFER_SIZE);
+  if (buf == NULL) {
+    reply_with_perror ("malloc");
+    return NULL;
+  }
+
+  for (i = 0; names[i] != NULL; ++i) {
+    CLEANUP_CLOSE int fd = -1;
+    struct stat statbuf;
+    char *csum = NULL;
+
+    /* O_NONBLOCK so that we don't hang opening a FIFO. */
+    if (strchr (names[i], '/') == NULL)
+      fd = openat (dfd, names[i],
+                   O_RDONLY|O_NOFOLLOW|O_NONBLOCK|O_NOCTTY|O_CLOEXEC);
+    if (fd >= 0 && fstat (fd, &statbuf) == 0 && S_ISREG (statbuf.st_mode)) {
+      csum = checksum_fd (type, fd, buf, 0);
+      if (csum == NULL) {
+        reply_with_perror ("%s/%s", dir, names[i]);
+        free_stringslen (ret.argv, ret.size);
+        return NULL;
+      }
+    }
+
+    if (csum == NULL) {
+      if (add_string (&ret, "") == -1)
+        return NULL;
+    }
+    else if (add_string_nodup (&ret, csum) == -1)
+      return NULL;
+  }
+
+  if (end_stringsbuf (&ret) == -1)
+    return NULL;
+
+  return ret.argv;              /* Caller frees. */
+}
@@ -40,7 +40,7 @@ do_compressX_out (const char *file, const char *filter, int is_device)
   int r;
   FILE *fp;
   CLEANUP_FREE char *cmd = NULL;
-  char buf[GUESTFS_MAX_CHUNK_SIZE];
+  char buf[GUESTFS_DEFAULT_CHUNK_SIZE];
 
   /* The command will look something like:
    *   gzip -c /sysroot%s     # file
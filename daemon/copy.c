@@ -23,12 +23,414 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/param.h>		/* defines MIN */
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "ignore-value.h"
 
 #include "guestfs_protocol.h"
 #include "daemon.h"
 #include "actions.h"
 
+/* This is the block copying engine used by the copy_* calls, dd,
+ * copy_size and is_zero*.  Data is read in large aligned buffers by
+ * a second thread, so that reading the next buffer overlaps with
+ * writing (or scanning) the current one.
+ */
+
+/* Alignment of buffers, offsets and lengths when using O_DIRECT. */
+#define COPY_ALIGNMENT 4096
+
+/* Granularity at which the sparse flag looks for zeroes. */
+#define SPARSE_BLOCK_SIZE 4096
+
+struct copy_buffer {
+  char *data;
+  size_t len;                   /* Bytes read, 0 at end of input. */
+  int err;                      /* errno if the read failed. */
+  int full;                     /* Set by reader, cleared by consumer. */
+};
+
+struct copy_reader {
+  int fd;
+  int direct;                   /* Reading with O_DIRECT. */
+  int64_t size;                 /* Bytes left to read, or -1 = to EOF. */
+  int stop;                     /* Consumer has finished. */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct copy_buffer bufs[2];
+};
+
+/* Stop using O_DIRECT on the input.  Returns 0, or -1 if the flag
+ * cannot be cleared.
+ */
+static int
+clear_direct (struct copy_reader *rd)
+{
+  int flags;
+
+  rd->direct = 0;
+  flags = fcntl (rd->fd, F_GETFL);
+  if (flags == -1 || fcntl (rd->fd, F_SETFL, flags & ~O_DIRECT) == -1)
+    return -1;
+  return 0;
+}
+
+/* Read up to 'n' bytes into 'buf' (which holds 'bufsize' bytes),
+ * stopping early only at end of input.  O_DIRECT reads must be a
+ * multiple of the alignment, so we may read past 'n', but never past
+ * the end of the buffer.  After a short read the buffer position is
+ * no longer aligned, so the rest is read without O_DIRECT.  If the
+ * kernel refuses an O_DIRECT read we also carry on without it.
+ */
+static ssize_t
+read_full (struct copy_reader *rd, char *buf, size_t n, size_t bufsize)
+{
+  size_t got = 0, want;
+  ssize_t r;
+
+  while (got < n) {
+    if (rd->direct && (got & (COPY_ALIGNMENT - 1)) != 0 &&
+        clear_direct (rd) == -1)
+      return -1;
+
+    want = n - got;
+    if (rd->direct) {
+      want = (want + COPY_ALIGNMENT - 1) & ~(COPY_ALIGNMENT - 1);
+      if (want > bufsize - got)
+        want = bufsize - got;
+    }
+    r = read (rd->fd, buf + got, want);
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EINVAL && rd->direct) {
+        if (clear_direct (rd) == 0)
+          continue;
+        errno = EINVAL;
+      }
+      return -1;
+    }
+    if (r == 0)
+      break;
+    got += r;
+  }
+
+  return got < n ? got : n;
+}
+
+static void *
+reader_thread (void *rdv)
+{
+  struct copy_reader *rd = rdv;
+  struct copy_buffer *b;
+  size_t i = 0, n;
+  ssize_t r;
+
+  for (;;) {
+    b = &rd->bufs[i];
+
+    pthread_mutex_lock (&rd->lock);
+    while (b->full && !rd->stop)
+      pthread_cond_wait (&rd->cond, &rd->lock);
+    if (rd->stop) {
+      pthread_mutex_unlock (&rd->lock);
+      break;
+    }
+    pthread_mutex_unlock (&rd->lock);
+
+    n = COPY_BUFFER_SIZE;
+    if (rd->size >= 0 && rd->size < (int64_t) n)
+      n = rd->size;
+
+    b->len = 0;
+    b->err = 0;
+    if (n > 0) {
+      r = read_full (rd, b->data, n, COPY_BUFFER_SIZE);
+      if (r == -1)
+        b->err = errno;
+      else {
+        b->len = r;
+        if (rd->size >= 0)
+          rd->size -= r;
+      }
+    }
+
+    pthread_mutex_lock (&rd->lock);
+    b->full = 1;
+    pthread_cond_broadcast (&rd->cond);
+    pthread_mutex_unlock (&rd->lock);
+
+    if (b->err || b->len == 0)
+      break;
+    i ^= 1;
+  }
+
+  return NULL;
+}
+
+/* Work out how many bytes are left to read from 'fd' from offset
+ * 'pos', for progress messages.  Returns 0 if unknown.
+ */
+static uint64_t
+bytes_left (int fd, off_t pos)
+{
+  struct stat statbuf;
+  uint64_t size;
+
+  if (fstat (fd, &statbuf) == -1)
+    return 0;
+  if (S_ISREG (statbuf.st_mode))
+    size = statbuf.st_size;
+  else if (S_ISBLK (statbuf.st_mode)) {
+    if (ioctl (fd, BLKGETSIZE64, &size) == -1)
+      return 0;
+  }
+  else
+    return 0;
+
+  return size > (uint64_t) pos ? size - pos : 0;
+}
+
+/* Read 'size' bytes (or until the end of input if 'size' is -1) from
+ * the current offset of 'fd', and pass them to 'cb' in blocks of up
+ * to COPY_BUFFER_SIZE bytes.  If 'direct' is set, we try to bypass
+ * the page cache with O_DIRECT (which is left set on 'fd').  Progress
+ * messages are sent as the input is consumed.
+ *
+ * 'cb' should return 0 to carry on, or any other value to stop.  It
+ * must send the error reply itself if it returns -1.
+ *
+ * Returns 0 at the end of input, -1 if an error was replied, or the
+ * value returned by 'cb' if it stopped early.
+ */
+int
+read_blocks (int fd, const char *display, int64_t size, int direct,
+             read_blocks_cb cb, void *opaque)
+{
+  struct copy_reader rd = { .fd = fd, .size = size };
+  struct copy_buffer *b;
+  pthread_t thread;
+  uint64_t total, done = 0;
+  off_t pos;
+  size_t i;
+  int flags, err, r = 0;
+
+  pos = lseek (fd, 0, SEEK_CUR);
+
+  if (size >= 0)
+    total = size;
+  else
+    total = pos >= 0 ? bytes_left (fd, pos) : 0;
+
+  if (direct && pos >= 0 && (pos & (COPY_ALIGNMENT - 1)) == 0) {
+    flags = fcntl (fd, F_GETFL);
+    if (flags >= 0 && fcntl (fd, F_SETFL, flags | O_DIRECT) == 0)
+      rd.direct = 1;
+  }
+
+  for (i = 0; i < 2; ++i) {
+    err = posix_memalign ((void **) &rd.bufs[i].data,
+                          COPY_ALIGNMENT, COPY_BUFFER_SIZE);
+    if (err != 0) {
+      errno = err;
+      reply_with_perror ("posix_memalign");
+      free (rd.bufs[0].data);
+      return -1;
+    }
+  }
+
+  pthread_mutex_init (&rd.lock, NULL);
+  pthread_cond_init (&rd.cond, NULL);
+
+  err = pthread_create (&thread, NULL, reader_thread, &rd);
+  if (err != 0) {
+    errno = err;
+    reply_with_perror ("pthread_create");
+    r = -1;
+    goto out;
+  }
+
+  for (i = 0;; i ^= 1) {
+    b = &rd.bufs[i];
+
+    pthread_mutex_lock (&rd.lock);
+    while (!b->full)
+      pthread_cond_wait (&rd.cond, &rd.lock);
+    pthread_mutex_unlock (&rd.lock);
+
+    if (b->err) {
+      errno = b->err;
+      reply_with_perror ("read: %s", display);
+      r = -1;
+      break;
+    }
+
+    if (b->len == 0) {
+      if (size >= 0 && done < (uint64_t) size) {
+        reply_with_error ("%s: input too short", display);
+        r = -1;
+      }
+      break;
+    }
+
+    r = cb (opaque, b->data, b->len);
+    if (r != 0)
+      break;
+
+    done += b->len;
+    if (total > 0)
+      notify_progress (done < total ? done : total, total);
+
+    pthread_mutex_lock (&rd.lock);
+    b->full = 0;
+    pthread_cond_broadcast (&rd.cond);
+    pthread_mutex_unlock (&rd.lock);
+  }
+
+  pthread_mutex_lock (&rd.lock);
+  rd.stop = 1;
+  pthread_cond_broadcast (&rd.cond);
+  pthread_mutex_unlock (&rd.lock);
+  pthread_join (thread, NULL);
+
+ out:
+  pthread_cond_destroy (&rd.cond);
+  pthread_mutex_destroy (&rd.lock);
+  free (rd.bufs[0].data);
+  free (rd.bufs[1].data);
+  return r;
+}
+
+struct copy_dest {
+  int fd;
+  const char *display;
+  int sparse;                   /* Skip blocks of zeroes. */
+  int punch;                    /* Punch holes instead of skipping. */
+  int append;                   /* O_APPEND, so we cannot skip. */
+  off_t size;                   /* Original size of a regular file. */
+  int skipped;                  /* Last block was skipped. */
+};
+
+/* Skip over 'len' bytes of zeroes in the destination.  If it is a
+ * regular file which already had data here, punch a hole so that the
+ * result is correct.  Devices are only skipped (see the description
+ * of the sparse flag in guestfs_copy_device_to_device).
+ */
+static int
+skip_zeroes (struct copy_dest *d, size_t len)
+{
+  off_t pos;
+
+  if (d->punch) {
+    pos = lseek (d->fd, 0, SEEK_CUR);
+    if (pos >= 0 && pos < d->size)
+      ignore_value (fallocate (d->fd,
+                               FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+                               pos, len));
+  }
+
+  if (lseek (d->fd, len, SEEK_CUR) == -1) {
+    reply_with_perror ("%s: seek (because of sparse flag)", d->display);
+    return -1;
+  }
+  d->skipped = 1;
+  return 0;
+}
+
+static int
+write_blocks (void *dv, const char *buf, size_t len)
+{
+  struct copy_dest *d = dv;
+  size_t p, q, n;
+  int zero;
+
+  if (!d->sparse || d->append) {
+    if (xwrite (d->fd, buf, len) == -1) {
+      reply_with_perror ("%s: write", d->display);
+      return -1;
+    }
+    return 0;
+  }
+
+  /* Split the buffer into runs of zero and non-zero blocks. */
+  for (p = 0; p < len; p = q) {
+    n = MIN (SPARSE_BLOCK_SIZE, len - p);
+    zero = is_zero (&buf[p], n);
+    for (q = p + n; q < len; q += n) {
+      n = MIN (SPARSE_BLOCK_SIZE, len - q);
+      if (is_zero (&buf[q], n) != zero)
+        break;
+    }
+
+    if (zero) {
+      if (skip_zeroes (d, q - p) == -1)
+        return -1;
+    }
+    else {
+      if (xwrite (d->fd, &buf[p], q - p) == -1) {
+        reply_with_perror ("%s: write", d->display);
+        return -1;
+      }
+      d->skipped = 0;
+    }
+  }
+
+  return 0;
+}
+
+/* Copy 'size' bytes (or until the end of input if 'size' is -1) from
+ * the current offset of 'src_fd' to the current offset of 'dest_fd'.
+ * Block devices are read with O_DIRECT.  If 'sparse' is set, blocks
+ * of zeroes are not written.
+ *
+ * Returns 0 on success, or -1 if an error was replied.  The caller
+ * must close both file descriptors.
+ */
+int
+copy_blocks (int src_fd, const char *src_display,
+             int dest_fd, const char *dest_display,
+             int64_t size, int sparse)
+{
+  struct copy_dest d = { .fd = dest_fd, .display = dest_display,
+                         .sparse = sparse };
+  struct stat statbuf;
+  int direct = 0, flags;
+  off_t pos;
+
+  if (fstat (src_fd, &statbuf) == 0 && S_ISBLK (statbuf.st_mode))
+    direct = 1;
+
+  if (sparse && fstat (dest_fd, &statbuf) == 0 &&
+      S_ISREG (statbuf.st_mode)) {
+    d.punch = 1;
+    d.size = statbuf.st_size;
+  }
+  flags = fcntl (dest_fd, F_GETFL);
+  if (flags >= 0 && (flags & O_APPEND))
+    d.append = 1;
+
+  if (read_blocks (src_fd, src_display, size, direct,
+                   write_blocks, &d) != 0)
+    return -1;
+
+  /* If the copy ended with skipped zeroes, extend a regular file. */
+  if (d.skipped && d.punch) {
+    pos = lseek (dest_fd, 0, SEEK_CUR);
+    if (pos > d.size && ftruncate (dest_fd, pos) == -1) {
+      reply_with_perror ("%s: ftruncate", dest_display);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
 /* wrflags */
 #define DEST_DEVICE_FLAGS O_WRONLY|O_CLOEXEC, 0
 
@@ -48,12 +450,7 @@ copy (const char *src, const char *src_display,
       int flags,
       int64_t srcoffset, int64_t destoffset, int64_t size, int sparse)
 {
-  int64_t saved_size = size;
   int src_fd, dest_fd;
-  char buf[BUFSIZ];
-  size_t n;
-  ssize_t r;
-  int err;
 
   if ((optargs_bitmask & GUESTFS_COPY_DEVICE_TO_DEVICE_SRCOFFSET_BITMASK)) {
     if (srcoffset < 0) {
@@ -114,80 +511,15 @@ copy (const char *src, const char *src_display,
     return -1;
   }
 
-  if (size == -1)
-    pulse_mode_start ();
-
-  while (size != 0) {
-    /* Calculate bytes to copy. */
-    if (size == -1 || size > (int64_t) sizeof buf)
-      n = sizeof buf;
-    else
-      n = size;
-
-    r = read (src_fd, buf, n);
-    if (r == -1) {
-      err = errno;
-      if (size == -1)
-        pulse_mode_cancel ();
-      errno = err;
-      reply_with_perror ("read: %s", src_display);
-      close (src_fd);
-      close (dest_fd);
-      if (flags & COPY_UNLINK_DEST_ON_FAILURE)
-        unlink (dest);
-      return -1;
-    }
-
-    if (r == 0) {
-      if (size == -1) /* if size == -1, this is normal end of loop */
-        break;
-      reply_with_error ("%s: input too short", src_display);
-      close (src_fd);
-      close (dest_fd);
-      if (flags & COPY_UNLINK_DEST_ON_FAILURE)
-        unlink (dest);
-      return -1;
-    }
-
-    if (sparse && is_zero (buf, r)) {
-      if (lseek (dest_fd, r, SEEK_CUR) == -1) {
-        err = errno;
-        if (size == -1)
-          pulse_mode_cancel ();
-        errno = err;
-        reply_with_perror ("%s: seek (because of sparse flag)", dest_display);
-        close (src_fd);
-        close (dest_fd);
-        if (flags & COPY_UNLINK_DEST_ON_FAILURE)
-          unlink (dest);
-        return -1;
-      }
-      goto sparse_skip;
-    }
-
-    if (xwrite (dest_fd, buf, r) == -1) {
-      err = errno;
-      if (size == -1)
-        pulse_mode_cancel ();
-      errno = err;
-      reply_with_perror ("%s: write", dest_display);
-      close (src_fd);
-      close (dest_fd);
-      if (flags & COPY_UNLINK_DEST_ON_FAILURE)
-        unlink (dest);
-      return -1;
-    }
-  sparse_skip:
-
-    if (size != -1) {
-      size -= r;
-      notify_progress ((uint64_t) (saved_size - size), (uint64_t) saved_size);
-    }
+  if (copy_blocks (src_fd, src_display, dest_fd, dest_display,
+                   size, sparse) == -1) {
+    close (src_fd);
+    close (dest_fd);
+    if (flags & COPY_UNLINK_DEST_ON_FAILURE)
+      unlink (dest);
+    return -1;
   }
 
-  if (size == -1)
-    pulse_mode_end ();
-
   if (close (src_fd) == -1) {
     reply_with_perror ("close: %s", src_display);
     close (dest_fd);
@@ -45,7 +45,7 @@ do_cpio_out (const char *dir, const char *format)
   int r;
   FILE *fp;
   CLEANUP_FREE char *cmd = NULL;
-  char buffer[GUESTFS_MAX_CHUNK_SIZE];
+  char buffer[GUESTFS_DEFAULT_CHUNK_SIZE];
 
   /* Check the filename exists and is a directory (RHBZ#908322). */
   buf = sysroot_path (dir);
@@ -24,6 +24,7 @@
 #include <stdint.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include <rpc/types.h>
 #include <rpc/xdr.h>
@@ -54,6 +55,7 @@ extern size_t sysroot_len;
 
 extern char *sysroot_path (const char *path);
 extern char *sysroot_realpath (const char *path);
+extern int sysroot_walk (const char *path, int follow, char **name_r);
 
 extern int is_root_device (const char *device);
 
@@ -190,10 +192,24 @@ extern void cleanup_free_stringsbuf (void *ptr);
 extern const char *function_names[];
 
 /*-- in proto.c --*/
-extern int proc_nr;
-extern int serial;
-extern uint64_t progress_hint;
-extern uint64_t optargs_bitmask;
+/* The request currently being processed.  Each request runs start to
+ * finish on a single thread (see main_loop), so these are per-thread.
+ */
+extern __thread int proc_nr;
+extern __thread int serial;
+extern __thread uint64_t progress_hint;
+extern __thread uint64_t optargs_bitmask;
+
+/* Negotiated maximum size of file transfer chunks.  This starts off
+ * as GUESTFS_DEFAULT_CHUNK_SIZE and may be raised by the library
+ * calling internal_set_chunk_size.
+ */
+extern size_t chunk_size;
+
+/* True if the library understands hole chunks in file transfers (it
+ * has called internal_set_sparse_transfers).
+ */
+extern int sparse_transfers;
 
 /*-- in mount.c --*/
 extern int is_root_mounted (void);
@@ -201,6 +217,7 @@ extern int is_device_mounted (const char *device);
 
 /*-- in stubs.c (auto-generated) --*/
 extern void dispatch_incoming_message (XDR *);
+extern int is_concurrent_procedure (int nr);
 extern guestfs_int_lvm_pv_list *parse_command_line_pvs (void);
 extern guestfs_int_lvm_vg_list *parse_command_line_vgs (void);
 extern guestfs_int_lvm_lv_list *parse_command_line_lvs (void);
@@ -227,12 +244,25 @@ extern int fstype_is_extfs (const char *fstype);
 /*-- in blkid.c --*/
 extern char *get_blkid_tag (const char *device, const char *tag);
 
+/*-- in balloon.c --*/
+extern void release_free_memory (void);
+
+/*-- in activate.c --*/
+extern void activate_volumes (void);
+
 /*-- in lvm.c --*/
 extern int lv_canonical (const char *device, char **ret);
 
 /*-- in lvm-filter.c --*/
 extern void copy_lvm (void);
 
+/*-- in copy.c --*/
+/* Size of each buffer used by read_blocks. */
+#define COPY_BUFFER_SIZE (4 * 1024 * 1024)
+typedef int (*read_blocks_cb) (void *opaque, const char *buf, size_t len);
+extern int read_blocks (int fd, const char *display, int64_t size, int direct, read_blocks_cb cb, void *opaque);
+extern int copy_blocks (int src_fd, const char *src_display, int dest_fd, const char *dest_display, int64_t size, int sparse);
+
 /*-- in zero.c --*/
 extern void wipe_device_before_mkfs (const char *device);
 
@@ -255,11 +285,24 @@ augeas_is_version (int major, int minor, int patch)
 extern void hivex_finalize (void);
 extern void journal_finalize (void);
 
+/*-- in file.c --*/
+extern void file_handles_finalize (void);
+
 /*-- in proto.c --*/
 extern void main_loop (int sock) __attribute__((noreturn));
 
+/*-- in stat.c --*/
+extern guestfs_int_statns *stat_to_statns (guestfs_int_statns *ret, const struct stat *statbuf);
+
 /*-- in xattr.c --*/
 extern int copy_xattrs (const char *src, const char *dest);
+extern guestfs_int_xattr_list *get_lxattrs_at (int dfd, const char *name);
+
+/*-- in checksum.c --*/
+/* Size of the buffer which must be passed to checksum_fd. */
+#define CHECKSUM_BUFFER_SIZE (256 * 1024)
+extern int csum_type_of_name (const char *csumtype);
+extern char *checksum_fd (int type, int fd, char *buf, uint64_t total);
 
 /*-- in xfs.c --*/
 /* Documented in xfs_admin(8). */
@@ -300,6 +343,13 @@ extern void reply_with_perror_errno (int err, const char *fs, ...)
 typedef int (*receive_cb) (void *opaque, const void *buf, size_t len);
 extern int receive_file (receive_cb cb, void *opaque);
 
+/* Like receive_file, but 'hole_cb' is called for runs of zero bytes
+ * which the library sent as holes.  (receive_file passes these to 'cb'
+ * as ordinary data.)
+ */
+typedef int (*receive_hole_cb) (void *opaque, uint64_t len);
+extern int receive_file_with_holes (receive_cb cb, receive_hole_cb hole_cb, void *opaque);
+
 /* daemon functions that receive files (FileIn) can call this
  * to cancel incoming transfers (eg. if there is a local error).
  */
@@ -307,11 +357,27 @@ extern int cancel_receive (void);
 
 /* daemon functions that return files (FileOut) should call
  * reply, then send_file_* for each FileOut parameter.
- * Note max write size if GUESTFS_MAX_CHUNK_SIZE.
+ * Note max write size is 'chunk_size'.  Callers which use a fixed
+ * size buffer should use GUESTFS_DEFAULT_CHUNK_SIZE, which is always
+ * <= 'chunk_size'.
  */
 extern int send_file_write (const void *buf, size_t len);
 extern int send_file_end (int cancel);
 
+/* FileOut functions which are copying from a file or device can use
+ * this instead of read + send_file_write.  It reads up to 'len'
+ * bytes directly from 'fd' into the socket (using splice where
+ * possible).  Returns bytes sent, 0 at end of file, -1 if reading
+ * 'fd' or sending failed (caller should cancel), or -2 if cancelled.
+ */
+extern int send_file_from_fd (int fd, size_t len);
+
+/* Send a run of 'len' zero bytes.  If the library understands holes
+ * this is sent as a single hole chunk, otherwise as data.  Returns
+ * the same as send_file_write.
+ */
+extern int send_file_hole (uint64_t len);
+
 /* only call this if there is a FileOut parameter */
 extern void reply (xdrproc_t xdrp, char *ret);
 
@@ -399,6 +465,9 @@ is_zero (const char *buffer, size_t size)
   } while (0)
 
 /* NB:
+ * (0) These change the root directory of the whole process, so they
+ *     must not be used by functions marked 'concurrent' in the
+ *     generator.  Use sysroot_walk instead.
  * (1) You must match CHROOT_IN and CHROOT_OUT even along error paths.
  * (2) You must not change directory!  cwd must always be "/", otherwise
  *     we can't escape our own chroot.
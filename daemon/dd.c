@@ -21,126 +21,62 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <fcntl.h>
+#include <sys/types.h>
 
 #include "guestfs_protocol.h"
 #include "daemon.h"
 #include "actions.h"
 
-GUESTFSD_EXT_CMD(str_dd, dd);
-
-int
-do_dd (const char *src, const char *dest)
+/* Open 'path' for do_dd and do_copy_size.  Paths not starting with
+ * /dev/ are inside the sysroot.  Returns -1 after replying with an
+ * error.
+ */
+static int
+open_dev_or_path (const char *path, int flags, mode_t mode)
 {
-  int src_is_dev, dest_is_dev;
-  CLEANUP_FREE char *if_arg = NULL, *of_arg = NULL;
-  CLEANUP_FREE char *err = NULL;
-  int r;
-
-  src_is_dev = STRPREFIX (src, "/dev/");
-
-  if (src_is_dev)
-    r = asprintf (&if_arg, "if=%s", src);
-  else
-    r = asprintf (&if_arg, "if=%s%s", sysroot, src);
-  if (r == -1) {
-    reply_with_perror ("asprintf");
-    return -1;
-  }
+  int fd;
 
-  dest_is_dev = STRPREFIX (dest, "/dev/");
-
-  if (dest_is_dev)
-    r = asprintf (&of_arg, "of=%s", dest);
-  else
-    r = asprintf (&of_arg, "of=%s%s", sysroot, dest);
-  if (r == -1) {
-    reply_with_perror ("asprintf");
-    return -1;
+  if (STRPREFIX (path, "/dev/"))
+    fd = open (path, flags, mode);
+  else {
+    CLEANUP_FREE char *buf = sysroot_path (path);
+    if (!buf) {
+      reply_with_perror ("malloc");
+      return -1;
+    }
+    if ((flags & O_ACCMODE) != O_RDONLY)
+      flags |= O_CREAT|O_TRUNC|O_NOCTTY;
+    fd = open (buf, flags, mode);
   }
-
-  r = command (NULL, &err, str_dd, "bs=1024K", if_arg, of_arg, NULL);
-  if (r == -1) {
-    reply_with_error ("%s: %s: %s", src, dest, err);
+  if (fd == -1) {
+    reply_with_perror ("%s", path);
     return -1;
   }
 
-  return 0;
+  return fd;
 }
 
-int
-do_copy_size (const char *src, const char *dest, int64_t ssize)
+static int
+copy_dev_or_path (const char *src, const char *dest, int64_t size)
 {
   int src_fd, dest_fd;
 
-  if (STRPREFIX (src, "/dev/"))
-    src_fd = open (src, O_RDONLY | O_CLOEXEC);
-  else {
-    CLEANUP_FREE char *buf = sysroot_path (src);
-    if (!buf) {
-      reply_with_perror ("malloc");
-      return -1;
-    }
-    src_fd = open (buf, O_RDONLY | O_CLOEXEC);
-  }
-  if (src_fd == -1) {
-    reply_with_perror ("%s", src);
+  src_fd = open_dev_or_path (src, O_RDONLY|O_CLOEXEC, 0);
+  if (src_fd == -1)
     return -1;
-  }
 
-  if (STRPREFIX (dest, "/dev/"))
-    dest_fd = open (dest, O_WRONLY | O_CLOEXEC);
-  else {
-    CLEANUP_FREE char *buf = sysroot_path (dest);
-    if (!buf) {
-      reply_with_perror ("malloc");
-      close (src_fd);
-      return -1;
-    }
-    dest_fd = open (buf, O_WRONLY|O_CREAT|O_TRUNC|O_NOCTTY|O_CLOEXEC, 0666);
-  }
+  dest_fd = open_dev_or_path (dest, O_WRONLY|O_CLOEXEC, 0666);
   if (dest_fd == -1) {
-    reply_with_perror ("%s", dest);
     close (src_fd);
     return -1;
   }
 
-  uint64_t position = 0, size = (uint64_t) ssize;
-
-  while (position < size) {
-    char buf[BUFSIZ];
-
-    /* Calculate bytes to copy. */
-    uint64_t n64 = size - position;
-    size_t n;
-    if (n64 > sizeof buf)
-      n = sizeof buf;
-    else
-      n = (size_t) n64; /* safe because of if condition */
-
-    ssize_t r = read (src_fd, buf, n);
-    if (r == -1) {
-      reply_with_perror ("%s: read", src);
-      close (src_fd);
-      close (dest_fd);
-      return -1;
-    }
-    if (r == 0) {
-      reply_with_error ("%s: input file too short", src);
-      close (src_fd);
-      close (dest_fd);
-      return -1;
-    }
-
-    if (xwrite (dest_fd, buf, r) == -1) {
-      reply_with_perror ("%s: write", dest);
-      close (src_fd);
-      close (dest_fd);
-      return -1;
-    }
-
-    position += r;
-    notify_progress ((uint64_t) position, (uint64_t) size);
+  if (copy_blocks (src_fd, src, dest_fd, dest, size, 0) == -1) {
+    close (src_fd);
+    close (dest_fd);
+    return -1;
   }
 
   if (close (src_fd) == -1) {
@@ -155,3 +91,20 @@ do_copy_size (const char *src, const char *dest, int64_t ssize)
 
   return 0;
 }
+
+int
+do_dd (const char *src, const char *dest)
+{
+  return copy_dev_or_path (src, dest, -1);
+}
+
+int
+do_copy_size (const char *src, const char *dest, int64_t ssize)
+{
+  if (ssize < 0) {
+    reply_with_error ("size is negative");
+    return -1;
+  }
+
+  return copy_dev_or_path (src, dest, ssize);
+}
@@ -377,3 +377,42 @@ do_list_disk_labels (void)
   free (rawdev);
   return NULL;
 }
+
+/* Has anything been written to the devices since the appliance
+ * started?  The fifth field of /sys/block/<dev>/stat is the number of
+ * write requests completed.
+ */
+int
+do_internal_devices_written (void)
+{
+  CLEANUP_FREE_STRING_LIST char **devices = do_list_devices ();
+  size_t i;
+
+  if (devices == NULL)
+    return -1;
+
+  for (i = 0; devices[i] != NULL; ++i) {
+    char path[256];
+    unsigned long long fields[5];
+    FILE *fp;
+    int r;
+
+    snprintf (path, sizeof path, "/sys/block/%s/stat", &devices[i][5]);
+    fp = fopen (path, "r");
+    if (fp == NULL) {
+      reply_with_perror ("%s", path);
+      return -1;
+    }
+    r = fscanf (fp, "%llu %llu %llu %llu %llu",
+                &fields[0], &fields[1], &fields[2], &fields[3], &fields[4]);
+    fclose (fp);
+    if (r != 5) {
+      reply_with_error ("%s: could not parse the device statistics", path);
+      return -1;
+    }
+    if (fields[4] > 0)
+      return 1;
+  }
+
+  return 0;
+}
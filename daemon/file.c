@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -291,20 +292,22 @@ do_internal_write_append (const char *path, const char *content, size_t size)
 
 static char *
 pread_fd (int fd, int count, int64_t offset, size_t *size_r,
-          const char *display_path)
+          const char *display_path, int close_fd)
 {
   ssize_t r;
   char *buf;
 
   if (count < 0) {
     reply_with_error ("count is negative");
-    close (fd);
+    if (close_fd)
+      close (fd);
     return NULL;
   }
 
   if (offset < 0) {
     reply_with_error ("offset is negative");
-    close (fd);
+    if (close_fd)
+      close (fd);
     return NULL;
   }
 
@@ -315,26 +318,29 @@ pread_fd (int fd, int count, int64_t offset, size_t *size_r,
    */
   if (count >= GUESTFS_MESSAGE_MAX) {
     reply_with_error ("%s: count is too large for the protocol, use smaller reads", display_path);
-    close (fd);
+    if (close_fd)
+      close (fd);
     return NULL;
   }
 
   buf = malloc (count);
   if (buf == NULL) {
     reply_with_perror ("malloc");
-    close (fd);
+    if (close_fd)
+      close (fd);
     return NULL;
   }
 
   r = pread (fd, buf, count, offset);
   if (r == -1) {
     reply_with_perror ("pread: %s", display_path);
-    close (fd);
+    if (close_fd)
+      close (fd);
     free (buf);
     return NULL;
   }
 
-  if (close (fd) == -1) {
+  if (close_fd && close (fd) == -1) {
     reply_with_perror ("close: %s", display_path);
     free (buf);
     return NULL;
@@ -361,7 +367,7 @@ do_pread (const char *path, int count, int64_t offset, size_t *size_r)
     return NULL;
   }
 
-  return pread_fd (fd, count, offset, size_r, path);
+  return pread_fd (fd, count, offset, size_r, path, 1);
 }
 
 char *
@@ -373,23 +379,24 @@ do_pread_device (const char *device, int count, int64_t offset, size_t *size_r)
     return NULL;
   }
 
-  return pread_fd (fd, count, offset, size_r, device);
+  return pread_fd (fd, count, offset, size_r, device, 1);
 }
 
 static int
 pwrite_fd (int fd, const char *content, size_t size, int64_t offset,
-           const char *display_path, int settle)
+           const char *display_path, int settle, int close_fd)
 {
   ssize_t r;
 
   r = pwrite (fd, content, size, offset);
   if (r == -1) {
     reply_with_perror ("pwrite: %s", display_path);
-    close (fd);
+    if (close_fd)
+      close (fd);
     return -1;
   }
 
-  if (close (fd) == -1) {
+  if (close_fd && close (fd) == -1) {
     reply_with_perror ("close: %s", display_path);
     return -1;
   }
@@ -428,7 +435,7 @@ do_pwrite (const char *path, const char *content, size_t size, int64_t offset)
     return -1;
   }
 
-  return pwrite_fd (fd, content, size, offset, path, 0);
+  return pwrite_fd (fd, content, size, offset, path, 0, 1);
 }
 
 int
@@ -446,7 +453,158 @@ do_pwrite_device (const char *device, const char *content, size_t size,
     return -1;
   }
 
-  return pwrite_fd (fd, content, size, offset, device, 1);
+  return pwrite_fd (fd, content, size, offset, device, 1, 1);
+}
+
+/* Files opened by guestfs_open_handle.  The handle is the index in
+ * this table.  Slots of closed handles (fd == -1) are reused.
+ *
+ * Only open_handle and close_handle, which are not concurrent, change
+ * the table.  The main loop waits for concurrent calls to finish
+ * before running them, so pread_handle (which is concurrent) can use
+ * the table without a lock.
+ */
+#define MAX_FILE_HANDLES 4096
+
+struct file_handle {
+  int fd;                       /* -1 = slot is free */
+  char *path;                   /* For error messages. */
+};
+
+static struct file_handle *file_handles;
+static size_t nr_file_handles;
+
+void file_handles_finalize (void) __attribute__((destructor));
+void
+file_handles_finalize (void)
+{
+  size_t i;
+
+  for (i = 0; i < nr_file_handles; ++i) {
+    if (file_handles[i].fd >= 0)
+      close (file_handles[i].fd);
+    free (file_handles[i].path);
+  }
+  free (file_handles);
+  file_handles = NULL;
+  nr_file_handles = 0;
+}
+
+static struct file_handle *
+get_file_handle (int handle)
+{
+  if (handle < 0 || (size_t) handle >= nr_file_handles ||
+      file_handles[handle].fd == -1) {
+    reply_with_error_errno (EBADF, "%d: invalid handle", handle);
+    return NULL;
+  }
+  return &file_handles[handle];
+}
+
+int
+do_open_handle (const char *path, int readwrite)
+{
+  int fd;
+  size_t i;
+  char *p;
+
+  p = strdup (path);
+  if (p == NULL) {
+    reply_with_perror ("strdup");
+    return -1;
+  }
+
+  for (i = 0; i < nr_file_handles; ++i)
+    if (file_handles[i].fd == -1)
+      break;
+  if (i == nr_file_handles) {
+    struct file_handle *new_handles;
+
+    if (nr_file_handles >= MAX_FILE_HANDLES) {
+      reply_with_error_errno (EMFILE, "too many open handles");
+      free (p);
+      return -1;
+    }
+    new_handles = realloc (file_handles,
+                           (nr_file_handles + 1) * sizeof *new_handles);
+    if (new_handles == NULL) {
+      reply_with_perror ("realloc");
+      free (p);
+      return -1;
+    }
+    file_handles = new_handles;
+    file_handles[nr_file_handles].fd = -1;
+    file_handles[nr_file_handles].path = NULL;
+    nr_file_handles++;
+  }
+
+  CHROOT_IN;
+  fd = open (path, (readwrite ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+  CHROOT_OUT;
+
+  if (fd == -1) {
+    reply_with_perror ("open: %s", path);
+    free (p);
+    return -1;
+  }
+
+  file_handles[i].fd = fd;
+  file_handles[i].path = p;
+  return i;
+}
+
+int
+do_close_handle (int handle)
+{
+  struct file_handle *fh;
+  int fd;
+  CLEANUP_FREE char *path = NULL;
+
+  fh = get_file_handle (handle);
+  if (fh == NULL)
+    return -1;
+
+  fd = fh->fd;
+  path = fh->path;
+  fh->fd = -1;
+  fh->path = NULL;
+
+  if (close (fd) == -1) {
+    reply_with_perror ("close: %s", path);
+    return -1;
+  }
+
+  return 0;
+}
+
+char *
+do_pread_handle (int handle, int count, int64_t offset, size_t *size_r)
+{
+  struct file_handle *fh;
+
+  fh = get_file_handle (handle);
+  if (fh == NULL)
+    return NULL;
+
+  return pread_fd (fh->fd, count, offset, size_r, fh->path, 0);
+}
+
+int
+do_pwrite_handle (int handle, const char *content, size_t size,
+                  int64_t offset)
+{
+  struct file_handle *fh;
+
+  if (offset < 0) {
+    reply_with_error ("offset is negative");
+    return -1;
+  }
+
+  fh = get_file_handle (handle);
+  if (fh == NULL)
+    return -1;
+
+  return pwrite_fd (fh->fd, content, size, offset, fh->path, 0, 0);
 }
 
 /* This runs the 'file' command. */
@@ -583,12 +741,14 @@ do_zfile (const char *method, const char *path)
 int64_t
 do_filesize (const char *path)
 {
-  int r;
+  CLEANUP_CLOSE int fd = -1;
+  CLEANUP_FREE char *name = NULL;
+  int r = -1;
   struct stat buf;
 
-  CHROOT_IN;
-  r = stat (path, &buf);        /* follow symlinks */
-  CHROOT_OUT;
+  fd = sysroot_walk (path, 1, &name); /* follow symlinks */
+  if (fd >= 0)
+    r = fstatat (fd, name, &buf, AT_SYMLINK_NOFOLLOW);
 
   if (r == -1) {
     reply_with_perror ("%s", path);
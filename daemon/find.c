@@ -61,7 +61,7 @@ do_find0 (const char *dir)
   CLEANUP_FREE char *cmd = NULL;
   CLEANUP_FREE char *sysrootdir = NULL;
   size_t sysrootdirlen;
-  char str[GUESTFS_MAX_CHUNK_SIZE];
+  char str[GUESTFS_DEFAULT_CHUNK_SIZE];
 
   sysrootdir = sysroot_path (dir);
   if (!sysrootdir) {
@@ -106,7 +106,7 @@ do_find0 (const char *dir)
    * turns out not to be a problem at some point in the future then
    * we'll need to modify the code to handle it.  XXX
    */
-  while ((r = input_to_nul (fp, str, GUESTFS_MAX_CHUNK_SIZE)) > 0) {
+  while ((r = input_to_nul (fp, str, GUESTFS_DEFAULT_CHUNK_SIZE)) > 0) {
     size_t len = strlen (str);
     if (len <= sysrootdirlen)
       continue;
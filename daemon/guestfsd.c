@@ -53,6 +53,7 @@
 #include "c-ctype.h"
 #include "ignore-value.h"
 #include "error.h"
+#include "areadlink.h"
 
 #include "daemon.h"
 
@@ -446,6 +447,168 @@ sysroot_realpath (const char *path)
   return sysroot_path (rp);
 }
 
+/* Maximum number of symlinks followed by sysroot_walk, the same as
+ * the Linux kernel.
+ */
+#define SYSROOT_WALK_MAXSYMLINKS 40
+
+/* Resolve the absolute guest path 'path' in the same way that the
+ * kernel would after chroot (sysroot), but without changing the root
+ * directory of the process.  This makes it safe to use from more than
+ * one thread at a time, unlike CHROOT_IN/CHROOT_OUT.
+ *
+ * Every directory in the path is opened in turn relative to the
+ * previous one.  Symbolic links are read and followed by hand, with
+ * absolute targets restarting from the sysroot, and ".." never goes
+ * above the sysroot.
+ *
+ * On success this returns a file descriptor for the directory
+ * containing the final path element, and sets '*name_r' to that
+ * element (which the caller must free).  The caller can then use
+ * fstatat, openat, readlinkat etc. on the pair, and must close the
+ * file descriptor.  If 'path' refers to the root directory then
+ * '*name_r' is ".".  If 'follow' is true and the final element is a
+ * symlink then it is followed too.
+ *
+ * On error this returns -1 with errno set and does NOT call
+ * reply_with_*.
+ */
+int
+sysroot_walk (const char *path, int follow, char **name_r)
+{
+  int fd, err;
+  size_t depth = 0, nr_symlinks = 0;
+  char *rest, *p, *name;
+
+  rest = strdup (path);
+  if (rest == NULL)
+    return -1;
+
+  fd = open (sysroot_len > 0 ? sysroot : "/",
+             O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if (fd == -1)
+    goto error;
+
+  p = rest;
+  for (;;) {
+    size_t len;
+    int is_last;
+    struct stat statbuf;
+
+    while (*p == '/')
+      p++;
+    if (*p == '\0') {
+      /* Path refers to a directory. */
+      name = strdup (".");
+      if (name == NULL)
+        goto error;
+      break;
+    }
+
+    len = strcspn (p, "/");
+    is_last = p[len + strspn (&p[len], "/")] == '\0';
+    name = strndup (p, len);
+    if (name == NULL)
+      goto error;
+    p += len;
+
+    if (STREQ (name, ".")) {
+      free (name);
+      if (is_last) {
+        name = strdup (".");
+        if (name == NULL)
+          goto error;
+        break;
+      }
+      continue;
+    }
+
+    if (STREQ (name, "..")) {
+      free (name);
+      if (depth > 0) {
+        int pfd = openat (fd, "..", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (pfd == -1)
+          goto error;
+        close (fd);
+        fd = pfd;
+        depth--;
+      }
+      if (is_last) {
+        name = strdup (".");
+        if (name == NULL)
+          goto error;
+        break;
+      }
+      continue;
+    }
+
+    if (fstatat (fd, name, &statbuf, AT_SYMLINK_NOFOLLOW) == -1) {
+      /* A missing final element is left for the caller to report. */
+      if (is_last && errno == ENOENT)
+        break;
+      free (name);
+      goto error;
+    }
+
+    if (S_ISLNK (statbuf.st_mode) && (!is_last || follow)) {
+      CLEANUP_FREE char *target = NULL;
+      char *new_rest;
+
+      if (++nr_symlinks > SYSROOT_WALK_MAXSYMLINKS) {
+        free (name);
+        errno = ELOOP;
+        goto error;
+      }
+
+      target = areadlinkat (fd, name);
+      free (name);
+      if (target == NULL)
+        goto error;
+
+      /* Replace the symlink with its target in the remaining path. */
+      if (asprintf (&new_rest, "%s%s", target, p) == -1)
+        goto error;
+      free (rest);
+      rest = p = new_rest;
+
+      if (target[0] == '/') {
+        close (fd);
+        fd = open (sysroot_len > 0 ? sysroot : "/",
+                   O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (fd == -1)
+          goto error;
+        depth = 0;
+      }
+      continue;
+    }
+
+    if (is_last)
+      break;
+
+    {
+      int cfd = openat (fd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+      free (name);
+      if (cfd == -1)
+        goto error;
+      close (fd);
+      fd = cfd;
+      depth++;
+    }
+  }
+
+  free (rest);
+  *name_r = name;
+  return fd;
+
+ error:
+  err = errno;
+  if (fd >= 0)
+    close (fd);
+  free (rest);
+  errno = err;
+  return -1;
+}
+
 int
 xwrite (int sock, const void *v_buf, size_t len)
 {
@@ -909,7 +1072,10 @@ commandrvf (char **stdoutput, char **stderror, int flags,
    * circumstances.
    */
 
-  if (pipe (so_fd) == -1 || pipe (se_fd) == -1) {
+  /* O_CLOEXEC stops commands started at the same time from other
+   * threads inheriting these pipes, which would delay end of file.
+   */
+  if (pipe2 (so_fd, O_CLOEXEC) == -1 || pipe2 (se_fd, O_CLOEXEC) == -1) {
     error (0, errno, "pipe");
     abort ();
   }
@@ -1247,6 +1413,8 @@ print_arginfo (const struct printf_info *info, size_t n, int *argtypes)
 #endif
 #endif
 
+static char *translate_device (const char *device);
+
 /* Perform device name translation.  See guestfs(3) for the algorithm.
  * Usually you should not call this directly.
  *
@@ -1254,13 +1422,36 @@ print_arginfo (const struct printf_info *info, size_t n, int *argtypes)
  *
  * It returns NULL on error.  *Note* it does *NOT* call reply_with_*.
  *
- * We have to open the device and test for ENXIO, because the device
- * nodes may exist in the appliance.
+ * If the device is not found, it may be an MD, LVM or LDM device
+ * which has not been activated yet, so activate them and try again.
  */
 char *
 device_name_translation (const char *device)
 {
-  int fd;
+  char *ret;
+  int err;
+
+  ret = translate_device (device);
+  err = errno;
+  if (ret == NULL && (err == ENXIO || err == ENOENT)) {
+    activate_volumes ();
+    ret = translate_device (device);
+  }
+
+  return ret;
+}
+
+/* We have to open the device and test for ENXIO, because the device
+ * nodes may exist in the appliance.
+ *
+ * If the device is not found, this returns NULL with errno set by
+ * the open of the original name, which device_name_translation
+ * relies on.
+ */
+static char *
+translate_device (const char *device)
+{
+  int fd, err;
   char *ret;
 
   fd = open (device, O_RDONLY|O_CLOEXEC);
@@ -1269,7 +1460,8 @@ device_name_translation (const char *device)
     return strdup (device);
   }
 
-  if (errno != ENXIO && errno != ENOENT)
+  err = errno;
+  if (err != ENXIO && err != ENOENT)
     return NULL;
 
   /* If the name begins with "/dev/sd" then try the alternatives. */
@@ -1307,6 +1499,7 @@ device_name_translation (const char *device)
   }
   free (ret);
 
+  errno = err;
   return NULL;
 }
 
@@ -413,6 +413,196 @@ do_hivex_node_set_value (int64_t nodeh,
   return 0;
 }
 
+/* State of hivex_node_get_subtree. */
+struct subtree {
+  guestfs_int_hivex_entry_list *ret;
+  size_t alloc;                 /* Number of entries allocated in ret. */
+  size_t size;                  /* Size of the reply when XDR-encoded. */
+};
+
+/* The nodes above the current one, to detect loops in corrupt hives. */
+struct subtree_parent {
+  hive_node_h node;
+  const struct subtree_parent *parent;
+};
+
+/* Size of a string or buffer of length 'len' when XDR-encoded. */
+#define XDR_OPAQUE_SIZE(len) (4 + (((len) + 3) & ~(size_t) 3))
+
+/* Leave this much space in the reply message for the header. */
+#define SUBTREE_REPLY_OVERHEAD 1024
+
+/* Append an entry to the list returned by hivex_node_get_subtree.
+ * The strings and the value buffer are owned by the list after this,
+ * or are freed on error.
+ */
+static int
+add_subtree_entry (struct subtree *st,
+                   char *path, int64_t nodeh, int64_t valueh,
+                   char *key, int64_t t, char *value, size_t len)
+{
+  guestfs_int_hivex_entry_list *ret = st->ret;
+  guestfs_int_hivex_entry *entry;
+
+  st->size +=
+    XDR_OPAQUE_SIZE (strlen (path)) + XDR_OPAQUE_SIZE (strlen (key)) +
+    XDR_OPAQUE_SIZE (len) + 3 * sizeof (int64_t);
+  if (st->size > GUESTFS_MESSAGE_MAX - SUBTREE_REPLY_OVERHEAD) {
+    reply_with_error ("subtree is too large to return in one call, "
+                      "use a smaller depth or a lower node");
+    goto error;
+  }
+
+  if (ret->guestfs_int_hivex_entry_list_len >= st->alloc) {
+    size_t new_alloc = st->alloc > 0 ? st->alloc * 2 : 64;
+    guestfs_int_hivex_entry *new_val;
+
+    new_val = realloc (ret->guestfs_int_hivex_entry_list_val,
+                       new_alloc * sizeof (guestfs_int_hivex_entry));
+    if (new_val == NULL) {
+      reply_with_perror ("realloc");
+      goto error;
+    }
+    ret->guestfs_int_hivex_entry_list_val = new_val;
+    st->alloc = new_alloc;
+  }
+
+  entry =
+    &ret->guestfs_int_hivex_entry_list_val[ret->guestfs_int_hivex_entry_list_len++];
+  entry->hivex_entry_path = path;
+  entry->hivex_entry_nodeh = nodeh;
+  entry->hivex_entry_valueh = valueh;
+  entry->hivex_entry_key = key;
+  entry->hivex_entry_type = t;
+  entry->hivex_entry_value.hivex_entry_value_val = value;
+  entry->hivex_entry_value.hivex_entry_value_len = len;
+  return 0;
+
+ error:
+  free (path);
+  free (key);
+  free (value);
+  return -1;
+}
+
+static int
+get_subtree (struct subtree *st, const struct subtree_parent *parent,
+             const char *path, hive_node_h node, int depth)
+{
+  CLEANUP_FREE hive_value_h *values = NULL;
+  CLEANUP_FREE hive_node_h *children = NULL;
+  const struct subtree_parent *pp;
+  struct subtree_parent this = { .node = node, .parent = parent };
+  char *p, *key;
+  size_t i;
+
+  for (pp = parent; pp != NULL; pp = pp->parent) {
+    if (pp->node == node) {
+      reply_with_error ("loop in the registry at node 0x%zx (%s)",
+                        node, path);
+      return -1;
+    }
+  }
+
+  p = strdup (path);
+  key = strdup ("");
+  if (p == NULL || key == NULL) {
+    reply_with_perror ("strdup");
+    free (p);
+    free (key);
+    return -1;
+  }
+  if (add_subtree_entry (st, p, node, 0, key, 0, NULL, 0) == -1)
+    return -1;
+
+  values = hivex_node_values (h, node);
+  if (values == NULL) {
+    reply_with_perror ("hivex_node_values");
+    return -1;
+  }
+
+  for (i = 0; values[i] != 0; ++i) {
+    hive_type t;
+    size_t len;
+    char *value;
+
+    key = hivex_value_key (h, values[i]);
+    if (key == NULL) {
+      reply_with_perror ("hivex_value_key");
+      return -1;
+    }
+    value = hivex_value_value (h, values[i], &t, &len);
+    if (value == NULL) {
+      reply_with_perror ("hivex_value_value");
+      free (key);
+      return -1;
+    }
+    /* The path is only set in the entry of the node, to keep the
+     * reply small.
+     */
+    p = strdup ("");
+    if (p == NULL) {
+      reply_with_perror ("strdup");
+      free (key);
+      free (value);
+      return -1;
+    }
+    if (add_subtree_entry (st, p, node, values[i], key, t, value, len) == -1)
+      return -1;
+  }
+
+  if (depth == 0)
+    return 0;
+
+  children = hivex_node_children (h, node);
+  if (children == NULL) {
+    reply_with_perror ("hivex_node_children");
+    return -1;
+  }
+
+  for (i = 0; children[i] != 0; ++i) {
+    CLEANUP_FREE char *name = NULL, *child_path = NULL;
+
+    name = hivex_node_name (h, children[i]);
+    if (name == NULL) {
+      reply_with_perror ("hivex_node_name");
+      return -1;
+    }
+    if (asprintf (&child_path, "%s%s%s",
+                  path, path[0] ? "\\" : "", name) == -1) {
+      reply_with_perror ("asprintf");
+      return -1;
+    }
+    if (get_subtree (st, &this, child_path, children[i],
+                     depth > 0 ? depth - 1 : depth) == -1)
+      return -1;
+  }
+
+  return 0;
+}
+
+guestfs_int_hivex_entry_list *
+do_hivex_node_get_subtree (int64_t nodeh, int depth)
+{
+  struct subtree st = { .alloc = 0, .size = 0 };
+
+  NEED_HANDLE (NULL);
+
+  st.ret = calloc (1, sizeof *st.ret);
+  if (st.ret == NULL) {
+    reply_with_perror ("calloc");
+    return NULL;
+  }
+
+  if (get_subtree (&st, NULL, "", nodeh, depth) == -1) {
+    xdr_free ((xdrproc_t) xdr_guestfs_int_hivex_entry_list, (char *) st.ret);
+    free (st.ret);
+    return NULL;
+  }
+
+  return st.ret;
+}
+
 #else /* !HAVE_HIVEX */
 
 OPTGROUP_HIVEX_NOT_AVAILABLE
@@ -24,6 +24,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 
 #include "guestfs_protocol.h"
 #include "daemon.h"
@@ -141,12 +142,14 @@ do_is_socket (const char *path, int followsymlinks)
 static int
 get_mode (const char *path, mode_t *mode, int followsymlinks)
 {
-  int r;
+  CLEANUP_CLOSE int fd = -1;
+  CLEANUP_FREE char *name = NULL;
+  int r = -1;
   struct stat buf;
 
-  CHROOT_IN;
-  r = (!followsymlinks ? lstat : stat) (path, &buf);
-  CHROOT_OUT;
+  fd = sysroot_walk (path, followsymlinks, &name);
+  if (fd >= 0)
+    r = fstatat (fd, name, &buf, AT_SYMLINK_NOFOLLOW);
 
   if (r == -1) {
     if (errno != ENOENT && errno != ENOTDIR) {
@@ -99,6 +99,8 @@ do_list_ldm_volumes (void)
 {
   struct stat buf;
 
+  activate_volumes ();
+
   /* If /dev/mapper doesn't exist at all, don't give an error. */
   if (stat ("/dev/mapper", &buf) == -1) {
     if (errno == ENOENT)
@@ -116,6 +118,8 @@ do_list_ldm_partitions (void)
 {
   struct stat buf;
 
+  activate_volumes ();
+
   /* If /dev/mapper doesn't exist at all, don't give an error. */
   if (stat ("/dev/mapper", &buf) == -1) {
     if (errno == ENOENT)
@@ -35,11 +35,13 @@ GUESTFSD_EXT_CMD(str_ln, ln);
 char *
 do_readlink (const char *path)
 {
-  char *link;
+  CLEANUP_CLOSE int fd = -1;
+  CLEANUP_FREE char *name = NULL;
+  char *link = NULL;
 
-  CHROOT_IN;
-  link = areadlink (path);
-  CHROOT_OUT;
+  fd = sysroot_walk (path, 0, &name);
+  if (fd >= 0)
+    link = areadlinkat (fd, name);
   if (link == NULL) {
     reply_with_perror ("%s", path);
     return NULL;
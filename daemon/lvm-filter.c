@@ -283,6 +283,8 @@ do_lvm_set_filter (char *const *devices)
   if (filters == NULL)
     return -1;
 
+  activate_volumes ();
+
   if (deactivate () == -1)
     return -1;
 
@@ -301,6 +303,8 @@ do_lvm_clear_filter (void)
 {
   const char *const filters[2] = { "a/.*/", NULL };
 
+  activate_volumes ();
+
   if (deactivate () == -1)
     return -1;
 
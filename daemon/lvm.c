@@ -110,6 +110,8 @@ do_pvs (void)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  activate_volumes ();
+
   r = command (&out, &err,
                str_lvm, "pvs", "-o", "pv_name", "--noheadings", NULL);
   if (r == -1) {
@@ -128,6 +130,8 @@ do_vgs (void)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  activate_volumes ();
+
   r = command (&out, &err,
                str_lvm, "vgs", "-o", "vg_name", "--noheadings", NULL);
   if (r == -1) {
@@ -146,6 +150,8 @@ do_lvs (void)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  activate_volumes ();
+
   r = command (&out, &err,
                str_lvm, "lvs",
                "-o", "vg_name,lv_name", "--noheadings",
@@ -166,18 +172,21 @@ do_lvs (void)
 guestfs_int_lvm_pv_list *
 do_pvs_full (void)
 {
+  activate_volumes ();
   return parse_command_line_pvs ();
 }
 
 guestfs_int_lvm_vg_list *
 do_vgs_full (void)
 {
+  activate_volumes ();
   return parse_command_line_vgs ();
 }
 
 guestfs_int_lvm_lv_list *
 do_lvs_full (void)
 {
+  activate_volumes ();
   return parse_command_line_lvs ();
 }
 
@@ -511,6 +520,9 @@ do_vg_activate (int activate, char *const *volgroups)
   CLEANUP_FREE char *err = NULL;
   CLEANUP_FREE const char **argv = NULL;
 
+  /* Do the first-use activation now, so it cannot undo this later. */
+  activate_volumes ();
+
   argc = count_strings (volgroups) + 4;
   argv = malloc (sizeof (char *) * (argc+1));
   if (argv == NULL) {
@@ -662,6 +674,8 @@ do_vgscan (void)
   CLEANUP_FREE char *err = NULL;
   int r;
 
+  activate_volumes ();
+
   r = command (NULL, &err,
                str_lvm, "vgscan", NULL);
   if (r == -1) {
@@ -763,6 +777,8 @@ do_list_dm_devices (void)
   DIR *dir;
   int r;
 
+  activate_volumes ();
+
   dir = opendir ("/dev/mapper");
   if (!dir) {
     reply_with_perror ("opendir: /dev/mapper");
@@ -214,6 +214,8 @@ do_list_md_devices (void)
   DECLARE_STRINGSBUF (ret);
   glob_t mds;
 
+  activate_volumes ();
+
   memset (&mds, 0, sizeof mds);
 
 #define PREFIX "/sys/block/md"
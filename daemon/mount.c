@@ -43,7 +43,8 @@ int
 is_root_mounted (void)
 {
   FILE *fp;
-  struct mntent *m;
+  struct mntent *m, mbuf;
+  char buf[BUFSIZ];
 
   /* NB: Eventually we should aim to parse /proc/self/mountinfo, but
    * that requires custom parsing code.
@@ -54,7 +55,10 @@ is_root_mounted (void)
     exit (EXIT_FAILURE);
   }
 
-  while ((m = getmntent (fp)) != NULL) {
+  /* This is called by every concurrent function (NEED_ROOT), so use
+   * the reentrant getmntent_r.
+   */
+  while ((m = getmntent_r (fp, &mbuf, buf, sizeof buf)) != NULL) {
     /* Allow a mount directory like "/sysroot". */
     if (sysroot_len > 0 && STREQ (m->mnt_dir, sysroot)) {
     gotit:
@@ -266,7 +270,8 @@ static char **
 mounts_or_mountpoints (int mp)
 {
   FILE *fp;
-  struct mntent *m;
+  struct mntent *m, mbuf;
+  char buf[BUFSIZ];
   DECLARE_STRINGSBUF (ret);
   size_t i;
   int r;
@@ -280,7 +285,10 @@ mounts_or_mountpoints (int mp)
     exit (EXIT_FAILURE);
   }
 
-  while ((m = getmntent (fp)) != NULL) {
+  /* mounts and mountpoints are not concurrent, but use getmntent_r
+   * for consistency with is_root_mounted.
+   */
+  while ((m = getmntent_r (fp, &mbuf, buf, sizeof buf)) != NULL) {
     /* Allow a mount directory like "/sysroot". */
     if (sysroot_len > 0 && STREQ (m->mnt_dir, sysroot)) {
       if (add_string (&ret, m->mnt_fsname) == -1) {
@@ -379,6 +387,7 @@ do_umount_all (void)
   aug_finalize ();
   hivex_finalize ();
   journal_finalize ();
+  file_handles_finalize ();
 
   /* NB: Eventually we should aim to parse /proc/self/mountinfo, but
    * that requires custom parsing code.
@@ -0,0 +1,351 @@
+/* libguestfs - the guestfsd daemon
+ * Copyright (C) 2015 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "guestfs_protocol.h"
+#include "daemon.h"
+#include "actions.h"
+
+GUESTFSD_EXT_CMD(str_mount, mount);
+GUESTFSD_EXT_CMD(str_umount, umount);
+
+/* Implement internal_probe_filesystems.  Each filesystem is mounted
+ * read-only on a private temporary directory (not under the sysroot),
+ * the paths are looked up, and it is unmounted again.  Several
+ * filesystems are probed at once on separate threads.  Nothing here
+ * may send a reply until all the threads have finished.
+ */
+
+#define MAX_PROBE_THREADS 8
+
+struct probe_job {
+  char *const *mountables;
+  char *const *vfstypes;
+  char *const *paths;
+  char *const *nocasepaths;
+  size_t nr_mountables;
+  size_t nr_paths;              /* paths + nocasepaths */
+  char **results;               /* One per mountable, NULL = failed. */
+  size_t next;                  /* Next mountable to probe. */
+  pthread_mutex_t lock;
+};
+
+/* Find the entry in the directory 'dfd' matching 'name', ignoring
+ * case.  An exact match is preferred.  Returns a newly allocated
+ * name, or NULL if there is no match.
+ */
+static char *
+find_nocase (int dfd, const char *name)
+{
+  struct stat statbuf;
+  DIR *dir;
+  struct dirent *d;
+  char *ret = NULL;
+  int fd;
+
+  if (fstatat (dfd, name, &statbuf, AT_SYMLINK_NOFOLLOW) == 0)
+    return strdup (name);
+
+  fd = dup (dfd);
+  if (fd == -1)
+    return NULL;
+  dir = fdopendir (fd);
+  if (dir == NULL) {
+    close (fd);
+    return NULL;
+  }
+  /* The duplicate shares the file offset with 'dfd'. */
+  rewinddir (dir);
+  while ((d = readdir (dir)) != NULL) {
+    if (strcasecmp (d->d_name, name) == 0) {
+      ret = strdup (d->d_name);
+      break;
+    }
+  }
+  closedir (dir);
+  return ret;
+}
+
+/* Look up the absolute 'path' under the directory 'mpfd' without
+ * following symlinks, and return a character describing it: 'f'
+ * regular file, 'd' directory, 'l' symlink, 'o' anything else, '-'
+ * not found.  If an intermediate component is a symlink we return
+ * '?', since the library has to resolve it in the guest.
+ */
+static char
+probe_path (int mpfd, const char *path, int nocase)
+{
+  CLEANUP_FREE char *copy = NULL;
+  char *comp, *next;
+  int dfd, fd;
+  struct stat statbuf;
+  char ret = '-';
+
+  copy = strdup (path);
+  if (copy == NULL)
+    return '?';
+
+  dfd = dup (mpfd);
+  if (dfd == -1)
+    return '?';
+
+  for (comp = copy; comp != NULL; comp = next) {
+    CLEANUP_FREE char *name = NULL;
+
+    while (*comp == '/')
+      comp++;
+    next = strchr (comp, '/');
+    if (next)
+      *next++ = '\0';
+    if (*comp == '\0') {        /* "/" or trailing slash */
+      ret = 'd';
+      break;
+    }
+
+    name = nocase ? find_nocase (dfd, comp) : strdup (comp);
+    if (name == NULL ||
+        fstatat (dfd, name, &statbuf, AT_SYMLINK_NOFOLLOW) == -1) {
+      ret = '-';
+      break;
+    }
+
+    while (next && *next == '/')
+      next++;
+    if (next == NULL || *next == '\0') {
+      if (S_ISREG (statbuf.st_mode))
+        ret = 'f';
+      else if (S_ISDIR (statbuf.st_mode))
+        ret = 'd';
+      else if (S_ISLNK (statbuf.st_mode))
+        ret = 'l';
+      else
+        ret = 'o';
+      break;
+    }
+
+    if (S_ISLNK (statbuf.st_mode)) {
+      ret = '?';
+      break;
+    }
+    if (!S_ISDIR (statbuf.st_mode)) {
+      ret = '-';
+      break;
+    }
+    fd = openat (dfd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+    if (fd == -1) {
+      ret = '?';
+      break;
+    }
+    close (dfd);
+    dfd = fd;
+  }
+
+  close (dfd);
+  return ret;
+}
+
+/* Mount one filesystem read-only on 'mp', the same way that
+ * inspection in the library does.  Returns 0 or -1.
+ */
+static int
+probe_mount (const char *mountable, const char *vfstype, const char *mp)
+{
+  CLEANUP_FREE char *device = NULL, *options = NULL;
+  mountable_t m = { .type = MOUNTABLE_DEVICE };
+  int r;
+
+  if (STRPREFIX (mountable, "btrfsvol:")) {
+    if (parse_btrfsvol (mountable + strlen ("btrfsvol:"), &m) == -1)
+      return -1;
+    device = m.device;
+    if (asprintf (&options, "ro,subvol=%s", m.volume) == -1) {
+      free (m.volume);
+      return -1;
+    }
+    free (m.volume);
+  }
+  else {
+    device = device_name_translation (mountable);
+    if (device == NULL)
+      return -1;
+  }
+
+  if (STREQ (vfstype, "ufs")) {
+    /* FreeBSD uses ufs2, while NetBSD and OpenBSD use 44bsd. */
+    r = command (NULL, NULL, str_mount, "-o", "ro,ufstype=ufs2",
+                 "-t", "ufs", device, mp, NULL);
+    if (r == -1)
+      r = command (NULL, NULL, str_mount, "-o", "ro,ufstype=44bsd",
+                   "-t", "ufs", device, mp, NULL);
+  }
+  else
+    r = command (NULL, NULL, str_mount, "-o", options ? options : "ro",
+                 device, mp, NULL);
+
+  return r;
+}
+
+/* Probe one filesystem.  Returns the result string, or NULL if the
+ * filesystem could not be mounted.
+ */
+static char *
+probe_filesystem (struct probe_job *job, size_t i)
+{
+  char mp[] = "/tmp/probeXXXXXX";
+  char *ret = NULL;
+  int mpfd;
+  size_t j, k;
+
+  if (STREQ (job->vfstypes[i], "swap") || STREQ (job->vfstypes[i], "unknown"))
+    return NULL;
+
+  if (mkdtemp (mp) == NULL) {
+    perror ("mkdtemp");
+    return NULL;
+  }
+
+  if (probe_mount (job->mountables[i], job->vfstypes[i], mp) == -1)
+    goto out;
+
+  mpfd = open (mp, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if (mpfd >= 0) {
+    ret = malloc (job->nr_paths + 1);
+    if (ret != NULL) {
+      k = 0;
+      for (j = 0; job->paths[j] != NULL; ++j)
+        ret[k++] = probe_path (mpfd, job->paths[j], 0);
+      for (j = 0; job->nocasepaths[j] != NULL; ++j)
+        ret[k++] = probe_path (mpfd, job->nocasepaths[j], 1);
+      ret[k] = '\0';
+    }
+    close (mpfd);
+  }
+
+  if (command (NULL, NULL, str_umount, mp, NULL) == -1) {
+    /* The results are still good, but leave the directory behind. */
+    fprintf (stderr, "guestfsd: probe: could not unmount %s from %s\n",
+             job->mountables[i], mp);
+    return ret;
+  }
+
+ out:
+  rmdir (mp);
+  return ret;
+}
+
+static void *
+probe_thread (void *jobv)
+{
+  struct probe_job *job = jobv;
+  size_t i;
+
+  for (;;) {
+    pthread_mutex_lock (&job->lock);
+    i = job->next++;
+    pthread_mutex_unlock (&job->lock);
+    if (i >= job->nr_mountables)
+      break;
+
+    job->results[i] = probe_filesystem (job, i);
+  }
+
+  return NULL;
+}
+
+char **
+do_internal_probe_filesystems (char *const *mountables,
+                               char *const *vfstypes,
+                               char *const *paths,
+                               char *const *nocasepaths)
+{
+  struct probe_job job = {
+    .mountables = mountables, .vfstypes = vfstypes,
+    .paths = paths, .nocasepaths = nocasepaths,
+  };
+  pthread_t threads[MAX_PROBE_THREADS];
+  size_t i, nr_threads;
+  int err;
+  DECLARE_STRINGSBUF (ret);
+
+  job.nr_mountables = count_strings (mountables);
+  if (count_strings (vfstypes) != job.nr_mountables) {
+    reply_with_error ("mountables and vfstypes lists have different lengths");
+    return NULL;
+  }
+  job.nr_paths = count_strings (paths) + count_strings (nocasepaths);
+
+  job.results = calloc (job.nr_mountables, sizeof (char *));
+  if (job.results == NULL) {
+    reply_with_perror ("calloc");
+    return NULL;
+  }
+  pthread_mutex_init (&job.lock, NULL);
+
+  nr_threads = job.nr_mountables;
+  if (nr_threads > MAX_PROBE_THREADS)
+    nr_threads = MAX_PROBE_THREADS;
+  for (i = 0; i < nr_threads; ++i) {
+    err = pthread_create (&threads[i], NULL, probe_thread, &job);
+    if (err != 0) {
+      /* The threads already started (or this one) do the work. */
+      nr_threads = i;
+      break;
+    }
+  }
+  if (nr_threads == 0)
+    probe_thread (&job);
+  for (i = 0; i < nr_threads; ++i)
+    pthread_join (threads[i], NULL);
+
+  pthread_mutex_destroy (&job.lock);
+
+  for (i = 0; i < job.nr_mountables; ++i) {
+    if (job.results[i] == NULL) {
+      if (add_string (&ret, "") == -1)
+        goto error;
+    }
+    else {
+      if (add_string_nodup (&ret, job.results[i]) == -1)
+        goto error;
+      job.results[i] = NULL;
+    }
+  }
+  free (job.results);
+
+  if (end_stringsbuf (&ret) == -1)
+    return NULL;
+
+  return ret.argv;              /* Caller frees. */
+
+ error:
+  for (i = 0; i < job.nr_mountables; ++i)
+    free (job.results[i]);
+  free (job.results);
+  return NULL;
+}
@@ -21,14 +21,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <string.h>
 #include <signal.h>
 #include <inttypes.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/param.h>		/* defines MIN */
 #include <sys/select.h>
 #include <sys/time.h>
+#include <pthread.h>
 #include <rpc/types.h>
 #include <rpc/xdr.h>
 
@@ -41,10 +44,14 @@
 #include "daemon.h"
 #include "guestfs_protocol.h"
 #include "errnostring.h"
+#include "actions.h"
+#include "call-stats.h"
 
-/* The message currently being processed. */
-int proc_nr;
-int serial;
+/* The message currently being processed.  These are thread-local
+ * because concurrent requests run on worker threads (see below).
+ */
+__thread int proc_nr;
+__thread int serial;
 
 /* Hint for implementing progress messages for uploaded/incoming data.
  * The caller sets this to a value > 0 if it knows or can estimate how
@@ -52,7 +59,7 @@ int serial;
  * coming from a pipe).  If this is known then we can emit progress
  * messages as we write the data.
  */
-uint64_t progress_hint;
+__thread uint64_t progress_hint;
 
 /* Optional arguments bitmask.  Caller sets this to indicate which
  * optional arguments in the guestfs_<foo>_args structure are
@@ -61,20 +68,108 @@ uint64_t progress_hint;
  * bitmask has bits set that the daemon doesn't understand, then the
  * whole call is rejected early in processing.
  */
-uint64_t optargs_bitmask;
+__thread uint64_t optargs_bitmask;
+
+/* Maximum size of file transfer chunks.  Until the library tells us
+ * otherwise (see do_internal_set_chunk_size) we must assume that it
+ * is an old library which only understands small chunks.
+ */
+size_t chunk_size = GUESTFS_DEFAULT_CHUNK_SIZE;
+
+/* Set by do_internal_set_sparse_transfers.  Old libraries don't
+ * understand hole chunks, so we must not send them unless asked.
+ */
+int sparse_transfers = 0;
 
 /* Time at which we received the current request. */
-static struct timeval start_t;
+static __thread struct timeval start_t;
 
 /* Time at which the last progress notification was sent. */
-static struct timeval last_progress_t;
+static __thread struct timeval last_progress_t;
 
 /* Counts the number of progress notifications sent during this call. */
-static size_t count_progress;
+static __thread size_t count_progress;
 
 /* The daemon communications socket. */
 static int sock;
 
+/* Statistics for each procedure, returned by
+ * do_internal_call_stats.  Workers update these too, so they are
+ * protected by stats_lock.
+ */
+static struct call_stats *stats[GUESTFS_MAX_PROC_NR+1];
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Return the statistics for procedure 'proc' (creating them if
+ * necessary), or NULL.  Must be called with stats_lock held.
+ */
+static struct call_stats *
+get_stats (int proc)
+{
+  if (proc <= 0 || proc > GUESTFS_MAX_PROC_NR)
+    return NULL;
+  if (stats[proc] == NULL)
+    stats[proc] = calloc (1, sizeof (struct call_stats));
+  return stats[proc];
+}
+
+static void
+count_bytes (size_t sent, size_t received)
+{
+  struct call_stats *cs;
+
+  pthread_mutex_lock (&stats_lock);
+  cs = get_stats (proc_nr);
+  if (cs) {
+    cs->bytes_sent += sent;
+    cs->bytes_received += received;
+  }
+  pthread_mutex_unlock (&stats_lock);
+}
+
+/* Replies may be written by the main thread and by worker threads,
+ * so each message is written to the socket while holding this lock.
+ */
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Worker pool for procedures marked 'concurrent' in the generator.
+ *
+ * The main thread is the only thread which reads from the socket.
+ * When it reads a concurrent request it queues it for the workers
+ * and goes straight back to reading.  Any other request may change
+ * state that the workers depend on (mounts, CHROOT_IN, file
+ * transfers on the socket), so before running one the main thread
+ * waits until the queue is empty and all workers are idle, and then
+ * runs it itself.  Replies to concurrent requests can therefore be
+ * sent out of order.  The library matches them up by serial number.
+ */
+#define MAX_WORKERS 16
+
+struct queued_request {
+  struct queued_request *next;
+  char *buf;
+  uint32_t len;
+};
+
+static size_t nr_workers;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static struct queued_request *queue_head, *queue_tail;
+static size_t nr_busy_workers;
+
+static void start_workers (void);
+static int is_concurrent_request (const char *buf, uint32_t len);
+static void queue_request (char *buf, uint32_t len);
+static void wait_for_workers (void);
+static void handle_request (char *buf, uint32_t len);
+static void wait_while_idle (void);
+
+/* Seconds without a call before the appliance releases its caches
+ * (see balloon.c).
+ */
+#define IDLE_TIMEOUT 30
+
 void
 main_loop (int _sock)
 {
@@ -82,11 +177,14 @@ main_loop (int _sock)
   char *buf;
   char lenbuf[4];
   uint32_t len;
-  struct guestfs_message_header hdr;
 
   sock = _sock;
 
+  start_workers ();
+
   for (;;) {
+    wait_while_idle ();
+
     /* Read the length word. */
     if (xread (sock, lenbuf, 4) == -1)
       exit (EXIT_FAILURE);
@@ -114,6 +212,7 @@ main_loop (int _sock)
 
     buf = malloc (len);
     if (!buf) {
+      wait_for_workers ();
       reply_with_perror ("malloc");
       continue;
     }
@@ -144,77 +243,311 @@ main_loop (int _sock)
     }
 #endif
 
-    gettimeofday (&start_t, NULL);
-    last_progress_t = start_t;
-    count_progress = 0;
-
-    /* Decode the message header. */
-    xdrmem_create (&xdr, buf, len, XDR_DECODE);
-    if (!xdr_guestfs_message_header (&xdr, &hdr)) {
-      fprintf (stderr, "guestfsd: could not decode message header\n");
-      exit (EXIT_FAILURE);
+    if (nr_workers > 0 && is_concurrent_request (buf, len)) {
+      queue_request (buf, len);
+      continue;
     }
 
-    /* Check the version etc. */
-    if (hdr.prog != GUESTFS_PROGRAM) {
-      reply_with_error ("wrong program (%d)", hdr.prog);
-      goto cont;
-    }
-    if (hdr.vers != GUESTFS_PROTOCOL_VERSION) {
-      reply_with_error ("wrong protocol version (%d)", hdr.vers);
-      goto cont;
-    }
-    if (hdr.direction != GUESTFS_DIRECTION_CALL) {
-      reply_with_error ("unexpected message direction (%d)", hdr.direction);
-      goto cont;
-    }
-    if (hdr.status != GUESTFS_STATUS_OK) {
-      reply_with_error ("unexpected message status (%d)", hdr.status);
-      goto cont;
-    }
+    wait_for_workers ();
+    handle_request (buf, len);
+  }
+}
 
-    proc_nr = hdr.proc;
-    serial = hdr.serial;
-    progress_hint = hdr.progress_hint;
-    optargs_bitmask = hdr.optargs_bitmask;
+/* Decode and run a single request, and send the reply.  This frees
+ * 'buf'.
+ */
+static void
+handle_request (char *buf, uint32_t len)
+{
+  XDR xdr;
+  struct guestfs_message_header hdr;
 
-    /* Clear errors before we call the stub functions.  This is just
-     * to ensure that we can accurately report errors in cases where
-     * error handling paths don't set errno correctly.
-     */
-    errno = 0;
+  gettimeofday (&start_t, NULL);
+  last_progress_t = start_t;
+  count_progress = 0;
+
+  /* Decode the message header. */
+  xdrmem_create (&xdr, buf, len, XDR_DECODE);
+  if (!xdr_guestfs_message_header (&xdr, &hdr)) {
+    fprintf (stderr, "guestfsd: could not decode message header\n");
+    exit (EXIT_FAILURE);
+  }
+
+  /* Check the version etc. */
+  if (hdr.prog != GUESTFS_PROGRAM) {
+    reply_with_error ("wrong program (%d)", hdr.prog);
+    goto cont;
+  }
+  if (hdr.vers != GUESTFS_PROTOCOL_VERSION) {
+    reply_with_error ("wrong protocol version (%d)", hdr.vers);
+    goto cont;
+  }
+  if (hdr.direction != GUESTFS_DIRECTION_CALL) {
+    reply_with_error ("unexpected message direction (%d)", hdr.direction);
+    goto cont;
+  }
+  if (hdr.status != GUESTFS_STATUS_OK) {
+    reply_with_error ("unexpected message status (%d)", hdr.status);
+    goto cont;
+  }
+
+  proc_nr = hdr.proc;
+  serial = hdr.serial;
+  progress_hint = hdr.progress_hint;
+  optargs_bitmask = hdr.optargs_bitmask;
+
+  /* Clear errors before we call the stub functions.  This is just
+   * to ensure that we can accurately report errors in cases where
+   * error handling paths don't set errno correctly.
+   */
+  errno = 0;
 #ifdef WIN32
-    SetLastError (0);
-    WSASetLastError (0);
+  SetLastError (0);
+  WSASetLastError (0);
 #endif
 
-    /* Now start to process this message. */
-    dispatch_incoming_message (&xdr);
-    /* Note that dispatch_incoming_message will also send a reply. */
+  count_bytes (0, len + 4);
+
+  /* Now start to process this message. */
+  dispatch_incoming_message (&xdr);
+  /* Note that dispatch_incoming_message will also send a reply. */
+
+  struct timeval end_t;
+  gettimeofday (&end_t, NULL);
+
+  int64_t start_us, end_us, elapsed_us;
+  start_us = (int64_t) start_t.tv_sec * 1000000 + start_t.tv_usec;
+  end_us = (int64_t) end_t.tv_sec * 1000000 + end_t.tv_usec;
+  elapsed_us = end_us - start_us;
+  if (elapsed_us < 0)
+    elapsed_us = 0;
+
+  pthread_mutex_lock (&stats_lock);
+  struct call_stats *cs = get_stats (proc_nr);
+  if (cs)
+    call_stats_add (cs, elapsed_us);
+  pthread_mutex_unlock (&stats_lock);
+
+  /* In verbose mode, display the time taken to run each command. */
+  if (verbose) {
+    fprintf (stderr,
+             "guestfsd: main_loop: proc %d (%s) took %d.%02d seconds\n",
+             proc_nr,
+             proc_nr >= 0 && proc_nr <= GUESTFS_MAX_PROC_NR
+             ? function_names[proc_nr] : "UNKNOWN PROCEDURE",
+             (int) (elapsed_us / 1000000),
+             (int) ((elapsed_us / 10000) % 100));
+  }
 
-    /* In verbose mode, display the time taken to run each command. */
-    if (verbose) {
-      struct timeval end_t;
-      gettimeofday (&end_t, NULL);
+ cont:
+  xdr_destroy (&xdr);
+  free (buf);
+}
 
-      int64_t start_us, end_us, elapsed_us;
-      start_us = (int64_t) start_t.tv_sec * 1000000 + start_t.tv_usec;
-      end_us = (int64_t) end_t.tv_sec * 1000000 + end_t.tv_usec;
-      elapsed_us = end_us - start_us;
+static void *worker_thread (void *arg);
 
-      fprintf (stderr,
-	       "guestfsd: main_loop: proc %d (%s) took %d.%02d seconds\n",
-               proc_nr,
-               proc_nr >= 0 && proc_nr <= GUESTFS_MAX_PROC_NR
-               ? function_names[proc_nr] : "UNKNOWN PROCEDURE",
-               (int) (elapsed_us / 1000000),
-               (int) ((elapsed_us / 10000) % 100));
+/* Start one worker per online CPU.  With a single CPU there is no
+ * point, and every request is run by the main thread as before.
+ */
+static void
+start_workers (void)
+{
+  long n;
+  size_t i;
+  pthread_t thread;
+  pthread_attr_t attr;
+  int err;
+
+  n = sysconf (_SC_NPROCESSORS_ONLN);
+  if (n <= 1)
+    return;
+  if (n > MAX_WORKERS)
+    n = MAX_WORKERS;
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  for (i = 0; i < (size_t) n; ++i) {
+    err = pthread_create (&thread, &attr, worker_thread, NULL);
+    if (err != 0) {
+      fprintf (stderr, "guestfsd: pthread_create: %s\n", strerror (err));
+      break;
     }
+    nr_workers++;
+  }
+  pthread_attr_destroy (&attr);
 
-  cont:
-    xdr_destroy (&xdr);
-    free (buf);
+  if (verbose)
+    fprintf (stderr, "guestfsd: started %zu worker threads\n", nr_workers);
+}
+
+static void *
+worker_thread (void *arg)
+{
+  sigset_t sigs;
+  struct queued_request *req;
+
+  /* Signals (eg. SIGALRM for pulse mode) must go to the main thread. */
+  sigfillset (&sigs);
+  pthread_sigmask (SIG_BLOCK, &sigs, NULL);
+
+  for (;;) {
+    pthread_mutex_lock (&queue_lock);
+    while (queue_head == NULL)
+      pthread_cond_wait (&queue_cond, &queue_lock);
+    req = queue_head;
+    queue_head = req->next;
+    if (queue_head == NULL)
+      queue_tail = NULL;
+    nr_busy_workers++;
+    pthread_mutex_unlock (&queue_lock);
+
+    handle_request (req->buf, req->len);
+    free (req);
+
+    pthread_mutex_lock (&queue_lock);
+    nr_busy_workers--;
+    if (queue_head == NULL && nr_busy_workers == 0)
+      pthread_cond_broadcast (&idle_cond);
+    pthread_mutex_unlock (&queue_lock);
   }
+
+  /*NOTREACHED*/
+  return NULL;
+}
+
+/* Is this a well-formed call to a procedure which may run on a
+ * worker thread?  Anything else (including malformed messages) is
+ * handled by the main thread.
+ */
+static int
+is_concurrent_request (const char *buf, uint32_t len)
+{
+  XDR xdr;
+  struct guestfs_message_header hdr;
+  int r = 0;
+
+  xdrmem_create (&xdr, (char *) buf, len, XDR_DECODE);
+  if (xdr_guestfs_message_header (&xdr, &hdr) &&
+      hdr.prog == GUESTFS_PROGRAM &&
+      hdr.vers == GUESTFS_PROTOCOL_VERSION &&
+      hdr.direction == GUESTFS_DIRECTION_CALL &&
+      hdr.status == GUESTFS_STATUS_OK)
+    r = is_concurrent_procedure (hdr.proc);
+  xdr_destroy (&xdr);
+
+  return r;
+}
+
+static void
+queue_request (char *buf, uint32_t len)
+{
+  struct queued_request *req;
+
+  req = malloc (sizeof *req);
+  if (req == NULL) {
+    perror ("malloc");
+    exit (EXIT_FAILURE);
+  }
+  req->next = NULL;
+  req->buf = buf;
+  req->len = len;
+
+  pthread_mutex_lock (&queue_lock);
+  if (queue_tail)
+    queue_tail->next = req;
+  else
+    queue_head = req;
+  queue_tail = req;
+  pthread_cond_signal (&queue_cond);
+  pthread_mutex_unlock (&queue_lock);
+}
+
+static bool
+workers_busy (void)
+{
+  bool busy;
+
+  if (nr_workers == 0)
+    return false;
+
+  pthread_mutex_lock (&queue_lock);
+  busy = queue_head != NULL || nr_busy_workers > 0;
+  pthread_mutex_unlock (&queue_lock);
+
+  return busy;
+}
+
+/* Wait for the next request to start arriving.  If none arrives
+ * within IDLE_TIMEOUT seconds, release memory to the host, once per
+ * idle period.
+ */
+static void
+wait_while_idle (void)
+{
+  fd_set rset;
+  struct timeval tv;
+  int r;
+
+  for (;;) {
+    FD_ZERO (&rset);
+    FD_SET (sock, &rset);
+    tv.tv_sec = IDLE_TIMEOUT;
+    tv.tv_usec = 0;
+
+    r = select (sock+1, &rset, NULL, NULL, &tv);
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      perror ("select");
+      return;
+    }
+    if (r > 0)
+      return;
+
+    /* Concurrent requests may still be running on worker threads. */
+    if (workers_busy ())
+      continue;
+
+    release_free_memory ();
+    return;
+  }
+}
+
+/* Wait until all queued concurrent requests have been answered. */
+static void
+wait_for_workers (void)
+{
+  if (nr_workers == 0)
+    return;
+
+  pthread_mutex_lock (&queue_lock);
+  while (queue_head != NULL || nr_busy_workers > 0)
+    pthread_cond_wait (&idle_cond, &queue_lock);
+  pthread_mutex_unlock (&queue_lock);
+}
+
+/* Write a length word and a message to the socket as one unit. */
+static void
+write_message (const char *buf, uint32_t len)
+{
+  XDR xdr;
+  char lenbuf[4];
+  int r;
+
+  xdrmem_create (&xdr, lenbuf, 4, XDR_ENCODE);
+  xdr_u_int (&xdr, &len);
+  xdr_destroy (&xdr);
+
+  pthread_mutex_lock (&write_lock);
+  r = xwrite (sock, lenbuf, 4) == 0 && xwrite (sock, buf, len) == 0 ? 0 : -1;
+  pthread_mutex_unlock (&write_lock);
+
+  if (r == -1) {
+    fprintf (stderr, "guestfsd: xwrite failed\n");
+    exit (EXIT_FAILURE);
+  }
+
+  count_bytes (len + 4, 0);
 }
 
 static void send_error (int errnum, char *msg);
@@ -245,6 +578,7 @@ reply_with_perror_errno (int err, const char *fs, ...)
   CLEANUP_FREE char *buf2 = NULL;
   va_list args;
   int r;
+  char errbuf[256];
 
   va_start (args, fs);
   r = vasprintf (&buf1, fs, args);
@@ -256,7 +590,12 @@ reply_with_perror_errno (int err, const char *fs, ...)
     exit (EXIT_FAILURE);
   }
 
-  r = asprintf (&buf2, "%s: %s", buf1, strerror (err));
+  /* Calls may be running on the worker threads, so strerror is not
+   * safe to use here.
+   */
+  strerror_r (err, errbuf, sizeof errbuf);
+
+  r = asprintf (&buf2, "%s: %s", buf1, errbuf);
   if (r == -1)
     goto error;
 
@@ -268,7 +607,6 @@ send_error (int errnum, char *msg)
 {
   XDR xdr;
   CLEANUP_FREE char *buf = NULL;
-  char lenbuf[4];
   struct guestfs_message_header hdr;
   struct guestfs_message_error err;
   unsigned len;
@@ -320,18 +658,7 @@ send_error (int errnum, char *msg)
   len = xdr_getpos (&xdr);
   xdr_destroy (&xdr);
 
-  xdrmem_create (&xdr, lenbuf, 4, XDR_ENCODE);
-  xdr_u_int (&xdr, &len);
-  xdr_destroy (&xdr);
-
-  if (xwrite (sock, lenbuf, 4) == -1) {
-    fprintf (stderr, "guestfsd: xwrite failed\n");
-    exit (EXIT_FAILURE);
-  }
-  if (xwrite (sock, buf, len) == -1) {
-    fprintf (stderr, "guestfsd: xwrite failed\n");
-    exit (EXIT_FAILURE);
-  }
+  write_message (buf, len);
 }
 
 void
@@ -339,7 +666,6 @@ reply (xdrproc_t xdrp, char *ret)
 {
   XDR xdr;
   CLEANUP_FREE char *buf = NULL;
-  char lenbuf[4];
   struct guestfs_message_header hdr;
   uint32_t len;
 
@@ -378,23 +704,50 @@ reply (xdrproc_t xdrp, char *ret)
   len = xdr_getpos (&xdr);
   xdr_destroy (&xdr);
 
-  xdrmem_create (&xdr, lenbuf, 4, XDR_ENCODE);
-  xdr_u_int (&xdr, &len);
-  xdr_destroy (&xdr);
-
-  if (xwrite (sock, lenbuf, 4) == -1) {
-    fprintf (stderr, "guestfsd: xwrite failed\n");
-    exit (EXIT_FAILURE);
-  }
-  if (xwrite (sock, buf, (size_t) len) == -1) {
-    fprintf (stderr, "guestfsd: xwrite failed\n");
-    exit (EXIT_FAILURE);
-  }
+  write_message (buf, len);
 }
 
 /* Receive file chunks, repeatedly calling 'cb'. */
 int
 receive_file (receive_cb cb, void *opaque)
+{
+  return receive_file_with_holes (cb, NULL, opaque);
+}
+
+/* Pass a hole of 'len' bytes to 'cb' as zeroes. */
+static int
+hole_to_data (receive_cb cb, void *opaque, uint64_t len)
+{
+  static const char zeroes[GUESTFS_DEFAULT_CHUNK_SIZE];
+  size_t n;
+  int r;
+
+  while (len > 0) {
+    n = MIN (len, sizeof zeroes);
+    r = cb (opaque, zeroes, n);
+    if (r == -1)
+      return -1;
+    len -= n;
+  }
+  return 0;
+}
+
+/* Decode the length from a hole chunk. */
+static int
+hole_length (const guestfs_chunk *chunk, uint64_t *len)
+{
+  XDR xdr;
+  int r;
+
+  xdrmem_create (&xdr, chunk->data.data_val, chunk->data.data_len,
+                 XDR_DECODE);
+  r = xdr_uint64_t (&xdr, len);
+  xdr_destroy (&xdr);
+  return r ? 0 : -1;
+}
+
+int
+receive_file_with_holes (receive_cb cb, receive_hole_cb hole_cb, void *opaque)
 {
   guestfs_chunk chunk;
   char lenbuf[4];
@@ -434,6 +787,8 @@ receive_file (receive_cb cb, void *opaque)
     if (xread (sock, buf, len) == -1)
       exit (EXIT_FAILURE);
 
+    count_bytes (0, len + 4);
+
     xdrmem_create (&xdr, buf, len, XDR_DECODE);
     memset (&chunk, 0, sizeof chunk);
     if (!xdr_guestfs_chunk (&xdr, &chunk)) {
@@ -447,6 +802,33 @@ receive_file (receive_cb cb, void *opaque)
                "guestfsd: receive_file: got chunk: cancel = 0x%x, len = %d, buf = %p\n",
                chunk.cancel, chunk.data.data_len, chunk.data.data_val);
 
+    if (chunk.cancel == GUESTFS_CHUNK_HOLE) {
+      uint64_t hole;
+
+      r = hole_length (&chunk, &hole);
+      xdr_free ((xdrproc_t) xdr_guestfs_chunk, (char *) &chunk);
+      if (r == -1) {
+        fprintf (stderr, "guestfsd: receive_file: invalid hole chunk\n");
+        return -1;
+      }
+      if (verbose)
+        fprintf (stderr, "guestfsd: receive_file: got hole: len = %" PRIu64 "\n",
+                 hole);
+
+      if (hole_cb)
+        r = hole_cb (opaque, hole);
+      else if (cb)
+        r = hole_to_data (cb, opaque, hole);
+      else
+        r = 0;
+      if (r == -1) {
+        if (verbose)
+          fprintf (stderr, "guestfsd: receive_file: write error\n");
+        return -1;
+      }
+      continue;
+    }
+
     if (chunk.cancel != 0 && chunk.cancel != 1) {
       fprintf (stderr,
                "guestfsd: receive_file: chunk.cancel != [0|1] ... "
@@ -515,9 +897,9 @@ send_file_write (const void *buf, size_t len)
   guestfs_chunk chunk;
   int cancel;
 
-  if (len > GUESTFS_MAX_CHUNK_SIZE) {
-    fprintf (stderr, "guestfsd: send_file_write: len (%zu) > GUESTFS_MAX_CHUNK_SIZE (%d)\n",
-             len, GUESTFS_MAX_CHUNK_SIZE);
+  if (len > chunk_size) {
+    fprintf (stderr, "guestfsd: send_file_write: len (%zu) > chunk_size (%zu)\n",
+             len, chunk_size);
     return -1;
   }
 
@@ -540,6 +922,178 @@ send_file_write (const void *buf, size_t len)
   return 0;
 }
 
+/* Zero-copy file transfers.  send_file_from_fd moves data from the
+ * file into a pipe with splice(2), then from the pipe to the socket,
+ * so the data is never copied into the daemon.  The pipe is created
+ * on first use and kept.  If the file or the socket don't support
+ * splice then we fall back to read(2) into a buffer and
+ * send_file_write.
+ *
+ * This is only used by FileOut functions, which always run on the
+ * main thread, so these don't need locking.
+ */
+static int splice_pipe[2] = { -1, -1 };
+static size_t splice_pipe_size;
+static int splice_to_sock_works = 1;
+
+static void
+close_splice_pipe (void)
+{
+  if (splice_pipe[0] >= 0) {
+    close (splice_pipe[0]);
+    close (splice_pipe[1]);
+  }
+  splice_pipe[0] = splice_pipe[1] = -1;
+}
+
+static int
+open_splice_pipe (void)
+{
+  int r;
+
+  if (splice_pipe[0] >= 0)
+    return 0;
+
+  if (pipe2 (splice_pipe, O_CLOEXEC) == -1) {
+    splice_pipe[0] = splice_pipe[1] = -1;
+    return -1;
+  }
+
+  /* Try to make the pipe big enough to hold a whole chunk.  The
+   * kernel may give us less than this (see
+   * /proc/sys/fs/pipe-max-size), which is fine: we just send smaller
+   * chunks.
+   */
+  r = fcntl (splice_pipe[1], F_SETPIPE_SZ, (int) chunk_size);
+  if (r == -1)
+    r = fcntl (splice_pipe[1], F_GETPIPE_SZ);
+  if (r <= 0) {
+    close_splice_pipe ();
+    return -1;
+  }
+  splice_pipe_size = r;
+  return 0;
+}
+
+/* Send up to 'len' bytes (which must be <= 'chunk_size') read from
+ * 'fd' at its current offset, as a single chunk.
+ *
+ * Returns the number of bytes sent, 0 at the end of the file, -1 if
+ * there was an error reading 'fd' or sending the chunk (the caller
+ * should cancel the transfer), or -2 if the library cancelled the
+ * transfer.
+ */
+int
+send_file_from_fd (int fd, size_t len)
+{
+  static char *buf = NULL;
+  ssize_t r;
+  size_t n, pad;
+  char hdr[12];
+  static const char zeroes[4];
+  XDR xdr;
+  uint32_t msglen, cancel, datalen;
+
+  if (len > chunk_size)
+    len = chunk_size;
+
+  if (check_for_library_cancellation ()) {
+    send_file_end (1);
+    return -2;
+  }
+
+  if (open_splice_pipe () == 0) {
+    if (len > splice_pipe_size)
+      len = splice_pipe_size;
+
+    /* Fill the pipe with up to 'len' bytes. */
+    n = 0;
+    while (n < len) {
+      r = splice (fd, NULL, splice_pipe[1], NULL, len - n, SPLICE_F_MOVE);
+      if (r == -1) {
+        if (errno == EINTR)
+          continue;
+        if (n == 0 && (errno == EINVAL || errno == ENOSYS))
+          goto fallback;      /* fd doesn't support splice. */
+        if (n > 0)
+          break;                /* Send what we have, error next time. */
+        return -1;
+      }
+      if (r == 0)
+        break;
+      n += r;
+    }
+    if (n == 0)
+      return 0;
+
+    /* Write the length word and the XDR encoding of a guestfs_chunk
+     * ('cancel' then the counted 'data'), followed by the data
+     * itself and padding to a multiple of 4 bytes.
+     */
+    pad = (4 - (n & 3)) & 3;
+    msglen = 8 + n + pad;
+    cancel = 0;
+    datalen = n;
+    xdrmem_create (&xdr, hdr, sizeof hdr, XDR_ENCODE);
+    xdr_u_int (&xdr, &msglen);
+    xdr_u_int (&xdr, &cancel);
+    xdr_u_int (&xdr, &datalen);
+    xdr_destroy (&xdr);
+
+    pthread_mutex_lock (&write_lock);
+    if (xwrite (sock, hdr, sizeof hdr) == -1)
+      goto write_error;
+    while (n > 0) {
+      if (splice_to_sock_works)
+        r = splice (splice_pipe[0], NULL, sock, NULL, n, SPLICE_F_MOVE);
+      else
+        r = -1;
+      if (r == -1 && splice_to_sock_works && errno == EINTR)
+        continue;
+      if (r == -1) {
+        /* The socket doesn't support splice, so copy the data out of
+         * the pipe instead.
+         */
+        char copybuf[BUFSIZ];
+
+        splice_to_sock_works = 0;
+        r = read (splice_pipe[0], copybuf, MIN (n, sizeof copybuf));
+        if (r <= 0 || xwrite (sock, copybuf, r) == -1)
+          goto write_error;
+      }
+      n -= r;
+    }
+    if (pad > 0 && xwrite (sock, zeroes, pad) == -1)
+      goto write_error;
+    pthread_mutex_unlock (&write_lock);
+
+    count_bytes (sizeof hdr + datalen + pad, 0);
+
+    return datalen;
+
+  write_error:
+    fprintf (stderr, "guestfsd: send_file_from_fd: write failed\n");
+    exit (EXIT_FAILURE);
+  }
+
+ fallback:
+  if (buf == NULL) {
+    buf = malloc (GUESTFS_MAX_CHUNK_SIZE);
+    if (buf == NULL)
+      return -1;
+  }
+  do {
+    r = read (fd, buf, len);
+  } while (r == -1 && errno == EINTR);
+  if (r <= 0)
+    return r;
+  n = r;
+  r = send_file_write (buf, n);
+  if (r < 0)
+    return r;
+  return n;
+}
+
 static int
 check_for_library_cancellation (void)
 {
@@ -591,15 +1145,138 @@ send_file_end (int cancel)
   return send_chunk (&chunk);
 }
 
+int
+send_file_hole (uint64_t len)
+{
+  static char *zeroes = NULL;
+  guestfs_chunk chunk;
+  char buf[8];
+  XDR xdr;
+  size_t n;
+  int r;
+
+  if (len == 0)
+    return 0;
+
+  if (!sparse_transfers) {
+    if (zeroes == NULL) {
+      zeroes = calloc (GUESTFS_MAX_CHUNK_SIZE, 1);
+      if (zeroes == NULL) {
+        perror ("calloc");
+        return -1;
+      }
+    }
+    while (len > 0) {
+      n = MIN (len, chunk_size);
+      r = send_file_write (zeroes, n);
+      if (r < 0)
+        return r;
+      len -= n;
+    }
+    return 0;
+  }
+
+  if (check_for_library_cancellation ()) {
+    send_file_end (1);
+    return -2;
+  }
+
+  xdrmem_create (&xdr, buf, sizeof buf, XDR_ENCODE);
+  xdr_uint64_t (&xdr, &len);
+  xdr_destroy (&xdr);
+
+  chunk.cancel = GUESTFS_CHUNK_HOLE;
+  chunk.data.data_len = sizeof buf;
+  chunk.data.data_val = buf;
+  return send_chunk (&chunk);
+}
+
+/* Called by the library at launch if it understands hole chunks. */
+int
+do_internal_set_sparse_transfers (void)
+{
+  sparse_transfers = 1;
+
+  if (verbose)
+    fprintf (stderr, "guestfsd: sparse file transfers enabled\n");
+
+  return 0;
+}
+
+guestfs_int_call_stat_list *
+do_internal_call_stats (void)
+{
+  guestfs_int_call_stat_list *ret;
+  size_t i, n = 0;
+
+  ret = calloc (1, sizeof *ret);
+  if (ret == NULL) {
+    reply_with_perror ("calloc");
+    return NULL;
+  }
+  ret->guestfs_int_call_stat_list_val =
+    calloc (GUESTFS_MAX_PROC_NR+1, sizeof (guestfs_int_call_stat));
+  if (ret->guestfs_int_call_stat_list_val == NULL) {
+    reply_with_perror ("calloc");
+    free (ret);
+    return NULL;
+  }
+
+  pthread_mutex_lock (&stats_lock);
+  for (i = 1; i <= GUESTFS_MAX_PROC_NR; ++i) {
+    const struct call_stats *cs = stats[i];
+    guestfs_int_call_stat *s;
+
+    if (cs == NULL || function_names[i] == NULL)
+      continue;
+
+    s = &ret->guestfs_int_call_stat_list_val[n];
+    s->cs_name = strdup (function_names[i]);
+    if (s->cs_name == NULL) {
+      pthread_mutex_unlock (&stats_lock);
+      reply_with_perror ("strdup");
+      ret->guestfs_int_call_stat_list_len = n;
+      xdr_free ((xdrproc_t) xdr_guestfs_int_call_stat_list, (char *) ret);
+      free (ret);
+      return NULL;
+    }
+    s->cs_calls = cs->calls;
+    s->cs_bytes_sent = cs->bytes_sent;
+    s->cs_bytes_received = cs->bytes_received;
+    s->cs_total_us = cs->total_us;
+    s->cs_p50_us = call_stats_percentile (cs, 50);
+    s->cs_p99_us = call_stats_percentile (cs, 99);
+    n++;
+  }
+  pthread_mutex_unlock (&stats_lock);
+
+  ret->guestfs_int_call_stat_list_len = n;
+  return ret;
+}
+
 static int
 send_chunk (const guestfs_chunk *chunk)
 {
-  char buf[GUESTFS_MAX_CHUNK_SIZE + 48];
-  char lenbuf[4];
+  /* The encoding buffer is kept between calls since it may be large
+   * (up to GUESTFS_MAX_CHUNK_SIZE) after the chunk size has been
+   * negotiated.
+   */
+  static char *buf = NULL;
+  static size_t buf_size = 0;
   XDR xdr;
   uint32_t len;
 
-  xdrmem_create (&xdr, buf, sizeof buf, XDR_ENCODE);
+  if (buf_size < chunk_size + 48) {
+    char *newbuf = realloc (buf, chunk_size + 48);
+    if (newbuf == NULL) {
+      perror ("realloc");
+      exit (EXIT_FAILURE);
+    }
+    buf = newbuf;
+    buf_size = chunk_size + 48;
+  }
+
+  xdrmem_create (&xdr, buf, buf_size, XDR_ENCODE);
   if (!xdr_guestfs_chunk (&xdr, (guestfs_chunk *) chunk)) {
     fprintf (stderr, "guestfsd: send_chunk: failed to encode chunk\n");
     xdr_destroy (&xdr);
@@ -609,18 +1286,30 @@ send_chunk (const guestfs_chunk *chunk)
   len = xdr_getpos (&xdr);
   xdr_destroy (&xdr);
 
-  xdrmem_create (&xdr, lenbuf, 4, XDR_ENCODE);
-  xdr_u_int (&xdr, &len);
-  xdr_destroy (&xdr);
+  write_message (buf, len);
+  return 0;
+}
 
-  int err = (xwrite (sock, lenbuf, 4) == 0
-             && xwrite (sock, buf, len) == 0 ? 0 : -1);
-  if (err) {
-    fprintf (stderr, "guestfsd: send_chunk: write failed\n");
-    exit (EXIT_FAILURE);
+/* Called by the library at launch to agree on a larger chunk size.
+ * Old libraries never call this, so they keep getting chunks of at
+ * most GUESTFS_DEFAULT_CHUNK_SIZE bytes.
+ */
+int
+do_internal_set_chunk_size (int size)
+{
+  if (size < GUESTFS_DEFAULT_CHUNK_SIZE) {
+    reply_with_error ("chunk size %d is smaller than the minimum (%d)",
+                      size, GUESTFS_DEFAULT_CHUNK_SIZE);
+    return -1;
   }
 
-  return err;
+  chunk_size = MIN ((size_t) size, (size_t) GUESTFS_MAX_CHUNK_SIZE);
+
+  if (verbose)
+    fprintf (stderr, "guestfsd: file transfer chunk size set to %zu\n",
+             chunk_size);
+
+  return (int) chunk_size;
 }
 
 /* Initial delay before sending notification messages, and
@@ -671,37 +1360,36 @@ notify_progress_no_ratelimit (uint64_t position, uint64_t total,
   char buf[128];
   uint32_t i;
   size_t len;
+  int r;
   guestfs_progress message;
 
   count_progress++;
   last_progress_t = *now_t;
 
-  /* Send the header word. */
+  /* The header word is followed by the message. */
   i = GUESTFS_PROGRESS_FLAG;
   xdrmem_create (&xdr, buf, 4, XDR_ENCODE);
   xdr_u_int (&xdr, &i);
   xdr_destroy (&xdr);
 
-  if (xwrite (sock, buf, 4) == -1) {
-    fprintf (stderr, "guestfsd: xwrite failed\n");
-    exit (EXIT_FAILURE);
-  }
-
   message.proc = proc_nr;
   message.serial = serial;
   message.position = position;
   message.total = total;
 
-  xdrmem_create (&xdr, buf, sizeof buf, XDR_ENCODE);
+  xdrmem_create (&xdr, buf + 4, sizeof buf - 4, XDR_ENCODE);
   if (!xdr_guestfs_progress (&xdr, &message)) {
     fprintf (stderr, "guestfsd: xdr_guestfs_progress: failed to encode message\n");
     xdr_destroy (&xdr);
     return;
   }
-  len = xdr_getpos (&xdr);
+  len = xdr_getpos (&xdr) + 4;
   xdr_destroy (&xdr);
 
-  if (xwrite (sock, buf, len) == -1) {
+  pthread_mutex_lock (&write_lock);
+  r = xwrite (sock, buf, len);
+  pthread_mutex_unlock (&write_lock);
+  if (r == -1) {
     fprintf (stderr, "guestfsd: xwrite failed\n");
     exit (EXIT_FAILURE);
   }
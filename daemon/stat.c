@@ -30,7 +30,7 @@
 #include "daemon.h"
 #include "actions.h"
 
-static guestfs_int_statns *
+guestfs_int_statns *
 stat_to_statns (guestfs_int_statns *ret, const struct stat *statbuf)
 {
   if (ret == NULL) {
@@ -87,12 +87,14 @@ stat_to_statns (guestfs_int_statns *ret, const struct stat *statbuf)
 guestfs_int_statns *
 do_statns (const char *path)
 {
-  int r;
+  CLEANUP_CLOSE int fd = -1;
+  CLEANUP_FREE char *name = NULL;
+  int r = -1;
   struct stat statbuf;
 
-  CHROOT_IN;
-  r = stat (path, &statbuf);
-  CHROOT_OUT;
+  fd = sysroot_walk (path, 1, &name);
+  if (fd >= 0)
+    r = fstatat (fd, name, &statbuf, AT_SYMLINK_NOFOLLOW);
 
   if (r == -1) {
     reply_with_perror ("%s", path);
@@ -105,12 +107,14 @@ do_statns (const char *path)
 guestfs_int_statns *
 do_lstatns (const char *path)
 {
-  int r;
+  CLEANUP_CLOSE int fd = -1;
+  CLEANUP_FREE char *name = NULL;
+  int r = -1;
   struct stat statbuf;
 
-  CHROOT_IN;
-  r = lstat (path, &statbuf);
-  CHROOT_OUT;
+  fd = sysroot_walk (path, 0, &name);
+  if (fd >= 0)
+    r = fstatat (fd, name, &statbuf, AT_SYMLINK_NOFOLLOW);
 
   if (r == -1) {
     reply_with_perror ("%s", path);
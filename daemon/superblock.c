@@ -0,0 +1,862 @@
+/* libguestfs - the guestfsd daemon
+ * Copyright (C) 2015 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#ifdef HAVE_ENDIAN_H
+#include <endian.h>
+#endif
+
+#ifdef HAVE_SYS_STATVFS_H
+#include <sys/statvfs.h>
+#endif
+
+#include "guestfs_protocol.h"
+#include "daemon.h"
+#include "actions.h"
+
+GUESTFSD_EXT_CMD(str_umount, umount);
+
+/* Implement vfs_statvfs.  For the common filesystems the usage
+ * counts are read straight from the superblock and the allocation
+ * metadata on the device, so nothing has to be mounted and no
+ * journal is replayed.  For anything else the filesystem is mounted
+ * read-only on a private temporary directory (not under the sysroot)
+ * and statvfs(2) is called on it.
+ *
+ * Each *_statvfs function below returns 0 on success, -1 on error
+ * (having called reply_with_*), or -2 if the device does not contain
+ * that type of filesystem or uses features we don't understand, in
+ * which case the caller tries the next method.
+ */
+
+/* Enough to cover the superblocks of all the filesystems below.  The
+ * btrfs superblock is the furthest into the device, at 64K.
+ */
+#define PROBE_SIZE (64 * 1024 + 4096)
+
+static inline uint16_t
+le16 (const uint8_t *p)
+{
+  uint16_t v;
+  memcpy (&v, p, sizeof v);
+  return le16toh (v);
+}
+
+static inline uint32_t
+le32 (const uint8_t *p)
+{
+  uint32_t v;
+  memcpy (&v, p, sizeof v);
+  return le32toh (v);
+}
+
+static inline uint64_t
+le64 (const uint8_t *p)
+{
+  uint64_t v;
+  memcpy (&v, p, sizeof v);
+  return le64toh (v);
+}
+
+static inline uint16_t
+be16 (const uint8_t *p)
+{
+  uint16_t v;
+  memcpy (&v, p, sizeof v);
+  return be16toh (v);
+}
+
+static inline uint32_t
+be32 (const uint8_t *p)
+{
+  uint32_t v;
+  memcpy (&v, p, sizeof v);
+  return be32toh (v);
+}
+
+static inline uint64_t
+be64 (const uint8_t *p)
+{
+  uint64_t v;
+  memcpy (&v, p, sizeof v);
+  return be64toh (v);
+}
+
+static inline int
+is_power_of_2 (uint64_t n)
+{
+  return n > 0 && (n & (n - 1)) == 0;
+}
+
+/* Read up to 'count' bytes at 'offset', stopping early only at the
+ * end of the device.  Returns the number of bytes read, or -1 on
+ * error (after calling reply_with_perror).
+ */
+static ssize_t
+read_device (int fd, const char *device,
+             void *buf, size_t count, uint64_t offset)
+{
+  size_t n = 0;
+  ssize_t r;
+
+  while (n < count) {
+    r = pread (fd, (char *) buf + n, count - n, offset + n);
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      reply_with_perror ("pread: %s", device);
+      return -1;
+    }
+    if (r == 0)
+      break;
+    n += r;
+  }
+
+  return n;
+}
+
+/* As above, but running into the end of the device means the
+ * metadata is not what we expected, so return -2.
+ */
+static int
+read_device_full (int fd, const char *device,
+                  void *buf, size_t count, uint64_t offset)
+{
+  ssize_t r;
+
+  r = read_device (fd, device, buf, count, offset);
+  if (r == -1)
+    return -1;
+  if ((size_t) r < count)
+    return -2;
+  return 0;
+}
+
+/* ext2/3/4.  The free counts are summed from the group descriptors,
+ * which is what the kernel does when it mounts the filesystem, and
+ * the metadata overhead and reserved blocks are subtracted as
+ * ext4_statfs does.
+ */
+#define EXT2_SUPER_MAGIC 0xEF53
+#define EXT2_FEATURE_COMPAT_HAS_JOURNAL 0x0004
+#define EXT4_FEATURE_COMPAT_SPARSE_SUPER2 0x0200
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001
+#define EXT4_FEATURE_RO_COMPAT_BIGALLOC 0x0200
+#define EXT3_FEATURE_INCOMPAT_JOURNAL_DEV 0x0008
+#define EXT2_FEATURE_INCOMPAT_META_BG 0x0010
+#define EXT3_FEATURE_INCOMPAT_EXTENTS 0x0040
+#define EXT4_FEATURE_INCOMPAT_64BIT 0x0080
+#define EXT3_JNL_BACKUP_BLOCKS 1
+
+static int
+ext2_test_root (uint32_t a, uint32_t b)
+{
+  while (a > b && a % b == 0)
+    a /= b;
+  return a == b;
+}
+
+static int
+ext2_group_has_super (const uint8_t *sb, uint32_t group)
+{
+  if (group == 0)
+    return 1;
+  if (le32 (sb + 0x5C) & EXT4_FEATURE_COMPAT_SPARSE_SUPER2)
+    return group == le32 (sb + 0x24C) || group == le32 (sb + 0x250);
+  if (group <= 1 || !(le32 (sb + 0x64) & EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER))
+    return 1;
+  if (!(group & 1))
+    return 0;
+  return ext2_test_root (group, 3) || ext2_test_root (group, 5) ||
+    ext2_test_root (group, 7);
+}
+
+static int
+ext2_statvfs (int fd, const char *device,
+              const uint8_t *probe, size_t probe_len,
+              guestfs_int_statvfs *ret)
+{
+  const uint8_t *sb = probe + 1024;
+  uint32_t compat, ro_compat, incompat;
+  uint32_t log_block_size, block_size;
+  uint32_t blocks_per_group, inodes_per_group, inode_size, desc_size;
+  uint64_t blocks_count, r_blocks_count, first_data_block;
+  uint64_t ngroups, gdt_blocks, itb_per_group, overhead, resv;
+  uint64_t free_blocks = 0, free_inodes = 0;
+  uint32_t g;
+  CLEANUP_FREE uint8_t *gdt = NULL;
+  int r;
+
+  if (probe_len < 2048 || le16 (sb + 0x38) != EXT2_SUPER_MAGIC)
+    return -2;
+
+  compat = le32 (sb + 0x5C);
+  incompat = le32 (sb + 0x60);
+  ro_compat = le32 (sb + 0x64);
+
+  /* Leave the unusual layouts to the kernel. */
+  if ((ro_compat & EXT4_FEATURE_RO_COMPAT_BIGALLOC) ||
+      (incompat & (EXT3_FEATURE_INCOMPAT_JOURNAL_DEV |
+                   EXT2_FEATURE_INCOMPAT_META_BG)))
+    return -2;
+
+  log_block_size = le32 (sb + 0x18);
+  if (log_block_size > 6)
+    return -2;
+  block_size = 1024 << log_block_size;
+
+  blocks_count = le32 (sb + 0x04);
+  r_blocks_count = le32 (sb + 0x08);
+  if (incompat & EXT4_FEATURE_INCOMPAT_64BIT) {
+    blocks_count |= (uint64_t) le32 (sb + 0x150) << 32;
+    r_blocks_count |= (uint64_t) le32 (sb + 0x154) << 32;
+    desc_size = le16 (sb + 0xFE);
+    if (desc_size < 64 || !is_power_of_2 (desc_size) ||
+        desc_size > block_size)
+      return -2;
+  }
+  else
+    desc_size = 32;
+
+  first_data_block = le32 (sb + 0x14);
+  blocks_per_group = le32 (sb + 0x20);
+  inodes_per_group = le32 (sb + 0x28);
+  inode_size = le32 (sb + 0x4C) == 0 ? 128 : le16 (sb + 0x58);
+  if (blocks_per_group == 0 || blocks_per_group > 8 * block_size ||
+      inode_size == 0 || first_data_block >= blocks_count)
+    return -2;
+
+  ngroups =
+    (blocks_count - first_data_block + blocks_per_group - 1) /
+    blocks_per_group;
+  if (ngroups > UINT32_MAX || ngroups * desc_size > 1024 * 1024 * 1024)
+    return -2;
+  gdt_blocks = (ngroups * desc_size + block_size - 1) / block_size;
+
+  gdt = malloc (ngroups * desc_size);
+  if (gdt == NULL) {
+    reply_with_perror ("malloc");
+    return -1;
+  }
+  r = read_device_full (fd, device, gdt, ngroups * desc_size,
+                        (first_data_block + 1) * block_size);
+  if (r != 0)
+    return r;
+
+  itb_per_group =
+    ((uint64_t) inodes_per_group * inode_size + block_size - 1) / block_size;
+
+  overhead = le32 (sb + 0x248);       /* s_overhead_clusters */
+  if (overhead == 0) {
+    overhead = first_data_block;
+    for (g = 0; g < ngroups; ++g) {
+      if (ext2_group_has_super (sb, g))
+        overhead += 1 + gdt_blocks + le16 (sb + 0xCE);
+      overhead += 2 + itb_per_group; /* bitmaps and inode table */
+    }
+
+    if ((compat & EXT2_FEATURE_COMPAT_HAS_JOURNAL) &&
+        le32 (sb + 0xE0) != 0) {
+      /* The size of the journal inode is kept in s_jnl_blocks. */
+      if (sb[0xFD] != EXT3_JNL_BACKUP_BLOCKS)
+        return -2;
+      overhead +=
+        (((uint64_t) le32 (sb + 0x10C + 15*4) << 32) |
+         le32 (sb + 0x10C + 16*4)) / block_size;
+    }
+  }
+  if (overhead > blocks_count)
+    return -2;
+
+  for (g = 0; g < ngroups; ++g) {
+    const uint8_t *desc = gdt + (uint64_t) g * desc_size;
+
+    free_blocks += le16 (desc + 0x0C);
+    free_inodes += le16 (desc + 0x0E);
+    if (desc_size >= 64) {
+      free_blocks += (uint64_t) le16 (desc + 0x2C) << 16;
+      free_inodes += (uint64_t) le16 (desc + 0x2E) << 16;
+    }
+  }
+
+  /* ext4_calculate_resv_clusters */
+  resv = 0;
+  if (incompat & EXT3_FEATURE_INCOMPAT_EXTENTS) {
+    resv = blocks_count / 50;
+    if (resv > 4096)
+      resv = 4096;
+  }
+  resv += r_blocks_count;
+
+  ret->bsize = block_size;
+  ret->frsize = block_size;
+  ret->blocks = blocks_count - overhead;
+  ret->bfree = free_blocks;
+  ret->bavail = free_blocks > resv ? free_blocks - resv : 0;
+  ret->files = le32 (sb + 0x00);
+  ret->ffree = free_inodes;
+  ret->favail = free_inodes;
+  ret->namemax = 255;
+  return 0;
+}
+
+/* XFS.  With lazy superblock counters the free counts in the
+ * superblock are only written at unmount, so they are summed from
+ * the AGF and AGI headers of every allocation group, which is what
+ * the kernel does after log recovery.
+ */
+#define XFS_ALLOC_SET_ASIDE_PER_AG 8
+
+static int
+xfs_statvfs (int fd, const char *device,
+             const uint8_t *probe, size_t probe_len,
+             guestfs_int_statvfs *ret)
+{
+  const uint8_t *sb = probe;
+  uint32_t block_size, ag_blocks, ag_count, log_blocks, sect_size;
+  uint64_t dblocks, log_start, unavail, fakeinos, maxicount;
+  uint64_t fdblocks = 0, icount = 0, ifree = 0, bfree, files;
+  uint8_t inopblog, imax_pct;
+  uint32_t ag;
+  CLEANUP_FREE uint8_t *buf = NULL;
+  int r;
+
+  if (probe_len < 512 || memcmp (sb, "XFSB", 4) != 0)
+    return -2;
+
+  block_size = be32 (sb + 4);
+  dblocks = be64 (sb + 8);
+  log_start = be64 (sb + 48);
+  ag_blocks = be32 (sb + 84);
+  ag_count = be32 (sb + 88);
+  log_blocks = be32 (sb + 96);
+  sect_size = be16 (sb + 102);
+  inopblog = sb[123];
+  imax_pct = sb[127];
+
+  if (!is_power_of_2 (block_size) || block_size < 512 ||
+      block_size > 65536 ||
+      !is_power_of_2 (sect_size) || sect_size < 512 ||
+      ag_blocks == 0 || ag_count == 0 || inopblog > 16)
+    return -2;
+
+  buf = malloc (2 * sect_size);
+  if (buf == NULL) {
+    reply_with_perror ("malloc");
+    return -1;
+  }
+
+  for (ag = 0; ag < ag_count; ++ag) {
+    const uint8_t *agf = buf, *agi = buf + sect_size;
+    uint64_t offset = (uint64_t) ag * ag_blocks * block_size;
+
+    /* The AGF and AGI are the second and third sectors of the AG. */
+    r = read_device_full (fd, device, buf, 2 * sect_size,
+                          offset + sect_size);
+    if (r != 0)
+      return r;
+    if (memcmp (agf, "XAGF", 4) != 0 || memcmp (agi, "XAGI", 4) != 0)
+      return -2;
+
+    fdblocks += be32 (agf + 52);       /* agf_freeblks */
+    fdblocks += be32 (agf + 48);       /* agf_flcount */
+    fdblocks += be32 (agf + 60);       /* agf_btreeblks */
+    icount += be32 (agi + 16);         /* agi_count */
+    ifree += be32 (agi + 28);          /* agi_freecount */
+  }
+
+  /* The blocks the kernel keeps back when mounting: the reserve pool
+   * (xfs_default_resblks) and the per-AG set aside for the free
+   * space btrees.  Filesystems with the rmap or reflink btrees also
+   * have per-AG metadata reservations which depend on the kernel
+   * version and are not subtracted, so the result is approximate.
+   */
+  unavail = dblocks / 20;
+  if (unavail > 8192)
+    unavail = 8192;
+  unavail += (uint64_t) ag_count * XFS_ALLOC_SET_ASIDE_PER_AG;
+  bfree = fdblocks > unavail ? fdblocks - unavail : 0;
+
+  /* As in xfs_fs_statfs, count the inodes that could be allocated in
+   * the free space, up to the imaxpct limit.
+   */
+  fakeinos = bfree << inopblog;
+  files = icount + fakeinos;
+  if (imax_pct) {
+    maxicount = (dblocks * imax_pct / 100) << inopblog;
+    if (files > maxicount)
+      files = maxicount;
+  }
+  if (files < icount)
+    files = icount;
+
+  ret->bsize = block_size;
+  ret->frsize = block_size;
+  ret->blocks = dblocks - (log_start ? log_blocks : 0);
+  ret->bfree = bfree;
+  ret->bavail = bfree;
+  ret->files = files;
+  ret->ffree = files - (icount - ifree);
+  ret->favail = ret->ffree;
+  ret->namemax = 255;
+  return 0;
+}
+
+/* btrfs.  The superblock records the total size and the bytes used by
+ * data and metadata, which are updated on every transaction commit.
+ * This does not take the RAID profiles into account, so for
+ * multi-device filesystems it is an approximation.  btrfs has no
+ * fixed number of inodes, and the kernel reports them as 0.
+ */
+static int
+btrfs_statvfs (int fd, const char *device,
+               const uint8_t *probe, size_t probe_len,
+               guestfs_int_statvfs *ret)
+{
+  const uint8_t *sb = probe + 0x10000;
+  uint64_t total_bytes, bytes_used;
+  uint32_t sector_size;
+
+  if (probe_len < 0x10000 + 4096 || memcmp (sb + 0x40, "_BHRfS_M", 8) != 0)
+    return -2;
+
+  total_bytes = le64 (sb + 0x70);
+  bytes_used = le64 (sb + 0x78);
+  sector_size = le32 (sb + 0x90);
+  if (!is_power_of_2 (sector_size) || sector_size < 4096 ||
+      sector_size > 65536)
+    return -2;
+
+  ret->bsize = sector_size;
+  ret->frsize = sector_size;
+  ret->blocks = total_bytes / sector_size;
+  ret->bfree =
+    total_bytes > bytes_used ? (total_bytes - bytes_used) / sector_size : 0;
+  ret->bavail = ret->bfree;
+  ret->files = 0;
+  ret->ffree = 0;
+  ret->favail = 0;
+  ret->namemax = 255;
+  return 0;
+}
+
+/* NTFS.  The free clusters are counted in the $Bitmap file and the
+ * free MFT records in the $BITMAP attribute of $MFT, as ntfs-3g does
+ * when it mounts the filesystem.
+ */
+#define NTFS_BLOCK_SIZE 512
+#define NTFS_AT_DATA 0x80
+#define NTFS_AT_BITMAP 0xB0
+#define NTFS_AT_END 0xFFFFFFFF
+#define NTFS_FILE_MFT 0
+#define NTFS_FILE_BITMAP 6
+
+struct ntfs_volume {
+  int fd;
+  const char *device;
+  uint32_t cluster_size;
+  uint32_t record_size;
+  uint64_t mft_offset;
+};
+
+/* Read MFT record 'n' into 'rec' and apply the update sequence. */
+static int
+ntfs_read_record (const struct ntfs_volume *vol, uint64_t n, uint8_t *rec)
+{
+  uint16_t usa_ofs, usa_count, i;
+  int r;
+
+  r = read_device_full (vol->fd, vol->device, rec, vol->record_size,
+                        vol->mft_offset + n * vol->record_size);
+  if (r != 0)
+    return r;
+
+  if (memcmp (rec, "FILE", 4) != 0 || !(le16 (rec + 0x16) & 1))
+    return -2;
+
+  usa_ofs = le16 (rec + 4);
+  usa_count = le16 (rec + 6);
+  if (usa_count != vol->record_size / NTFS_BLOCK_SIZE + 1 ||
+      (uint32_t) usa_ofs + usa_count * 2 > vol->record_size)
+    return -2;
+
+  for (i = 1; i < usa_count; ++i) {
+    uint8_t *p = rec + i * NTFS_BLOCK_SIZE - 2;
+
+    if (memcmp (p, rec + usa_ofs, 2) != 0)
+      return -2;
+    memcpy (p, rec + usa_ofs + i * 2, 2);
+  }
+
+  return 0;
+}
+
+/* Find the unnamed attribute of 'type' in an MFT record.  Attributes
+ * which have been moved to other records through an $ATTRIBUTE_LIST
+ * are not found.
+ */
+static const uint8_t *
+ntfs_find_attribute (const struct ntfs_volume *vol, const uint8_t *rec,
+                     uint32_t type, uint32_t *len_r)
+{
+  uint32_t offset = le16 (rec + 0x14);
+
+  while (offset + 16 <= vol->record_size) {
+    const uint8_t *attr = rec + offset;
+    uint32_t attr_type = le32 (attr);
+    uint32_t len = le32 (attr + 4);
+
+    if (attr_type == NTFS_AT_END || len < 16 || len % 8 != 0 ||
+        offset + len > vol->record_size)
+      break;
+    if (attr_type == type && attr[9] == 0) {
+      *len_r = len;
+      return attr;
+    }
+    offset += len;
+  }
+
+  return NULL;
+}
+
+static uint64_t
+count_bits (const uint8_t *buf, uint64_t nbits)
+{
+  uint64_t i, n = 0;
+
+  for (i = 0; i < nbits / 8; ++i)
+    n += __builtin_popcount (buf[i]);
+  if (nbits % 8)
+    n += __builtin_popcount (buf[i] & ((1 << (nbits % 8)) - 1));
+  return n;
+}
+
+/* Count the bits set in the first 'nbits' bits of the value of an
+ * attribute, reading it from the device if it is non-resident.
+ */
+static int
+ntfs_count_bits (const struct ntfs_volume *vol,
+                 const uint8_t *attr, uint32_t attr_len,
+                 uint64_t nbits, uint64_t *count_r)
+{
+  const uint8_t *p, *end;
+  uint64_t done = 0;            /* bits */
+  int64_t lcn = 0;
+  CLEANUP_FREE uint8_t *buf = NULL;
+  const size_t buf_size = 64 * 1024;
+
+  *count_r = 0;
+
+  if (attr[8] == 0) {           /* resident */
+    uint32_t value_len;
+    uint16_t value_offset;
+
+    if (attr_len < 0x18)
+      return -2;
+    value_len = le32 (attr + 0x10);
+    value_offset = le16 (attr + 0x14);
+
+    /* Compute this in 64 bits so a huge value_len cannot wrap. */
+    if ((uint64_t) value_offset + value_len > attr_len ||
+        (uint64_t) value_len * 8 < nbits)
+      return -2;
+    *count_r = count_bits (attr + value_offset, nbits);
+    return 0;
+  }
+
+  /* Non-resident.  Only the first extent is in the base record. */
+  if (attr_len < 0x40 || le64 (attr + 0x10) != 0)
+    return -2;
+
+  buf = malloc (buf_size);
+  if (buf == NULL) {
+    reply_with_perror ("malloc");
+    return -1;
+  }
+
+  p = attr + le16 (attr + 0x20);
+  end = attr + attr_len;
+  while (done < nbits) {
+    unsigned len_bytes, offset_bytes, i;
+    uint64_t run_len = 0, run_bits;
+
+    if (p >= end || *p == 0)
+      return -2;
+    len_bytes = *p & 0xf;
+    offset_bytes = *p >> 4;
+    p++;
+    if (len_bytes == 0 || len_bytes > 8 || offset_bytes > 8 ||
+        p + len_bytes + offset_bytes > end)
+      return -2;
+
+    for (i = 0; i < len_bytes; ++i)
+      run_len |= (uint64_t) p[i] << (i * 8);
+    p += len_bytes;
+
+    run_bits = run_len * vol->cluster_size * 8;
+    if (run_bits > nbits - done)
+      run_bits = nbits - done;
+
+    if (offset_bytes > 0) {
+      uint64_t delta = 0, pos, bits;
+
+      for (i = 0; i < offset_bytes; ++i)
+        delta |= (uint64_t) p[i] << (i * 8);
+      if (offset_bytes < 8 && (p[offset_bytes-1] & 0x80))
+        delta |= ~UINT64_C(0) << (offset_bytes * 8);
+      p += offset_bytes;
+      lcn += (int64_t) delta;
+      if (lcn < 0)
+        return -2;
+
+      for (pos = 0; pos < run_bits; pos += bits) {
+        size_t n;
+        int r;
+
+        bits = run_bits - pos;
+        if (bits > buf_size * 8)
+          bits = buf_size * 8;
+        n = (bits + 7) / 8;
+        r = read_device_full (vol->fd, vol->device, buf, n,
+                              (uint64_t) lcn * vol->cluster_size + pos / 8);
+        if (r != 0)
+          return r;
+        *count_r += count_bits (buf, bits);
+      }
+    }
+    /* else a sparse run, which reads as zeroes */
+
+    done += run_bits;
+  }
+
+  return 0;
+}
+
+static int
+ntfs_statvfs (int fd, const char *device,
+              const uint8_t *probe, size_t probe_len,
+              guestfs_int_statvfs *ret)
+{
+  const uint8_t *boot = probe;
+  struct ntfs_volume vol = { .fd = fd, .device = device };
+  uint32_t bytes_per_sector, sectors_per_cluster, len;
+  int8_t clusters_per_record;
+  uint64_t nr_clusters, used_clusters, free_clusters;
+  uint64_t mft_records, used_records, extra_records;
+  const uint8_t *attr;
+  CLEANUP_FREE uint8_t *rec = NULL;
+  int r;
+
+  if (probe_len < 512 || memcmp (boot + 3, "NTFS    ", 8) != 0)
+    return -2;
+
+  bytes_per_sector = le16 (boot + 0x0B);
+  sectors_per_cluster = boot[0x0D];
+  /* Clusters larger than 64K are stored as a negative shift. */
+  if (sectors_per_cluster > 0x80)
+    sectors_per_cluster = 1 << (256 - sectors_per_cluster);
+  if (!is_power_of_2 (bytes_per_sector) || bytes_per_sector < 256 ||
+      bytes_per_sector > 4096 || !is_power_of_2 (sectors_per_cluster))
+    return -2;
+  vol.cluster_size = bytes_per_sector * sectors_per_cluster;
+  if (vol.cluster_size > 2 * 1024 * 1024)
+    return -2;
+
+  clusters_per_record = (int8_t) boot[0x40];
+  if (clusters_per_record > 0)
+    vol.record_size = clusters_per_record * vol.cluster_size;
+  else if (clusters_per_record > -31)
+    vol.record_size = UINT32_C(1) << -clusters_per_record;
+  else
+    return -2;
+  if (vol.record_size < NTFS_BLOCK_SIZE || vol.record_size > 65536 ||
+      !is_power_of_2 (vol.record_size))
+    return -2;
+
+  nr_clusters = le64 (boot + 0x28) / sectors_per_cluster;
+  vol.mft_offset = le64 (boot + 0x30) * vol.cluster_size;
+
+  rec = malloc (vol.record_size);
+  if (rec == NULL) {
+    reply_with_perror ("malloc");
+    return -1;
+  }
+
+  /* Free clusters. */
+  r = ntfs_read_record (&vol, NTFS_FILE_BITMAP, rec);
+  if (r != 0)
+    return r;
+  attr = ntfs_find_attribute (&vol, rec, NTFS_AT_DATA, &len);
+  if (attr == NULL)
+    return -2;
+  r = ntfs_count_bits (&vol, attr, len, nr_clusters, &used_clusters);
+  if (r != 0)
+    return r;
+  free_clusters = nr_clusters - used_clusters;
+
+  /* Free MFT records. */
+  r = ntfs_read_record (&vol, NTFS_FILE_MFT, rec);
+  if (r != 0)
+    return r;
+  attr = ntfs_find_attribute (&vol, rec, NTFS_AT_DATA, &len);
+  if (attr == NULL || attr[8] == 0 || len < 0x40)
+    return -2;
+  mft_records = le64 (attr + 0x30) / vol.record_size;
+  attr = ntfs_find_attribute (&vol, rec, NTFS_AT_BITMAP, &len);
+  if (attr == NULL)
+    return -2;
+  r = ntfs_count_bits (&vol, attr, len, mft_records, &used_records);
+  if (r != 0)
+    return r;
+
+  /* The MFT can grow into the free space. */
+  extra_records = free_clusters * vol.cluster_size / vol.record_size;
+
+  ret->bsize = vol.cluster_size;
+  ret->frsize = vol.cluster_size;
+  ret->blocks = nr_clusters;
+  ret->bfree = free_clusters;
+  ret->bavail = free_clusters;
+  ret->files = mft_records + extra_records;
+  ret->ffree = mft_records - used_records + extra_records;
+  ret->favail = ret->ffree;
+  ret->namemax = 255;
+  return 0;
+}
+
+static int
+statvfs_by_mounting (const mountable_t *mountable, guestfs_int_statvfs *ret)
+{
+#ifdef HAVE_STATVFS
+  char mp[] = "/tmp/statvfsXXXXXX";
+  struct statvfs statbuf;
+  CLEANUP_FREE char *err = NULL;
+  int r;
+
+  if (mkdtemp (mp) == NULL) {
+    reply_with_perror ("mkdtemp");
+    return -1;
+  }
+
+  if (mount_vfs_nochroot ("ro", NULL, mountable, mp, "<internal>") == -1) {
+    rmdir (mp);
+    return -1;
+  }
+
+  r = statvfs (mp, &statbuf);
+  if (r == -1)
+    reply_with_perror ("statvfs");
+
+  if (command (NULL, &err, str_umount, mp, NULL) == -1) {
+    /* Leave the directory behind. */
+    if (r == 0)
+      reply_with_error ("umount: %s", err);
+    return -1;
+  }
+  rmdir (mp);
+
+  if (r == -1)
+    return -1;
+
+  ret->bsize = statbuf.f_bsize;
+  ret->frsize = statbuf.f_frsize;
+  ret->blocks = statbuf.f_blocks;
+  ret->bfree = statbuf.f_bfree;
+  ret->bavail = statbuf.f_bavail;
+  ret->files = statbuf.f_files;
+  ret->ffree = statbuf.f_ffree;
+  ret->favail = statbuf.f_favail;
+  ret->fsid = statbuf.f_fsid;
+  ret->flag = statbuf.f_flag;
+  ret->namemax = statbuf.f_namemax;
+  return 0;
+
+#else /* !HAVE_STATVFS */
+  NOT_SUPPORTED (-1, "statvfs is not available");
+#endif
+}
+
+guestfs_int_statvfs *
+do_vfs_statvfs (const mountable_t *mountable)
+{
+  static int (*const readers[]) (int, const char *, const uint8_t *, size_t,
+                                 guestfs_int_statvfs *) = {
+    ext2_statvfs, xfs_statvfs, btrfs_statvfs, ntfs_statvfs,
+  };
+  guestfs_int_statvfs *ret;
+  CLEANUP_FREE uint8_t *probe = NULL;
+  ssize_t probe_len;
+  size_t i;
+  int fd, r = -2;
+
+  ret = calloc (1, sizeof *ret);
+  probe = malloc (PROBE_SIZE);
+  if (ret == NULL || probe == NULL) {
+    reply_with_perror ("malloc");
+    free (ret);
+    return NULL;
+  }
+
+  fd = open (mountable->device, O_RDONLY|O_CLOEXEC);
+  if (fd == -1) {
+    reply_with_perror ("open: %s", mountable->device);
+    free (ret);
+    return NULL;
+  }
+
+  probe_len = read_device (fd, mountable->device, probe, PROBE_SIZE, 0);
+  if (probe_len == -1)
+    r = -1;
+
+  for (i = 0; r == -2 && i < sizeof readers / sizeof readers[0]; ++i)
+    r = readers[i] (fd, mountable->device, probe, probe_len, ret);
+
+  if (close (fd) == -1 && r == 0) {
+    reply_with_perror ("close: %s", mountable->device);
+    r = -1;
+  }
+
+  if (r == -2) {
+    if (verbose)
+      fprintf (stderr, "vfs_statvfs: %s: mounting to get statistics\n",
+               mountable->device);
+    r = statvfs_by_mounting (mountable, ret);
+  }
+  else if (r == 0) {
+    /* As with stat, -1 indicates a field is not known. */
+    ret->fsid = -1;
+    ret->flag = -1;
+  }
+
+  if (r == -1) {
+    free (ret);
+    return NULL;
+  }
+
+  return ret;
+}
@@ -24,6 +24,7 @@
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/param.h>		/* defines MIN */
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -34,6 +35,7 @@
 struct write_cb_data {
   int fd;                       /* file descriptor */
   uint64_t written;             /* bytes written so far */
+  int is_reg;                   /* fd is a regular file */
 };
 
 static int
@@ -54,11 +56,53 @@ write_cb (void *data_vp, const void *buf, size_t len)
   return 0;
 }
 
+/* Called for holes sent by the library.  In regular files we punch
+ * a hole (in case there was old data there) and seek over it.
+ * Anything else gets zeroes written.
+ */
+static int
+hole_cb (void *data_vp, uint64_t len)
+{
+  struct write_cb_data *data = data_vp;
+  static const char zeroes[GUESTFS_DEFAULT_CHUNK_SIZE];
+  struct stat statbuf;
+  off_t pos;
+  size_t n;
+
+  if (data->is_reg) {
+    pos = lseek (data->fd, 0, SEEK_CUR);
+    if (pos == -1 || fstat (data->fd, &statbuf) == -1)
+      return -1;
+
+    if (pos >= statbuf.st_size ||
+        fallocate (data->fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+                   pos, len) == 0) {
+      if (lseek (data->fd, len, SEEK_CUR) == -1)
+        return -1;
+      data->written += len;
+      if (progress_hint > 0)
+        notify_progress (data->written, progress_hint);
+      return 0;
+    }
+    /* else the filesystem can't punch holes, so write zeroes */
+  }
+
+  while (len > 0) {
+    n = MIN (len, sizeof zeroes);
+    if (write_cb (data, zeroes, n) == -1)
+      return -1;
+    len -= n;
+  }
+
+  return 0;
+}
+
 /* Has one FileIn parameter. */
 static int
 upload (const char *filename, int flags, int64_t offset)
 {
   struct write_cb_data data = { .written = 0 };
+  struct stat statbuf;
   int err, r, is_dev;
 
   is_dev = STRPREFIX (filename, "/dev/");
@@ -84,7 +128,17 @@ upload (const char *filename, int flags, int64_t offset)
     }
   }
 
-  r = receive_file (write_cb, &data.fd);
+  if (fstat (data.fd, &statbuf) == -1) {
+    err = errno;
+    r = cancel_receive ();
+    errno = err;
+    reply_with_perror ("fstat: %s", filename);
+    close (data.fd);
+    return -1;
+  }
+  data.is_reg = S_ISREG (statbuf.st_mode);
+
+  r = receive_file_with_holes (write_cb, hole_cb, &data);
   if (r == -1) {		/* write error */
     err = errno;
     r = cancel_receive ();
@@ -102,6 +156,18 @@ upload (const char *filename, int flags, int64_t offset)
     return -1;
   }
 
+  /* If the file ended with a hole, extend it to the right size. */
+  if (data.is_reg) {
+    off_t pos = lseek (data.fd, 0, SEEK_CUR);
+
+    if (pos == -1 || fstat (data.fd, &statbuf) == -1 ||
+        (pos > statbuf.st_size && ftruncate (data.fd, pos) == -1)) {
+      reply_with_perror ("%s", filename);
+      close (data.fd);
+      return -1;
+    }
+  }
+
   if (close (data.fd) == -1) {
     reply_with_perror ("close: %s", filename);
     return -1;
@@ -147,12 +213,160 @@ check_not_directory (const char *filename, int fd)
   return 0;
 }
 
+/* When sending devices to a library which understands holes, each
+ * chunk is checked for runs of blocks of this size which are all
+ * zeroes.
+ */
+#define ZERO_BLOCK_SIZE (64 * 1024)
+
+/* Send 'buf', sending runs of zero blocks as holes. */
+static int
+send_buffer_sparse (const char *buf, size_t len)
+{
+  size_t i, j, blk;
+  int zero, r;
+
+  for (i = 0; i < len; i = j) {
+    blk = MIN (ZERO_BLOCK_SIZE, len - i);
+    zero = is_zero (&buf[i], blk);
+    for (j = i + blk; j < len; j += blk) {
+      blk = MIN (ZERO_BLOCK_SIZE, len - j);
+      if (is_zero (&buf[j], blk) != zero)
+        break;
+    }
+
+    if (zero)
+      r = send_file_hole (j - i);
+    else
+      r = send_file_write (&buf[i], j - i);
+    if (r < 0)
+      return r;
+  }
+
+  return 0;
+}
+
+/* Send up to 'size' bytes of 'fd' starting at offset 'pos', stopping
+ * early at the end of the file.  'total' is used for progress
+ * messages.
+ *
+ * If the library understands holes, then holes in files (found
+ * using SEEK_DATA and SEEK_HOLE) and blocks of zeroes in devices are
+ * sent as holes instead of data.  Device chunks are only read and
+ * scanned for zeroes if they start with a zero block, so that runs
+ * of data can still be spliced.  Everything else is sent using
+ * send_file_from_fd.
+ *
+ * Returns 0 if OK, -1 if reading the file or sending a chunk failed
+ * (the caller must cancel the transfer), or -2 if the transfer was
+ * cancelled.
+ */
+static int
+send_range (int fd, int is_dev, uint64_t pos, uint64_t size, uint64_t total)
+{
+  CLEANUP_FREE char *buf = NULL;
+  int seek_holes = sparse_transfers && !is_dev;
+  int scan_zeroes = sparse_transfers && is_dev;
+  uint64_t sent = 0, n;
+  struct stat statbuf;
+  off_t data, hole;
+  ssize_t r;
+  int err, zero;
+
+  if (scan_zeroes) {
+    buf = malloc (chunk_size);
+    if (buf == NULL)
+      return -1;
+  }
+
+  while (sent < size) {
+    n = MIN (size - sent, chunk_size);
+
+    if (seek_holes) {
+      data = lseek (fd, pos, SEEK_DATA);
+      if (data == -1 && errno == ENXIO) {
+        /* There is no more data, but there may be a hole up to the
+         * end of the file.
+         */
+        if (fstat (fd, &statbuf) == -1)
+          return -1;
+        if ((uint64_t) statbuf.st_size <= pos)
+          break;
+        data = statbuf.st_size;
+      }
+      else if (data == -1) {
+        /* SEEK_DATA is not supported, so just send the data. */
+        seek_holes = 0;
+        if (lseek (fd, pos, SEEK_SET) == -1)
+          return -1;
+        continue;
+      }
+
+      if ((uint64_t) data > pos) {
+        n = MIN ((uint64_t) data - pos, size - sent);
+        err = send_file_hole (n);
+        if (err < 0)
+          return err;
+        pos += n;
+        sent += n;
+        notify_progress (sent, total);
+        continue;
+      }
+
+      /* Send data up to the next hole. */
+      hole = lseek (fd, pos, SEEK_HOLE);
+      if (hole > (off_t) pos)
+        n = MIN (n, (uint64_t) hole - pos);
+      if (lseek (fd, pos, SEEK_SET) == -1)
+        return -1;
+    }
+
+    zero = 0;
+    if (scan_zeroes) {
+      /* Peek at the first block without moving the file offset. */
+      do {
+        r = pread (fd, buf, MIN (n, ZERO_BLOCK_SIZE), pos);
+      } while (r == -1 && errno == EINTR);
+      if (r == -1)
+        return -1;
+      if (r == 0)
+        break;
+      zero = is_zero (buf, r);
+    }
+
+    if (zero) {
+      do {
+        r = read (fd, buf, n);
+      } while (r == -1 && errno == EINTR);
+      if (r == -1)
+        return -1;
+      if (r == 0)
+        break;
+      err = send_buffer_sparse (buf, r);
+      if (err < 0)
+        return err;
+    }
+    else {
+      r = send_file_from_fd (fd, n);
+      if (r < 0)
+        return r;
+      if (r == 0)
+        break;
+    }
+
+    pos += r;
+    sent += r;
+    notify_progress (sent, total);
+  }
+
+  return 0;
+}
+
 /* Has one FileOut parameter. */
 int
 do_download (const char *filename)
 {
   int fd, r, is_dev;
-  char buf[GUESTFS_MAX_CHUNK_SIZE];
 
   is_dev = STRPREFIX (filename, "/dev/");
 
@@ -170,7 +384,7 @@ do_download (const char *filename)
   }
 
   /* Calculate the size of the file or device for notification messages. */
-  uint64_t total, sent = 0;
+  uint64_t total;
   if (!is_dev) {
     struct stat statbuf;
     if (fstat (fd, &statbuf) == -1) {
@@ -195,14 +409,14 @@ do_download (const char *filename)
    */
   reply (NULL, NULL);
 
-  while ((r = read (fd, buf, sizeof buf)) > 0) {
-    if (send_file_write (buf, r) < 0) {
-      close (fd);
-      return -1;
-    }
+  posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 
-    sent += r;
-    notify_progress (sent, total);
+  /* Send the largest chunks that the library has agreed to accept. */
+  r = send_range (fd, is_dev, 0, UINT64_MAX, total);
+
+  if (r == -2) {                /* Cancelled. */
+    close (fd);
+    return -1;
   }
 
   if (r == -1) {
@@ -229,7 +443,6 @@ int
 do_download_offset (const char *filename, int64_t offset, int64_t size)
 {
   int fd, r, is_dev;
-  char buf[GUESTFS_MAX_CHUNK_SIZE];
 
   if (offset < 0) {
     reply_with_perror ("%s: offset in file is negative", filename);
@@ -265,37 +478,27 @@ do_download_offset (const char *filename, int64_t offset, int64_t size)
     }
   }
 
-  uint64_t total = usize, sent = 0;
-
   /* Now we must send the reply message, before the file contents.  After
    * this there is no opportunity in the protocol to send any error
    * message back.  Instead we can only cancel the transfer.
    */
   reply (NULL, NULL);
 
-  while (usize > 0) {
-    r = read (fd, buf, usize > sizeof buf ? sizeof buf : usize);
-    if (r == -1) {
-      fprintf (stderr, "read: %s: %m\n", filename);
-      send_file_end (1);        /* Cancel. */
-      close (fd);
-      return -1;
-    }
-
-    if (r == 0)
-      /* The documentation leaves this case undefined.  Currently we
-       * just read fewer bytes than requested.
-       */
-      break;
-
-    if (send_file_write (buf, r) < 0) {
-      close (fd);
-      return -1;
-    }
+  /* If the file is shorter than offset + size, the documentation
+   * leaves this case undefined.  Currently we just send fewer bytes
+   * than requested.
+   */
+  r = send_range (fd, is_dev, (uint64_t) offset, usize, usize);
+  if (r == -1) {
+    fprintf (stderr, "read: %s: %m\n", filename);
+    send_file_end (1);          /* Cancel. */
+    close (fd);
+    return -1;
+  }
 
-    sent += r;
-    usize -= r;
-    notify_progress (sent, total);
+  if (r == -2) {                /* Cancelled. */
+    close (fd);
+    return -1;
   }
 
   if (close (fd) == -1) {
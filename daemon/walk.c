@@ -0,0 +1,335 @@
+/* libguestfs - the guestfsd daemon
+ * Copyright (C) 2015 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "areadlink.h"
+
+#include "guestfs_protocol.h"
+#include "daemon.h"
+#include "actions.h"
+
+/* Implement guestfs_walk_out.  The format of the output is described
+ * in the documentation of that call in generator/actions.ml.  Records
+ * are packed into a buffer which is sent to the library whenever it
+ * holds a full chunk, so a single record may be split across chunks.
+ */
+
+struct walk {
+  char *buf;                    /* Output buffer, 'chunk_size' bytes. */
+  size_t len;                   /* Bytes used in buf. */
+  int csumtype;                 /* Checksum type, or -1 for none. */
+  char *csumbuf;                /* Buffer for checksum_fd. */
+  int send_failed;              /* send_file_write failed or cancelled. */
+};
+
+static int walk_dir (struct walk *w, int dfd, const char *dir, const char *rel);
+
+static int
+walk_write (struct walk *w, const void *data, size_t n)
+{
+  const char *p = data;
+  size_t m;
+
+  while (n > 0) {
+    if (w->len == chunk_size) {
+      if (send_file_write (w->buf, w->len) < 0) {
+        w->send_failed = 1;
+        return -1;
+      }
+      w->len = 0;
+    }
+    m = chunk_size - w->len;
+    if (m > n)
+      m = n;
+    memcpy (&w->buf[w->len], p, m);
+    w->len += m;
+    p += m;
+    n -= m;
+  }
+
+  return 0;
+}
+
+static int
+walk_write_string (struct walk *w, const char *str)
+{
+  return walk_write (w, str, strlen (str) + 1);
+}
+
+static int
+walk_write_uint32 (struct walk *w, uint32_t v)
+{
+  unsigned char b[4];
+
+  b[0] = v >> 24;
+  b[1] = v >> 16;
+  b[2] = v >> 8;
+  b[3] = v;
+  return walk_write (w, b, sizeof b);
+}
+
+static int
+walk_write_int64 (struct walk *w, int64_t v)
+{
+  if (walk_write_uint32 (w, (uint64_t) v >> 32) == -1)
+    return -1;
+  return walk_write_uint32 (w, (uint64_t) v & 0xffffffff);
+}
+
+/* Write the record for one entry.  'dfd' and 'name' locate the entry
+ * on the appliance side.  'path' is the full guest path (used in
+ * error messages) and 'rel' is the path which is written into the
+ * record.
+ */
+static int
+walk_entry (struct walk *w, int dfd, const char *name,
+            const char *path, const char *rel, const struct stat *statbuf)
+{
+  guestfs_int_statns st;
+  guestfs_int_xattr_list *xattrs;
+  CLEANUP_FREE char *link = NULL;
+  CLEANUP_FREE char *csum = NULL;
+  size_t i;
+  int r;
+
+  stat_to_statns (&st, statbuf);
+
+  if (walk_write_string (w, rel) == -1 ||
+      walk_write_int64 (w, st.st_dev) == -1 ||
+      walk_write_int64 (w, st.st_ino) == -1 ||
+      walk_write_int64 (w, st.st_mode) == -1 ||
+      walk_write_int64 (w, st.st_nlink) == -1 ||
+      walk_write_int64 (w, st.st_uid) == -1 ||
+      walk_write_int64 (w, st.st_gid) == -1 ||
+      walk_write_int64 (w, st.st_rdev) == -1 ||
+      walk_write_int64 (w, st.st_size) == -1 ||
+      walk_write_int64 (w, st.st_blksize) == -1 ||
+      walk_write_int64 (w, st.st_blocks) == -1 ||
+      walk_write_int64 (w, st.st_atime_sec) == -1 ||
+      walk_write_int64 (w, st.st_atime_nsec) == -1 ||
+      walk_write_int64 (w, st.st_mtime_sec) == -1 ||
+      walk_write_int64 (w, st.st_mtime_nsec) == -1 ||
+      walk_write_int64 (w, st.st_ctime_sec) == -1 ||
+      walk_write_int64 (w, st.st_ctime_nsec) == -1)
+    return -1;
+
+  /* Like the link target and the checksum below, failing to read the
+   * extended attributes of one entry doesn't stop the walk.  The entry
+   * is written with no extended attributes instead.
+   */
+  xattrs = get_lxattrs_at (dfd, name);
+  if (xattrs == NULL) {
+    perror (path);
+    r = walk_write_uint32 (w, 0);
+  }
+  else {
+    r = walk_write_uint32 (w, xattrs->guestfs_int_xattr_list_len);
+    for (i = 0; r == 0 && i < xattrs->guestfs_int_xattr_list_len; ++i) {
+      const guestfs_int_xattr *xa = &xattrs->guestfs_int_xattr_list_val[i];
+
+      r = walk_write_string (w, xa->attrname) ||
+        walk_write_uint32 (w, xa->attrval.attrval_len) ||
+        walk_write (w, xa->attrval.attrval_val, xa->attrval.attrval_len);
+    }
+    xdr_free ((xdrproc_t) xdr_guestfs_int_xattr_list, (char *) xattrs);
+    free (xattrs);
+  }
+  if (r != 0)
+    return -1;
+
+  if (S_ISLNK (statbuf->st_mode))
+    link = areadlinkat (dfd, name);
+
+  if (w->csumtype >= 0 && S_ISREG (statbuf->st_mode)) {
+    CLEANUP_CLOSE int fd = -1;
+
+    fd = openat (dfd, name, O_RDONLY|O_NOFOLLOW|O_NONBLOCK|O_CLOEXEC);
+    if (fd >= 0)
+      csum = checksum_fd (w->csumtype, fd, w->csumbuf, 0);
+  }
+
+  if (walk_write_string (w, link ? link : "") == -1 ||
+      walk_write_string (w, csum ? csum : "") == -1)
+    return -1;
+
+  return 0;
+}
+
+/* Write records for everything in the directory 'dfd' (which is
+ * closed by this function), recursing into subdirectories.  'dir' is
+ * the guest path of the directory and 'rel' is its path relative to
+ * the top of the walk.
+ */
+static int
+walk_dir (struct walk *w, int dfd, const char *dir, const char *rel)
+{
+  DIR *dirp;
+  struct dirent *d;
+  char **names = NULL, **new_names;
+  size_t i, nr_names = 0;
+  int r = 0;
+
+  dirp = fdopendir (dfd);
+  if (dirp == NULL) {
+    perror (dir);
+    close (dfd);
+    return -1;
+  }
+
+  /* We can't use add_string here because it sends an error reply. */
+  for (;;) {
+    errno = 0;
+    d = readdir (dirp);
+    if (d == NULL)
+      break;
+    if (STREQ (d->d_name, ".") || STREQ (d->d_name, ".."))
+      continue;
+    new_names = realloc (names, (nr_names+1) * sizeof (char *));
+    if (new_names == NULL)
+      break;
+    names = new_names;
+    names[nr_names] = strdup (d->d_name);
+    if (names[nr_names] == NULL)
+      break;
+    nr_names++;
+  }
+  if (errno != 0) {
+    perror (dir);
+    r = -1;
+  }
+
+  /* Return the entries in the same order as guestfs_ls. */
+  if (nr_names > 0)
+    sort_strings (names, nr_names);
+
+  for (i = 0; r == 0 && i < nr_names; ++i) {
+    const char *name = names[i];
+    CLEANUP_FREE char *path = NULL, *subrel = NULL;
+    struct stat statbuf;
+
+    if (fstatat (dirfd (dirp), name, &statbuf, AT_SYMLINK_NOFOLLOW) == -1)
+      /* Probably deleted since readdir, so ignore it. */
+      continue;
+
+    if (asprintf (&path, "%s%s%s",
+                  dir, STREQ (dir, "/") ? "" : "/", name) == -1 ||
+        asprintf (&subrel, "%s%s%s",
+                  rel, STREQ (rel, "") ? "" : "/", name) == -1) {
+      perror ("asprintf");
+      r = -1;
+      break;
+    }
+
+    r = walk_entry (w, dirfd (dirp), name, path, subrel, &statbuf);
+
+    if (r == 0 && S_ISDIR (statbuf.st_mode)) {
+      int subfd;
+
+      subfd = openat (dirfd (dirp), name,
+                      O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+      if (subfd >= 0)
+        r = walk_dir (w, subfd, path, subrel);
+    }
+  }
+
+  free_stringslen (names, nr_names);
+  closedir (dirp);
+  return r;
+}
+
+/* Has one FileOut parameter. */
+/* Takes optional arguments, consult optargs_bitmask. */
+int
+do_walk_out (const char *dir, const char *checksum)
+{
+  CLEANUP_CLOSE int parentfd = -1;
+  CLEANUP_FREE char *name = NULL;
+  CLEANUP_FREE char *buf = NULL;
+  CLEANUP_FREE char *csumbuf = NULL;
+  struct walk w = { .len = 0, .csumtype = -1 };
+  struct stat statbuf;
+  int dfd = -1;
+  int r;
+
+  if (optargs_bitmask & GUESTFS_WALK_OUT_CHECKSUM_BITMASK) {
+    w.csumtype = csum_type_of_name (checksum);
+    if (w.csumtype == -1)
+      return -1;
+    csumbuf = malloc (CHECKSUM_BUFFER_SIZE);
+    if (csumbuf == NULL) {
+      reply_with_perror ("malloc");
+      return -1;
+    }
+    w.csumbuf = csumbuf;
+  }
+
+  buf = malloc (chunk_size);
+  if (buf == NULL) {
+    reply_with_perror ("malloc");
+    return -1;
+  }
+  w.buf = buf;
+
+  parentfd = sysroot_walk (dir, 1, &name);
+  if (parentfd >= 0)
+    dfd = openat (parentfd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+  if (dfd == -1 || fstat (dfd, &statbuf) == -1) {
+    reply_with_perror ("%s", dir);
+    if (dfd >= 0)
+      close (dfd);
+    return -1;
+  }
+
+  /* Now we must send the reply message, before the file contents.  After
+   * this there is no opportunity in the protocol to send any error
+   * message back.  Instead we can only cancel the transfer.
+   */
+  reply (NULL, NULL);
+
+  r = walk_entry (&w, parentfd, name, dir, "", &statbuf);
+  if (r == 0)
+    r = walk_dir (&w, dfd, dir, "");
+  else
+    close (dfd);
+
+  if (r == 0 && w.len > 0 && send_file_write (w.buf, w.len) < 0) {
+    w.send_failed = 1;
+    r = -1;
+  }
+
+  if (r != 0) {
+    if (!w.send_failed)
+      send_file_end (1);        /* Cancel. */
+    return -1;
+  }
+
+  if (send_file_end (0))        /* Normal end of file. */
+    return -1;
+
+  return 0;
+}
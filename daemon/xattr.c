@@ -19,8 +19,10 @@
 #include <config.h>
 
 #include <stdio.h>
+#include <errno.h>
 #include <limits.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 #include "guestfs_protocol.h"
 #include "daemon.h"
@@ -572,10 +574,108 @@ copy_xattrs (const char *src, const char *dest)
   return 0;
 }
 
+/* Get the extended attributes of 'name' in the directory 'dfd'
+ * without following symlinks.  Unlike the functions above, no chroot
+ * is done and no error is sent to the library.  This is used by
+ * guestfs_walk_out.
+ *
+ * There is no llistxattrat, so the entry is opened with O_PATH and
+ * the attributes are read through /proc/self/fd.  Following that
+ * link leads to the entry itself (even if it is a symlink), so the
+ * path is never resolved again from the root.
+ *
+ * Returns the list sorted by attrname (free it with xdr_free), or
+ * NULL with errno set.
+ */
+guestfs_int_xattr_list *
+get_lxattrs_at (int dfd, const char *name)
+{
+  ssize_t len, vlen;
+  CLEANUP_FREE char *buf = NULL;
+  CLEANUP_CLOSE int fd = -1;
+  char fdpath[64];
+  size_t i, j;
+  guestfs_int_xattr_list *r;
+
+  r = calloc (1, sizeof (*r));
+  if (r == NULL)
+    return NULL;
+
+  fd = openat (dfd, name, O_PATH|O_NOFOLLOW|O_CLOEXEC);
+  if (fd == -1)
+    goto error;
+  snprintf (fdpath, sizeof fdpath, "/proc/self/fd/%d", fd);
+
+  len = listxattr (fdpath, NULL, 0);
+  if (len == -1) {
+    /* Filesystems without xattr support return an empty list. */
+    if (errno == ENOTSUP)
+      return r;
+    goto error;
+  }
+  if (len == 0)
+    return r;
+
+  buf = malloc (len);
+  if (buf == NULL)
+    goto error;
+  len = listxattr (fdpath, buf, len);
+  if (len == -1)
+    goto error;
+
+  for (i = 0; i < (size_t) len; i += strlen (&buf[i]) + 1)
+    r->guestfs_int_xattr_list_len++;
+
+  r->guestfs_int_xattr_list_val =
+    calloc (r->guestfs_int_xattr_list_len, sizeof (guestfs_int_xattr));
+  if (r->guestfs_int_xattr_list_val == NULL)
+    goto error;
+
+  for (i = 0, j = 0; i < (size_t) len; i += strlen (&buf[i]) + 1, ++j) {
+    guestfs_int_xattr *xa = &r->guestfs_int_xattr_list_val[j];
+
+    vlen = getxattr (fdpath, &buf[i], NULL, 0);
+    if (vlen == -1)
+      goto error;
+
+    xa->attrname = strdup (&buf[i]);
+    xa->attrval.attrval_val = malloc (vlen > 0 ? vlen : 1);
+    if (xa->attrname == NULL || xa->attrval.attrval_val == NULL)
+      goto error;
+
+    vlen = getxattr (fdpath, &buf[i], xa->attrval.attrval_val, vlen);
+    if (vlen == -1)
+      goto error;
+    xa->attrval.attrval_len = vlen;
+  }
+
+  qsort (&r->guestfs_int_xattr_list_val[0],
+         (size_t) r->guestfs_int_xattr_list_len,
+         sizeof (guestfs_int_xattr),
+         compare_xattrs);
+
+  return r;
+
+ error: {
+    int err = errno;
+    xdr_free ((xdrproc_t) xdr_guestfs_int_xattr_list, (char *) r);
+    free (r);
+    errno = err;
+    return NULL;
+  }
+}
+
 #else /* no HAVE_LINUX_XATTRS */
 
 OPTGROUP_LINUXXATTRS_NOT_AVAILABLE
 
+guestfs_int_xattr_list *
+get_lxattrs_at (int dfd, const char *name)
+{
+  /* No extended attributes. */
+  return calloc (1, sizeof (guestfs_int_xattr_list));
+}
+
 int
 copy_xattrs (const char *src, const char *dest)
 {
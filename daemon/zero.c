@@ -193,12 +193,16 @@ do_zero_device (const char *device)
   return 0;
 }
 
+static int
+check_zero (void *opaque, const char *buf, size_t len)
+{
+  return is_zero (buf, len) ? 0 : 1;
+}
+
 int
 do_is_zero (const char *path)
 {
-  int fd;
-  char buf[BUFSIZ];
-  ssize_t r;
+  int fd, r;
 
   CHROOT_IN;
   fd = open (path, O_RDONLY|O_CLOEXEC);
@@ -209,17 +213,10 @@ do_is_zero (const char *path)
     return -1;
   }
 
-  while ((r = read (fd, buf, sizeof buf)) > 0) {
-    if (!is_zero (buf, r)) {
-      close (fd);
-      return 0;
-    }
-  }
-
-  if (r == -1) {
-    reply_with_perror ("read: %s", path);
+  r = read_blocks (fd, path, -1, 0, check_zero, NULL);
+  if (r != 0) {
     close (fd);
-    return -1;
+    return r == -1 ? -1 : 0;
   }
 
   if (close (fd) == -1) {
@@ -233,9 +230,7 @@ do_is_zero (const char *path)
 int
 do_is_zero_device (const char *device)
 {
-  int fd;
-  char buf[BUFSIZ];
-  ssize_t r;
+  int fd, r;
 
   fd = open (device, O_RDONLY|O_CLOEXEC);
   if (fd == -1) {
@@ -243,17 +238,10 @@ do_is_zero_device (const char *device)
     return -1;
   }
 
-  while ((r = read (fd, buf, sizeof buf)) > 0) {
-    if (!is_zero (buf, r)) {
-      close (fd);
-      return 0;
-    }
-  }
-
-  if (r == -1) {
-    reply_with_perror ("read: %s", device);
+  r = read_blocks (fd, device, -1, 1, check_zero, NULL);
+  if (r != 0) {
     close (fd);
-    return -1;
+    return r == -1 ? -1 : 0;
   }
 
   if (close (fd) == -1) {
@@ -63,16 +63,13 @@ df_on_handle (guestfs_h *g, const char *name, const char *uuid, FILE *fp)
       if (verbose)
         fprintf (stderr, "df_on_handle: %s dev %s\n", name, dev);
 
-      /* Try mounting and stating the device.  This might reasonably
-       * fail, so don't show errors.
+      /* Get the statistics of the device.  For most filesystems they
+       * are read from the metadata without mounting, otherwise the
+       * daemon mounts it.  This might reasonably fail, so don't show
+       * errors.
        */
       guestfs_push_error_handler (g, NULL, NULL);
-
-      if (guestfs_mount_ro (g, dev, "/") == 0) {
-        stat = guestfs_statvfs (g, "/");
-        guestfs_umount_all (g);
-      }
-
+      stat = guestfs_vfs_statvfs (g, dev);
       guestfs_pop_error_handler (g);
 
       if (stat)
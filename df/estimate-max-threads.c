@@ -29,48 +29,21 @@
 #include "guestfs-internal-frontend.h"
 #include "estimate-max-threads.h"
 
-static char *read_line_from (const char *cmd);
-
-/* The actual overhead is likely much smaller than this, but err on
- * the safe side.
- */
-#define MBYTES_PER_THREAD 650
-
 size_t
 estimate_max_threads (void)
 {
-  CLEANUP_FREE char *mbytes_str = NULL;
-  size_t mbytes;
-
-  /* Choose the number of threads based on the amount of free memory. */
-  mbytes_str = read_line_from ("LANG=C free -m | "
-                               "grep '^Mem' | awk '{print $4+$6+$7}'");
-  if (mbytes_str == NULL)
-    return 1;
-
-  if (sscanf (mbytes_str, "%zu", &mbytes) != 1)
-    return 1;
-
-  return MAX (1, mbytes / MBYTES_PER_THREAD);
-}
-
-/* Run external command and read the first line of output. */
-static char *
-read_line_from (const char *cmd)
-{
-  FILE *pp;
-  char *ret = NULL;
-  size_t allocsize = 0;
-
-  pp = popen (cmd, "r");
-  if (pp == NULL)
-    error (EXIT_FAILURE, errno, "%s: external command failed", cmd);
+  guestfs_h *g;
+  int n;
 
-  if (getline (&ret, &allocsize, pp) == -1)
-    error (EXIT_FAILURE, errno, "could not read line from external command");
+  /* Ask the library how many appliances with the default settings
+   * fit in the memory which is available now.
+   */
+  g = guestfs_create ();
+  if (g == NULL)
+    error (EXIT_FAILURE, errno, "guestfs_create");
 
-  if (pclose (pp) == -1)
-    error (EXIT_FAILURE, errno, "pclose");
+  n = guestfs_estimate_max_handles (g);
+  guestfs_close (g);
 
-  return ret;
+  return MAX (1, n);
 }
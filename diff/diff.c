@@ -424,7 +424,7 @@ free_tree (struct tree *t)
   free (t);
 }
 
-static int visit_entry (const char *dir, const char *name, const struct guestfs_statns *stat, const struct guestfs_xattr_list *xattrs, void *vt);
+static int visit_entry (const char *dir, const char *name, const struct guestfs_statns *stat, const struct guestfs_xattr_list *xattrs, const char *link, const char *csum, void *vt);
 
 static struct tree *
 visit_guest (guestfs_h *g)
@@ -440,7 +440,7 @@ visit_guest (guestfs_h *g)
   t->files = NULL;
   t->nr_files = t->allocated = 0;
 
-  if (visit (g, "/", visit_entry, t) == -1) {
+  if (visit (g, "/", checksum, visit_entry, t) == -1) {
     free_tree (t);
     return NULL;
   }
@@ -460,6 +460,7 @@ static int
 visit_entry (const char *dir, const char *name,
              const struct guestfs_statns *stat_orig,
              const struct guestfs_xattr_list *xattrs_orig,
+             const char *link, const char *csum_orig,
              void *vt)
 {
   struct tree *t = vt;
@@ -485,9 +486,16 @@ visit_entry (const char *dir, const char *name,
   }
 
   if (checksum && is_reg (stat->st_mode)) {
-    csum = guestfs_checksum (t->g, checksum, path);
-    if (!csum)
+    if (!csum_orig) {
+      fprintf (stderr, _("%s: %s: cannot compute checksum\n"),
+               guestfs_int_program_name, path);
       goto error;
+    }
+    csum = strdup (csum_orig);
+    if (csum == NULL) {
+      perror ("strdup");
+      goto error;
+    }
   }
 
   /* If --atime option was NOT passed, flatten the atime field. */
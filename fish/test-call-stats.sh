@@ -0,0 +1,42 @@
+#!/bin/bash -
+# libguestfs
+# Copyright (C) 2015 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Test guestfish get-call-stats.
+
+set -e
+
+rm -f test-call-stats.img
+
+output="$($VG guestfish <<EOT
+sparse test-call-stats.img 10M
+run
+is-zero-device /dev/sda
+is-zero-device /dev/sda
+is-zero-device /dev/sda
+get-call-stats
+EOT
+)"
+
+if ! echo "$output" | grep -A1 'cs_name: is_zero_device' |
+        grep -sq 'cs_calls: 3'; then
+    echo "$0: unexpected output from get-call-stats:"
+    echo "$output"
+    exit 1
+fi
+
+rm test-call-stats.img
@@ -0,0 +1,50 @@
+#!/bin/bash -
+# libguestfs
+# Copyright (C) 2015 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Test guestfish set-workload and estimate-max-handles.
+
+set -e
+
+output="$($VG guestfish <<EOF
+get-workload
+set-workload copy
+get-workload
+set-workload ""
+get-workload
+EOF
+)"
+
+expected="
+copy"
+
+if [ "$output" != "$expected" ]; then
+    echo "$0: unexpected output from get-workload:"
+    echo "$output"
+    exit 1
+fi
+
+if $VG guestfish set-workload foo 2>/dev/null; then
+    echo "$0: set-workload did not reject an unknown workload"
+    exit 1
+fi
+
+n="$($VG guestfish estimate-max-handles)"
+if [ "$n" -lt 1 ]; then
+    echo "$0: estimate-max-handles returned $n"
+    exit 1
+fi
@@ -108,6 +108,7 @@ usage (int status)
              "  %s [--options] mountpoint\n"
              "Options:\n"
              "  -a|--add image       Add image\n"
+             "  --appliances N       Serve requests with N appliances\n"
              "  -c|--connect uri     Specify libvirt URI for -d option\n"
              "  --dir-cache-timeout  Set readdir cache timeout (default 5 sec)\n"
              "  -d|--domain guest    Add disks from libvirt guest\n"
@@ -124,6 +125,7 @@ usage (int status)
              "  -n|--no-sync         Don't autosync\n"
              "  -o|--option opt      Pass extra option to FUSE\n"
              "  --pid-file filename  Write PID to filename\n"
+             "  --read-cache-size MB Set size of file data cache (default 64 MB)\n"
              "  -r|--ro              Mount read-only\n"
              "  --selinux            Enable SELinux support\n"
              "  -v|--verbose         Verbose messages\n"
@@ -153,6 +155,7 @@ main (int argc, char *argv[])
   static const char *options = "a:c:d:im:no:rv?Vwx";
   static const struct option long_options[] = {
     { "add", 1, 0, 'a' },
+    { "appliances", 1, 0, 0 },
     { "connect", 1, 0, 'c' },
     { "dir-cache-timeout", 1, 0, 0 },
     { "domain", 1, 0, 'd' },
@@ -170,6 +173,7 @@ main (int argc, char *argv[])
     { "no-sync", 0, 0, 'n' },
     { "option", 1, 0, 'o' },
     { "pid-file", 1, 0, 0 },
+    { "read-cache-size", 1, 0, 0 },
     { "ro", 0, 0, 'r' },
     { "rw", 0, 0, 'w' },
     { "selinux", 0, 0, 0 },
@@ -192,6 +196,8 @@ main (int argc, char *argv[])
 
   int debug_calls = 0;
   int dir_cache_timeout = -1;
+  int read_cache_size = -1;
+  int appliances = 0;
   int do_fork = 1;
   char *fuse_options = NULL;
   char *pid_file = NULL;
@@ -225,6 +231,21 @@ main (int argc, char *argv[])
         display_short_options (options);
       else if (STREQ (long_options[option_index].name, "dir-cache-timeout"))
         dir_cache_timeout = atoi (optarg);
+      else if (STREQ (long_options[option_index].name, "read-cache-size")) {
+        if (sscanf (optarg, "%d", &read_cache_size) != 1 ||
+            read_cache_size < 0) {
+          fprintf (stderr, _("%s: unable to parse --read-cache-size option value: %s\n"),
+                   guestfs_int_program_name, optarg);
+          exit (EXIT_FAILURE);
+        }
+      }
+      else if (STREQ (long_options[option_index].name, "appliances")) {
+        if (sscanf (optarg, "%d", &appliances) != 1 || appliances < 1) {
+          fprintf (stderr, _("%s: unable to parse --appliances option value: %s\n"),
+                   guestfs_int_program_name, optarg);
+          exit (EXIT_FAILURE);
+        }
+      }
       else if (STREQ (long_options[option_index].name, "fuse-help"))
         fuse_help ();
       else if (STREQ (long_options[option_index].name, "selinux")) {
@@ -404,6 +425,14 @@ main (int argc, char *argv[])
     optargs.bitmask |= GUESTFS_MOUNT_LOCAL_CACHETIMEOUT_BITMASK;
     optargs.cachetimeout = dir_cache_timeout;
   }
+  if (read_cache_size >= 0) {
+    optargs.bitmask |= GUESTFS_MOUNT_LOCAL_READCACHESIZE_BITMASK;
+    optargs.readcachesize = read_cache_size;
+  }
+  if (appliances > 0) {
+    optargs.bitmask |= GUESTFS_MOUNT_LOCAL_APPLIANCES_BITMASK;
+    optargs.appliances = appliances;
+  }
   if (fuse_options != NULL) {
     optargs.bitmask |= GUESTFS_MOUNT_LOCAL_OPTIONS_BITMASK;
     optargs.options = fuse_options;
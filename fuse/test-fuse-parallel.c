@@ -0,0 +1,412 @@
+/* Test FUSE with several appliances.
+ * Copyright (C) 2015 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Mount a filesystem with the 'appliances' parameter of
+ * guestfs_mount_local, and read and write several files in parallel
+ * through the mountpoint.  The read-only mount (of a drive added
+ * read-only, which has not been written to) uses extra appliances.
+ * The read-write mount only has the main handle, but requests are
+ * still served by several threads.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <guestfs.h>
+#include "guestfs-internal-frontend.h"
+
+#include "ignore-value.h"
+
+static guestfs_h *g;
+
+static const char *disk = "test-fuse-parallel.img";
+
+#define SIZE INT64_C(512*1024*1024)
+
+/* Number of files, and of processes reading or writing them. */
+#define NR_FILES 8
+
+/* Size of each file.  This is larger than the read cache blocks and
+ * the largest single read, so each file takes several calls.
+ */
+#define FILE_SIZE (3*1024*1024 + 4567)
+
+/* NB: Must be a path that does not need quoting. */
+static char mountpoint[] = "/tmp/testfuseXXXXXX";
+
+static void open_disk (int readonly);
+static void close_disk (void);
+static int mount_and_test (const char *prog, int readonly, int (*test) (void));
+static int test_parallel_reads (void);
+static int test_parallel_writes (void);
+
+int
+main (int argc, char *argv[])
+{
+  const char *s;
+  struct sigaction sa;
+  char path[32], pattern[32];
+  size_t i, j, size;
+  char *content;
+  int r;
+
+  s = getenv ("SKIP_TEST_FUSE_PARALLEL");
+  if (s && STRNEQ (s, "")) {
+    printf ("%s: test skipped because environment variable is set\n",
+            argv[0]);
+    exit (77);
+  }
+
+  if (access ("/dev/fuse", W_OK) == -1) {
+    perror ("/dev/fuse");
+    exit (77);
+  }
+
+  /* Make the disk.  Each file repeats a different pattern. */
+  g = guestfs_create ();
+  if (g == NULL) {
+    perror ("guestfs_create");
+    exit (EXIT_FAILURE);
+  }
+
+  if (guestfs_disk_create (g, disk, "raw", SIZE, -1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_add_drive_opts (g, disk,
+                              GUESTFS_ADD_DRIVE_OPTS_FORMAT, "raw",
+                              -1) == -1)
+    exit (EXIT_FAILURE);
+
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+
+  if (guestfs_part_disk (g, "/dev/sda", "mbr") == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_mkfs (g, "ext4", "/dev/sda1") == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_mount (g, "/dev/sda1", "/") == -1)
+    exit (EXIT_FAILURE);
+
+  for (i = 0; i < NR_FILES; ++i) {
+    snprintf (path, sizeof path, "/file%zu", i);
+    snprintf (pattern, sizeof pattern, "file %zu contents\n", i);
+    if (guestfs_fill_pattern (g, pattern, FILE_SIZE, path) == -1)
+      exit (EXIT_FAILURE);
+  }
+
+  close_disk ();
+
+  /* Make a mountpoint. */
+  if (mkdtemp (mountpoint) == NULL)
+    exit (EXIT_FAILURE);
+
+  /* Ignore signals in the parent while running the child. */
+  memset (&sa, 0, sizeof sa);
+  sa.sa_handler = SIG_IGN;
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+
+  /* The extra appliances are only used if the drive has not been
+   * written to and the filesystem is mounted read-only.
+   */
+  open_disk (1);
+  r = mount_and_test (argv[0], 1, test_parallel_reads);
+  close_disk ();
+
+  if (r == 0) {
+    open_disk (0);
+    r = mount_and_test (argv[0], 0, test_parallel_writes);
+  }
+
+  /* Check the files written through the mountpoint. */
+  for (i = 0; r == 0 && i < NR_FILES; ++i) {
+    snprintf (path, sizeof path, "/new%zu", i);
+    snprintf (pattern, sizeof pattern, "new file %zu\n", i);
+    content = guestfs_read_file (g, path, &size);
+    if (content == NULL)
+      exit (EXIT_FAILURE);
+    if (size != FILE_SIZE) {
+      fprintf (stderr, "%s: %s: size is %zu, expected %d\n",
+               argv[0], path, size, FILE_SIZE);
+      r = -1;
+    }
+    else {
+      for (j = 0; j < size; ++j) {
+        if (content[j] != pattern[j % strlen (pattern)]) {
+          fprintf (stderr, "%s: %s: wrong content at offset %zu\n",
+                   argv[0], path, j);
+          r = -1;
+          break;
+        }
+      }
+    }
+    free (content);
+  }
+
+  if (rmdir (mountpoint) == -1) {
+    perror (mountpoint);
+    exit (EXIT_FAILURE);
+  }
+
+  close_disk ();
+  unlink (disk);
+
+  exit (r == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/* Open the disk in a new handle and mount the filesystem. */
+static void
+open_disk (int readonly)
+{
+  g = guestfs_create ();
+  if (g == NULL) {
+    perror ("guestfs_create");
+    exit (EXIT_FAILURE);
+  }
+
+  if (guestfs_add_drive_opts (g, disk,
+                              GUESTFS_ADD_DRIVE_OPTS_FORMAT, "raw",
+                              GUESTFS_ADD_DRIVE_OPTS_READONLY, readonly,
+                              -1) == -1)
+    exit (EXIT_FAILURE);
+
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+
+  if (readonly) {
+    if (guestfs_mount_ro (g, "/dev/sda1", "/") == -1)
+      exit (EXIT_FAILURE);
+  }
+  else {
+    if (guestfs_mount (g, "/dev/sda1", "/") == -1)
+      exit (EXIT_FAILURE);
+  }
+}
+
+static void
+close_disk (void)
+{
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+
+  guestfs_close (g);
+}
+
+/* Mount the filesystem with appliances=2, and run 'test' in a child
+ * process with the mountpoint as the current directory.  Returns 0
+ * if the test passed, or -1 if it failed.
+ */
+static int
+mount_and_test (const char *prog, int readonly, int (*test) (void))
+{
+  int r, res;
+  pid_t pid;
+  char cmd[128];
+
+  if (guestfs_mount_local (g, mountpoint,
+                           GUESTFS_MOUNT_LOCAL_READONLY, readonly,
+                           GUESTFS_MOUNT_LOCAL_DEBUGCALLS, guestfs_get_trace (g),
+                           GUESTFS_MOUNT_LOCAL_APPLIANCES, 2,
+                           -1) == -1)
+    return -1;
+
+  pid = fork ();
+  if (pid == -1) {
+    perror ("fork");
+    exit (EXIT_FAILURE);
+  }
+
+  if (pid == 0) {               /* Child. */
+    if (chdir (mountpoint) == -1) {
+      perror (mountpoint);
+      _exit (EXIT_FAILURE);
+    }
+
+    res = test ();
+    printf ("test returned %d\n", res);
+    fflush (stdout);
+
+    ignore_value (chdir ("/"));
+
+    snprintf (cmd, sizeof cmd, "guestunmount %s", mountpoint);
+    printf ("%s\n", cmd);
+    fflush (stdout);
+    r = system (cmd);
+    if (!WIFEXITED (r) || WEXITSTATUS (r) != EXIT_SUCCESS)
+      fprintf (stderr, "%s: warning: guestunmount command failed\n", prog);
+
+    _exit (res == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+
+  /* Parent. */
+  if (guestfs_mount_local_run (g) == -1)
+    exit (EXIT_FAILURE);
+
+  if (waitpid (pid, &r, 0) == -1) {
+    perror ("waitpid");
+    exit (EXIT_FAILURE);
+  }
+
+  return !WIFEXITED (r) || WEXITSTATUS (r) != 0 ? -1 : 0;
+}
+
+/* Run 'fn' for each file number in a separate process, all at the
+ * same time.  Returns 0 if they all succeeded.
+ */
+static int
+run_parallel (int (*fn) (size_t i))
+{
+  pid_t pids[NR_FILES];
+  size_t i;
+  int r, ret = 0;
+
+  for (i = 0; i < NR_FILES; ++i) {
+    pids[i] = fork ();
+    if (pids[i] == -1) {
+      perror ("fork");
+      _exit (EXIT_FAILURE);
+    }
+    if (pids[i] == 0)
+      _exit (fn (i) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+
+  for (i = 0; i < NR_FILES; ++i) {
+    if (waitpid (pids[i], &r, 0) == -1) {
+      perror ("waitpid");
+      _exit (EXIT_FAILURE);
+    }
+    if (!WIFEXITED (r) || WEXITSTATUS (r) != 0)
+      ret = -1;
+  }
+
+  return ret;
+}
+
+/* Read the file 'path' and check that it repeats 'pattern'. */
+static int
+check_file (const char *path, const char *pattern)
+{
+  const size_t len = strlen (pattern);
+  char buf[65536];
+  size_t offset = 0, i;
+  ssize_t r;
+  int fd;
+
+  fd = open (path, O_RDONLY|O_NOCTTY|O_CLOEXEC);
+  if (fd == -1) {
+    perror (path);
+    return -1;
+  }
+
+  while ((r = read (fd, buf, sizeof buf)) > 0) {
+    for (i = 0; i < (size_t) r; ++i) {
+      if (buf[i] != pattern[(offset + i) % len]) {
+        fprintf (stderr, "%s: wrong content at offset %zu\n",
+                 path, offset + i);
+        close (fd);
+        return -1;
+      }
+    }
+    offset += r;
+  }
+  if (r == -1) {
+    perror (path);
+    close (fd);
+    return -1;
+  }
+  close (fd);
+
+  if (offset != FILE_SIZE) {
+    fprintf (stderr, "%s: read %zu bytes, expected %d\n",
+             path, offset, FILE_SIZE);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int
+read_file (size_t i)
+{
+  char path[32], pattern[32];
+
+  snprintf (path, sizeof path, "file%zu", i);
+  snprintf (pattern, sizeof pattern, "file %zu contents\n", i);
+  return check_file (path, pattern);
+}
+
+static int
+test_parallel_reads (void)
+{
+  printf ("checking parallel reads on a read-only mount\n");
+  fflush (stdout);
+
+  return run_parallel (read_file);
+}
+
+/* Write a new file, then read it and one of the existing files. */
+static int
+write_file (size_t i)
+{
+  char path[32], pattern[32];
+  size_t len, n;
+  FILE *fp;
+
+  snprintf (path, sizeof path, "new%zu", i);
+  snprintf (pattern, sizeof pattern, "new file %zu\n", i);
+  len = strlen (pattern);
+
+  fp = fopen (path, "w");
+  if (fp == NULL) {
+    perror (path);
+    return -1;
+  }
+  for (n = 0; n < FILE_SIZE; n += len) {
+    if (fwrite (pattern, 1, FILE_SIZE - n < len ? FILE_SIZE - n : len,
+                fp) == 0) {
+      perror (path);
+      fclose (fp);
+      return -1;
+    }
+  }
+  if (fclose (fp) == EOF) {
+    perror (path);
+    return -1;
+  }
+
+  if (check_file (path, pattern) == -1)
+    return -1;
+
+  return read_file ((i + 1) % NR_FILES);
+}
+
+static int
+test_parallel_writes (void)
+{
+  printf ("checking parallel writes on a read-write mount\n");
+  fflush (stdout);
+
+  return run_parallel (write_file);
+}
@@ -25,6 +25,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -62,8 +64,21 @@ static char mountpoint[] = "/tmp/testfuseXXXXXX";
 static int acl_available;
 static int linuxxattrs_available;
 
+/* A file larger than the largest single read (RW_LIMIT in
+ * src/fuse.c), which does not end on a read cache block boundary.
+ */
+#define BIG_SIZE (2*1024*1024 + 3*128*1024 + 1234)
+static char *big_data;
+
+static int stage = 0;
+#define STAGE(fs,...)                                   \
+  printf ("%02d: " fs "\n", ++stage, ##__VA_ARGS__);    \
+  fflush (stdout)
+
 static void create_initial_filesystem (void);
+static int mount_and_test (const char *prog, int readcachesize, int (*test) (void));
 static int test_fuse (void);
+static int test_big_reads (void);
 
 int
 main (int argc, char *argv[])
@@ -71,10 +86,8 @@ main (int argc, char *argv[])
   const char *s;
   const char *acl_group[] = { "acl", NULL };
   const char *linuxxattrs_group[] = { "linuxxattrs", NULL };
-  int debug_calls, r, res;
-  pid_t pid;
   struct sigaction sa;
-  char cmd[128];
+  int r;
 
   /* Allow the test to be skipped.  Note I'm using the old shell
    * script name here.
@@ -117,13 +130,54 @@ main (int argc, char *argv[])
   if (mkdtemp (mountpoint) == NULL)
     exit (EXIT_FAILURE);
 
-  /* Mount the filesystem on the host using FUSE. */
-  debug_calls = guestfs_get_trace (g);
-  if (guestfs_mount_local (g, mountpoint,
-                           GUESTFS_MOUNT_LOCAL_DEBUGCALLS, debug_calls,
-                           -1) == -1)
+  /* Ignore signals in the parent while running the child. */
+  memset (&sa, 0, sizeof sa);
+  sa.sa_handler = SIG_IGN;
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+
+  r = mount_and_test (argv[0], -1, test_fuse);
+
+  /* Repeat the reads with the read cache disabled. */
+  if (r == 0)
+    r = mount_and_test (argv[0], 0, test_big_reads);
+
+  if (rmdir (mountpoint) == -1) {
+    perror (mountpoint);
+    exit (EXIT_FAILURE);
+  }
+
+  if (guestfs_shutdown (g) == -1)
     exit (EXIT_FAILURE);
 
+  guestfs_close (g);
+  free (big_data);
+
+  exit (r == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/* Mount the filesystem on the host using FUSE, and run 'test' in a
+ * child process with the mountpoint as the current directory.  If
+ * 'readcachesize' is >= 0 it is passed to guestfs_mount_local.
+ * Returns 0 if the test passed, or -1 if it failed.
+ */
+static int
+mount_and_test (const char *prog, int readcachesize, int (*test) (void))
+{
+  struct guestfs_mount_local_argv optargs;
+  int r, res;
+  pid_t pid;
+  char cmd[128];
+
+  optargs.bitmask = GUESTFS_MOUNT_LOCAL_DEBUGCALLS_BITMASK;
+  optargs.debugcalls = guestfs_get_trace (g);
+  if (readcachesize >= 0) {
+    optargs.bitmask |= GUESTFS_MOUNT_LOCAL_READCACHESIZE_BITMASK;
+    optargs.readcachesize = readcachesize;
+  }
+  if (guestfs_mount_local_argv (g, mountpoint, &optargs) == -1)
+    return -1;
+
   /* Fork to run the next part of the test. */
   pid = fork ();
   if (pid == -1) {
@@ -138,8 +192,8 @@ main (int argc, char *argv[])
       _exit (EXIT_FAILURE);
     }
 
-    res = test_fuse ();
-    printf ("test_fuse() returned %d\n", res);
+    res = test ();
+    printf ("test returned %d\n", res);
     fflush (stdout);
 
     /* Move out of the mountpoint (otherwise our cwd will prevent the
@@ -159,46 +213,31 @@ main (int argc, char *argv[])
     fflush (stdout);
     r = system (cmd);
     if (!WIFEXITED (r) || WEXITSTATUS (r) != EXIT_SUCCESS)
-      fprintf (stderr, "%s: warning: guestunmount command failed\n", argv[0]);
+      fprintf (stderr, "%s: warning: guestunmount command failed\n", prog);
 
     _exit (res == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
   }
 
   /* Parent. */
-
-  /* Ignore signals in the parent while running the child. */
-  memset (&sa, 0, sizeof sa);
-  sa.sa_handler = SIG_IGN;
-  sigaction (SIGINT, &sa, NULL);
-  sigaction (SIGTERM, &sa, NULL);
-
   if (guestfs_mount_local_run (g) == -1)
     exit (EXIT_FAILURE);
 
-  /* Clean up and exit. */
   if (waitpid (pid, &r, 0) == -1) {
     perror ("waitpid");
     exit (EXIT_FAILURE);
   }
 
-  if (rmdir (mountpoint) == -1) {
-    perror (mountpoint);
-    exit (EXIT_FAILURE);
-  }
-
-  if (guestfs_shutdown (g) == -1)
-    exit (EXIT_FAILURE);
-
-  guestfs_close (g);
-
   /* Did the child process fail? */
-  exit (!WIFEXITED (r) || WEXITSTATUS (r) != 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+  return !WIFEXITED (r) || WEXITSTATUS (r) != 0 ? -1 : 0;
 }
 
 /* Create a filesystem with some initial content. */
 static void
 create_initial_filesystem (void)
 {
+  size_t i;
+  uint32_t x;
+
   if (guestfs_part_disk (g, "/dev/sda", "mbr") == -1)
     exit (EXIT_FAILURE);
 
@@ -222,6 +261,27 @@ create_initial_filesystem (void)
   if (guestfs_touch (g, "/empty") == -1)
     exit (EXIT_FAILURE);
 
+  /* Pseudo-random content, so that reading from the wrong offset
+   * cannot return the expected data.
+   */
+  big_data = malloc (BIG_SIZE);
+  if (big_data == NULL) {
+    perror ("malloc");
+    exit (EXIT_FAILURE);
+  }
+  for (i = 0, x = 1; i < BIG_SIZE; ++i) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    big_data[i] = x >> 24;
+  }
+  /* In two pieces, because of the protocol message size limit. */
+  if (guestfs_write (g, "/big", big_data, BIG_SIZE / 2) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_write_append (g, "/big", &big_data[BIG_SIZE / 2],
+                            BIG_SIZE - BIG_SIZE / 2) == -1)
+    exit (EXIT_FAILURE);
+
   if (linuxxattrs_available) {
     if (guestfs_touch (g, "/user_xattr") == -1)
       exit (EXIT_FAILURE);
@@ -244,10 +304,6 @@ create_initial_filesystem (void)
 static int
 test_fuse (void)
 {
-  int stage = 0;
-#define STAGE(fs,...)                                   \
-  printf ("%02d: " fs "\n", ++stage, ##__VA_ARGS__);    \
-  fflush (stdout)
   FILE *fp;
   char *line = NULL;
   size_t len = 0;
@@ -647,6 +703,40 @@ test_fuse (void)
   }
   fclose (fp);
 
+  STAGE ("checking reads see rewritten data");
+
+  fd = open ("new.txt", O_WRONLY|O_NOCTTY|O_CLOEXEC);
+  if (fd == -1) {
+    perror ("open: new.txt");
+    return -1;
+  }
+  if (pwrite (fd, "LINE", 4, 0) != 4) {
+    perror ("pwrite: new.txt");
+    return -1;
+  }
+  if (close (fd) == -1) {
+    perror ("close: new.txt");
+    return -1;
+  }
+
+  fp = fopen ("new.txt", "r");
+  if (fp == NULL) {
+    perror ("open: new.txt");
+    return -1;
+  }
+  if (getline (&line, &len, fp) == -1) {
+    perror ("getline: new.txt");
+    return -1;
+  }
+  if (STRNEQ (line, "LINE 0\n")) {
+    fprintf (stderr, "unexpected content after rewrite: %s\n", line);
+    return -1;
+  }
+  fclose (fp);
+
+  if (test_big_reads () == -1)
+    return -1;
+
 #ifdef HAVE_ACL
   if (acl_available) {
     STAGE ("checking POSIX ACL read operation");
@@ -700,3 +790,194 @@ test_fuse (void)
   free (line);
   return 0;
 }
+
+/* Read 'count' bytes at 'offset' from the file "big", and check
+ * them against big_data.  Fewer bytes are expected at the end of
+ * the file.
+ */
+static int
+check_pread (int fd, off_t offset, size_t count)
+{
+  char *buf;
+  size_t expected, n = 0;
+  ssize_t r;
+
+  if (offset >= BIG_SIZE)
+    expected = 0;
+  else if (count > (size_t) (BIG_SIZE - offset))
+    expected = BIG_SIZE - offset;
+  else
+    expected = count;
+
+  buf = malloc (count + 1);
+  if (buf == NULL) {
+    perror ("malloc");
+    return -1;
+  }
+
+  /* Read past the expected end, to check that nothing more is
+   * returned.
+   */
+  while (n <= count) {
+    r = pread (fd, buf + n, count + 1 - n, offset + n);
+    if (r == -1) {
+      perror ("pread: big");
+      free (buf);
+      return -1;
+    }
+    if (r == 0)
+      break;
+    n += r;
+  }
+
+  if (n != expected) {
+    fprintf (stderr, "big: read at %" PRIi64 " returned %zu bytes, "
+             "expected %zu\n", (int64_t) offset, n, expected);
+    free (buf);
+    return -1;
+  }
+  if (memcmp (buf, &big_data[offset < BIG_SIZE ? offset : 0], n) != 0) {
+    fprintf (stderr, "big: read at %" PRIi64 " of %zu bytes returned "
+             "wrong data\n", (int64_t) offset, count);
+    free (buf);
+    return -1;
+  }
+
+  free (buf);
+  return 0;
+}
+
+/* Read the file "big" in 'chunk' byte pieces with read(2) from
+ * 'offset' to the end, checking the data.
+ */
+static int
+check_sequential (int fd, off_t offset, size_t chunk)
+{
+  char *buf;
+  ssize_t r;
+
+  if (lseek (fd, offset, SEEK_SET) == -1) {
+    perror ("lseek: big");
+    return -1;
+  }
+
+  buf = malloc (chunk);
+  if (buf == NULL) {
+    perror ("malloc");
+    return -1;
+  }
+
+  while ((r = read (fd, buf, chunk)) > 0) {
+    if (offset + r > BIG_SIZE ||
+        memcmp (buf, &big_data[offset], r) != 0) {
+      fprintf (stderr, "big: sequential read of %zu bytes at %" PRIi64
+               " returned wrong data\n", chunk, (int64_t) offset);
+      free (buf);
+      return -1;
+    }
+    offset += r;
+  }
+  free (buf);
+
+  if (r == -1) {
+    perror ("read: big");
+    return -1;
+  }
+  if (offset != BIG_SIZE) {
+    fprintf (stderr, "big: sequential read of %zu bytes ended at %" PRIi64
+             "\n", chunk, (int64_t) offset);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Read a file larger than the read cache blocks and the largest
+ * single read, in ways which exercise the read cache and read-ahead
+ * in src/fuse.c.  The file is reopened for each part of the test so
+ * that the kernel page cache (which is dropped on open) does not
+ * answer the reads.
+ */
+static int
+test_big_reads (void)
+{
+  const size_t block = 128 * 1024;
+  size_t i, count;
+  off_t offset;
+  uint32_t x;
+  int fd;
+
+#define OPEN_BIG()                                      \
+  fd = open ("big", O_RDONLY|O_NOCTTY|O_CLOEXEC);       \
+  if (fd == -1) {                                       \
+    perror ("open: big");                               \
+    return -1;                                          \
+  }
+#define CHECK(expr)                             \
+  if ((expr) == -1) {                           \
+    close (fd);                                 \
+    return -1;                                  \
+  }
+
+  STAGE ("checking sequential reads of a large file");
+
+  OPEN_BIG ();
+  CHECK (check_sequential (fd, 0, 4096));
+  close (fd);
+
+  /* Not a divisor of the block size, so the reads straddle blocks. */
+  OPEN_BIG ();
+  CHECK (check_sequential (fd, 0, 65537));
+  close (fd);
+
+  STAGE ("checking reads across read cache block boundaries");
+
+  OPEN_BIG ();
+  for (i = 1; i * block < BIG_SIZE; ++i) {
+    CHECK (check_pread (fd, i * block - 1, 2));
+    CHECK (check_pread (fd, i * block - 100, block + 200));
+  }
+  close (fd);
+
+  STAGE ("checking reads of the last block and past the end");
+
+  OPEN_BIG ();
+  CHECK (check_pread (fd, BIG_SIZE - 100, 4096));
+  CHECK (check_pread (fd, BIG_SIZE - 1, 1));
+  CHECK (check_pread (fd, BIG_SIZE, 4096));
+  CHECK (check_pread (fd, BIG_SIZE + 1000, 4096));
+  CHECK (check_pread (fd, BIG_SIZE / block * block, block));
+  close (fd);
+
+  STAGE ("checking random unaligned reads");
+
+  OPEN_BIG ();
+  for (i = 0, x = 12345; i < 200; ++i) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    offset = x % (BIG_SIZE + 1000);
+    count = 1 + (x >> 8) % (3 * block);
+    CHECK (check_pread (fd, offset, count));
+  }
+  close (fd);
+
+  STAGE ("checking sequential reads after seeks");
+
+  /* Sequential reads grow the read-ahead window, and a seek must
+   * reset it without returning the read-ahead data for the old
+   * position.
+   */
+  OPEN_BIG ();
+  for (offset = 0; offset < 4 * 65536; offset += 65536)
+    CHECK (check_pread (fd, offset, 65536));
+  CHECK (check_sequential (fd, 3*512*1024 + 7, 65536));
+  CHECK (check_sequential (fd, 10, 100000));
+  CHECK (check_sequential (fd, BIG_SIZE - 3*block - 1, 4096));
+  close (fd);
+
+#undef OPEN_BIG
+#undef CHECK
+
+  return 0;
+}
@@ -35,6 +35,7 @@ let defaults = { name = "";
                  progress = false; camel_name = "";
                  cancellable = false; config_only = false;
                  once_had_no_optargs = false; blocking = true; wrapper = true;
+                 pipelined = false; concurrent = false;
                  c_name = ""; c_function = ""; c_optarg_prefix = "";
                  non_c_aliases = [] }
 
@@ -2334,7 +2335,7 @@ This returns the number of virtual CPUs assigned to the appliance." };
 
   { defaults with
     name = "mount_local"; added = (1, 17, 22);
-    style = RErr, [String "localmountpoint"], [OBool "readonly"; OString "options"; OInt "cachetimeout"; OBool "debugcalls"];
+    style = RErr, [String "localmountpoint"], [OBool "readonly"; OString "options"; OInt "cachetimeout"; OBool "debugcalls"; OInt "readcachesize"; OInt "appliances"];
     shortdesc = "mount on the local filesystem";
     longdesc = "\
 This call exports the libguestfs-accessible filesystem to
@@ -2355,6 +2356,29 @@ for further information.
 If C<debugcalls> is set to true, then additional debugging
 information is generated for every FUSE call.
 
+C<readcachesize> sets the size (in megabytes) of the cache of
+file data read through the mountpoint.  The default is 64 MB.
+Set it to 0 to disable the cache.  Cached data expires after
+C<cachetimeout>, or when the file is changed through the
+mountpoint.
+
+C<appliances> sets how many appliances serve requests.  With
+the default (1), requests are handled one at a time.  If it is
+greater than 1, requests are handled by several threads.  For a
+C<readonly> mount, C<guestfs_mount_local_run> also launches
+C<appliances - 1> extra appliances which open the same disk
+images read-only and mount the same filesystems, so that
+requests are processed in parallel.  The extra appliances are
+only launched if all drives are local files, nothing has been
+written to the drives since launch, and every filesystem is
+mounted read-only (for example with C<guestfs_mount_ro>);
+otherwise the mount is served by this handle alone.  If the
+extra appliances cannot be launched, the mount works with
+fewer appliances.  For a
+read-write mount, no extra appliances are launched and only
+requests which are answered from the caches are processed in
+parallel.
+
 When C<guestfs_mount_local> returns, the filesystem is ready,
 but is not processing requests (access to it will block).  You
 have to call C<guestfs_mount_local_run> to run the main loop.
@@ -3356,6 +3380,387 @@ To download to the current directory, use C<.> as in:
 
 Wildcards cannot be used." };
 
+  { defaults with
+    name = "checksums_list"; added = (1, 29, 49);
+    style = RStringList "checksums", [String "csumtype"; Pathname "directory"; StringList "names"], [];
+    tests = [
+      InitISOFS, Always, TestResult (
+        [["checksums_list"; "md5"; "/"; "known-3 notexists directory known-3"]],
+        "is_string_list (ret, 4, \"46d6ca27ee07cdc6fa99c2e138cc522c\", \"\", \"\", \"46d6ca27ee07cdc6fa99c2e138cc522c\")"), [];
+      InitISOFS, Always, TestResult (
+        [["checksums_list"; "crc"; "/"; "known-3"]],
+        "is_string_list (ret, 1, \"2891671662\")"), [];
+      InitISOFS, Always, TestLastFail (
+        [["checksums_list"; "md5"; "/notexists"; "known-3"]]), []
+    ];
+    shortdesc = "compute checksums of multiple files";
+    longdesc = "\
+This call computes the checksums of multiple files, where all
+files are in the directory C<directory>.  C<names> is the list
+of files from this directory.  C<csumtype> is any of the checksum
+types supported by C<guestfs_checksum>.
+
+On return you get a list of strings, with a one-to-one
+correspondence to the C<names> list.  Each string is the
+checksum of the file, in the same format as returned by
+C<guestfs_checksum>.
+
+If a name is not a regular file or cannot be opened, then
+the corresponding result string is the empty string C<\"\">,
+and the other files are still checksummed.  However if there
+is an error reading one of the files, the whole call fails
+with that error.
+
+This call is intended for programs that want to checksum
+all the files in a directory without making one round-trip
+per file." };
+
+  { defaults with
+    name = "set_inspect_cache"; added = (1, 29, 49);
+    style = RErr, [Bool "inspectcache"], [];
+    fish_alias = ["inspect-cache"]; config_only = true;
+    blocking = false;
+    shortdesc = "enable or disable the inspection cache";
+    longdesc = "\
+If C<inspectcache> is true, the results of C<guestfs_inspect_os>
+and C<guestfs_inspect_list_applications2> are saved in a cache
+under C<guestfs_get_cachedir>, and later inspections of the same
+disk images are answered from the cache.
+
+The cache is keyed by the drives that have been added: their
+paths, formats, sizes, device and inode numbers, modification and
+change times (to the nanosecond) and a checksum of the start of
+each image.  Only local files can be
+cached.  Backing files of overlays are B<not> checked, so do not
+enable the cache if the backing file of an added drive may be
+changed.
+
+When the cache has an answer, C<guestfs_inspect_os> may be called
+before C<guestfs_launch>, and the C<guestfs_inspect_get_*> calls
+then work without the appliance being launched.
+
+The default is false.  You can also enable the cache by setting
+the environment variable C<LIBGUESTFS_INSPECT_CACHE=1>." };
+
+  { defaults with
+    name = "get_inspect_cache"; added = (1, 29, 49);
+    style = RBool "inspectcache", [], [];
+    blocking = false;
+    shortdesc = "get the inspection cache flag";
+    longdesc = "\
+This returns the inspection cache flag.  See
+C<guestfs_set_inspect_cache>." };
+
+  { defaults with
+    name = "set_launch_pool"; added = (1, 29, 49);
+    style = RErr, [Int "size"], [];
+    fish_alias = ["launch-pool"]; config_only = true;
+    blocking = false;
+    shortdesc = "use pre-launched appliances";
+    longdesc = "\
+If C<size> is greater than zero and no drives have been added to
+the handle, C<guestfs_launch> takes an appliance which has already
+been started from a pool of appliances shared by all handles in the
+process.  The library then starts new appliances in the background
+until C<size> appliances with the same settings are available again.
+The first launch in the process (and any launch which finds the pool
+empty) starts an appliance in the normal way.
+
+Drives are then hot-added by calling C<guestfs_add_drive_opts> with
+a C<label> after launch, and should be referred to as
+F</dev/disk/guestfs/LABEL>.  The device names of hot-added drives
+are the same whether or not the appliance came from the pool.
+
+Since this uses hotplugging, it only works with backends which
+support it (at present only the libvirt backend).  Note that:
+
+=over 4
+
+=item *
+
+The pool is not used if drives were added before launch, because
+they would get different device names from a normal launch.
+
+=item *
+
+A pre-launched appliance is only used if it was started with the
+same backend, backend settings, hypervisor, appliance path, kernel
+command line, memory size, number of CPUs, network, SELinux,
+temporary and cache directories as this handle.
+
+=item *
+
+The pool is not used if the handle has C<guestfs_config> parameters
+or is in verbose mode.
+
+=back
+
+The default is C<0> (don't use the pool)." };
+
+  { defaults with
+    name = "get_launch_pool"; added = (1, 29, 49);
+    style = RInt "size", [], [];
+    blocking = false;
+    shortdesc = "get the size of the launch pool";
+    longdesc = "\
+This returns the size of the launch pool.  See
+C<guestfs_set_launch_pool>." };
+
+  { defaults with
+    name = "set_reuse_overlays"; added = (1, 29, 49);
+    style = RErr, [Bool "reuseoverlays"], [];
+    fish_alias = ["reuse-overlays"]; config_only = true;
+    blocking = false;
+    shortdesc = "keep overlays of read-only drives across relaunch";
+    longdesc = "\
+Each drive added read-only (see the C<readonly> parameter of
+C<guestfs_add_drive_opts>) is protected by an overlay, a temporary
+file which receives any writes.  Normally a new overlay is created
+every time the drive is added.
+
+If C<reuseoverlays> is true, then after C<guestfs_shutdown> the
+overlays are kept, and if the same local file is added again before
+the next C<guestfs_launch> its overlay is reset to empty and used
+again.  Programs which shut down and relaunch the same handle with
+the same read-only drives can use this to avoid creating the
+overlays each time.
+
+Writes made to a drive before the shutdown are discarded as usual.
+An overlay is not reused if the file has changed size or
+modification time since the overlay was created.
+
+The default is false." };
+
+  { defaults with
+    name = "get_reuse_overlays"; added = (1, 29, 49);
+    style = RBool "reuseoverlays", [], [];
+    blocking = false;
+    shortdesc = "get the reuse overlays flag";
+    longdesc = "\
+This returns the reuse overlays flag.  See
+C<guestfs_set_reuse_overlays>." };
+
+  { defaults with
+    name = "get_launch_timings"; added = (1, 29, 49);
+    style = RStructList ("timings", "launch_timing"), [], [];
+    blocking = false;
+    shortdesc = "get the time taken by each phase of launch";
+    longdesc = "\
+This returns how long each phase of the most recent
+C<guestfs_launch> took.  Each phase starts where the previous one
+finished, so together they cover the whole launch.  C<lt_start> is
+the start of the phase and C<lt_duration> is its length, both in
+microseconds (with a resolution of one millisecond), measured from
+the call to C<guestfs_launch>.
+
+The phases are returned in the order they happened.  Which phases
+appear depends on the backend and on what could be detected.  The
+possible phases are:
+
+=over 4
+
+=item C<qemu_probe>
+
+Testing the features of qemu (direct backend), or connecting to
+libvirt and reading its capabilities (libvirt backend).
+
+=item C<appliance>
+
+Checking, and if necessary building, the appliance.
+
+=item C<overlay>
+
+Creating the overlay on top of the appliance disk.
+
+=item C<qemu_exec>
+
+Preparing the command line or domain XML and starting qemu.
+
+=item C<firmware>
+
+Running the firmware, up to the point where the kernel starts.  This
+is only seen if the kernel banner is printed on the console, which
+normally requires verbose mode.  Otherwise the time is included in
+the C<kernel> phase.
+
+=item C<kernel>
+
+Booting the kernel, up to the point where the appliance C</init>
+script starts.
+
+=item C<init>
+
+Running the appliance C</init> script, up to the point where it
+starts the daemon.
+
+=item C<daemon>
+
+Starting the daemon (under valgrind, if the appliance runs it that
+way), up to the point where it tells the library that it is ready.
+With an appliance from an older version of libguestfs, this phase
+also includes the C<init> phase.
+
+=item C<negotiate>
+
+Negotiating protocol features with the daemon.
+
+=item C<pool>
+
+Taking over an appliance from the launch pool (see
+C<guestfs_set_launch_pool>).  In this case most of the phases above
+do not appear.
+
+=back
+
+If the handle has not been launched, this returns an empty list.
+If launch failed, the phases up to the failure are returned.
+
+You should not rely on the set of phases, which may change in
+future." };
+
+  { defaults with
+    name = "set_workload"; added = (1, 29, 49);
+    style = RErr, [String "workload"], [];
+    fish_alias = ["workload"]; config_only = true;
+    blocking = false;
+    shortdesc = "size the appliance for a kind of operation";
+    longdesc = "\
+Tell libguestfs what the handle will mostly be used for, so that
+C<guestfs_launch> can choose the memory size and number of virtual
+CPUs of the appliance to suit it and the drives that have been
+added.  C<workload> can be:
+
+=over 4
+
+=item C<inspection>
+
+Inspecting the guest (see L<guestfs(3)/INSPECTION>).  A little more
+memory is given for each drive, and one vCPU per drive, up to 4.
+
+=item C<copy>
+
+Copying large amounts of data in or out of the guest.  The appliance
+gets extra memory for the page cache and 2 vCPUs.
+
+=item C<mkfs>
+
+Creating or checking filesystems.  Memory is added in proportion to
+the total size of the drives.
+
+=item C<\"\">
+
+The empty string restores the default, which is to use the default
+memory size and a single vCPU.
+
+=back
+
+The appliance is never given more than half of the memory of the
+host, or more vCPUs than the host has.  A memory size or number of
+vCPUs set with C<guestfs_set_memsize>, C<LIBGUESTFS_MEMSIZE> or
+C<guestfs_set_smp> is always used as it is.
+
+After launch, C<guestfs_get_memsize> and C<guestfs_get_smp> return
+the values which were chosen." };
+
+  { defaults with
+    name = "get_workload"; added = (1, 29, 49);
+    style = RString "workload", [], [];
+    blocking = false;
+    shortdesc = "get the workload";
+    longdesc = "\
+This returns the workload set by C<guestfs_set_workload>, or
+the empty string if none was set." };
+
+  { defaults with
+    name = "estimate_max_handles"; added = (1, 29, 49);
+    style = RInt "handles", [], [];
+    blocking = false;
+    shortdesc = "estimate how many appliances the host can run";
+    longdesc = "\
+Estimate how many appliances configured like this handle (with the
+same memory size, workload and drives) could be launched at the
+same time without running the host out of memory.  This is based on
+the memory currently available on the host, so the answer changes
+as other programs start and stop.
+
+Programs which process many guests in parallel can use this to
+choose the number of threads.  The result is always at least 1." };
+
+  { defaults with
+    name = "get_appliance_rss"; added = (1, 29, 49);
+    style = RInt64 "rss", [], [];
+    blocking = false;
+    shortdesc = "get the host memory used by the appliance";
+    longdesc = "\
+Return the resident set size (RSS) in bytes of the hypervisor
+process running the appliance, that is, how much host memory the
+appliance is using at the moment.  This can only be called after
+launch, and is not supported by every backend.
+
+The appliance has a virtio-balloon device with free page reporting
+when the hypervisor supports it (qemu E<ge> 5.1, and libvirt
+E<ge> 6.9 with the libvirt backend).  When no call has been made for
+30 seconds, the daemon drops its caches, and the memory which is
+freed is given back to the host.  The memory is allocated again as
+soon as it is needed, so this only costs some speed on the next
+call.  You can use this call to see how much memory an idle handle
+holds." };
+
+  { defaults with
+    name = "get_call_stats"; added = (1, 29, 49);
+    style = RStructList ("stats", "call_stat"), [], [];
+    blocking = false;
+    shortdesc = "get statistics about calls made on the handle";
+    longdesc = "\
+Return statistics about the calls to the daemon made on this
+handle since it was created, one entry for each kind of call that
+has been made.  The fields are:
+
+=over 4
+
+=item C<cs_name>
+
+The name of the call, eg. C<\"mount\">.
+
+=item C<cs_calls>
+
+The number of calls.
+
+=item C<cs_bytes_sent>
+
+=item C<cs_bytes_received>
+
+The number of bytes sent to and received from the daemon, including
+files which were uploaded or downloaded.
+
+=item C<cs_total_us>
+
+=item C<cs_p50_us>
+
+=item C<cs_p99_us>
+
+The total time taken by the calls, and the time within which 50%
+and 99% of the calls completed, in microseconds.  This is measured
+in the library, from sending the call until the reply (and any
+downloaded files) has been received.  The percentiles are estimates,
+accurate to about 10%.
+
+=item C<cs_daemon_us>
+
+=item C<cs_daemon_p50_us>
+
+=item C<cs_daemon_p99_us>
+
+The same times measured inside the daemon, that is, without the
+time spent passing the call and its reply between the library and
+the appliance.  These only cover the calls made since the current
+appliance was launched, and are 0 if the handle is not launched.
+
+=back
+
+Collecting the statistics costs very little, so it is always
+done." };
+
 ]
 
 (* daemon_functions are any functions which cause some action
@@ -3974,6 +4379,8 @@ yourself (Augeas support makes this relatively easy)." };
     name = "exists"; added = (0, 0, 8);
     style = RBool "existsflag", [Pathname "path"], [];
     proc_nr = Some 36;
+    pipelined = true;
+    concurrent = true;
     tests = [
       InitISOFS, Always, TestResultTrue (
         [["exists"; "/empty"]]), [];
@@ -3991,6 +4398,7 @@ See also C<guestfs_is_file>, C<guestfs_is_dir>, C<guestfs_stat>." };
     name = "is_file"; added = (0, 0, 8);
     style = RBool "fileflag", [Pathname "path"], [OBool "followsymlinks"];
     proc_nr = Some 37;
+    concurrent = true;
     once_had_no_optargs = true;
     tests = [
       InitISOFS, Always, TestResultTrue (
@@ -4016,6 +4424,7 @@ See also C<guestfs_stat>." };
     name = "is_dir"; added = (0, 0, 8);
     style = RBool "dirflag", [Pathname "path"], [OBool "followsymlinks"];
     proc_nr = Some 38;
+    concurrent = true;
     once_had_no_optargs = true;
     tests = [
       InitISOFS, Always, TestResultFalse (
@@ -4723,6 +5132,9 @@ See also C<guestfs_upload>, C<guestfs_cat>." };
     name = "checksum"; added = (1, 0, 2);
     style = RString "checksum", [String "csumtype"; Pathname "path"], [];
     proc_nr = Some 68;
+    pipelined = true;
+    concurrent = true;
+    progress = true;
     tests = [
       InitISOFS, Always, TestResultString (
         [["checksum"; "crc"; "/known-3"]], "2891671662"), [];
@@ -4761,27 +5173,27 @@ for the C<cksum> command.
 
 =item C<md5>
 
-Compute the MD5 hash (using the C<md5sum> program).
+Compute the MD5 hash (the same as the C<md5sum> program).
 
 =item C<sha1>
 
-Compute the SHA1 hash (using the C<sha1sum> program).
+Compute the SHA1 hash (the same as the C<sha1sum> program).
 
 =item C<sha224>
 
-Compute the SHA224 hash (using the C<sha224sum> program).
+Compute the SHA224 hash (the same as the C<sha224sum> program).
 
 =item C<sha256>
 
-Compute the SHA256 hash (using the C<sha256sum> program).
+Compute the SHA256 hash (the same as the C<sha256sum> program).
 
 =item C<sha384>
 
-Compute the SHA384 hash (using the C<sha384sum> program).
+Compute the SHA384 hash (the same as the C<sha384sum> program).
 
 =item C<sha512>
 
-Compute the SHA512 hash (using the C<sha512sum> program).
+Compute the SHA512 hash (the same as the C<sha512sum> program).
 
 =back
 
@@ -4789,7 +5201,8 @@ The checksum is returned as a printable string.
 
 To get the checksum for a device, use C<guestfs_checksum_device>.
 
-To get the checksums for many files, use C<guestfs_checksums_out>." };
+To get the checksums of many files in one directory, use
+C<guestfs_checksums_list> or C<guestfs_checksums_out>." };
 
   { defaults with
     name = "tar_in"; added = (1, 0, 3);
@@ -6408,6 +6821,7 @@ process compressed files." };
     name = "getxattrs"; added = (1, 0, 59);
     style = RStructList ("xattrs", "xattr"), [Pathname "path"], [];
     proc_nr = Some 141;
+    pipelined = true;
     optional = Some "linuxxattrs";
     shortdesc = "list extended attributes of a file or directory";
     longdesc = "\
@@ -6423,6 +6837,7 @@ See also: C<guestfs_lgetxattrs>, L<attr(5)>." };
     name = "lgetxattrs"; added = (1, 0, 59);
     style = RStructList ("xattrs", "xattr"), [Pathname "path"], [];
     proc_nr = Some 142;
+    pipelined = true;
     optional = Some "linuxxattrs";
     shortdesc = "list extended attributes of a file or directory";
     longdesc = "\
@@ -6811,6 +7226,7 @@ matching lines." };
     name = "realpath"; added = (1, 0, 66);
     style = RString "rpath", [Pathname "path"], [];
     proc_nr = Some 163;
+    pipelined = true;
     tests = [
       InitISOFS, Always, TestResultString (
         [["realpath"; "/../directory"]], "/directory"), []
@@ -6888,6 +7304,8 @@ The I<-f> option removes the link (C<linkname>) if it exists already." };
     name = "readlink"; added = (1, 0, 66);
     style = RString "link", [Pathname "path"], [];
     proc_nr = Some 168;
+    pipelined = true;
+    concurrent = true;
     shortdesc = "read the target of a symbolic link";
     longdesc = "\
 This command reads the target of a symbolic link." };
@@ -8022,6 +8440,7 @@ See also C<guestfs_filesystem_available>." };
     name = "dd"; added = (1, 0, 80);
     style = RErr, [Dev_or_Path "src"; Dev_or_Path "dest"], [];
     proc_nr = Some 217;
+    progress = true;
     deprecated_by = Some "copy_device_to_device";
     tests = [
       InitScratchFS, Always, TestResult (
@@ -8029,7 +8448,20 @@ See also C<guestfs_filesystem_available>." };
          ["write"; "/dd/src"; "hello, world"];
          ["dd"; "/dd/src"; "/dd/dest"];
          ["read_file"; "/dd/dest"]],
-        "compare_buffers (ret, size, \"hello, world\", 12) == 0"), []
+        "compare_buffers (ret, size, \"hello, world\", 12) == 0"), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/dd2"];
+         ["write"; "/dd2/src"; "hello, world"];
+         ["dd"; "/dd2/src"; "/dev/sdc"];
+         ["pread_device"; "/dev/sdc"; "12"; "0"]],
+        "compare_buffers (ret, size, \"hello, world\", 12) == 0"), [];
+      InitScratchFS, Always, TestResultString (
+        [["mkdir"; "/dd3"];
+         ["zero_device"; "/dev/sdc"];
+         ["pwrite_device"; "/dev/sdc"; "X"; "8191"];
+         ["pwrite_device"; "/dev/sdc"; "Y"; "3145729"];
+         ["dd"; "/dev/sdc"; "/dd3/dest"];
+         ["checksum"; "md5"; "/dd3/dest"]], "6604bcc0cb60cb22e3b6838986430759"), []
     ];
     shortdesc = "copy from source to destination using dd";
     longdesc = "\
@@ -8047,10 +8479,23 @@ This command cannot do partial copies
     name = "filesize"; added = (1, 0, 82);
     style = RInt64 "size", [Pathname "file"], [];
     proc_nr = Some 218;
+    pipelined = true;
+    concurrent = true;
     tests = [
       InitScratchFS, Always, TestResult (
         [["write"; "/filesize"; "hello, world"];
-         ["filesize"; "/filesize"]], "ret == 12"), []
+         ["filesize"; "/filesize"]], "ret == 12"), [];
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/filesize2"];
+         ["write"; "/filesize2/file"; "hello, world"];
+         ["ln_s"; "/filesize2/file"; "/filesize2/abs"];
+         ["filesize"; "/filesize2/abs"]], "ret == 12"), [];
+      (* ".." must not go above the root of the guest filesystem. *)
+      InitScratchFS, Always, TestResult (
+        [["mkdir"; "/filesize3"];
+         ["write"; "/filesize3/file"; "hello, world"];
+         ["ln_s"; "../../../filesize3/file"; "/filesize3/rel"];
+         ["filesize"; "/filesize3/rel"]], "ret == 12"), []
     ];
     shortdesc = "return the size of the file in bytes";
     longdesc = "\
@@ -8326,6 +8771,7 @@ types (see C<guestfs_part_get_parttype>)." };
     name = "checksum_device"; added = (1, 3, 2);
     style = RString "checksum", [String "csumtype"; Device "device"], [];
     proc_nr = Some 237;
+    progress = true;
     tests = [
       InitISOFS, Always, TestResult (
         [["checksum_device"; "md5"; "/dev/sdd"]],
@@ -8829,6 +9275,7 @@ To find the label of a filesystem, use C<guestfs_vfs_label>." };
     name = "is_chardev"; added = (1, 5, 10);
     style = RBool "flag", [Pathname "path"], [OBool "followsymlinks"];
     proc_nr = Some 267;
+    concurrent = true;
     once_had_no_optargs = true;
     tests = [
       InitISOFS, Always, TestResultFalse (
@@ -8852,6 +9299,7 @@ See also C<guestfs_stat>." };
     name = "is_blockdev"; added = (1, 5, 10);
     style = RBool "flag", [Pathname "path"], [OBool "followsymlinks"];
     proc_nr = Some 268;
+    concurrent = true;
     once_had_no_optargs = true;
     tests = [
       InitISOFS, Always, TestResultFalse (
@@ -8879,6 +9327,7 @@ See also C<guestfs_stat>." };
     name = "is_fifo"; added = (1, 5, 10);
     style = RBool "flag", [Pathname "path"], [OBool "followsymlinks"];
     proc_nr = Some 269;
+    concurrent = true;
     once_had_no_optargs = true;
     tests = [
       InitISOFS, Always, TestResultFalse (
@@ -8902,6 +9351,8 @@ See also C<guestfs_stat>." };
     name = "is_symlink"; added = (1, 5, 10);
     style = RBool "flag", [Pathname "path"], [];
     proc_nr = Some 270;
+    pipelined = true;
+    concurrent = true;
     tests = [
       InitISOFS, Always, TestResultFalse (
         [["is_symlink"; "/directory"]]), [];
@@ -8919,6 +9370,7 @@ See also C<guestfs_stat>." };
     name = "is_socket"; added = (1, 5, 10);
     style = RBool "flag", [Pathname "path"], [OBool "followsymlinks"];
     proc_nr = Some 271;
+    concurrent = true;
     once_had_no_optargs = true;
     (* XXX Need a positive test for sockets. *)
     tests = [
@@ -9145,6 +9597,7 @@ which sets sector size for ufs filesystem.
     name = "getxattr"; added = (1, 7, 24);
     style = RBufferOut "xattr", [Pathname "path"; String "name"], [];
     proc_nr = Some 279;
+    pipelined = true;
     optional = Some "linuxxattrs";
     shortdesc = "get a single extended attribute";
     longdesc = "\
@@ -9168,6 +9621,7 @@ See also: C<guestfs_getxattrs>, C<guestfs_lgetxattr>, L<attr(5)>." };
     name = "lgetxattr"; added = (1, 7, 24);
     style = RBufferOut "xattr", [Pathname "path"; String "name"], [];
     proc_nr = Some 280;
+    pipelined = true;
     optional = Some "linuxxattrs";
     shortdesc = "get a single extended attribute";
     longdesc = "\
@@ -9221,11 +9675,24 @@ handle is closed." };
     name = "is_zero"; added = (1, 11, 8);
     style = RBool "zeroflag", [Pathname "path"], [];
     proc_nr = Some 283;
+    progress = true;
     tests = [
       InitISOFS, Always, TestResultTrue (
         [["is_zero"; "/100kallzeroes"]]), [];
       InitISOFS, Always, TestResultFalse (
-        [["is_zero"; "/100kallspaces"]]), []
+        [["is_zero"; "/100kallspaces"]]), [];
+      (* The only non-zero byte is the last one, in the last of several
+       * copy buffers.
+       *)
+      InitScratchFS, Always, TestResultFalse (
+        [["mkdir"; "/is_zero"];
+         ["fill"; "0"; "9999999"; "/is_zero/file"];
+         ["pwrite"; "/is_zero/file"; "x"; "9999998"];
+         ["is_zero"; "/is_zero/file"]]), [];
+      InitScratchFS, Always, TestResultTrue (
+        [["mkdir"; "/is_zero2"];
+         ["fill"; "0"; "9999999"; "/is_zero2/file"];
+         ["is_zero"; "/is_zero2/file"]]), []
     ];
     shortdesc = "test if a file contains all zero bytes";
     longdesc = "\
@@ -9236,13 +9703,18 @@ it contains all zero bytes." };
     name = "is_zero_device"; added = (1, 11, 8);
     style = RBool "zeroflag", [Device "device"], [];
     proc_nr = Some 284;
+    progress = true;
     tests = [
       InitBasicFS, Always, TestResultTrue (
         [["umount"; "/dev/sda1"; "false"; "false"];
          ["zero_device"; "/dev/sda1"];
          ["is_zero_device"; "/dev/sda1"]]), [];
       InitBasicFS, Always, TestResultFalse (
-        [["is_zero_device"; "/dev/sda1"]]), []
+        [["is_zero_device"; "/dev/sda1"]]), [];
+      InitScratchFS, Always, TestResultFalse (
+        [["zero_device"; "/dev/sdc"];
+         ["pwrite_device"; "/dev/sdc"; "x"; "10485759"];
+         ["is_zero_device"; "/dev/sdc"]]), []
     ];
     shortdesc = "test if a device contains all zero bytes";
     longdesc = "\
@@ -9429,6 +9901,23 @@ See also C<guestfs_part_to_dev>." };
     style = RErr, [Device "src"; Device "dest"], [OInt64 "srcoffset"; OInt64 "destoffset"; OInt64 "size"; OBool "sparse"; OBool "append"];
     proc_nr = Some 294;
     progress = true;
+    tests = [
+      InitScratchFS, Always, TestResult (
+        [["zero_device"; "/dev/sdc"];
+         ["pwrite_device"; "/dev/sdc"; "abcdefghij"; "4095"];
+         ["copy_device_to_device"; "/dev/sdc"; "/dev/sda"; "4090"; "12345"; "20"; ""; ""];
+         ["pread_device"; "/dev/sda"; "20"; "12345"]],
+        "compare_buffers (ret, size, \"\\0\\0\\0\\0\\0abcdefghij\\0\\0\\0\\0\\0\", 20) == 0"), [];
+      (* An aligned source offset, so the source is read with O_DIRECT,
+       * and a size which is not a multiple of the block size.
+       *)
+      InitScratchFS, Always, TestResult (
+        [["zero_device"; "/dev/sdc"];
+         ["pwrite_device"; "/dev/sdc"; "abcdefghij"; "4095"];
+         ["copy_device_to_device"; "/dev/sdc"; "/dev/sda"; "0"; "8192"; "4100"; ""; ""];
+         ["pread_device"; "/dev/sda"; "5"; "12287"]],
+        "compare_buffers (ret, size, \"abcde\", 5) == 0"), []
+    ];
     shortdesc = "copy from source device to destination device";
     longdesc = "\
 The four calls C<guestfs_copy_device_to_device>,
@@ -9466,6 +9955,26 @@ in incorrect copying." };
     style = RErr, [Device "src"; Pathname "dest"], [OInt64 "srcoffset"; OInt64 "destoffset"; OInt64 "size"; OBool "sparse"; OBool "append"];
     proc_nr = Some 295;
     progress = true;
+    tests = [
+      (* Sparse copy of a device larger than the copy buffers, which
+       * ends in zeroes.
+       *)
+      InitScratchFS, Always, TestResultString (
+        [["mkdir"; "/copydf"];
+         ["zero_device"; "/dev/sdc"];
+         ["pwrite_device"; "/dev/sdc"; "X"; "8191"];
+         ["pwrite_device"; "/dev/sdc"; "Y"; "3145729"];
+         ["copy_device_to_file"; "/dev/sdc"; "/copydf/dest"; ""; ""; ""; "true"; ""];
+         ["checksum"; "md5"; "/copydf/dest"]], "6604bcc0cb60cb22e3b6838986430759"), [];
+      (* Crosses the end of the first copy buffer by one byte. *)
+      InitScratchFS, Always, TestResultString (
+        [["mkdir"; "/copydf2"];
+         ["zero_device"; "/dev/sdc"];
+         ["pwrite_device"; "/dev/sdc"; "X"; "8191"];
+         ["pwrite_device"; "/dev/sdc"; "Y"; "3145729"];
+         ["copy_device_to_file"; "/dev/sdc"; "/copydf2/dest"; "4096"; ""; "4194305"; ""; ""];
+         ["checksum"; "md5"; "/copydf2/dest"]], "858abc03cf0f6c535f6833fb37499ed1"), []
+    ];
     shortdesc = "copy from source device to destination file";
     longdesc = "\
 See C<guestfs_copy_device_to_device> for a general overview
@@ -12094,6 +12603,8 @@ Get the realtime (wallclock) timestamp of the current journal entry." };
     name = "statns"; added = (1, 27, 53);
     style = RStruct ("statbuf", "statns"), [Pathname "path"], [];
     proc_nr = Some 421;
+    pipelined = true;
+    concurrent = true;
     tests = [
       InitISOFS, Always, TestResult (
         [["statns"; "/empty"]], "ret->st_size == 0"), []
@@ -12108,6 +12619,8 @@ This is the same as the L<stat(2)> system call." };
     name = "lstatns"; added = (1, 27, 53);
     style = RStruct ("statbuf", "statns"), [Pathname "path"], [];
     proc_nr = Some 422;
+    pipelined = true;
+    concurrent = true;
     tests = [
       InitISOFS, Always, TestResult (
         [["lstatns"; "/empty"]], "ret->st_size == 0"), []
@@ -12653,6 +13166,350 @@ Specifies  the  type  of file allocation tables used (12, 16 or 32 bit).
 
 =back" };
 
+  { defaults with
+    name = "internal_set_chunk_size"; added = (1, 29, 49);
+    style = RInt "chunksize", [Int "chunksize"], [];
+    proc_nr = Some 457;
+    visibility = VInternal;
+    shortdesc = "negotiate the file transfer chunk size";
+    longdesc = "\
+This function is used internally at launch to negotiate the
+size of the chunks used for FileIn and FileOut transfers.
+The library passes the largest chunk size it would like to use.
+The daemon returns the chunk size that both sides must use
+from now on, which is never larger than the requested size." };
+
+  { defaults with
+    name = "internal_checksums_list"; added = (1, 29, 49);
+    style = RStringList "checksums", [String "csumtype"; Pathname "directory"; StringList "names"], [];
+    proc_nr = Some 458;
+    visibility = VInternal;
+    concurrent = true;
+    shortdesc = "compute checksums of multiple files";
+    longdesc = "\
+This is the internal call which implements C<guestfs_checksums_list>." };
+
+  { defaults with
+    name = "walk_out"; added = (1, 29, 49);
+    style = RErr, [Pathname "directory"; FileOut "filename"], [OString "checksum"];
+    proc_nr = Some 459;
+    cancellable = true;
+    shortdesc = "stat all files in a directory tree";
+    longdesc = "\
+This command walks the directory tree starting at C<directory>
+and writes a record for every file and directory found to the local
+file C<filename>.  It is equivalent to calling C<guestfs_ls>,
+C<guestfs_lstatns>, C<guestfs_lgetxattrs> and C<guestfs_readlink>
+on every entry in the tree, but it takes a single round trip.
+
+The first record is for C<directory> itself.  It is followed by the
+contents of the directory in the order returned by C<guestfs_ls>.
+Each subdirectory is followed immediately by its own contents
+(a pre-order, depth-first walk).  Symbolic links are never followed.
+
+Each record consists of the following fields, where strings are
+terminated by an ASCII NUL character and integers are stored in
+big-endian byte order:
+
+=over 4
+
+=item *
+
+The path, relative to C<directory>.  It is the empty string for
+C<directory> itself.
+
+=item *
+
+Sixteen signed 64 bit integers, the fields of
+C<struct guestfs_statns> from C<st_dev> to C<st_ctime_nsec> in order.
+
+=item *
+
+An unsigned 32 bit integer, the number of extended attributes.  It is
+followed by that many extended attributes, each consisting of the
+name, an unsigned 32 bit integer giving the length of the value, and
+the value.  If the extended attributes of the entry could not be
+read, the number is C<0>.
+
+=item *
+
+If the entry is a symbolic link, the target of the link, else the
+empty string.
+
+=item *
+
+If the optional C<checksum> argument was given and the entry is a
+regular file, its checksum (see C<guestfs_checksum> for the types
+of checksum supported), else the empty string.
+
+=back" };
+
+  { defaults with
+    name = "internal_set_sparse_transfers"; added = (1, 29, 49);
+    style = RErr, [], [];
+    proc_nr = Some 460;
+    visibility = VInternal;
+    shortdesc = "enable holes in file transfers";
+    longdesc = "\
+This function is used internally at launch to tell the daemon
+that the library understands hole chunks in file transfers.
+After this call, both sides may send runs of zero bytes as
+holes instead of as data." };
+
+  { defaults with
+    name = "internal_probe_filesystems"; added = (1, 29, 49);
+    style = RStringList "types", [StringList "mountables"; StringList "vfstypes"; StringList "paths"; StringList "nocasepaths"], [];
+    proc_nr = Some 461;
+    visibility = VInternal;
+    shortdesc = "probe for paths on several filesystems";
+    longdesc = "\
+This function is used internally by C<guestfs_inspect_os>.  Each
+filesystem in C<mountables> (whose types, as returned by
+C<guestfs_list_filesystems>, are in C<vfstypes>) is mounted
+read-only away from the sysroot, and every path in C<paths> and
+C<nocasepaths> is looked up on it without following symlinks.
+Paths in C<nocasepaths> are matched case-insensitively.
+Filesystems are probed in parallel.
+
+One string is returned for each filesystem.  It is empty if the
+filesystem could not be mounted.  Otherwise it has one character
+for each path, in order: C<f> (regular file), C<d> (directory),
+C<l> (symlink), C<o> (other), C<-> (not found) or C<?> (a
+directory in the path is a symlink, so the caller must check the
+path itself)." };
+
+  { defaults with
+    name = "internal_call_stats"; added = (1, 29, 49);
+    style = RStructList ("stats", "call_stat"), [], [];
+    proc_nr = Some 462;
+    visibility = VInternal;
+    shortdesc = "get call statistics from the daemon";
+    longdesc = "\
+This function is used internally by C<guestfs_get_call_stats>.
+It returns the statistics kept by the daemon, with the times it
+measured in C<cs_total_us>, C<cs_p50_us> and C<cs_p99_us>." };
+
+  { defaults with
+    name = "open_handle"; added = (1, 29, 49);
+    style = RInt "handle", [Pathname "path"], [OBool "readwrite"];
+    proc_nr = Some 463;
+    shortdesc = "open a file and return a handle";
+    longdesc = "\
+This opens the file C<path> and returns a handle (a small
+non-negative integer) which can be used with C<guestfs_pread_handle>
+and C<guestfs_pwrite_handle>.  The file is opened read-only, or
+for reading and writing if C<readwrite> is true.
+
+Unlike C<guestfs_pread> and C<guestfs_pwrite>, which open the
+file on every call, the file stays open until the handle is
+closed with C<guestfs_close_handle>.  This is faster when doing
+many small reads or writes at random offsets.
+
+An open handle keeps the filesystem busy, so it cannot be
+unmounted.  C<guestfs_umount_all> closes all handles." };
+
+  { defaults with
+    name = "close_handle"; added = (1, 29, 49);
+    style = RErr, [Int "handle"], [];
+    proc_nr = Some 464;
+    tests = [
+      InitISOFS, Always, TestLastFail (
+        [["open_handle"; "/known-4"; ""];
+         ["close_handle"; "0"];
+         ["close_handle"; "0"]]), []
+    ];
+    shortdesc = "close a file handle";
+    longdesc = "\
+This closes a handle returned by C<guestfs_open_handle>.
+The handle number may be reused by a later C<guestfs_open_handle>." };
+
+  { defaults with
+    name = "pread_handle"; added = (1, 29, 49);
+    style = RBufferOut "content", [Int "handle"; Int "count"; Int64 "offset"], [];
+    proc_nr = Some 465;
+    concurrent = true;
+    protocol_limit_warning = true;
+    tests = [
+      InitISOFS, Always, TestResult (
+        [["open_handle"; "/known-4"; ""];
+         ["pread_handle"; "0"; "1"; "3"]],
+        "compare_buffers (ret, size, \"\\n\", 1) == 0"), [["close_handle"; "0"]]
+    ];
+    shortdesc = "read part of an open file";
+    longdesc = "\
+This is the same as C<guestfs_pread>, except that it reads from
+a file opened with C<guestfs_open_handle>." };
+
+  { defaults with
+    name = "pwrite_handle"; added = (1, 29, 49);
+    style = RInt "nbytes", [Int "handle"; BufferIn "content"; Int64 "offset"], [];
+    proc_nr = Some 466;
+    protocol_limit_warning = true;
+    tests = [
+      InitScratchFS, Always, TestResultString (
+        [["write"; "/pwrite_handle"; "new file contents"];
+         ["open_handle"; "/pwrite_handle"; "true"];
+         ["pwrite_handle"; "0"; "data"; "4"];
+         ["close_handle"; "0"];
+         ["cat"; "/pwrite_handle"]], "new data contents"), []
+    ];
+    shortdesc = "write to part of an open file";
+    longdesc = "\
+This is the same as C<guestfs_pwrite>, except that it writes to
+a file opened with C<guestfs_open_handle> with C<readwrite> set
+to true." };
+
+  { defaults with
+    name = "hivex_node_get_subtree"; added = (1, 29, 49);
+    style = RStructList ("entries", "hivex_entry"), [Int64 "nodeh"; Int "depth"], [];
+    proc_nr = Some 467;
+    optional = Some "hivex";
+    protocol_limit_warning = true;
+    tests = [
+      InitScratchFS, Always, TestRun (
+        [["upload"; "$srcdir/../data/minimal"; "/hivex_node_get_subtree"];
+         ["hivex_open"; "/hivex_node_get_subtree"; ""; ""; "false"];
+         ["hivex_node_get_subtree"; "0x1020"; "-1"]]), [["hivex_close"]];
+      InitScratchFS, Always, TestResult (
+        [["upload"; "$srcdir/../data/minimal"; "/hivex_node_get_subtree2"];
+         ["hivex_open"; "/hivex_node_get_subtree2"; ""; ""; "true"];
+         ["hivex_node_set_value"; "0x1020"; "key1"; "1"; "abc"];
+         ["hivex_node_set_value"; "0x1020"; "key2"; "3"; "de"];
+         ["hivex_node_add_child"; "0x1020"; "a"];
+         ["hivex_node_add_child"; "0x1020"; "b"];
+         ["hivex_node_get_subtree"; "0x1020"; "-1"]],
+        "ret->len == 5 && "^
+        "ret->val[0].hivex_entry_nodeh == 0x1020 && "^
+        "ret->val[0].hivex_entry_valueh == 0 && "^
+        "STREQ (ret->val[0].hivex_entry_path, \"\") && "^
+        "ret->val[1].hivex_entry_nodeh == 0x1020 && "^
+        "ret->val[1].hivex_entry_valueh != 0 && "^
+        "STREQ (ret->val[1].hivex_entry_path, \"\") && "^
+        "STREQ (ret->val[1].hivex_entry_key, \"key1\") && "^
+        "ret->val[1].hivex_entry_type == 1 && "^
+        "ret->val[1].hivex_entry_value_len == 3 && "^
+        "memcmp (ret->val[1].hivex_entry_value, \"abc\", 3) == 0 && "^
+        "ret->val[2].hivex_entry_valueh != 0 && "^
+        "STREQ (ret->val[2].hivex_entry_key, \"key2\") && "^
+        "ret->val[2].hivex_entry_type == 3 && "^
+        "ret->val[2].hivex_entry_value_len == 2 && "^
+        "memcmp (ret->val[2].hivex_entry_value, \"de\", 2) == 0 && "^
+        "ret->val[3].hivex_entry_valueh == 0 && "^
+        "STREQ (ret->val[3].hivex_entry_path, \"a\") && "^
+        "ret->val[4].hivex_entry_valueh == 0 && "^
+        "STREQ (ret->val[4].hivex_entry_path, \"b\")"), [["hivex_close"]];
+      InitScratchFS, Always, TestResult (
+        [["upload"; "$srcdir/../data/minimal"; "/hivex_node_get_subtree3"];
+         ["hivex_open"; "/hivex_node_get_subtree3"; ""; ""; "true"];
+         ["hivex_node_set_value"; "0x1020"; "key1"; "1"; "abc"];
+         ["hivex_node_add_child"; "0x1020"; "a"];
+         ["hivex_node_get_subtree"; "0x1020"; "0"]],
+        "ret->len == 2 && "^
+        "ret->val[0].hivex_entry_valueh == 0 && "^
+        "STREQ (ret->val[1].hivex_entry_key, \"key1\")"), [["hivex_close"]]
+    ];
+    shortdesc = "return a registry subtree in one call";
+    longdesc = "\
+Return the node C<nodeh>, its values, and the nodes and values
+below it down to C<depth> levels, in one call.  If C<depth> is
+C<0> only C<nodeh> and its values are returned.  If C<depth> is
+C<-1> the whole subtree is returned.
+
+This is much faster than walking the tree with
+C<guestfs_hivex_node_children>, C<guestfs_hivex_node_values>,
+C<guestfs_hivex_value_key> and C<guestfs_hivex_value_value>,
+which need one round trip to the appliance for every node and
+value.
+
+Each node is returned as an entry with C<hivex_entry_valueh>
+set to C<0>, followed by one entry for each of its values,
+followed by its child nodes.  The fields are:
+
+=over 4
+
+=item C<hivex_entry_path>
+
+For the entry of a node, the path of the node relative to
+C<nodeh>, with the names of the nodes separated by backslash
+characters.  This is the empty string for C<nodeh> itself.
+To keep the reply small, this is also the empty string for
+the entries of values, which belong to the node entry before
+them.
+
+=item C<hivex_entry_nodeh>
+
+The node handle.
+
+=item C<hivex_entry_valueh>
+
+The value handle, or C<0> for the entry of the node itself.
+
+=item C<hivex_entry_key>
+
+=item C<hivex_entry_type>
+
+=item C<hivex_entry_value>
+
+The (key, datatype, data) tuple of the value, as returned by
+C<guestfs_hivex_value_key>, C<guestfs_hivex_value_type> and
+C<guestfs_hivex_value_value>.  These are empty for the entry
+of the node itself.
+
+=back
+
+If the subtree would not fit in a single reply message, this
+returns an error, and you should use a smaller C<depth> or
+start from a lower node.  An error is also returned if the
+hive is corrupt and a node is its own ancestor." };
+
+  { defaults with
+    name = "vfs_statvfs"; added = (1, 29, 49);
+    style = RStruct ("statbuf", "statvfs"), [Mountable "mountable"], [];
+    proc_nr = Some 468;
+    tests = [
+      InitEmpty, Always, TestResult (
+        [["part_disk"; "/dev/sda"; "mbr"];
+         ["mkfs"; "ext4"; "/dev/sda1"; ""; "NOARG"; ""; ""; "NOARG"];
+         ["vfs_statvfs"; "/dev/sda1"]],
+        "ret->blocks > 0 && ret->bfree > 0 && ret->bfree < ret->blocks && ret->ffree > 0 && ret->ffree < ret->files"), [];
+      InitISOFS, Always, TestResult (
+        [["vfs_statvfs"; "/dev/sdd"]], "ret->blocks > 0"), []
+    ];
+    shortdesc = "get file system statistics without mounting";
+    longdesc = "\
+Returns file system statistics for the filesystem on C<mountable>,
+which does not need to be mounted.  The fields are the same as
+those returned by C<guestfs_statvfs>.
+
+For ext2/3/4, XFS, btrfs and NTFS the statistics are read from
+the superblock and the allocation metadata, which is much faster
+than mounting the filesystem.  The journal is not replayed, so if
+the filesystem was not cleanly unmounted the numbers may not include
+the most recent changes.  For XFS filesystems the free space is
+approximate, because the space the kernel reserves for metadata
+depends on the kernel version and the filesystem features.  For
+btrfs filesystems using RAID the numbers are approximate, and the
+inode counts are always C<0>.
+The C<fsid> and C<flag> fields are returned as C<-1>.
+
+For other filesystems, and for ext2/3/4 filesystems using unusual
+features, the filesystem is mounted read-only on a private
+mountpoint and L<statvfs(2)> is called on it.
+
+If the filesystem is mounted read-write, use C<guestfs_statvfs>
+instead." };
+
+  { defaults with
+    name = "internal_devices_written"; added = (1, 29, 49);
+    style = RBool "written", [], [];
+    proc_nr = Some 469;
+    visibility = VInternal;
+    shortdesc = "test if the devices have been written to";
+    longdesc = "\
+This returns true if anything has been written to any of the
+devices (as listed by C<guestfs_list_devices>) since the appliance
+started.  It is used by C<guestfs_mount_local>." };
+
 ]
 
 (* Non-API meta-commands available only in guestfish.
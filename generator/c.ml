@@ -322,6 +322,26 @@ L</KEYS AND PASSPHRASES> for more information.\n\n";
     pr "\n\n";
     pr "This is the \"argv variant\" of L</guestfs_%s>.\n\n" c_name;
     pr "See L</CALLS WITH OPTIONAL ARGUMENTS>.\n\n";
+  );
+
+  (* Pipelined variants. *)
+  if f.pipelined then (
+    pr "=head2 guestfs_%s_send\n\n" c_name;
+    generate_prototype ~extern:false ~indent:" " ~handle:"g"
+      ~prefix:"guestfs_" ~suffix:"_send"
+      c_name (RInt "serial", args, []);
+    pr "\n\n";
+    pr "=head2 guestfs_%s_recv\n\n" c_name;
+    generate_prototype ~extern:false ~indent:" " ~handle:"g"
+      ~prefix:"guestfs_" ~suffix:"_recv"
+      c_name (ret, [Int "serial"], []);
+    pr "\n\n";
+    pr "These are the \"pipelined variants\" of L</guestfs_%s>.\n" c_name;
+    pr "C<guestfs_%s_send> sends the request and returns its serial\n" c_name;
+    pr "number (or -1 on error) without waiting for the reply.\n";
+    pr "C<guestfs_%s_recv> waits for the reply with that serial number\n" c_name;
+    pr "and returns the result exactly as L</guestfs_%s> would.\n\n" c_name;
+    pr "See L</PIPELINING>.\n\n";
   )
 
 and generate_actions_pod_back_compat_entry ({ name = name;
@@ -644,7 +664,8 @@ extern GUESTFS_DLL_PUBLIC void *guestfs_next_private (guestfs_h *g, const char *
 
   let generate_action_header { name = shortname;
                                style = ret, args, optargs as style;
-                               deprecated_by = deprecated_by } =
+                               deprecated_by = deprecated_by;
+                               pipelined = pipelined } =
     let test =
       String.length shortname >= 13 &&
         String.sub shortname 0 13 = "internal_test" in
@@ -703,6 +724,18 @@ extern GUESTFS_DLL_PUBLIC void *guestfs_next_private (guestfs_h *g, const char *
         shortname style;
     );
 
+    if pipelined then (
+      pr "#define GUESTFS_HAVE_%s_SEND 1\n" (String.uppercase shortname);
+      generate_prototype ~single_line:true ~newline:true ~handle:"g"
+        ~prefix:"guestfs_" ~suffix:"_send"
+        ~dll_public:true
+        shortname (RInt "serial", args, []);
+      generate_prototype ~single_line:true ~newline:true ~handle:"g"
+        ~prefix:"guestfs_" ~suffix:"_recv"
+        ~dll_public:true
+        shortname (ret, [Int "serial"], []);
+    );
+
     pr "\n"
   in
 
@@ -1629,6 +1662,167 @@ and generate_client_actions hash () =
       () (* no wrapper *)
   ) non_daemon_functions;
 
+  (* Generate code to copy the arguments of a daemon function into
+   * the XDR 'args' struct.
+   *)
+  let marshal_daemon_args name c_name (_, args, optargs as style) errcode =
+    List.iter (
+      function
+      | Pathname n | Device n | Mountable n | Dev_or_Path n 
+      | Mountable_or_Path n | String n
+      | Key n | GUID n ->
+        pr "  args.%s = (char *) %s;\n" n n
+      | OptString n ->
+        pr "  args.%s = %s ? (char **) &%s : NULL;\n" n n n
+      | StringList n | DeviceList n ->
+        pr "  args.%s.%s_val = (char **) %s;\n" n n n;
+        pr "  for (args.%s.%s_len = 0; %s[args.%s.%s_len]; args.%s.%s_len++) ;\n" n n n n n n n;
+      | Bool n ->
+        pr "  args.%s = %s;\n" n n
+      | Int n ->
+        pr "  args.%s = %s;\n" n n
+      | Int64 n ->
+        pr "  args.%s = %s;\n" n n
+      | BufferIn n ->
+        pr "  /* Just catch grossly large sizes. XDR encoding will make this precise. */\n";
+        pr "  if (%s_size >= GUESTFS_MESSAGE_MAX) {\n" n;
+        trace_return_error ~indent:4 name style errcode;
+        pr "    error (g, \"%%s: size of input buffer too large\", \"%s\");\n"
+          name;
+        pr "    return %s;\n" (string_of_errcode errcode);
+        pr "  }\n";
+        pr "  args.%s.%s_val = (char *) %s;\n" n n n;
+        pr "  args.%s.%s_len = %s_size;\n" n n n
+      | FileIn _ | FileOut _ | Pointer _ -> assert false
+    ) (List.filter (function FileIn _ | FileOut _ -> false | _ -> true) args);
+
+    List.iter (
+      fun argt ->
+        let n = name_of_optargt argt in
+        pr "  if (optargs->bitmask & GUESTFS_%s_%s_BITMASK) {\n"
+          (String.uppercase c_name) (String.uppercase n);
+        (match argt with
+        | OBool n
+        | OInt n
+        | OInt64 n ->
+          pr "    args.%s = optargs->%s;\n" n n;
+          pr "  } else {\n";
+          pr "    args.%s = 0;\n" n;
+          pr "  }\n";
+        | OString n ->
+          pr "    args.%s = (char *) optargs->%s;\n" n n;
+          pr "  } else {\n";
+          pr "    args.%s = (char *) \"\";\n" n;
+          pr "  }\n";
+        | OStringList n ->
+          pr "    args.%s.%s_val = (char **) optargs->%s;\n" n n n;
+          pr "    for (args.%s.%s_len = 0; optargs->%s[args.%s.%s_len]; args.%s.%s_len++) ;\n" n n n n n n n;
+          pr "  } else {\n";
+          pr "    args.%s.%s_len = 0;\n" n n;
+          pr "    args.%s.%s_val = NULL;\n" n n;
+          pr "  }\n";
+        )
+    ) optargs
+  in
+
+  (* Generate the local variable which holds the return value. *)
+  let declare_ret_v ret =
+    match ret with
+    | RErr | RInt _ | RBool _ -> pr "  int ret_v;\n"
+    | RInt64 _ -> pr "  int64_t ret_v;\n"
+    | RConstString _ | RConstOptString _ -> pr "  const char *ret_v;\n"
+    | RString _ | RBufferOut _ -> pr "  char *ret_v;\n"
+    | RStringList _ | RHashtable _ -> pr "  char **ret_v;\n"
+    | RStruct (_, typ) -> pr "  struct guestfs_%s *ret_v;\n" typ
+    | RStructList (_, typ) -> pr "  struct guestfs_%s_list *ret_v;\n" typ
+  in
+
+  (* Generate code to check the reply header, and to turn an error
+   * reply from the daemon into an error on the handle.
+   *)
+  let check_daemon_reply name trace_name style errcode =
+    pr "  if (guestfs_int_check_reply_header (g, &hdr, GUESTFS_PROC_%s, serial) == -1) {\n"
+      (String.uppercase name);
+    trace_return_error ~indent:4 trace_name style errcode;
+    pr "    return %s;\n" (string_of_errcode errcode);
+    pr "  }\n";
+    pr "\n";
+
+    pr "  if (hdr.status == GUESTFS_STATUS_ERROR) {\n";
+    pr "    int errnum = 0;\n";
+    pr "\n";
+    trace_return_error ~indent:4 trace_name style errcode;
+    pr "    if (err.errno_string[0] != '\\0')\n";
+    pr "      errnum = guestfs_int_string_to_errno (err.errno_string);\n";
+    pr "    if (errnum <= 0)\n";
+    pr "      error (g, \"%%s: %%s\", \"%s\", err.error_message);\n"
+      name;
+    pr "    else\n";
+    pr "      guestfs_int_error_errno (g, errnum, \"%%s: %%s\", \"%s\",\n"
+      name;
+    pr "                               err.error_message);\n";
+    pr "    free (err.error_message);\n";
+    pr "    free (err.errno_string);\n";
+    pr "    return %s;\n" (string_of_errcode errcode);
+    pr "  }\n";
+    pr "\n"
+  in
+
+  (* Generate code to convert the XDR 'ret' struct to the C return
+   * value 'ret_v'.
+   *)
+  let convert_daemon_ret ret =
+    match ret with
+    | RErr ->
+      pr "  ret_v = 0;\n"
+    | RInt n | RInt64 n | RBool n ->
+      pr "  ret_v = ret.%s;\n" n
+    | RConstString _ | RConstOptString _ ->
+      failwithf "RConstString|RConstOptString cannot be used by daemon functions"
+    | RString n ->
+      pr "  ret_v = ret.%s; /* caller will free */\n" n
+    | RStringList n | RHashtable n ->
+      pr "  /* caller will free this, but we need to add a NULL entry */\n";
+      pr "  ret.%s.%s_val =\n" n n;
+      pr "    safe_realloc (g, ret.%s.%s_val,\n" n n;
+      pr "                  sizeof (char *) * (ret.%s.%s_len + 1));\n"
+        n n;
+      pr "  ret.%s.%s_val[ret.%s.%s_len] = NULL;\n" n n n n;
+      pr "  ret_v = ret.%s.%s_val;\n" n n
+    | RStruct (n, _) ->
+      pr "  /* caller will free this */\n";
+      pr "  ret_v = safe_memdup (g, &ret.%s, sizeof (ret.%s));\n" n n
+    | RStructList (n, _) ->
+      pr "  /* caller will free this */\n";
+      pr "  ret_v = safe_memdup (g, &ret.%s, sizeof (ret.%s));\n" n n
+    | RBufferOut n ->
+      pr "  /* RBufferOut is tricky: If the buffer is zero-length, then\n";
+      pr "   * _val might be NULL here.  To make the API saner for\n";
+      pr "   * callers, we turn this case into a unique pointer (using\n";
+      pr "   * malloc(1)).\n";
+      pr "   */\n";
+      pr "  if (ret.%s.%s_len > 0) {\n" n n;
+      pr "    *size_r = ret.%s.%s_len;\n" n n;
+      pr "    ret_v = ret.%s.%s_val; /* caller will free */\n" n n;
+      pr "  } else {\n";
+      pr "    free (ret.%s.%s_val);\n" n n;
+      pr "    char *p = safe_malloc (g, 1);\n";
+      pr "    *size_r = ret.%s.%s_len;\n" n n;
+      pr "    ret_v = p;\n";
+      pr "  }\n";
+  in
+
+  let has_daemon_ret ret =
+    match ret with
+    | RErr -> false
+    | RConstString _ | RConstOptString _ ->
+      failwithf "RConstString|RConstOptString cannot be used by daemon functions"
+    | RInt _ | RInt64 _
+    | RBool _ | RString _ | RStringList _
+    | RStruct _ | RStructList _
+    | RHashtable _ | RBufferOut _ -> true
+  in
+
   (* Client-side stubs for each function. *)
   let generate_daemon_stub { name = name; c_name = c_name;
                              style = ret, args, optargs as style } =
@@ -1664,31 +1858,15 @@ and generate_client_actions hash () =
 
     pr "  guestfs_message_header hdr;\n";
     pr "  guestfs_message_error err;\n";
-    let has_ret =
-      match ret with
-      | RErr -> false
-      | RConstString _ | RConstOptString _ ->
-        failwithf "RConstString|RConstOptString cannot be used by daemon functions"
-      | RInt _ | RInt64 _
-      | RBool _ | RString _ | RStringList _
-      | RStruct _ | RStructList _
-      | RHashtable _ | RBufferOut _ ->
-        pr "  struct guestfs_%s_ret ret;\n" name;
-        true in
+    let has_ret = has_daemon_ret ret in
+    if has_ret then
+      pr "  struct guestfs_%s_ret ret;\n" name;
 
     pr "  int serial;\n";
     pr "  int r;\n";
     pr "  int trace_flag = g->trace;\n";
     pr "  struct trace_buffer trace_buffer;\n";
-    (match ret with
-    | RErr | RInt _ | RBool _ -> pr "  int ret_v;\n"
-    | RInt64 _ -> pr "  int64_t ret_v;\n"
-    | RConstString _ | RConstOptString _ -> pr "  const char *ret_v;\n"
-    | RString _ | RBufferOut _ -> pr "  char *ret_v;\n"
-    | RStringList _ | RHashtable _ -> pr "  char **ret_v;\n"
-    | RStruct (_, typ) -> pr "  struct guestfs_%s *ret_v;\n" typ
-    | RStructList (_, typ) -> pr "  struct guestfs_%s_list *ret_v;\n" typ
-    );
+    declare_ret_v ret;
 
     let has_filein =
       List.exists (function FileIn _ -> true | _ -> false) args in
@@ -1731,63 +1909,7 @@ and generate_client_actions hash () =
         (String.uppercase name);
       pr "                             NULL, NULL);\n"
     ) else (
-      List.iter (
-        function
-        | Pathname n | Device n | Mountable n | Dev_or_Path n 
-        | Mountable_or_Path n | String n
-        | Key n | GUID n ->
-          pr "  args.%s = (char *) %s;\n" n n
-        | OptString n ->
-          pr "  args.%s = %s ? (char **) &%s : NULL;\n" n n n
-        | StringList n | DeviceList n ->
-          pr "  args.%s.%s_val = (char **) %s;\n" n n n;
-          pr "  for (args.%s.%s_len = 0; %s[args.%s.%s_len]; args.%s.%s_len++) ;\n" n n n n n n n;
-        | Bool n ->
-          pr "  args.%s = %s;\n" n n
-        | Int n ->
-          pr "  args.%s = %s;\n" n n
-        | Int64 n ->
-          pr "  args.%s = %s;\n" n n
-        | BufferIn n ->
-          pr "  /* Just catch grossly large sizes. XDR encoding will make this precise. */\n";
-          pr "  if (%s_size >= GUESTFS_MESSAGE_MAX) {\n" n;
-          trace_return_error ~indent:4 name style errcode;
-          pr "    error (g, \"%%s: size of input buffer too large\", \"%s\");\n"
-            name;
-          pr "    return %s;\n" (string_of_errcode errcode);
-          pr "  }\n";
-          pr "  args.%s.%s_val = (char *) %s;\n" n n n;
-          pr "  args.%s.%s_len = %s_size;\n" n n n
-        | FileIn _ | FileOut _ | Pointer _ -> assert false
-      ) args_passed_to_daemon;
-
-      List.iter (
-        fun argt ->
-          let n = name_of_optargt argt in
-          pr "  if (optargs->bitmask & GUESTFS_%s_%s_BITMASK) {\n"
-            (String.uppercase c_name) (String.uppercase n);
-          (match argt with
-          | OBool n
-          | OInt n
-          | OInt64 n ->
-            pr "    args.%s = optargs->%s;\n" n n;
-            pr "  } else {\n";
-            pr "    args.%s = 0;\n" n;
-            pr "  }\n";
-          | OString n ->
-            pr "    args.%s = (char *) optargs->%s;\n" n n;
-            pr "  } else {\n";
-            pr "    args.%s = (char *) \"\";\n" n;
-            pr "  }\n";
-          | OStringList n ->
-            pr "    args.%s.%s_val = (char **) optargs->%s;\n" n n n;
-            pr "    for (args.%s.%s_len = 0; optargs->%s[args.%s.%s_len]; args.%s.%s_len++) ;\n" n n n n n n n;
-            pr "  } else {\n";
-            pr "    args.%s.%s_len = 0;\n" n n;
-            pr "    args.%s.%s_val = NULL;\n" n n;
-            pr "  }\n";
-          )
-      ) optargs;
+      marshal_daemon_args name c_name style errcode;
 
       pr "  serial = guestfs_int_send (g, GUESTFS_PROC_%s,\n"
         (String.uppercase name);
@@ -1827,7 +1949,7 @@ and generate_client_actions hash () =
     pr "  memset (&err, 0, sizeof err);\n";
     if has_ret then pr "  memset (&ret, 0, sizeof ret);\n";
     pr "\n";
-    pr "  r = guestfs_int_recv (g, \"%s\", &hdr, &err,\n        " name;
+    pr "  r = guestfs_int_recv (g, \"%s\", serial, &hdr, &err,\n        " name;
     if not has_ret then
       pr "NULL, NULL"
     else
@@ -1840,31 +1962,7 @@ and generate_client_actions hash () =
     pr "  }\n";
     pr "\n";
 
-    pr "  if (guestfs_int_check_reply_header (g, &hdr, GUESTFS_PROC_%s, serial) == -1) {\n"
-      (String.uppercase name);
-    trace_return_error ~indent:4 name style errcode;
-    pr "    return %s;\n" (string_of_errcode errcode);
-    pr "  }\n";
-    pr "\n";
-
-    pr "  if (hdr.status == GUESTFS_STATUS_ERROR) {\n";
-    pr "    int errnum = 0;\n";
-    pr "\n";
-    trace_return_error ~indent:4 name style errcode;
-    pr "    if (err.errno_string[0] != '\\0')\n";
-    pr "      errnum = guestfs_int_string_to_errno (err.errno_string);\n";
-    pr "    if (errnum <= 0)\n";
-    pr "      error (g, \"%%s: %%s\", \"%s\", err.error_message);\n"
-      name;
-    pr "    else\n";
-    pr "      guestfs_int_error_errno (g, errnum, \"%%s: %%s\", \"%s\",\n"
-      name;
-    pr "                               err.error_message);\n";
-    pr "    free (err.error_message);\n";
-    pr "    free (err.errno_string);\n";
-    pr "    return %s;\n" (string_of_errcode errcode);
-    pr "  }\n";
-    pr "\n";
+    check_daemon_reply name name style errcode;
 
     (* Expecting to receive further files (FileOut)? *)
     List.iter (
@@ -1878,53 +1976,119 @@ and generate_client_actions hash () =
       | _ -> ()
     ) args;
 
-    (match ret with
-    | RErr ->
-      pr "  ret_v = 0;\n"
-    | RInt n | RInt64 n | RBool n ->
-      pr "  ret_v = ret.%s;\n" n
-    | RConstString _ | RConstOptString _ ->
-      failwithf "RConstString|RConstOptString cannot be used by daemon functions"
-    | RString n ->
-      pr "  ret_v = ret.%s; /* caller will free */\n" n
-    | RStringList n | RHashtable n ->
-      pr "  /* caller will free this, but we need to add a NULL entry */\n";
-      pr "  ret.%s.%s_val =\n" n n;
-      pr "    safe_realloc (g, ret.%s.%s_val,\n" n n;
-      pr "                  sizeof (char *) * (ret.%s.%s_len + 1));\n"
-        n n;
-      pr "  ret.%s.%s_val[ret.%s.%s_len] = NULL;\n" n n n n;
-      pr "  ret_v = ret.%s.%s_val;\n" n n
-    | RStruct (n, _) ->
-      pr "  /* caller will free this */\n";
-      pr "  ret_v = safe_memdup (g, &ret.%s, sizeof (ret.%s));\n" n n
-    | RStructList (n, _) ->
-      pr "  /* caller will free this */\n";
-      pr "  ret_v = safe_memdup (g, &ret.%s, sizeof (ret.%s));\n" n n
-    | RBufferOut n ->
-      pr "  /* RBufferOut is tricky: If the buffer is zero-length, then\n";
-      pr "   * _val might be NULL here.  To make the API saner for\n";
-      pr "   * callers, we turn this case into a unique pointer (using\n";
-      pr "   * malloc(1)).\n";
-      pr "   */\n";
-      pr "  if (ret.%s.%s_len > 0) {\n" n n;
-      pr "    *size_r = ret.%s.%s_len;\n" n n;
-      pr "    ret_v = ret.%s.%s_val; /* caller will free */\n" n n;
-      pr "  } else {\n";
-      pr "    free (ret.%s.%s_val);\n" n n;
-      pr "    char *p = safe_malloc (g, 1);\n";
-      pr "    *size_r = ret.%s.%s_len;\n" n n;
-      pr "    ret_v = p;\n";
-      pr "  }\n";
-    );
+    convert_daemon_ret ret;
     trace_return name style "ret_v";
     pr "  return ret_v;\n";
     pr "}\n\n"
   in
 
+  (* Pipelined variants of daemon functions.  guestfs_<name>_send
+   * writes the request and returns its serial number without waiting
+   * for the reply.  guestfs_<name>_recv waits for (or picks up an
+   * already received) reply with that serial number.  See
+   * guestfs(3)/PIPELINING.
+   *)
+  let generate_daemon_async_stubs { name = name; c_name = c_name;
+                                    style = ret, args, _ } =
+    let errcode =
+      match errcode_of_ret ret with
+      | `CannotReturnError -> assert false
+      | (`ErrorIsMinusOne | `ErrorIsNULL) as e -> e in
+    let send_name = name ^ "_send" and recv_name = name ^ "_recv" in
+    let send_style = RInt "serial", args, []
+    and recv_style = ret, [Int "serial"], [] in
+
+    generate_prototype ~extern:false ~semicolon:false ~newline:true
+      ~handle:"g" ~prefix:"guestfs_" ~suffix:"_send"
+      ~dll_public:true
+      c_name send_style;
+
+    pr "{\n";
+    if args <> [] then
+      pr "  struct guestfs_%s_args args;\n" name;
+    pr "  int serial;\n";
+    pr "  int trace_flag = g->trace;\n";
+    pr "  struct trace_buffer trace_buffer;\n";
+    pr "\n";
+    enter_event send_name;
+    check_null_strings c_name send_style;
+    check_args_validity c_name send_style;
+    trace_call send_name c_name send_style;
+
+    pr "  if (guestfs_int_check_appliance_up (g, \"%s\") == -1) {\n" send_name;
+    trace_return_error ~indent:4 send_name send_style `ErrorIsMinusOne;
+    pr "    return -1;\n";
+    pr "  }\n";
+    pr "\n";
+
+    if args = [] then (
+      pr "  serial = guestfs_int_send_async (g, GUESTFS_PROC_%s, NULL, NULL);\n"
+        (String.uppercase name)
+    ) else (
+      marshal_daemon_args send_name c_name send_style `ErrorIsMinusOne;
+      pr "  serial = guestfs_int_send_async (g, GUESTFS_PROC_%s,\n"
+        (String.uppercase name);
+      pr "                                   (xdrproc_t) xdr_guestfs_%s_args, (char *) &args);\n"
+        name
+    );
+    pr "  if (serial == -1) {\n";
+    trace_return_error ~indent:4 send_name send_style `ErrorIsMinusOne;
+    pr "    return -1;\n";
+    pr "  }\n";
+    pr "\n";
+    trace_return send_name send_style "serial";
+    pr "  return serial;\n";
+    pr "}\n\n";
+
+    generate_prototype ~extern:false ~semicolon:false ~newline:true
+      ~handle:"g" ~prefix:"guestfs_" ~suffix:"_recv"
+      ~dll_public:true
+      c_name recv_style;
+
+    pr "{\n";
+    pr "  guestfs_message_header hdr;\n";
+    pr "  guestfs_message_error err;\n";
+    let has_ret = has_daemon_ret ret in
+    if has_ret then
+      pr "  struct guestfs_%s_ret ret;\n" name;
+    pr "  int r;\n";
+    pr "  int trace_flag = g->trace;\n";
+    pr "  struct trace_buffer trace_buffer;\n";
+    declare_ret_v ret;
+    pr "\n";
+    enter_event recv_name;
+    trace_call recv_name c_name recv_style;
+
+    pr "  memset (&hdr, 0, sizeof hdr);\n";
+    pr "  memset (&err, 0, sizeof err);\n";
+    if has_ret then pr "  memset (&ret, 0, sizeof ret);\n";
+    pr "\n";
+    pr "  r = guestfs_int_recv_async (g, \"%s\", serial, &hdr, &err,\n        "
+      recv_name;
+    if not has_ret then
+      pr "NULL, NULL"
+    else
+      pr "(xdrproc_t) xdr_guestfs_%s_ret, (char *) &ret" name;
+    pr ");\n";
+    pr "  if (r == -1) {\n";
+    trace_return_error ~indent:4 recv_name recv_style errcode;
+    pr "    return %s;\n" (string_of_errcode errcode);
+    pr "  }\n";
+    pr "\n";
+
+    check_daemon_reply name recv_name recv_style errcode;
+    convert_daemon_ret ret;
+    trace_return recv_name recv_style "ret_v";
+    pr "  return ret_v;\n";
+    pr "}\n\n"
+  in
+
   List.iter (
     fun f ->
-      if hash_matches hash f then generate_daemon_stub f
+      if hash_matches hash f then (
+        generate_daemon_stub f;
+        if f.pipelined then generate_daemon_async_stubs f
+      )
   ) daemon_functions
 
 (* Functions which have optional arguments have two or three
@@ -2050,7 +2214,7 @@ and generate_client_actions_variants () =
     pr "}\n\n"
 
   and generate_back_compat_wrapper { name = name;
-                                     style = ret, args, _ as style } =
+                                     style = ret, args, _ } =
     generate_prototype ~extern:false ~semicolon:false ~newline:true
       ~handle:"g" ~prefix:"guestfs_"
       name (ret, args, []);
@@ -2141,6 +2305,32 @@ guestfs_event_to_string (uint64_t event)
 }
 "
 
+(* Names of the daemon procedures, indexed by proc_nr.  The library
+ * uses these for guestfs_get_call_stats.
+ *)
+and generate_client_proc_names () =
+  generate_header CStyle LGPLv2plus;
+
+  pr "\
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include \"guestfs.h\"
+#include \"guestfs-internal.h\"
+
+const char *const guestfs_int_proc_names[%d] = {
+" (max_proc_nr + 1);
+
+  List.iter (
+    function
+    | { name = name; proc_nr = Some proc_nr } ->
+      pr "  [%d] = \"%s\",\n" proc_nr name
+    | { proc_nr = None } -> assert false
+  ) daemon_functions;
+  pr "};\n"
+
 (* Generate the linker script which controls the visibility of
  * symbols in the public ABI and ensures no other symbols get
  * exported accidentally.
@@ -2185,6 +2375,10 @@ and generate_linker_script () =
     List.flatten (
       List.map (
         function
+        | { c_name = c_name; style = _, _, []; pipelined = true } ->
+            ["guestfs_" ^ c_name;
+             "guestfs_" ^ c_name ^ "_recv";
+             "guestfs_" ^ c_name ^ "_send"]
         | { c_name = c_name; style = _, _, [] } -> ["guestfs_" ^ c_name]
         | { c_name = c_name; style = _, _, (_::_);
             once_had_no_optargs = false } ->
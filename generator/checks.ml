@@ -281,6 +281,47 @@ let () =
     | { config_only = false } -> ()
   ) (daemon_functions @ fish_commands);
 
+  (* The pipelined flag only makes sense for public daemon functions
+   * that have no optional arguments and don't transfer files.
+   *)
+  List.iter (
+    function
+    | { name = name; pipelined = true } ->
+      failwithf "%s: only daemon functions can be pipelined" name
+    | { pipelined = false } -> ()
+  ) (non_daemon_functions @ fish_commands);
+  List.iter (
+    function
+    | { pipelined = false } -> ()
+    | { name = name; style = _, _, (_::_) } ->
+      failwithf "%s: pipelined functions cannot have optional arguments" name
+    | { name = name; visibility = (VInternal | VDebug | VBindTest) } ->
+      failwithf "%s: pipelined functions must be public" name
+    | { name = name; style = _, args, [] } ->
+      if List.exists (function FileIn _ | FileOut _ -> true | _ -> false) args
+      then
+        failwithf "%s: pipelined functions cannot have FileIn or FileOut parameters" name
+  ) daemon_functions;
+
+  (* Concurrent functions run on daemon worker threads, so they cannot
+   * be non-daemon functions, and cannot transfer files since only the
+   * main thread reads from the daemon socket.
+   *)
+  List.iter (
+    function
+    | { name = name; concurrent = true } ->
+      failwithf "%s: only daemon functions can be concurrent" name
+    | { concurrent = false } -> ()
+  ) (non_daemon_functions @ fish_commands);
+  List.iter (
+    function
+    | { concurrent = false } -> ()
+    | { name = name; style = _, args, _ } ->
+      if List.exists (function FileIn _ | FileOut _ -> true | _ -> false) args
+      then
+        failwithf "%s: concurrent functions cannot have FileIn or FileOut parameters" name
+  ) daemon_functions;
+
   (* once_had_no_optargs can only apply if the function now has optargs. *)
   List.iter (
     function
@@ -509,6 +509,23 @@ cleanup_free_mountable (mountable_t *mountable)
   pr "  }\n";
   pr "}\n";
   pr "\n";
+  (* Procedures which may run on a worker thread. *)
+  pr "int\n";
+  pr "is_concurrent_procedure (int nr)\n";
+  pr "{\n";
+  pr "  switch (nr) {\n";
+  List.iter (
+    function
+    | { name = name; concurrent = true } ->
+      pr "    case GUESTFS_PROC_%s:\n" (String.uppercase name)
+    | { concurrent = false } -> ()
+  ) daemon_functions;
+  pr "      return 1;\n";
+  pr "    default:\n";
+  pr "      return 0;\n";
+  pr "  }\n";
+  pr "}\n";
+  pr "\n";
 
   (* LVM columns and tokenization functions. *)
   (* XXX This generates crap code.  We should rethink how we
@@ -417,6 +417,33 @@ let structs = [
     ];
     s_camel_name = "UTSName" };
 
+  (* Launch phase timings, see guestfs_get_launch_timings. *)
+  { defaults with
+    s_name = "launch_timing";
+    s_cols = [
+    "lt_phase", FString;
+    "lt_start", FInt64;
+    "lt_duration", FInt64;
+    ];
+    s_camel_name = "LaunchTiming" };
+
+  (* Per-procedure call statistics, see guestfs_get_call_stats. *)
+  { defaults with
+    s_name = "call_stat";
+    s_cols = [
+    "cs_name", FString;
+    "cs_calls", FInt64;
+    "cs_bytes_sent", FInt64;
+    "cs_bytes_received", FInt64;
+    "cs_total_us", FInt64;
+    "cs_p50_us", FInt64;
+    "cs_p99_us", FInt64;
+    "cs_daemon_us", FInt64;
+    "cs_daemon_p50_us", FInt64;
+    "cs_daemon_p99_us", FInt64;
+    ];
+    s_camel_name = "CallStat" };
+
   (* Used by hivex_* APIs to return a list of int64 handles (node
    * handles and value handles).  Note that we can't add a putative
    * 'RInt64List' type to the generator because we need to return
@@ -434,6 +461,21 @@ let structs = [
     "hivex_value_h", FInt64;
     ];
     s_camel_name = "HivexValue" };
+
+  (* Used by hivex_node_get_subtree to return a whole registry
+   * subtree in one call.
+   *)
+  { defaults with
+    s_name = "hivex_entry";
+    s_cols = [
+    "hivex_entry_path", FString;
+    "hivex_entry_nodeh", FInt64;
+    "hivex_entry_valueh", FInt64;
+    "hivex_entry_key", FString;
+    "hivex_entry_type", FInt64;
+    "hivex_entry_value", FBuffer;
+    ];
+    s_camel_name = "HivexEntry" };
   { defaults with
     s_name = "internal_mountable";
     s_internal = true;
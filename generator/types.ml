@@ -375,6 +375,21 @@ type action = {
                                      checks arguments and deals with trace
                                      messages.  Set this to false for functions
                                      that have to be thread-safe. *)
+  pipelined : bool;               (* For daemon functions, also generate
+                                     the C-only guestfs_<name>_send and
+                                     guestfs_<name>_recv functions, so
+                                     that several calls can be in flight
+                                     at once.  Only small, frequently
+                                     called functions with no FileIn,
+                                     FileOut or optional arguments. *)
+  concurrent : bool;              (* For daemon functions, the daemon
+                                     implementation only reads from the
+                                     filesystem and is thread-safe (in
+                                     particular it does not use
+                                     CHROOT_IN/CHROOT_OUT), so guestfsd
+                                     may run it on a worker thread at
+                                     the same time as other concurrent
+                                     calls. *)
 
   (* "Internal" data attached by the generator at various stages.  This
    * doesn't need to (and shouldn't) be set when defining actions.
@@ -240,7 +240,15 @@ struct guestfs_message_header {
   guestfs_message_status status;
 };
 
-const GUESTFS_MAX_CHUNK_SIZE = 8192;
+/* File transfers are split into chunks.  Both ends start by using
+ * chunks of at most GUESTFS_DEFAULT_CHUNK_SIZE bytes, which is all
+ * that old daemons and libraries understand.  After launch the
+ * library may negotiate a larger chunk size (up to
+ * GUESTFS_MAX_CHUNK_SIZE) by calling internal_set_chunk_size.  If
+ * the daemon does not know that call, the default is kept.
+ */
+const GUESTFS_DEFAULT_CHUNK_SIZE = 8192;
+const GUESTFS_MAX_CHUNK_SIZE = 1048576;
 
 struct guestfs_chunk {
   int cancel;			     /* if non-zero, transfer is cancelled */
@@ -248,6 +256,13 @@ struct guestfs_chunk {
   opaque data<GUESTFS_MAX_CHUNK_SIZE>;
 };
 
+/* Once the library has called internal_set_sparse_transfers, either
+ * side may send a chunk with 'cancel' set to GUESTFS_CHUNK_HOLE.  This
+ * is not a cancellation.  It stands for a run of zero bytes (a hole),
+ * and 'data' contains the length of the run as an XDR unsigned hyper.
+ */
+const GUESTFS_CHUNK_HOLE = 2;
+
 /* Progress notifications.  Daemon self-limits these messages to
  * at most one per second.  The daemon can send these messages
  * at any time, and the caller should discard unexpected messages.
@@ -22,10 +22,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
 #include <time.h>
+#include <dirent.h>
+#include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/select.h>
 #include <sys/types.h>
@@ -34,6 +40,7 @@
 
 #include "glthread/lock.h"
 #include "ignore-value.h"
+#include "sha256.h"
 
 #include "guestfs.h"
 #include "guestfs-internal.h"
@@ -52,7 +59,8 @@ static int contains_old_style_appliance (guestfs_h *g, const char *path, void *d
 static int contains_fixed_appliance (guestfs_h *g, const char *path, void *data);
 static int contains_supermin_appliance (guestfs_h *g, const char *path, void *data);
 static int build_supermin_appliance (guestfs_h *g, const char *supermin_path, uid_t uid, char **kernel, char **dtb, char **initrd, char **appliance);
-static int run_supermin_build (guestfs_h *g, const char *lockfile, const char *appliancedir, const char *supermin_path);
+static int run_supermin_build (guestfs_h *g, const char *outputdir, const char *supermin_path);
+static int compare_strings (const void *vp1, const void *vp2);
 
 /* Locate or build the appliance.
  *
@@ -85,18 +93,27 @@ static int run_supermin_build (guestfs_h *g, const char *lockfile, const char *a
  * If one is found, return it.
  *
  * The supermin appliance cache directory lives in
- * $TMPDIR/.guestfs-$UID/ and consists of up to five files:
+ * $TMPDIR/.guestfs-$UID/.  Each built appliance is stored in a
+ * directory named after a hash of the inputs to supermin (see
+ * appliance_hash), so a changed host gets a new directory instead of
+ * an update in place:
  *
- *   $TMPDIR/.guestfs-$UID/lock         - the supermin lock file
- *   $TMPDIR/.guestfs-$UID/appliance.d/kernel  - the kernel
- *   $TMPDIR/.guestfs-$UID/appliance.d/dtb     - the device tree (on ARM)
- *   $TMPDIR/.guestfs-$UID/appliance.d/initrd  - the supermin initrd
- *   $TMPDIR/.guestfs-$UID/appliance.d/root    - the appliance
+ *   $TMPDIR/.guestfs-$UID/appliance-$HASH/kernel  - the kernel
+ *   $TMPDIR/.guestfs-$UID/appliance-$HASH/dtb     - the device tree (on ARM)
+ *   $TMPDIR/.guestfs-$UID/appliance-$HASH/initrd  - the supermin initrd
+ *   $TMPDIR/.guestfs-$UID/appliance-$HASH/root    - the appliance
+ *   $TMPDIR/.guestfs-$UID/appliance-$HASH.lock    - the appliance lock
+ *   $TMPDIR/.guestfs-$UID/appliance               - symlink to the newest
  *
  * Multiple instances of libguestfs with the same UID may be racing to
- * create an appliance.  However (since supermin >= 5) supermin
- * provides a --lock flag and atomic update of the appliance.d
- * subdirectory.
+ * create an appliance.  If the directory for the current hash exists
+ * it is used under a shared lock.  Otherwise one process takes the
+ * lock exclusively, builds the appliance in a temporary directory and
+ * publishes it with rename(2).  Other processes do not wait for it:
+ * they use the appliance that the 'appliance' symlink points to, and
+ * only wait if there is no previous appliance at all.  The shared
+ * lock is kept until the backend has started the appliance, so old
+ * appliances can be removed while no one is using them.
  */
 int
 guestfs_int_build_appliance (guestfs_h *g,
@@ -120,6 +137,20 @@ guestfs_int_build_appliance (guestfs_h *g,
   return 0;
 }
 
+/* Release the lock taken on the appliance by
+ * guestfs_int_build_appliance.  Called once the backend has started
+ * the appliance (or failed to), since the hypervisor then holds the
+ * files open.
+ */
+void
+guestfs_int_unlock_appliance (guestfs_h *g)
+{
+  if (g->appliance_lock_fd >= 0) {
+    close (g->appliance_lock_fd);
+    g->appliance_lock_fd = -1;
+  }
+}
+
 static int
 build_appliance (guestfs_h *g,
                  char **kernel,
@@ -207,6 +238,324 @@ contains_supermin_appliance (guestfs_h *g, const char *path, void *data)
   return dir_contains_files (path, "supermin.d", NULL);
 }
 
+/* Files whose modification time tells us that the host packages have
+ * changed, and directories which supermin looks in for the kernel.
+ * These are inputs to the appliance, along with supermin.d, so they
+ * are part of the hash which names the cached appliance.
+ */
+static const char *appliance_inputs[] = {
+  "/var/lib/rpm/Packages",
+  "/var/lib/rpm/rpmdb.sqlite",
+  "/var/lib/dpkg/status",
+  "/var/lib/pacman/local",
+  "/boot",
+  "/lib/modules",
+  NULL
+};
+
+/* Environment variables which change how supermin picks the kernel. */
+static const char *appliance_input_envs[] = {
+  "SUPERMIN_KERNEL",
+  "SUPERMIN_KERNEL_VERSION",
+  "SUPERMIN_MODULES",
+  "SUPERMIN_DTB",
+  NULL
+};
+
+static void
+hash_stat (struct sha256_ctx *ctx, const char *name)
+{
+  struct stat statbuf;
+  char rec[PATH_MAX + 128];
+
+  if (stat (name, &statbuf) == -1)
+    snprintf (rec, sizeof rec, "%s -\n", name);
+  else
+    snprintf (rec, sizeof rec,
+              "%s %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 "\n",
+              name, (int64_t) statbuf.st_size, (int64_t) statbuf.st_mtime,
+              (int64_t) statbuf.st_ctime, (int64_t) statbuf.st_ino);
+  sha256_process_bytes (rec, strlen (rec), ctx);
+}
+
+/* Compute the hash of everything that goes into building the
+ * supermin appliance, as a string of hex digits.  The files are
+ * identified by their size, times and inode number rather than by
+ * reading them, which is the same test that 'supermin --if-newer'
+ * used to make.
+ */
+static int
+appliance_hash (guestfs_h *g, const char *supermin_path,
+                char hash[2 * SHA256_DIGEST_SIZE + 1])
+{
+  CLEANUP_FREE char *supermin_d = NULL;
+  CLEANUP_FREE_STRINGSBUF DECLARE_STRINGSBUF (names);
+  struct sha256_ctx ctx;
+  unsigned char digest[SHA256_DIGEST_SIZE];
+  DIR *dir;
+  struct dirent *d;
+  size_t i;
+
+  sha256_init_ctx (&ctx);
+  sha256_process_bytes (PACKAGE_VERSION "\n" host_cpu "\n" SUPERMIN "\n",
+                        strlen (PACKAGE_VERSION "\n" host_cpu "\n"
+                                SUPERMIN "\n"), &ctx);
+#ifdef DTB_WILDCARD
+  sha256_process_bytes (DTB_WILDCARD "\n", strlen (DTB_WILDCARD "\n"), &ctx);
+#endif
+
+  supermin_d = safe_asprintf (g, "%s/supermin.d", supermin_path);
+  dir = opendir (supermin_d);
+  if (dir == NULL) {
+    perrorf (g, "opendir: %s", supermin_d);
+    return -1;
+  }
+  while ((d = readdir (dir)) != NULL) {
+    if (d->d_name[0] != '.')
+      guestfs_int_add_sprintf (g, &names, "%s/%s", supermin_d, d->d_name);
+  }
+  closedir (dir);
+  guestfs_int_end_stringsbuf (g, &names);
+  qsort (names.argv, names.size-1, sizeof (char *), compare_strings);
+
+  for (i = 0; names.argv[i] != NULL; ++i)
+    hash_stat (&ctx, names.argv[i]);
+  for (i = 0; appliance_inputs[i] != NULL; ++i)
+    hash_stat (&ctx, appliance_inputs[i]);
+  for (i = 0; appliance_input_envs[i] != NULL; ++i) {
+    const char *v = getenv (appliance_input_envs[i]);
+
+    if (v) {
+      sha256_process_bytes (appliance_input_envs[i],
+                            strlen (appliance_input_envs[i]) + 1, &ctx);
+      sha256_process_bytes (v, strlen (v) + 1, &ctx);
+    }
+  }
+
+  sha256_finish_ctx (&ctx, digest);
+  for (i = 0; i < SHA256_DIGEST_SIZE; ++i)
+    sprintf (&hash[2*i], "%02x", digest[i]);
+  return 0;
+}
+
+static int
+compare_strings (const void *vp1, const void *vp2)
+{
+  const char *s1 = * (char * const *) vp1;
+  const char *s2 = * (char * const *) vp2;
+
+  return strcmp (s1, s2);
+}
+
+static int
+is_built_appliance (const char *appliancedir)
+{
+  return dir_contains_files (appliancedir, "kernel", "initrd", "root", NULL);
+}
+
+/* Open 'lockfile' and lock it.  'op' is LOCK_EX or LOCK_SH.  flock(2)
+ * locks belong to the open file, so this also excludes other threads
+ * in the same process.  If 'wait' is false and the lock is held in a
+ * conflicting way, return -2 immediately.  Otherwise returns the
+ * locked file descriptor, or -1 on error.
+ *
+ * The lock file of an appliance is held exclusively while it is being
+ * built or removed, and shared while it is being used by a launch.
+ */
+static int
+lock_file (guestfs_h *g, const char *lockfile, int op, bool wait)
+{
+  int fd;
+
+  fd = open (lockfile, O_RDWR|O_CREAT|O_NOFOLLOW|O_CLOEXEC, 0644);
+  if (fd == -1) {
+    perrorf (g, "open: %s", lockfile);
+    return -1;
+  }
+  while (flock (fd, wait ? op : op|LOCK_NB) == -1) {
+    if (errno == EINTR)
+      continue;
+    if (!wait && errno == EWOULDBLOCK) {
+      close (fd);
+      return -2;
+    }
+    perrorf (g, "flock: %s", lockfile);
+    close (fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* Make $cachedir/appliance point to the appliance which was just
+ * published.  This is the appliance used by other processes while a
+ * newer one is being built.  Errors are ignored.
+ */
+static void
+set_last_appliance (guestfs_h *g, const char *cachedir, const char *name)
+{
+  CLEANUP_FREE char *link = safe_asprintf (g, "%s/appliance", cachedir);
+  CLEANUP_FREE char *tmp =
+    safe_asprintf (g, "%s/appliance.tmp.%d", cachedir, (int) getpid ());
+
+  unlink (tmp);
+  if (symlink (name, tmp) == -1 || rename (tmp, link) == -1) {
+    debug (g, "supermin: could not update %s: %s", link, strerror (errno));
+    unlink (tmp);
+  }
+}
+
+/* Find the appliance that $cachedir/appliance points to, and take a
+ * shared lock on it without waiting.  If it is complete, returns the
+ * locked file descriptor and sets '*appliancedir_r'.  Otherwise
+ * returns -1.
+ */
+static int
+lock_last_appliance (guestfs_h *g, const char *cachedir,
+                     char **appliancedir_r)
+{
+  CLEANUP_FREE char *link = safe_asprintf (g, "%s/appliance", cachedir);
+  CLEANUP_FREE char *lockfile = NULL;
+  char name[NAME_MAX + 1];
+  char *appliancedir;
+  ssize_t r;
+  int fd;
+
+  r = readlink (link, name, sizeof name - 1);
+  if (r <= 0)
+    return -1;
+  name[r] = '\0';
+  if (strchr (name, '/') != NULL || !STRPREFIX (name, "appliance-"))
+    return -1;
+
+  appliancedir = safe_asprintf (g, "%s/%s", cachedir, name);
+  lockfile = safe_asprintf (g, "%s.lock", appliancedir);
+  guestfs_push_error_handler (g, NULL, NULL);
+  fd = lock_file (g, lockfile, LOCK_SH, false);
+  guestfs_pop_error_handler (g);
+  if (fd < 0) {
+    free (appliancedir);
+    return -1;
+  }
+  if (!is_built_appliance (appliancedir)) {
+    close (fd);
+    free (appliancedir);
+    return -1;
+  }
+  *appliancedir_r = appliancedir;
+  return fd;
+}
+
+/* Remove the appliances which are not the current one.  An appliance
+ * whose lock is held (because it is being built, or used by a launch)
+ * is left alone.  Temporary directories left by builds which were
+ * interrupted are removed the same way, since the lock is held for
+ * the whole build.
+ *
+ * Also remove the appliance.d directory used by earlier versions of
+ * libguestfs, which were protected by $cachedir/lock.
+ */
+static void
+remove_old_appliances (guestfs_h *g, const char *cachedir, const char *keep)
+{
+  DIR *dir;
+  struct dirent *d;
+  CLEANUP_FREE char *legacydir = NULL, *legacylock = NULL;
+  int fd;
+
+  dir = opendir (cachedir);
+  if (dir == NULL)
+    return;
+
+  while ((d = readdir (dir)) != NULL) {
+    const size_t len = strlen ("appliance-") + 2*SHA256_DIGEST_SIZE;
+    CLEANUP_FREE char *path = NULL, *lockfile = NULL;
+    bool is_tmp;
+
+    /* appliance-$HASH or appliance-$HASH.tmp.$PID */
+    if (!STRPREFIX (d->d_name, "appliance-") || strlen (d->d_name) < len)
+      continue;
+    is_tmp = STRPREFIX (&d->d_name[len], ".tmp.");
+    if (!is_tmp && d->d_name[len] != '\0')
+      continue;
+    if (!is_tmp && STREQ (d->d_name, keep))
+      continue;
+
+    path = safe_asprintf (g, "%s/%s", cachedir, d->d_name);
+    lockfile = safe_asprintf (g, "%s/%.*s.lock", cachedir, (int) len, d->d_name);
+    guestfs_push_error_handler (g, NULL, NULL);
+    fd = lock_file (g, lockfile, LOCK_EX, false);
+    guestfs_pop_error_handler (g);
+    if (fd < 0)
+      continue;
+
+    if (is_tmp) {
+      debug (g, "supermin: removing interrupted build %s", path);
+      guestfs_int_recursive_remove_dir (g, path);
+    }
+    else {
+      debug (g, "supermin: removing old appliance %s", path);
+      guestfs_int_recursive_remove_dir (g, path);
+      unlink (lockfile);
+    }
+    close (fd);
+  }
+
+  closedir (dir);
+
+  legacydir = safe_asprintf (g, "%s/appliance.d", cachedir);
+  if (access (legacydir, F_OK) == -1)
+    return;
+  legacylock = safe_asprintf (g, "%s/lock", cachedir);
+  guestfs_push_error_handler (g, NULL, NULL);
+  fd = lock_file (g, legacylock, LOCK_EX, false);
+  guestfs_pop_error_handler (g);
+  if (fd < 0)
+    return;
+
+  debug (g, "supermin: removing old appliance %s", legacydir);
+  guestfs_int_recursive_remove_dir (g, legacydir);
+  unlink (legacylock);
+  close (fd);
+}
+
+/* Build the appliance into a temporary directory and publish it as
+ * 'appliancedir' by renaming it.  The caller holds the lock for
+ * 'appliancedir'.
+ */
+static int
+build_and_publish (guestfs_h *g, const char *supermin_path,
+                   const char *appliancedir)
+{
+  CLEANUP_FREE char *tmpdir =
+    safe_asprintf (g, "%s.tmp.%d", appliancedir, (int) getpid ());
+
+  /* Left over from a build which was interrupted. */
+  guestfs_int_recursive_remove_dir (g, tmpdir);
+
+  if (run_supermin_build (g, tmpdir, supermin_path) == -1) {
+    guestfs_int_recursive_remove_dir (g, tmpdir);
+    return -1;
+  }
+
+  if (rename (tmpdir, appliancedir) == -1) {
+    /* Shouldn't happen because we hold the lock, but an older
+     * appliance which was not cleaned up could be in the way.
+     */
+    if (errno != EEXIST && errno != ENOTEMPTY) {
+      perrorf (g, "rename: %s", appliancedir);
+      guestfs_int_recursive_remove_dir (g, tmpdir);
+      return -1;
+    }
+    guestfs_int_recursive_remove_dir (g, tmpdir);
+    if (!is_built_appliance (appliancedir)) {
+      error (g, _("%s exists but is not a complete appliance"), appliancedir);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
 /* Build supermin appliance from supermin_path to $TMPDIR/.guestfs-$UID.
  *
  * Returns:
@@ -221,19 +570,14 @@ build_supermin_appliance (guestfs_h *g,
 			  char **initrd, char **appliance)
 {
   CLEANUP_FREE char *tmpdir = guestfs_get_cachedir (g);
+  CLEANUP_FREE char *cachedir = NULL;
+  CLEANUP_FREE char *appliancedir = NULL;
+  CLEANUP_FREE char *lockfile = NULL;
+  char hash[2 * SHA256_DIGEST_SIZE + 1];
   struct stat statbuf;
-  size_t len;
+  int fd;
 
-  /* len must be longer than the length of any pathname we can
-   * generate in this function.
-   */
-  len = strlen (tmpdir) + 128;
-  char cachedir[len];
-  snprintf (cachedir, len, "%s/.guestfs-%d", tmpdir, uid);
-  char lockfile[len];
-  snprintf (lockfile, len, "%s/lock", cachedir);
-  char appliancedir[len];
-  snprintf (appliancedir, len, "%s/appliance.d", cachedir);
+  cachedir = safe_asprintf (g, "%s/.guestfs-%d", tmpdir, uid);
 
   ignore_value (mkdir (cachedir, 0755));
   ignore_value (chmod (cachedir, 0755)); /* RHBZ#921292 */
@@ -263,31 +607,88 @@ build_supermin_appliance (guestfs_h *g,
   if (g->verbose)
     guestfs_int_print_timestamped_message (g, "begin building supermin appliance");
 
-  /* Build the appliance if it needs to be built. */
-  if (g->verbose)
-    guestfs_int_print_timestamped_message (g, "run supermin");
+  if (appliance_hash (g, supermin_path, hash) == -1)
+    return -1;
+  appliancedir = safe_asprintf (g, "%s/appliance-%s", cachedir, hash);
+  lockfile = safe_asprintf (g, "%s.lock", appliancedir);
+
+  /* Hold a shared lock on the appliance which is used until the
+   * backend has started with it (see guestfs_int_unlock_appliance),
+   * so that remove_old_appliances in another process cannot remove
+   * it in the meantime.  If the appliance is removed while we wait
+   * for the lock, build it again.
+   */
+ again:
+  if (is_built_appliance (appliancedir)) {
+    fd = lock_file (g, lockfile, LOCK_SH, true);
+    if (fd == -1)
+      return -1;
+    if (is_built_appliance (appliancedir))
+      goto found;
+    close (fd);
+  }
+
+  /* Build the appliance.  If it is already being built by someone
+   * else, use the previous appliance rather than waiting, if there is
+   * one.
+   */
+  fd = lock_file (g, lockfile, LOCK_EX, false);
+  if (fd == -2) {
+    char *last;
+
+    fd = lock_last_appliance (g, cachedir, &last);
+    if (fd >= 0) {
+      debug (g, "supermin: %s is being built, using %s", appliancedir, last);
+      free (appliancedir);
+      appliancedir = last;
+      goto found;
+    }
+    debug (g, "supermin: waiting for %s to be built", appliancedir);
+    fd = lock_file (g, lockfile, LOCK_EX, true);
+  }
+  if (fd == -1)
+    return -1;
+
+  if (!is_built_appliance (appliancedir)) {
+    if (g->verbose)
+      guestfs_int_print_timestamped_message (g, "run supermin");
+
+    if (build_and_publish (g, supermin_path, appliancedir) == -1) {
+      close (fd);
+      return -1;
+    }
+    set_last_appliance (g, cachedir, &appliancedir[strlen (cachedir) + 1]);
+  }
 
-  if (run_supermin_build (g, lockfile, appliancedir, supermin_path) == -1)
+  /* Converting the lock to shared is not atomic, so check again. */
+  if (flock (fd, LOCK_SH) == -1) {
+    perrorf (g, "flock: %s", lockfile);
+    close (fd);
     return -1;
+  }
+  if (!is_built_appliance (appliancedir)) {
+    close (fd);
+    goto again;
+  }
+
+  remove_old_appliances (g, cachedir, &appliancedir[strlen (cachedir) + 1]);
+
+ found:
+  guestfs_int_unlock_appliance (g);
+  g->appliance_lock_fd = fd;
 
   if (g->verbose)
     guestfs_int_print_timestamped_message (g, "finished building supermin appliance");
 
   /* Return the appliance filenames. */
-  *kernel = safe_malloc (g, len);
+  *kernel = safe_asprintf (g, "%s/kernel", appliancedir);
 #ifdef DTB_WILDCARD
-  *dtb = safe_malloc (g, len);
+  *dtb = safe_asprintf (g, "%s/dtb", appliancedir);
 #else
   *dtb = NULL;
 #endif
-  *initrd = safe_malloc (g, len);
-  *appliance = safe_malloc (g, len);
-  snprintf (*kernel, len, "%s/kernel", appliancedir);
-#ifdef DTB_WILDCARD
-  snprintf (*dtb, len, "%s/dtb", appliancedir);
-#endif
-  snprintf (*initrd, len, "%s/initrd", appliancedir);
-  snprintf (*appliance, len, "%s/root", appliancedir);
+  *initrd = safe_asprintf (g, "%s/initrd", appliancedir);
+  *appliance = safe_asprintf (g, "%s/root", appliancedir);
 
   /* Touch the files so they don't get deleted (as they are in /var/tmp). */
   (void) utimes (*kernel, NULL);
@@ -314,13 +715,12 @@ build_supermin_appliance (guestfs_h *g,
   return 0;
 }
 
-/* Run supermin --build and tell it to generate the
- * appliance.
+/* Run supermin --build and tell it to generate the appliance in
+ * 'outputdir', which should not exist.
  */
 static int
 run_supermin_build (guestfs_h *g,
-                    const char *lockfile,
-                    const char *appliancedir,
+                    const char *outputdir,
                     const char *supermin_path)
 {
   CLEANUP_CMD_CLOSE struct command *cmd = guestfs_int_new_command (g);
@@ -337,9 +737,6 @@ run_supermin_build (guestfs_h *g,
   guestfs_int_cmd_add_arg (cmd, "--build");
   if (g->verbose)
     guestfs_int_cmd_add_arg (cmd, "--verbose");
-  guestfs_int_cmd_add_arg (cmd, "--if-newer");
-  guestfs_int_cmd_add_arg (cmd, "--lock");
-  guestfs_int_cmd_add_arg (cmd, lockfile);
 #if 0
   if (pass_u_g_args) {
     guestfs_int_cmd_add_arg (cmd, "-u");
@@ -359,7 +756,7 @@ run_supermin_build (guestfs_h *g,
 #endif
   guestfs_int_cmd_add_arg_format (cmd, "%s/supermin.d", supermin_path);
   guestfs_int_cmd_add_arg (cmd, "-o");
-  guestfs_int_cmd_add_arg (cmd, appliancedir);
+  guestfs_int_cmd_add_arg (cmd, outputdir);
 
   r = guestfs_int_cmd_run (cmd);
   if (r == -1)
@@ -0,0 +1,251 @@
+/* libguestfs
+ * Copyright (C) 2015 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* Per-procedure call statistics (guestfs_get_call_stats).
+ *
+ * proto.c tells us when a call is sent, when a reply arrives and how
+ * much file data is transferred.  The time of a call runs from
+ * sending it until its reply arrives.  For calls which download
+ * files the reply comes before the files, so the time is corrected
+ * when the last file has been received.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <rpc/types.h>
+#include <rpc/xdr.h>
+
+#include "guestfs.h"
+#include "guestfs-internal.h"
+#include "guestfs-internal-actions.h"
+#include "guestfs_protocol.h"
+#include "call-stats.h"
+
+/* The start times of calls waiting for a reply, indexed by serial
+ * number.  At most MAX_ASYNC_IN_FLIGHT pipelined calls (see proto.c)
+ * and one ordinary call can be waiting, and serial numbers are
+ * consecutive, so a slot is never reused while its call is waiting.
+ */
+#define NR_CALL_STARTS 128
+
+struct call_start {
+  int serial;
+  int proc_nr;                  /* 0 = slot is free */
+  int64_t start_us;
+};
+
+static int64_t
+now_us (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static struct call_stats *
+get_call_stats (guestfs_h *g, int proc_nr)
+{
+  if (proc_nr <= 0 || proc_nr > GUESTFS_MAX_PROC_NR)
+    return NULL;
+
+  if (g->call_stats == NULL)
+    g->call_stats = safe_calloc (g, GUESTFS_MAX_PROC_NR + 1,
+                                 sizeof (struct call_stats *));
+  if (g->call_stats[proc_nr] == NULL)
+    g->call_stats[proc_nr] = safe_calloc (g, 1, sizeof (struct call_stats));
+
+  return g->call_stats[proc_nr];
+}
+
+/* Called when a call message of 'len' bytes has been sent. */
+void
+guestfs_int_call_stats_send (guestfs_h *g, int proc_nr, int serial,
+                             size_t len)
+{
+  struct call_stats *cs = get_call_stats (g, proc_nr);
+  struct call_start *start;
+
+  if (cs == NULL)
+    return;
+
+  cs->bytes_sent += len;
+
+  if (g->call_starts == NULL)
+    g->call_starts = safe_calloc (g, NR_CALL_STARTS,
+                                  sizeof (struct call_start));
+  start = &g->call_starts[(unsigned) serial % NR_CALL_STARTS];
+  start->serial = serial;
+  start->proc_nr = proc_nr;
+  start->start_us = now_us ();
+
+  /* Any FileIn parameters are sent next. */
+  g->call_file_proc = proc_nr;
+  g->call_file_start_us = start->start_us;
+  g->call_file_us = -1;
+}
+
+/* Called when a reply message of 'len' bytes has arrived. */
+void
+guestfs_int_call_stats_reply (guestfs_h *g, int proc_nr, int serial,
+                              size_t len)
+{
+  struct call_stats *cs = get_call_stats (g, proc_nr);
+  struct call_start *start;
+  int64_t us;
+
+  if (cs == NULL)
+    return;
+
+  cs->bytes_received += len;
+
+  if (g->call_starts == NULL)
+    return;
+  start = &g->call_starts[(unsigned) serial % NR_CALL_STARTS];
+  if (start->proc_nr != proc_nr || start->serial != serial)
+    return;
+
+  us = now_us () - start->start_us;
+  if (us < 0)
+    us = 0;
+  call_stats_add (cs, us);
+  start->proc_nr = 0;
+
+  /* Any FileOut parameters are received next. */
+  g->call_file_proc = proc_nr;
+  g->call_file_start_us = start->start_us;
+  g->call_file_us = us;
+}
+
+/* Called for each chunk of a file sent or received. */
+void
+guestfs_int_call_stats_file_data (guestfs_h *g, size_t sent, size_t received)
+{
+  struct call_stats *cs = get_call_stats (g, g->call_file_proc);
+
+  if (cs == NULL)
+    return;
+
+  cs->bytes_sent += sent;
+  cs->bytes_received += received;
+}
+
+/* Called when a downloaded file has been completely received. */
+void
+guestfs_int_call_stats_file_done (guestfs_h *g)
+{
+  struct call_stats *cs = get_call_stats (g, g->call_file_proc);
+  int64_t us;
+
+  if (cs == NULL || g->call_file_us < 0)
+    return;
+
+  us = now_us () - g->call_file_start_us;
+  if (us < g->call_file_us)
+    us = g->call_file_us;
+  call_stats_remove (cs, g->call_file_us);
+  call_stats_add (cs, us);
+  g->call_file_us = us;
+}
+
+void
+guestfs_int_free_call_stats (guestfs_h *g)
+{
+  size_t i;
+
+  if (g->call_stats) {
+    for (i = 0; i <= GUESTFS_MAX_PROC_NR; ++i)
+      free (g->call_stats[i]);
+    free (g->call_stats);
+    g->call_stats = NULL;
+  }
+  free (g->call_starts);
+  g->call_starts = NULL;
+}
+
+static int
+compare_call_stat (const void *av, const void *bv)
+{
+  const struct guestfs_call_stat *a = av;
+  const struct guestfs_call_stat *b = bv;
+
+  return strcmp (a->cs_name, b->cs_name);
+}
+
+struct guestfs_call_stat_list *
+guestfs_impl_get_call_stats (guestfs_h *g)
+{
+  CLEANUP_FREE_CALL_STAT_LIST struct guestfs_call_stat_list *daemon = NULL;
+  struct guestfs_call_stat_list *ret;
+  size_t i, j, n = 0;
+
+  /* The daemon's view.  Old daemons don't have this call. */
+  if (g->state == READY) {
+    guestfs_push_error_handler (g, NULL, NULL);
+    daemon = guestfs_internal_call_stats (g);
+    guestfs_pop_error_handler (g);
+  }
+
+  if (g->call_stats) {
+    for (i = 0; i <= GUESTFS_MAX_PROC_NR; ++i)
+      if (g->call_stats[i])
+        n++;
+  }
+
+  ret = safe_malloc (g, sizeof *ret);
+  ret->len = 0;
+  ret->val = safe_calloc (g, n > 0 ? n : 1, sizeof (struct guestfs_call_stat));
+
+  for (i = 0; n > 0 && i <= GUESTFS_MAX_PROC_NR; ++i) {
+    const struct call_stats *cs = g->call_stats[i];
+    struct guestfs_call_stat *s;
+
+    if (cs == NULL)
+      continue;
+
+    s = &ret->val[ret->len++];
+    s->cs_name = safe_strdup (g, guestfs_int_proc_names[i] ?
+                              guestfs_int_proc_names[i] : "unknown");
+    s->cs_calls = cs->calls;
+    s->cs_bytes_sent = cs->bytes_sent;
+    s->cs_bytes_received = cs->bytes_received;
+    s->cs_total_us = cs->total_us;
+    s->cs_p50_us = call_stats_percentile (cs, 50);
+    s->cs_p99_us = call_stats_percentile (cs, 99);
+
+    for (j = 0; daemon && j < daemon->len; ++j) {
+      if (STREQ (daemon->val[j].cs_name, s->cs_name)) {
+        s->cs_daemon_us = daemon->val[j].cs_total_us;
+        s->cs_daemon_p50_us = daemon->val[j].cs_p50_us;
+        s->cs_daemon_p99_us = daemon->val[j].cs_p99_us;
+        break;
+      }
+    }
+  }
+
+  qsort (ret->val, ret->len, sizeof (struct guestfs_call_stat),
+         compare_call_stat);
+
+  return ret;
+}
@@ -0,0 +1,111 @@
+/* libguestfs
+ * Copyright (C) 2015 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* NB: This is shared by the library (src/call-stats.c) and the
+ * daemon (daemon/proto.c).  See guestfs_get_call_stats.
+ */
+
+#ifndef GUESTFS_CALL_STATS_H_
+#define GUESTFS_CALL_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Latencies are kept in microseconds in a histogram with 4 buckets
+ * for each power of 2, so percentiles are within about 10% of the
+ * real value.  Bucket 0-3 hold 0-3us, 4-7 hold 4-7us, 8-11 hold
+ * 8-15us in steps of 2, and so on up to 2^41us (25 days).
+ */
+#define CALL_STATS_BUCKETS 160
+
+struct call_stats {
+  uint64_t calls;
+  uint64_t bytes_sent;
+  uint64_t bytes_received;
+  uint64_t total_us;
+  uint32_t hist[CALL_STATS_BUCKETS];
+};
+
+static inline size_t
+call_stats_bucket (uint64_t us)
+{
+  size_t e, b;
+
+  if (us < 4)
+    return us;
+
+  /* e = floor (log2 (us)), which is >= 2 here. */
+  for (e = 2; e < 63 && (us >> (e+1)) != 0; ++e)
+    ;
+  b = 4 * (e-1) + ((us >> (e-2)) & 3);
+  return b < CALL_STATS_BUCKETS ? b : CALL_STATS_BUCKETS-1;
+}
+
+/* The smallest latency which goes in bucket 'b'. */
+static inline uint64_t
+call_stats_bucket_start (size_t b)
+{
+  if (b < 4)
+    return b;
+  return (UINT64_C(4) + b % 4) << (b/4 - 1);
+}
+
+static inline void
+call_stats_add (struct call_stats *cs, uint64_t us)
+{
+  cs->calls++;
+  cs->total_us += us;
+  cs->hist[call_stats_bucket (us)]++;
+}
+
+static inline void
+call_stats_remove (struct call_stats *cs, uint64_t us)
+{
+  cs->calls--;
+  cs->total_us -= us;
+  cs->hist[call_stats_bucket (us)]--;
+}
+
+/* Estimate the latency within which 'pct' percent of the calls
+ * completed, as the middle of the bucket where that call falls.
+ */
+static inline uint64_t
+call_stats_percentile (const struct call_stats *cs, unsigned pct)
+{
+  uint64_t rank, seen = 0, lo, hi;
+  size_t b;
+
+  if (cs->calls == 0)
+    return 0;
+
+  rank = (cs->calls * pct + 99) / 100;
+  if (rank == 0)
+    rank = 1;
+
+  for (b = 0; b < CALL_STATS_BUCKETS-1; ++b) {
+    seen += cs->hist[b];
+    if (seen >= rank)
+      break;
+  }
+
+  lo = call_stats_bucket_start (b);
+  hi = b < CALL_STATS_BUCKETS-1 ? call_stats_bucket_start (b+1) : lo + 1;
+  return lo + (hi - lo - 1) / 2;
+}
+
+#endif /* GUESTFS_CALL_STATS_H_ */
@@ -35,6 +35,19 @@
 #include "guestfs.h"
 #include "guestfs-internal.h"
 
+/* Data from the daemon is read into a buffer of this size.  Most
+ * messages are much smaller than this, so the length word, the
+ * message and often the next few messages arrive in a single read(2)
+ * instead of one read for each call of read_data.  Requests for more
+ * than this are read straight into the caller's buffer.
+ */
+#define RECV_BUFFER_SIZE (256 * 1024)
+
+/* While data keeps arriving we don't wait in poll(2), so the console
+ * socket is checked after this many reads or writes instead.
+ */
+#define CONSOLE_CHECK_INTERVAL 32
+
 struct connection_socket {
   const struct connection_ops *ops;
 
@@ -45,6 +58,15 @@ struct connection_socket {
    * before and during accept_connection.
    */
   int daemon_accept_sock;
+
+  /* Data read from daemon_sock but not yet returned by read_data is
+   * recv_buf[recv_start .. recv_end-1].  Allocated on first use.
+   */
+  char *recv_buf;
+  size_t recv_start, recv_end;
+
+  /* Reads and writes since the console was last checked. */
+  unsigned io_count;
 };
 
 static int handle_log_message (guestfs_h *g, struct connection_socket *conn);
@@ -131,25 +153,22 @@ accept_connection (guestfs_h *g, struct connection *connv)
   return 1;
 }
 
-static ssize_t
-read_data (guestfs_h *g, struct connection *connv, void *bufv, size_t len)
+/* Wait until the daemon socket is ready for 'events' (POLLIN or
+ * POLLOUT), handling any log messages that arrive meanwhile.
+ *
+ * Returns: 1 = ready, 0 = appliance closed connection, -1 = error
+ */
+static int
+wait_daemon_sock (guestfs_h *g, struct connection_socket *conn,
+                  short events, const char *fn)
 {
-  char *buf = bufv;
-  struct connection_socket *conn = (struct connection_socket *) connv;
-  size_t original_len = len;
-
-  if (conn->daemon_sock == -1) {
-    error (g, _("read_data: socket not connected"));
-    return -1;
-  }
-
-  while (len > 0) {
+  for (;;) {
     struct pollfd fds[2];
     nfds_t nfds = 1;
     int r;
 
     fds[0].fd = conn->daemon_sock;
-    fds[0].events = POLLIN;
+    fds[0].events = events;
     fds[0].revents = 0;
 
     if (conn->console_sock >= 0) {
@@ -163,10 +182,12 @@ read_data (guestfs_h *g, struct connection *connv, void *bufv, size_t len)
     if (r == -1) {
       if (errno == EINTR || errno == EAGAIN)
         continue;
-      perrorf (g, "read_data: poll");
+      perrorf (g, "%s: poll", fn);
       return -1;
     }
 
+    conn->io_count = 0;
+
     /* Log message? */
     if (nfds > 1 && (fds[1].revents & POLLIN) != 0) {
       r = handle_log_message (g, conn);
@@ -174,33 +195,125 @@ read_data (guestfs_h *g, struct connection *connv, void *bufv, size_t len)
         return r;
     }
 
-    /* Read data on daemon socket? */
-    if ((fds[0].revents & POLLIN) != 0) {
-      ssize_t n = read (conn->daemon_sock, buf, len);
-      if (n == -1) {
-        if (errno == EINTR || errno == EAGAIN)
-          continue;
-        if (errno == ECONNRESET) /* essentially the same as EOF case */
-          goto closed;
-        perrorf (g, "read_data: read");
-        return -1;
+    /* POLLHUP and POLLERR are reported by the following read or
+     * write.
+     */
+    if ((fds[0].revents & (events|POLLHUP|POLLERR)) != 0)
+      return 1;
+  }
+}
+
+/* Called after each read or write which did not have to wait.
+ * Every so often, handle log messages from the console so that the
+ * appliance does not block writing to it.
+ *
+ * Returns: 1 = OK, 0 = appliance closed connection, -1 = error
+ */
+static int
+check_console (guestfs_h *g, struct connection_socket *conn)
+{
+  struct pollfd fd;
+
+  if (conn->console_sock == -1 ||
+      ++conn->io_count < CONSOLE_CHECK_INTERVAL)
+    return 1;
+  conn->io_count = 0;
+
+  fd.fd = conn->console_sock;
+  fd.events = POLLIN;
+  fd.revents = 0;
+  if (poll (&fd, 1, 0) == 1 && (fd.revents & POLLIN) != 0)
+    return handle_log_message (g, conn);
+
+  return 1;
+}
+
+static ssize_t
+read_data (guestfs_h *g, struct connection *connv, void *bufv, size_t len)
+{
+  char *buf = bufv;
+  struct connection_socket *conn = (struct connection_socket *) connv;
+  size_t original_len = len;
+
+  if (conn->daemon_sock == -1) {
+    error (g, _("read_data: socket not connected"));
+    return -1;
+  }
+
+  while (len > 0) {
+    char *dest;
+    size_t dest_len;
+    ssize_t n;
+    int r;
+
+    /* Return data that was read earlier. */
+    if (conn->recv_start < conn->recv_end) {
+      n = MIN (len, conn->recv_end - conn->recv_start);
+      memcpy (buf, &conn->recv_buf[conn->recv_start], n);
+      conn->recv_start += n;
+      if (conn->recv_start == conn->recv_end)
+        conn->recv_start = conn->recv_end = 0;
+      buf += n;
+      len -= n;
+      continue;
+    }
+
+    /* The buffer is empty.  Read as much as is available into it,
+     * unless the caller wants so much that we may as well read it
+     * directly.
+     */
+    if (len >= RECV_BUFFER_SIZE) {
+      dest = buf;
+      dest_len = len;
+    }
+    else {
+      if (conn->recv_buf == NULL)
+        conn->recv_buf = safe_malloc (g, RECV_BUFFER_SIZE);
+      dest = conn->recv_buf;
+      dest_len = RECV_BUFFER_SIZE;
+    }
+
+    /* The socket is non-blocking, so try to read first and only wait
+     * if nothing is available.
+     */
+    n = read (conn->daemon_sock, dest, dest_len);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        r = wait_daemon_sock (g, conn, POLLIN, "read_data");
+        if (r <= 0)
+          return r;
+        continue;
       }
-      if (n == 0) {
-      closed:
-        /* Even though qemu has gone away, there could be more log
-         * messages in the console socket buffer in the kernel.  Read
-         * them out here.
-         */
-        if (g->verbose && conn->console_sock >= 0) {
-          while (handle_log_message (g, conn) == 1)
-            ;
-        }
-        return 0;
+      if (errno == ECONNRESET) /* essentially the same as EOF case */
+        goto closed;
+      perrorf (g, "read_data: read");
+      return -1;
+    }
+    if (n == 0) {
+    closed:
+      /* Even though qemu has gone away, there could be more log
+       * messages in the console socket buffer in the kernel.  Read
+       * them out here.
+       */
+      if (g->verbose && conn->console_sock >= 0) {
+        while (handle_log_message (g, conn) == 1)
+          ;
       }
+      return 0;
+    }
 
+    if (dest == buf) {
       buf += n;
       len -= n;
     }
+    else
+      conn->recv_end = n;
+
+    r = check_console (g, conn);
+    if (r <= 0)
+      return r;
   }
 
   return original_len;
@@ -218,6 +331,9 @@ can_read_data (guestfs_h *g, struct connection *connv)
     return -1;
   }
 
+  if (conn->recv_start < conn->recv_end)
+    return 1;
+
   fd.fd = conn->daemon_sock;
   fd.events = POLLIN;
   fd.revents = 0;
@@ -248,51 +364,31 @@ write_data (guestfs_h *g, struct connection *connv,
   }
 
   while (len > 0) {
-    struct pollfd fds[2];
-    nfds_t nfds = 1;
+    ssize_t n;
     int r;
 
-    fds[0].fd = conn->daemon_sock;
-    fds[0].events = POLLOUT;
-    fds[0].revents = 0;
-
-    if (conn->console_sock >= 0) {
-      fds[1].fd = conn->console_sock;
-      fds[1].events = POLLIN;
-      fds[1].revents = 0;
-      nfds++;
-    }
-
-    r = poll (fds, nfds, -1);
-    if (r == -1) {
-      if (errno == EINTR || errno == EAGAIN)
+    n = write (conn->daemon_sock, buf, len);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        r = wait_daemon_sock (g, conn, POLLOUT, "write_data");
+        if (r <= 0)
+          return r;
         continue;
-      perrorf (g, "write_data: poll");
+      }
+      if (errno == EPIPE) /* Disconnected from guest (RHBZ#508713). */
+        return 0;
+      perrorf (g, "write_data: write");
       return -1;
     }
 
-    /* Log message? */
-    if (nfds > 1 && (fds[1].revents & POLLIN) != 0) {
-      r = handle_log_message (g, conn);
-      if (r <= 0)
-        return r;
-    }
-
-    /* Can write data on daemon socket? */
-    if ((fds[0].revents & POLLOUT) != 0) {
-      ssize_t n = write (conn->daemon_sock, buf, len);
-      if (n == -1) {
-        if (errno == EINTR || errno == EAGAIN)
-          continue;
-        if (errno == EPIPE) /* Disconnected from guest (RHBZ#508713). */
-          return 0;
-        perrorf (g, "write_data: write");
-        return -1;
-      }
+    buf += n;
+    len -= n;
 
-      buf += n;
-      len -= n;
-    }
+    r = check_console (g, conn);
+    if (r <= 0)
+      return r;
   }
 
   return original_len;
@@ -378,6 +474,7 @@ free_conn_socket (guestfs_h *g, struct connection *connv)
   if (conn->daemon_accept_sock >= 0)
     close (conn->daemon_accept_sock);
 
+  free (conn->recv_buf);
   free (conn);
 }
 
@@ -428,6 +525,9 @@ guestfs_int_new_conn_socket_listening (guestfs_h *g,
   conn->console_sock = console_sock;
   conn->daemon_sock = -1;
   conn->daemon_accept_sock = daemon_accept_sock;
+  conn->recv_buf = NULL;
+  conn->recv_start = conn->recv_end = 0;
+  conn->io_count = 0;
 
   return (struct connection *) conn;
 }
@@ -467,6 +567,9 @@ guestfs_int_new_conn_socket_connected (guestfs_h *g,
   conn->console_sock = console_sock;
   conn->daemon_sock = daemon_sock;
   conn->daemon_accept_sock = -1;
+  conn->recv_buf = NULL;
+  conn->recv_start = conn->recv_end = 0;
+  conn->io_count = 0;
 
   return (struct connection *) conn;
 }
@@ -35,6 +35,8 @@
 #include <linux/fs.h>
 #endif
 
+#include "full-write.h"
+
 #include "guestfs.h"
 #include "guestfs-internal.h"
 #include "guestfs-internal-actions.h"
@@ -338,6 +340,202 @@ disk_create_qcow2 (guestfs_h *g, const char *orig_filename, int64_t size,
   return 0;
 }
 
+/* Write a qcow2 overlay on top of a local raw or qcow2 backing file
+ * directly, rather than running 'qemu-img create'.  Read-only drives
+ * need one overlay each on every launch, so for guests with many
+ * disks this saves starting several qemu-img processes.
+ *
+ * The overlay is a version 2 qcow2 file with 64K clusters and an
+ * empty L1 table.  Cluster 0 contains the header, the backing format
+ * extension and the backing file name, cluster 1 is the refcount
+ * table, cluster 2 the only refcount block and the L1 table starts at
+ * cluster 3.
+ */
+#define QCOW2_MAGIC 0x514649fb
+#define QCOW2_CLUSTER_BITS 16
+#define QCOW2_CLUSTER_SIZE (UINT64_C(1) << QCOW2_CLUSTER_BITS)
+#define QCOW2_EXT_BACKING_FORMAT 0xe2792aca
+#define QCOW2_MAX_BACKING_NAME 1023
+#define QCOW2_MAX_L1_SIZE (32 * 1024 * 1024 / 8)
+
+static void
+put_be32 (unsigned char *p, uint32_t v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static void
+put_be64 (unsigned char *p, uint64_t v)
+{
+  put_be32 (p, v >> 32);
+  put_be32 (p+4, v & 0xffffffff);
+}
+
+static uint64_t
+get_be64 (const unsigned char *p)
+{
+  uint64_t v = 0;
+  size_t i;
+
+  for (i = 0; i < 8; ++i)
+    v = (v << 8) | p[i];
+  return v;
+}
+
+/* Get the virtual size of a local raw or qcow2 file, or -1 if it
+ * cannot be found here (the caller then falls back to qemu-img, which
+ * will report any error).
+ */
+int64_t
+guestfs_int_get_virtual_size (const char *filename, const char *format)
+{
+  int fd;
+  int64_t size = -1;
+
+  fd = open (filename, O_RDONLY|O_NOCTTY|O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+
+  if (STREQ (format, "raw"))
+    size = lseek (fd, 0, SEEK_END);
+  else {
+    unsigned char header[32];
+
+    if (pread (fd, header, sizeof header, 0) == sizeof header &&
+        get_be64 (header) >> 32 == QCOW2_MAGIC)
+      size = get_be64 (&header[24]);
+  }
+
+  close (fd);
+  return size;
+}
+
+/* Returns 0 if the overlay was written, 1 if it cannot be done here
+ * and the caller should use qemu-img, or -1 on error.
+ */
+static int
+write_qcow2_overlay (guestfs_h *g, const char *overlay,
+                     const char *backingfile, const char *backingformat)
+{
+  const size_t name_len = strlen (backingfile);
+  const size_t fmt_len = backingformat ? strlen (backingformat) : 0;
+  CLEANUP_FREE unsigned char *buf = NULL;
+  unsigned char *p;
+  int64_t size;
+  uint64_t l1_size, l1_clusters, nr_clusters, i;
+  size_t name_offset;
+  int fd;
+
+  /* Only local files with a known format.  With no format qemu-img
+   * would probe it, which we don't want to reimplement.
+   */
+  if (backingfile[0] != '/' || name_len > QCOW2_MAX_BACKING_NAME ||
+      backingformat == NULL ||
+      (STRNEQ (backingformat, "raw") && STRNEQ (backingformat, "qcow2")))
+    return 1;
+
+  size = guestfs_int_get_virtual_size (backingfile, backingformat);
+  if (size <= 0)
+    return 1;
+  /* qemu-img rounds the size up to a whole sector. */
+  size = (size + 511) & ~INT64_C(511);
+
+  l1_size = (size + (QCOW2_CLUSTER_SIZE << (QCOW2_CLUSTER_BITS - 3)) - 1)
+    >> (QCOW2_CLUSTER_BITS * 2 - 3);
+  if (l1_size > QCOW2_MAX_L1_SIZE)
+    return 1;
+  l1_clusters = (l1_size * 8 + QCOW2_CLUSTER_SIZE - 1) / QCOW2_CLUSTER_SIZE;
+  nr_clusters = 3 + l1_clusters;
+
+  buf = safe_calloc (g, 3, QCOW2_CLUSTER_SIZE);
+
+  /* Header extensions start straight after the 72 byte version 2
+   * header, and the backing file name follows them.
+   */
+  p = &buf[72];
+  put_be32 (p, QCOW2_EXT_BACKING_FORMAT);
+  put_be32 (p+4, fmt_len);
+  memcpy (p+8, backingformat, fmt_len);
+  p += 8 + ((fmt_len + 7) & ~7);
+  p += 8;                       /* End of extensions (type 0). */
+  name_offset = p - buf;
+  memcpy (p, backingfile, name_len);
+
+  put_be32 (&buf[0], QCOW2_MAGIC);
+  put_be32 (&buf[4], 2);        /* version */
+  put_be64 (&buf[8], name_offset);
+  put_be32 (&buf[16], name_len);
+  put_be32 (&buf[20], QCOW2_CLUSTER_BITS);
+  put_be64 (&buf[24], size);
+  put_be32 (&buf[32], 0);       /* crypt_method */
+  put_be32 (&buf[36], l1_size);
+  put_be64 (&buf[40], 3 * QCOW2_CLUSTER_SIZE); /* l1_table_offset */
+  put_be64 (&buf[48], 1 * QCOW2_CLUSTER_SIZE); /* refcount_table_offset */
+  put_be32 (&buf[56], 1);       /* refcount_table_clusters */
+  put_be32 (&buf[60], 0);       /* nb_snapshots */
+  put_be64 (&buf[64], 0);       /* snapshots_offset */
+
+  /* Refcount table, pointing to the refcount block. */
+  put_be64 (&buf[QCOW2_CLUSTER_SIZE], 2 * QCOW2_CLUSTER_SIZE);
+
+  /* Refcount block: 16 bit refcounts, each metadata cluster is used once. */
+  for (i = 0; i < nr_clusters; ++i) {
+    p = &buf[2 * QCOW2_CLUSTER_SIZE + i * 2];
+    p[0] = 0;
+    p[1] = 1;
+  }
+
+  fd = open (overlay, O_WRONLY|O_CREAT|O_TRUNC|O_NOCTTY|O_CLOEXEC, 0666);
+  if (fd == -1) {
+    perrorf (g, _("cannot create qcow2 overlay: %s"), overlay);
+    return -1;
+  }
+  /* The L1 table is all zeroes, so it is left as a hole. */
+  if (full_write (fd, buf, 3 * QCOW2_CLUSTER_SIZE) != 3 * QCOW2_CLUSTER_SIZE ||
+      ftruncate (fd, nr_clusters * QCOW2_CLUSTER_SIZE) == -1) {
+    perrorf (g, _("write: %s"), overlay);
+    close (fd);
+    unlink (overlay);
+    return -1;
+  }
+  if (close (fd) == -1) {
+    perrorf (g, _("close: %s"), overlay);
+    unlink (overlay);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Create a qcow2 overlay 'overlay' backed by 'backingfile' (which
+ * must already be an absolute path or a qemu URI), for protecting
+ * read-only drives.  'backingformat' may be NULL.
+ */
+int
+guestfs_int_create_qcow2_overlay (guestfs_h *g, const char *overlay,
+                                  const char *backingfile,
+                                  const char *backingformat)
+{
+  struct guestfs_disk_create_argv optargs;
+  int r;
+
+  r = write_qcow2_overlay (g, overlay, backingfile, backingformat);
+  if (r <= 0)
+    return r;
+
+  optargs.bitmask = GUESTFS_DISK_CREATE_BACKINGFILE_BITMASK;
+  optargs.backingfile = backingfile;
+  if (backingformat) {
+    optargs.bitmask |= GUESTFS_DISK_CREATE_BACKINGFORMAT_BITMASK;
+    optargs.backingformat = backingformat;
+  }
+
+  return guestfs_disk_create_argv (g, overlay, "qcow2", -1, &optargs);
+}
+
 /* XXX Duplicated in launch-direct.c. */
 static char *
 qemu_escape_param (guestfs_h *g, const char *param)
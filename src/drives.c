@@ -33,12 +33,16 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <assert.h>
+#include <errno.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 
 #include <pcre.h>
 
 #include "c-ctype.h"
 #include "ignore-value.h"
+#include "full-read.h"
+#include "full-write.h"
 
 #include "guestfs.h"
 #include "guestfs-internal.h"
@@ -70,15 +74,199 @@ COMPILE_REGEXP (re_hostname_port, "(.*):(\\d+)$", 0)
 static void free_drive_struct (struct drive *drv);
 static void free_drive_source (struct drive_source *src);
 
+/* An overlay kept after shutdown (see guestfs_set_reuse_overlays). */
+struct spare_overlay {
+  struct spare_overlay *next;
+  char *key;
+  char *overlay;
+  char *data;
+  size_t data_len;
+  size_t size;
+};
+
+/* Don't keep the contents of overlays bigger than this.  An empty
+ * qcow2 overlay is a few hundred kilobytes even for large disks.
+ */
+#define MAX_OVERLAY_DATA (16 * 1024 * 1024)
+
+/* Return a string identifying the source of a drive, for matching
+ * overlays, or NULL if the overlay of this drive should not be
+ * reused.  Only local files are handled, since for those we can tell
+ * if the file has changed since the overlay was created.
+ */
+static char *
+overlay_key (guestfs_h *g, const struct drive *drv)
+{
+  CLEANUP_FREE char *path = NULL;
+  struct stat statbuf;
+  off_t size;
+  int fd;
+
+  if (drv->src.protocol != drive_protocol_file)
+    return NULL;
+
+  path = realpath (drv->src.u.path, NULL);
+  if (path == NULL)
+    return NULL;
+  fd = open (path, O_RDONLY|O_CLOEXEC);
+  if (fd == -1)
+    return NULL;
+  if (fstat (fd, &statbuf) == -1) {
+    close (fd);
+    return NULL;
+  }
+  size = lseek (fd, 0, SEEK_END);  /* st_size is 0 for block devices */
+  close (fd);
+  if (size == -1)
+    return NULL;
+
+  return safe_asprintf (g, "%s\n%s\n%s\n%" PRIi64 " %" PRIi64 " %ld",
+                        g->backend, path,
+                        drv->src.format ? drv->src.format : "",
+                        (int64_t) size, (int64_t) statbuf.st_mtime,
+                        (long) statbuf.st_mtim.tv_nsec);
+}
+
+/* Remember the contents of a newly created overlay so that it can be
+ * reset later.  Failures just mean the overlay won't be reused.
+ */
+static void
+save_overlay_data (guestfs_h *g, struct drive *drv, char *key)
+{
+  struct stat statbuf;
+  char *data;
+  size_t len;
+  int fd;
+
+  fd = open (drv->overlay, O_RDONLY|O_CLOEXEC);
+  if (fd == -1)
+    goto fail;
+  if (fstat (fd, &statbuf) == -1 || !S_ISREG (statbuf.st_mode) ||
+      statbuf.st_size > MAX_OVERLAY_DATA) {
+    close (fd);
+    goto fail;
+  }
+  len = statbuf.st_size;
+  data = safe_malloc (g, len + 1);
+  if (full_read (fd, data, len) != len) {
+    free (data);
+    close (fd);
+    goto fail;
+  }
+  close (fd);
+
+  drv->overlay_size = len;
+  while (len > 0 && data[len-1] == '\0')
+    len--;
+  drv->overlay_key = key;
+  drv->overlay_data = data;
+  drv->overlay_data_len = len;
+  return;
+
+ fail:
+  debug (g, "%s: not reusable", drv->overlay);
+  free (key);
+}
+
+/* If a spare overlay was made from the same drive, reset it to its
+ * initial contents and use it for 'drv'.  Returns 0 if an overlay was
+ * reused, -1 if not.
+ */
+static int
+reuse_overlay (guestfs_h *g, struct drive *drv, const char *key)
+{
+  struct spare_overlay **pp, *sp;
+  int fd;
+
+  for (pp = &g->spare_overlays; *pp != NULL; pp = &(*pp)->next) {
+    if (STREQ ((*pp)->key, key))
+      break;
+  }
+  sp = *pp;
+  if (sp == NULL)
+    return -1;
+  *pp = sp->next;
+
+  fd = open (sp->overlay, O_WRONLY|O_TRUNC|O_NOCTTY|O_CLOEXEC);
+  if (fd == -1 ||
+      full_write (fd, sp->data, sp->data_len) != sp->data_len ||
+      ftruncate (fd, sp->size) == -1 ||
+      close (fd) == -1) {
+    debug (g, "%s: could not reset overlay: %s", sp->overlay, strerror (errno));
+    if (fd >= 0)
+      close (fd);
+    unlink (sp->overlay);
+    free (sp->key);
+    free (sp->overlay);
+    free (sp->data);
+    free (sp);
+    return -1;
+  }
+
+  debug (g, "reusing overlay %s", sp->overlay);
+  free (drv->overlay);
+  drv->overlay = sp->overlay;
+  drv->overlay_key = sp->key;
+  drv->overlay_data = sp->data;
+  drv->overlay_data_len = sp->data_len;
+  drv->overlay_size = sp->size;
+  free (sp);
+  return 0;
+}
+
+/* Called when the drives are freed at shutdown: move the overlay
+ * into the list of spare overlays.
+ */
+static void
+keep_overlay (guestfs_h *g, struct drive *drv)
+{
+  struct spare_overlay *sp;
+
+  sp = safe_malloc (g, sizeof *sp);
+  sp->key = drv->overlay_key;
+  sp->overlay = drv->overlay;
+  sp->data = drv->overlay_data;
+  sp->data_len = drv->overlay_data_len;
+  sp->size = drv->overlay_size;
+  sp->next = g->spare_overlays;
+  g->spare_overlays = sp;
+
+  drv->overlay_key = drv->overlay = drv->overlay_data = NULL;
+}
+
+/* Delete the spare overlays which were not reused.  This is called
+ * at launch (after all the drives have been added) and when the
+ * handle is closed.
+ */
+void
+guestfs_int_free_spare_overlays (guestfs_h *g)
+{
+  struct spare_overlay *sp, *next;
+
+  for (sp = g->spare_overlays; sp != NULL; sp = next) {
+    next = sp->next;
+    unlink (sp->overlay);
+    free (sp->key);
+    free (sp->overlay);
+    free (sp->data);
+    free (sp);
+  }
+  g->spare_overlays = NULL;
+}
+
 /* For readonly drives, create an overlay to protect the original
  * drive content.  Note we never need to clean up these overlays since
  * they are created in the temporary directory and deleted when the
  * handle is closed.
+ *
+ * If guestfs_set_reuse_overlays is enabled, an overlay of the same
+ * drive from before the last shutdown is used instead if possible.
  */
 static int
 create_overlay (guestfs_h *g, struct drive *drv)
 {
   char *overlay;
+  char *key = NULL;
 
   assert (g->backend_ops != NULL);
 
@@ -87,14 +275,27 @@ create_overlay (guestfs_h *g, struct drive *drv)
     return -1;
   }
 
+  if (g->reuse_overlays) {
+    key = overlay_key (g, drv);
+    if (key && reuse_overlay (g, drv, key) == 0) {
+      free (key);
+      return 0;
+    }
+  }
+
   debug (g, "creating COW overlay to protect original drive content");
   overlay = g->backend_ops->create_cow_overlay (g, g->backend_data, drv);
-  if (overlay == NULL)
+  if (overlay == NULL) {
+    free (key);
     return -1;
+  }
 
   free (drv->overlay);
   drv->overlay = overlay;
 
+  if (key)
+    save_overlay_data (g, drv, key);
+
   return 0;
 }
 
@@ -469,6 +670,8 @@ free_drive_struct (struct drive *drv)
 {
   free_drive_source (&drv->src);
   free (drv->overlay);
+  free (drv->overlay_key);
+  free (drv->overlay_data);
   free (drv->iface);
   free (drv->name);
   free (drv->disk_label);
@@ -566,6 +769,8 @@ guestfs_int_free_drives (guestfs_h *g)
   size_t i;
 
   ITER_DRIVES (g, i, drv) {
+    if (g->reuse_overlays && drv->overlay_key)
+      keep_overlay (g, drv);
     free_drive_struct (drv);
   }
 
@@ -733,6 +938,50 @@ parse_servers (guestfs_h *g, char *const *strs,
   return n;
 }
 
+/* Hot-add a drive to the running appliance.  'drv' is always
+ * consumed: either it is now owned by the handle or it has been
+ * freed.
+ */
+static int
+hot_add_drive (guestfs_h *g, struct drive *drv)
+{
+  size_t i, drv_index;
+
+  if (!g->backend_ops->hot_add_drive) {
+    error (g, _("the current backend does not support hotplugging drives"));
+    free_drive_struct (drv);
+    return -1;
+  }
+
+  if (!drv->disk_label) {
+    error (g, _("'label' is required when hotplugging drives"));
+    free_drive_struct (drv);
+    return -1;
+  }
+
+  /* Get the first free index, or add it at the end. */
+  drv_index = g->nr_drives;
+  for (i = 0; i < g->nr_drives; ++i)
+    if (g->drives[i] == NULL)
+      drv_index = i;
+
+  /* Hot-add the drive. */
+  if (g->backend_ops->hot_add_drive (g, g->backend_data,
+                                     drv, drv_index) == -1) {
+    free_drive_struct (drv);
+    return -1;
+  }
+
+  add_drive_to_handle_at (g, drv, drv_index);
+  /* drv is now owned by the handle */
+
+  /* Call into the appliance to wait for the new drive to appear. */
+  if (guestfs_internal_hot_add_drive (g, drv->disk_label) == -1)
+    return -1;
+
+  return 0;
+}
+
 int
 guestfs_impl_add_drive_opts (guestfs_h *g, const char *filename,
                          const struct guestfs_add_drive_opts_argv *optargs)
@@ -740,7 +989,6 @@ guestfs_impl_add_drive_opts (guestfs_h *g, const char *filename,
   struct drive_create_data data;
   const char *protocol;
   struct drive *drv;
-  size_t i, drv_index;
 
   data.nr_servers = 0;
   data.servers = NULL;
@@ -912,39 +1160,7 @@ guestfs_impl_add_drive_opts (guestfs_h *g, const char *filename,
   }
 
   /* ... else, hotplugging case. */
-  if (!g->backend_ops->hot_add_drive) {
-    error (g, _("the current backend does not support hotplugging drives"));
-    free_drive_struct (drv);
-    return -1;
-  }
-
-  if (!drv->disk_label) {
-    error (g, _("'label' is required when hotplugging drives"));
-    free_drive_struct (drv);
-    return -1;
-  }
-
-  /* Get the first free index, or add it at the end. */
-  drv_index = g->nr_drives;
-  for (i = 0; i < g->nr_drives; ++i)
-    if (g->drives[i] == NULL)
-      drv_index = i;
-
-  /* Hot-add the drive. */
-  if (g->backend_ops->hot_add_drive (g, g->backend_data,
-                                     drv, drv_index) == -1) {
-    free_drive_struct (drv);
-    return -1;
-  }
-
-  add_drive_to_handle_at (g, drv, drv_index);
-  /* drv is now owned by the handle */
-
-  /* Call into the appliance to wait for the new drive to appear. */
-  if (guestfs_internal_hot_add_drive (g, drv->disk_label) == -1)
-    return -1;
-
-  return 0;
+  return hot_add_drive (g, drv);
 }
 
 int
@@ -508,6 +508,48 @@ guestfs_impl_readlinklist (guestfs_h *g, const char *dir, char *const *names)
   return ret;
 }
 
+#define CHECKSUMS_LIST_MAX 1000
+
+char **
+guestfs_impl_checksums_list (guestfs_h *g, const char *csumtype,
+                             const char *dir, char *const *names)
+{
+  size_t len = guestfs_int_count_strings (names);
+  size_t old_len, ret_len = 0;
+  char **ret = NULL;
+
+  while (len > 0) {
+    /* Note we don't need to free up the strings because the 'csums'
+     * strings are copied to ret, and 'take_strings' does not do a
+     * deep copy.
+     */
+    CLEANUP_FREE char **csums = NULL;
+    CLEANUP_FREE char **first =
+      take_strings (g, names, CHECKSUMS_LIST_MAX, &names);
+    len = len <= CHECKSUMS_LIST_MAX ? 0 : len - CHECKSUMS_LIST_MAX;
+
+    csums = guestfs_internal_checksums_list (g, csumtype, dir, first);
+
+    if (csums == NULL) {
+      if (ret)
+        guestfs_int_free_string_list (ret);
+      return NULL;
+    }
+
+    /* Append csums to ret. */
+    old_len = ret_len;
+    ret_len += guestfs_int_count_strings (csums);
+    ret = safe_realloc (g, ret, ret_len * sizeof (char *));
+    memcpy (&ret[old_len], csums, (ret_len-old_len) * sizeof (char *));
+  }
+
+  /* NULL-terminate the list. */
+  ret = safe_realloc (g, ret, (ret_len+1) * sizeof (char *));
+  ret[ret_len] = NULL;
+
+  return ret;
+}
+
 char **
 guestfs_impl_ls (guestfs_h *g, const char *directory)
 {
@@ -20,10 +20,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/statvfs.h>
 #include <string.h>
 
 #if HAVE_FUSE
@@ -62,6 +66,13 @@ static const struct stat *lsc_lookup (guestfs_h *, const char *pathname);
 static const struct guestfs_xattr_list *xac_lookup (guestfs_h *, const char *pathname);
 static const char *rlc_lookup (guestfs_h *, const char *pathname);
 
+/* Functions handling the read cache. */
+struct open_file;
+static int init_read_cache (guestfs_h *);
+static void free_read_cache (guestfs_h *);
+static void read_cache_invalidate (guestfs_h *, const char *path);
+static ssize_t read_cache_read (guestfs_h *, struct open_file *, const char *path, char *buf, size_t size, off_t offset, size_t readahead);
+
 /* This lock protects access to g->localmountpoint. */
 gl_lock_define_initialized (static, mount_local_lock);
 
@@ -73,18 +84,113 @@ gl_lock_define_initialized (static, mount_local_lock);
            g->localmountpoint, __func__, ## __VA_ARGS__);               \
   }
 
-#define RETURN_ERRNO                                                 \
-  do {                                                               \
-    int ret_errno = guestfs_last_errno (g);                          \
-                                                                     \
-    /* 0 doesn't mean "no error".  It means the errno was not        \
-     * captured.  Therefore we have to substitute an errno here.     \
-     */                                                              \
-    if (ret_errno == 0)                                              \
-      ret_errno = EINVAL;                                            \
-                                                                     \
-    return -ret_errno;                                               \
-  } while (0)
+/* Handles and locks used when requests are processed concurrently
+ * (see guestfs_mount_local, 'appliances' parameter).
+ *
+ * Every libguestfs call made for a FUSE request goes through a handle
+ * taken from the free list with get_handle and given back with
+ * put_handle, so that no handle is used by two threads at the same
+ * time.  The list contains the main handle 'g' and, for read-only
+ * mounts, helper handles which are separate appliances with the same
+ * drives added read-only and the same filesystems mounted.  For
+ * read-write mounts there is only 'g', so calls are serialized, but
+ * requests which are answered from the caches still run in parallel.
+ *
+ * Requests which change the filesystem invalidate the caches while
+ * they still hold the handle, and requests which fill the caches do
+ * so before giving back the handle, so with a single handle the
+ * caches are always consistent with the filesystem.
+ *
+ * The caches themselves are protected by cache_lock.
+ */
+struct mount_local_pool {
+  pthread_mutex_t cache_lock;
+  pthread_mutex_t lock;         /* Protects the fields below. */
+  pthread_cond_t cond;          /* Signalled when a handle is put back. */
+  guestfs_h **free_handles;     /* Stack of handles not in use. */
+  size_t nr_free;
+  guestfs_h **helpers;          /* Helper handles, closed at the end. */
+  size_t nr_helpers;
+};
+
+/* Take a handle from the free list.  If 'want' is not NULL, take
+ * that handle if it is free.  If it is in use, wait for it if 'wait'
+ * is true, otherwise take any handle.
+ */
+static guestfs_h *
+get_handle_prefer (guestfs_h *g, guestfs_h *want, int wait)
+{
+  struct mount_local_pool *pool = g->ml_pool;
+  guestfs_h *h;
+  size_t i;
+
+  pthread_mutex_lock (&pool->lock);
+  for (;;) {
+    for (i = 0; want && i < pool->nr_free; ++i) {
+      if (pool->free_handles[i] == want) {
+        pool->free_handles[i] = pool->free_handles[--pool->nr_free];
+        h = want;
+        goto out;
+      }
+    }
+    if ((!want || !wait) && pool->nr_free > 0) {
+      h = pool->free_handles[--pool->nr_free];
+      goto out;
+    }
+    pthread_cond_wait (&pool->cond, &pool->lock);
+  }
+ out:
+  pthread_mutex_unlock (&pool->lock);
+
+  return h;
+}
+
+static guestfs_h *
+get_handle (guestfs_h *g)
+{
+  return get_handle_prefer (g, NULL, 0);
+}
+
+static void
+put_handle (guestfs_h *g, guestfs_h *h)
+{
+  struct mount_local_pool *pool = g->ml_pool;
+
+  pthread_mutex_lock (&pool->lock);
+  pool->free_handles[pool->nr_free++] = h;
+  /* Threads may be waiting for a particular handle. */
+  pthread_cond_broadcast (&pool->cond);
+  pthread_mutex_unlock (&pool->lock);
+}
+
+static void
+lock_caches (guestfs_h *g)
+{
+  pthread_mutex_lock (&g->ml_pool->cache_lock);
+}
+
+static void
+unlock_caches (guestfs_h *g)
+{
+  pthread_mutex_unlock (&g->ml_pool->cache_lock);
+}
+
+/* Return the error of the last call on handle 'h', in the form that
+ * FUSE wants (a negative errno).
+ */
+static int
+fuse_errno (guestfs_h *h)
+{
+  int ret_errno = guestfs_last_errno (h);
+
+  /* 0 doesn't mean "no error".  It means the errno was not
+   * captured.  Therefore we have to substitute an errno here.
+   */
+  if (ret_errno == 0)
+    ret_errno = EINVAL;
+
+  return -ret_errno;
+}
 
 static struct guestfs_xattr_list *
 copy_xattr_list (guestfs_h *g, const struct guestfs_xattr *first, size_t num)
@@ -123,17 +229,25 @@ mount_local_readdir (const char *path, void *buf, fuse_fill_dir_t filler,
   time_t now;
   size_t i;
   char **names;
+  guestfs_h *h;
   CLEANUP_FREE_DIRENT_LIST struct guestfs_dirent_list *ents = NULL;
   DECL_G ();
   DEBUG_CALL ("%s, %p, %ld", path, buf, (long) offset);
 
   time (&now);
 
+  lock_caches (g);
   dir_cache_remove_all_expired (g, now);
+  unlock_caches (g);
 
-  ents = guestfs_readdir (g, path);
-  if (ents == NULL)
-    RETURN_ERRNO;
+  h = get_handle (g);
+
+  ents = guestfs_readdir (h, path);
+  if (ents == NULL) {
+    int r = fuse_errno (h);
+    put_handle (g, h);
+    return r;
+  }
 
   for (i = 0; i < ents->len; ++i) {
     struct stat stat;
@@ -174,7 +288,12 @@ mount_local_readdir (const char *path, void *buf, fuse_fill_dir_t filler,
       names[i] = ents->val[i].name;
     names[i] = NULL;
 
-    ss = guestfs_lstatnslist (g, path, names);
+    ss = guestfs_lstatnslist (h, path, names);
+    xattrs = guestfs_lxattrlist (h, path, names);
+    links = guestfs_readlinklist (h, path, names);
+
+    lock_caches (g);
+
     if (ss) {
       for (i = 0; i < ss->len; ++i) {
         if (ss->val[i].st_ino >= 0) {
@@ -209,7 +328,6 @@ mount_local_readdir (const char *path, void *buf, fuse_fill_dir_t filler,
       }
     }
 
-    xattrs = guestfs_lxattrlist (g, path, names);
     if (xattrs) {
       size_t ni, num;
       struct guestfs_xattr *first;
@@ -233,7 +351,6 @@ mount_local_readdir (const char *path, void *buf, fuse_fill_dir_t filler,
       }
     }
 
-    links = guestfs_readlinklist (g, path, names);
     if (links) {
       for (i = 0; names[i] != NULL; ++i) {
         if (links[i][0])
@@ -246,9 +363,13 @@ mount_local_readdir (const char *path, void *buf, fuse_fill_dir_t filler,
       free (links);             /* free the array, not the strings */
     }
 
+    unlock_caches (g);
+
     free (names);
   }
 
+  put_handle (g, h);
+
   return 0;
 }
 
@@ -256,19 +377,27 @@ static int
 mount_local_getattr (const char *path, struct stat *statbuf)
 {
   const struct stat *buf;
+  guestfs_h *h;
   CLEANUP_FREE_STAT struct guestfs_statns *r = NULL;
   DECL_G ();
   DEBUG_CALL ("%s, %p", path, statbuf);
 
+  lock_caches (g);
   buf = lsc_lookup (g, path);
-  if (buf) {
+  if (buf)
     memcpy (statbuf, buf, sizeof *statbuf);
+  unlock_caches (g);
+  if (buf)
     return 0;
-  }
 
-  r = guestfs_lstatns (g, path);
-  if (r == NULL)
-    RETURN_ERRNO;
+  h = get_handle (g);
+  r = guestfs_lstatns (h, path);
+  if (r == NULL) {
+    int err = fuse_errno (h);
+    put_handle (g, h);
+    return err;
+  }
+  put_handle (g, h);
 
   memset (statbuf, 0, sizeof *statbuf);
   statbuf->st_dev = r->st_dev;
@@ -365,18 +494,29 @@ mount_local_access (const char *path, int mask)
 static int
 mount_local_readlink (const char *path, char *buf, size_t size)
 {
-  const char *r;
-  int free_it = 0;
+  char *r;
+  const char *cached;
+  guestfs_h *h;
   size_t len;
   DECL_G ();
   DEBUG_CALL ("%s, %p, %zu", path, buf, size);
 
-  r = rlc_lookup (g, path);
+  lock_caches (g);
+  cached = rlc_lookup (g, path);
+  r = cached ? strdup (cached) : NULL;
+  unlock_caches (g);
+  if (cached && !r)
+    return -errno;
+
   if (!r) {
-    r = guestfs_readlink (g, path);
-    if (r == NULL)
-      RETURN_ERRNO;
-    free_it = 1;
+    h = get_handle (g);
+    r = guestfs_readlink (h, path);
+    if (r == NULL) {
+      int err = fuse_errno (h);
+      put_handle (g, h);
+      return err;
+    }
+    put_handle (g, h);
   }
 
   /* Note this is different from the real readlink(2) syscall.  FUSE wants
@@ -389,200 +529,229 @@ mount_local_readlink (const char *path, char *buf, size_t size)
   memcpy (buf, r, len);
   buf[len] = '\0';
 
-  if (free_it) {
-    char *tmp = (char *) r;
-    free (tmp);
-  }
+  free (r);
 
   return 0;
 }
 
+/* Called by the requests which change 'path', with the handle still
+ * held (see above).
+ */
+static void
+invalidate (guestfs_h *g, const char *path)
+{
+  lock_caches (g);
+  dir_cache_invalidate (g, path);
+  unlock_caches (g);
+}
+
 static int
 mount_local_mknod (const char *path, mode_t mode, dev_t rdev)
 {
   int r;
+  guestfs_h *h;
   DECL_G ();
   DEBUG_CALL ("%s, 0%o, 0x%lx", path, mode, (long) rdev);
 
   if (g->ml_read_only) return -EROFS;
 
-  dir_cache_invalidate (g, path);
-
-  r = guestfs_mknod (g, mode, major (rdev), minor (rdev), path);
+  h = get_handle (g);
+  r = guestfs_mknod (h, mode, major (rdev), minor (rdev), path);
   if (r == -1)
-    RETURN_ERRNO;
+    r = fuse_errno (h);
+  invalidate (g, path);
+  put_handle (g, h);
 
-  return 0;
+  return r;
 }
 
 static int
 mount_local_mkdir (const char *path, mode_t mode)
 {
   int r;
+  guestfs_h *h;
   DECL_G ();
   DEBUG_CALL ("%s, 0%o", path, mode);
 
   if (g->ml_read_only) return -EROFS;
 
-  dir_cache_invalidate (g, path);
-
-  r = guestfs_mkdir_mode (g, path, mode);
+  h = get_handle (g);
+  r = guestfs_mkdir_mode (h, path, mode);
   if (r == -1)
-    RETURN_ERRNO;
+    r = fuse_errno (h);
+  invalidate (g, path);
+  put_handle (g, h);
 
-  return 0;
+  return r;
 }
 
 static int
 mount_local_unlink (const char *path)
 {
   int r;
+  guestfs_h *h;
   DECL_G ();
   DEBUG_CALL ("%s", path);
 
   if (g->ml_read_only) return -EROFS;
 
-  dir_cache_invalidate (g, path);
-
-  r = guestfs_rm (g, path);
+  h = get_handle (g);
+  r = guestfs_rm (h, path);
   if (r == -1)
-    RETURN_ERRNO;
+    r = fuse_errno (h);
+  invalidate (g, path);
+  put_handle (g, h);
 
-  return 0;
+  return r;
 }
 
 static int
 mount_local_rmdir (const char *path)
 {
   int r;
+  guestfs_h *h;
   DECL_G ();
   DEBUG_CALL ("%s", path);
 
   if (g->ml_read_only) return -EROFS;
 
-  dir_cache_invalidate (g, path);
-
-  r = guestfs_rmdir (g, path);
+  h = get_handle (g);
+  r = guestfs_rmdir (h, path);
   if (r == -1)
-    RETURN_ERRNO;
+    r = fuse_errno (h);
+  invalidate (g, path);
+  put_handle (g, h);
 
-  return 0;
+  return r;
 }
 
 static int
 mount_local_symlink (const char *from, const char *to)
 {
   int r;
+  guestfs_h *h;
   DECL_G ();
   DEBUG_CALL ("%s, %s", from, to);
 
   if (g->ml_read_only) return -EROFS;
 
-  dir_cache_invalidate (g, to);
-
-  r = guestfs_ln_s (g, from, to);
+  h = get_handle (g);
+  r = guestfs_ln_s (h, from, to);
   if (r == -1)
-    RETURN_ERRNO;
+    r = fuse_errno (h);
+  invalidate (g, to);
+  put_handle (g, h);
 
-  return 0;
+  return r;
 }
 
 static int
 mount_local_rename (const char *from, const char *to)
 {
   int r;
+  guestfs_h *h;
   DECL_G ();
   DEBUG_CALL ("%s, %s", from, to);
 
   if (g->ml_read_only) return -EROFS;
 
-  dir_cache_invalidate (g, from);
-  dir_cache_invalidate (g, to);
-
-  r = guestfs_rename (g, from, to);
+  h = get_handle (g);
+  r = guestfs_rename (h, from, to);
   if (r == -1)
-    RETURN_ERRNO;
+    r = fuse_errno (h);
+  invalidate (g, from);
+  invalidate (g, to);
+  put_handle (g, h);
 
-  return 0;
+  return r;
 }
 
 static int
 mount_local_link (const char *from, const char *to)
 {
   int r;
+  guestfs_h *h;
   DECL_G ();
   DEBUG_CALL ("%s, %s", from, to);
 
   if (g->ml_read_only) return -EROFS;
 
-  dir_cache_invalidate (g, from);
-  dir_cache_invalidate (g, to);
-
-  r = guestfs_ln (g, from, to);
+  h = get_handle (g);
+  r = guestfs_ln (h, from, to);
   if (r == -1)
-    RETURN_ERRNO;
+    r = fuse_errno (h);
+  invalidate (g, from);
+  invalidate (g, to);
+  put_handle (g, h);
 
-  return 0;
+  return r;
 }
 
 static int
 mount_local_chmod (const char *path, mode_t mode)
 {
   int r;
+  guestfs_h *h;
   DECL_G ();
   DEBUG_CALL ("%s, 0%o", path, mode);
 
   if (g->ml_read_only) return -EROFS;
 
-  dir_cache_invalidate (g, path);
-
-  r = guestfs_chmod (g, mode, path);
+  h = get_handle (g);
+  r = guestfs_chmod (h, mode, path);
   if (r == -1)
-    RETURN_ERRNO;
+    r = fuse_errno (h);
+  invalidate (g, path);
+  put_handle (g, h);
 
-  return 0;
+  return r;
 }
 
 static int
 mount_local_chown (const char *path, uid_t uid, gid_t gid)
 {
   int r;
+  guestfs_h *h;
   DECL_G ();
   DEBUG_CALL ("%s, %ld, %ld", path, (long) uid, (long) gid);
 
   if (g->ml_read_only) return -EROFS;
 
-  dir_cache_invalidate (g, path);
-
-  r = guestfs_lchown (g, uid, gid, path);
+  h = get_handle (g);
+  r = guestfs_lchown (h, uid, gid, path);
   if (r == -1)
-    RETURN_ERRNO;
+    r = fuse_errno (h);
+  invalidate (g, path);
+  put_handle (g, h);
 
-  return 0;
+  return r;
 }
 
 static int
 mount_local_truncate (const char *path, off_t size)
 {
   int r;
+  guestfs_h *h;
   DECL_G ();
   DEBUG_CALL ("%s, %ld", path, (long) size);
 
   if (g->ml_read_only) return -EROFS;
 
-  dir_cache_invalidate (g, path);
-
-  r = guestfs_truncate_size (g, path, size);
+  h = get_handle (g);
+  r = guestfs_truncate_size (h, path, size);
   if (r == -1)
-    RETURN_ERRNO;
+    r = fuse_errno (h);
+  invalidate (g, path);
+  put_handle (g, h);
 
-  return 0;
+  return r;
 }
 
 static int
 mount_local_utimens (const char *path, const struct timespec ts[2])
 {
   int r;
+  guestfs_h *h;
   time_t atsecs, mtsecs;
   long atnsecs, mtnsecs;
   DECL_G ();
@@ -591,8 +760,6 @@ mount_local_utimens (const char *path, const struct timespec ts[2])
 
   if (g->ml_read_only) return -EROFS;
 
-  dir_cache_invalidate (g, path);
-
   atsecs = ts[0].tv_sec;
   atnsecs = ts[0].tv_nsec;
   mtsecs = ts[1].tv_sec;
@@ -615,26 +782,137 @@ mount_local_utimens (const char *path, const struct timespec ts[2])
     mtnsecs = -2;
 #endif
 
-  r = guestfs_utimens (g, path, atsecs, atnsecs, mtsecs, mtnsecs);
+  h = get_handle (g);
+  r = guestfs_utimens (h, path, atsecs, atnsecs, mtsecs, mtnsecs);
   if (r == -1)
-    RETURN_ERRNO;
+    r = fuse_errno (h);
+  invalidate (g, path);
+  put_handle (g, h);
 
-  return 0;
+  return r;
+}
+
+/* The guestfs protocol limits pread and pwrite to somewhere over
+ * 2MB.  We just reduce the requested size accordingly and push the
+ * problem up to every user.  http://www.jwz.org/doc/worse-is-better.html
+ */
+#define RW_LIMIT (2 * 1024 * 1024)
+
+/* State kept for each open file (in fi->fh).  Protected by
+ * cache_lock.
+ *
+ * The file is opened in the appliance (guestfs_open_handle) on the
+ * second read or write which is not answered from the read cache, so
+ * that later calls don't have to open the file by path again.  Files
+ * which are only read once (which is most of them, because of the
+ * read cache) cost no more round trips than before.  This is done on
+ * whichever handle the call got from the pool.  Calls which get a
+ * different handle use the path.
+ */
+struct open_file {
+  off_t next_offset;            /* Where the next sequential read starts. */
+  size_t readahead;             /* Current read-ahead window in bytes. */
+  int readwrite;                /* Opened for writing. */
+  unsigned nr_calls;            /* Reads and writes sent by path. */
+  guestfs_h *h;                 /* Handle on which the file was opened. */
+  int handle;                   /* From guestfs_open_handle, or -1. */
+};
+
+/* The read-ahead window starts at this size, doubles with each
+ * sequential read, and is limited to what one pread can return.
+ */
+#define MIN_READAHEAD (128 * 1024)
+#define MAX_READAHEAD RW_LIMIT
+
+/* Get a handle for a read or write of 'of', preferring the handle on
+ * which the file is open.
+ */
+static guestfs_h *
+get_file_handle (guestfs_h *g, struct open_file *of)
+{
+  guestfs_h *want = NULL;
+
+  if (of) {
+    lock_caches (g);
+    want = of->h;
+    unlock_caches (g);
+  }
+
+  return get_handle_prefer (g, want, 0);
 }
 
-/* All this function needs to do is to check that the requested open
- * flags are valid.  See the notes in <fuse/fuse.h>.
+/* Return the appliance handle of 'of' which can be used on 'h',
+ * opening the file if this is the second call, or -1 if the path must
+ * be used.  The caller holds 'h'.
+ */
+static int
+open_file_handle (guestfs_h *g, guestfs_h *h, struct open_file *of,
+                  const char *path)
+{
+  int handle, open_it = 0;
+
+  if (of == NULL)
+    return -1;
+
+  lock_caches (g);
+  if (of->h == NULL && ++of->nr_calls >= 2) {
+    of->h = h;
+    open_it = 1;
+  }
+  handle = of->h == h ? of->handle : -1;
+  unlock_caches (g);
+
+  if (!open_it)
+    return handle;
+
+  /* If this fails (eg. an old appliance), we just use the path. */
+  guestfs_push_error_handler (h, NULL, NULL);
+  handle = guestfs_open_handle (h, path,
+                                GUESTFS_OPEN_HANDLE_READWRITE, of->readwrite,
+                                -1);
+  guestfs_pop_error_handler (h);
+
+  lock_caches (g);
+  of->handle = handle;
+  unlock_caches (g);
+
+  return handle;
+}
+
+static char *
+file_pread (guestfs_h *g, guestfs_h *h, struct open_file *of,
+            const char *path, size_t count, off_t offset, size_t *rsize)
+{
+  const int handle = open_file_handle (g, h, of, path);
+
+  if (handle >= 0)
+    return guestfs_pread_handle (h, handle, count, offset, rsize);
+  else
+    return guestfs_pread (h, path, count, offset, rsize);
+}
+
+/* Apart from checking that the requested open flags are valid (see
+ * the notes in <fuse/fuse.h>), this only sets up the open_file
+ * state.
  */
 static int
 mount_local_open (const char *path, struct fuse_file_info *fi)
 {
   int flags = fi->flags & O_ACCMODE;
+  struct open_file *of;
   DECL_G ();
   DEBUG_CALL ("%s, 0%o", path, fi->flags);
 
   if (g->ml_read_only && flags != O_RDONLY)
     return -EROFS;
 
+  of = calloc (1, sizeof *of);
+  if (of == NULL)
+    return -errno;
+  of->readwrite = flags != O_RDONLY;
+  of->handle = -1;
+  fi->fh = (uintptr_t) of;
+
   return 0;
 }
 
@@ -644,20 +922,38 @@ mount_local_read (const char *path, char *buf, size_t size, off_t offset,
 {
   char *r;
   size_t rsize;
-  const size_t limit = 2 * 1024 * 1024;
+  guestfs_h *h;
+  struct open_file *of = (struct open_file *) (uintptr_t) fi->fh;
+  size_t readahead;
   DECL_G ();
   DEBUG_CALL ("%s, %p, %zu, %ld", path, buf, size, (long) offset);
 
-  /* The guestfs protocol limits size to somewhere over 2MB.  We just
-   * reduce the requested size here accordingly and push the problem
-   * up to every user.  http://www.jwz.org/doc/worse-is-better.html
-   */
-  if (size > limit)
-    size = limit;
+  if (size > RW_LIMIT)
+    size = RW_LIMIT;
+
+  if (g->rc_ht && of) {
+    /* Read ahead only while the file is being read sequentially. */
+    lock_caches (g);
+    if (offset == of->next_offset && offset > 0)
+      of->readahead = MIN (MAX_READAHEAD,
+                           MAX (MIN_READAHEAD, of->readahead * 2));
+    else
+      of->readahead = 0;
+    of->next_offset = offset + size;
+    readahead = of->readahead;
+    unlock_caches (g);
+
+    return read_cache_read (g, of, path, buf, size, offset, readahead);
+  }
 
-  r = guestfs_pread (g, path, size, offset, &rsize);
-  if (r == NULL)
-    RETURN_ERRNO;
+  h = get_file_handle (g, of);
+  r = file_pread (g, h, of, path, size, offset, &rsize);
+  if (r == NULL) {
+    int err = fuse_errno (h);
+    put_handle (g, h);
+    return err;
+  }
+  put_handle (g, h);
 
   /* This should never happen, but at least it stops us overflowing
    * the output buffer if it does happen.
@@ -675,22 +971,27 @@ static int
 mount_local_write (const char *path, const char *buf, size_t size,
                    off_t offset, struct fuse_file_info *fi)
 {
-  const size_t limit = 2 * 1024 * 1024;
-  int r;
+  int r, fh;
+  guestfs_h *h;
+  struct open_file *of = (struct open_file *) (uintptr_t) fi->fh;
   DECL_G ();
   DEBUG_CALL ("%s, %p, %zu, %ld", path, buf, size, (long) offset);
 
   if (g->ml_read_only) return -EROFS;
 
-  dir_cache_invalidate (g, path);
-
-  /* See mount_local_read. */
-  if (size > limit)
-    size = limit;
+  if (size > RW_LIMIT)
+    size = RW_LIMIT;
 
-  r = guestfs_pwrite (g, path, buf, size, offset);
+  h = get_file_handle (g, of);
+  fh = open_file_handle (g, h, of, path);
+  if (fh >= 0)
+    r = guestfs_pwrite_handle (h, fh, buf, size, offset);
+  else
+    r = guestfs_pwrite (h, path, buf, size, offset);
   if (r == -1)
-    RETURN_ERRNO;
+    r = fuse_errno (h);
+  invalidate (g, path);
+  put_handle (g, h);
 
   return r;
 }
@@ -699,12 +1000,18 @@ static int
 mount_local_statfs (const char *path, struct statvfs *stbuf)
 {
   CLEANUP_FREE_STATVFS struct guestfs_statvfs *r;
+  guestfs_h *h;
   DECL_G ();
   DEBUG_CALL ("%s, %p", path, stbuf);
 
-  r = guestfs_statvfs (g, path);
-  if (r == NULL)
-    RETURN_ERRNO;
+  h = get_handle (g);
+  r = guestfs_statvfs (h, path);
+  if (r == NULL) {
+    int err = fuse_errno (h);
+    put_handle (g, h);
+    return err;
+  }
+  put_handle (g, h);
 
   stbuf->f_bsize = r->bsize;
   stbuf->f_frsize = r->frsize;
@@ -724,12 +1031,31 @@ mount_local_statfs (const char *path, struct statvfs *stbuf)
 static int
 mount_local_release (const char *path, struct fuse_file_info *fi)
 {
+  struct open_file *of = (struct open_file *) (uintptr_t) fi->fh;
+  guestfs_h *h, *of_h;
+  int handle;
   DECL_G ();
   DEBUG_CALL ("%s", path);
 
-  /* Just a stub. This method is optional and can safely be left
-   * unimplemented.
-   */
+  if (of == NULL)
+    return 0;
+
+  lock_caches (g);
+  of_h = of->h;
+  handle = of->handle;
+  unlock_caches (g);
+
+  if (of_h && handle >= 0) {
+    h = get_handle_prefer (g, of_h, 1);
+    guestfs_push_error_handler (h, NULL, NULL);
+    guestfs_close_handle (h, handle);
+    guestfs_pop_error_handler (h);
+    put_handle (g, h);
+  }
+
+  free (of);
+  fi->fh = 0;
+
   return 0;
 }
 
@@ -739,14 +1065,17 @@ mount_local_fsync (const char *path, int isdatasync,
                    struct fuse_file_info *fi)
 {
   int r;
+  guestfs_h *h;
   DECL_G ();
   DEBUG_CALL ("%s, %d", path, isdatasync);
 
-  r = guestfs_sync (g);
+  h = get_handle (g);
+  r = guestfs_sync (h);
   if (r == -1)
-    RETURN_ERRNO;
+    r = fuse_errno (h);
+  put_handle (g, h);
 
-  return 0;
+  return r;
 }
 
 static int
@@ -754,19 +1083,48 @@ mount_local_setxattr (const char *path, const char *name, const char *value,
              size_t size, int flags)
 {
   int r;
+  guestfs_h *h;
   DECL_G ();
   DEBUG_CALL ("%s, %s, %p, %zu", path, name, value, size);
 
   if (g->ml_read_only) return -EROFS;
 
-  dir_cache_invalidate (g, path);
-
   /* XXX Underlying guestfs(3) API doesn't understand the flags. */
-  r = guestfs_lsetxattr (g, name, value, size, path);
+  h = get_handle (g);
+  r = guestfs_lsetxattr (h, name, value, size, path);
   if (r == -1)
-    RETURN_ERRNO;
+    r = fuse_errno (h);
+  invalidate (g, path);
+  put_handle (g, h);
 
-  return 0;
+  return r;
+}
+
+/* Get the xattrs of 'path', from the cache if possible.  The caller
+ * must free the list.  On error, returns NULL and sets *err.
+ */
+static struct guestfs_xattr_list *
+get_xattrs (guestfs_h *g, const char *path, int *err)
+{
+  const struct guestfs_xattr_list *cached;
+  struct guestfs_xattr_list *xattrs = NULL;
+  guestfs_h *h;
+
+  lock_caches (g);
+  cached = xac_lookup (g, path);
+  if (cached)
+    xattrs = copy_xattr_list (g, cached->val, cached->len);
+  unlock_caches (g);
+  if (xattrs)
+    return xattrs;
+
+  h = get_handle (g);
+  xattrs = guestfs_lgetxattrs (h, path);
+  if (xattrs == NULL)
+    *err = fuse_errno (h);
+  put_handle (g, h);
+
+  return xattrs;
 }
 
 /* The guestfs(3) API for getting xattrs is much easier to use
@@ -777,20 +1135,16 @@ static int
 mount_local_getxattr (const char *path, const char *name, char *value,
                       size_t size)
 {
-  const struct guestfs_xattr_list *xattrs;
-  int free_attrs = 0;
+  struct guestfs_xattr_list *xattrs;
   ssize_t r;
   size_t i, sz;
+  int err;
   DECL_G ();
   DEBUG_CALL ("%s, %s, %p, %zu", path, name, value, size);
 
-  xattrs = xac_lookup (g, path);
-  if (xattrs == NULL) {
-    xattrs = guestfs_lgetxattrs (g, path);
-    if (xattrs == NULL)
-      RETURN_ERRNO;
-    free_attrs = 1;
-  }
+  xattrs = get_xattrs (g, path, &err);
+  if (xattrs == NULL)
+    return err;
 
   /* Find the matching attribute (index in 'i'). */
   for (i = 0; i < xattrs->len; ++i) {
@@ -825,8 +1179,7 @@ mount_local_getxattr (const char *path, const char *name, char *value,
   memcpy (value, xattrs->val[i].attrval, sz);
 
 out:
-  if (free_attrs)
-    guestfs_free_xattr_list ((struct guestfs_xattr_list *) xattrs);
+  guestfs_free_xattr_list (xattrs);
 
   return r;
 }
@@ -835,22 +1188,18 @@ out:
 static int
 mount_local_listxattr (const char *path, char *list, size_t size)
 {
-  const struct guestfs_xattr_list *xattrs;
-  int free_attrs = 0;
+  struct guestfs_xattr_list *xattrs;
   size_t space = 0;
   size_t len;
   size_t i;
   ssize_t r;
+  int err;
   DECL_G ();
   DEBUG_CALL ("%s, %p, %zu", path, list, size);
 
-  xattrs = xac_lookup (g, path);
-  if (xattrs == NULL) {
-    xattrs = guestfs_lgetxattrs (g, path);
-    if (xattrs == NULL)
-      RETURN_ERRNO;
-    free_attrs = 1;
-  }
+  xattrs = get_xattrs (g, path, &err);
+  if (xattrs == NULL)
+    return err;
 
   /* Calculate how much space is required to hold the result. */
   for (i = 0; i < xattrs->len; ++i) {
@@ -885,8 +1234,7 @@ mount_local_listxattr (const char *path, char *list, size_t size)
   }
 
  out:
-  if (free_attrs)
-    guestfs_free_xattr_list ((struct guestfs_xattr_list *) xattrs);
+  guestfs_free_xattr_list (xattrs);
 
   return r;
 }
@@ -895,18 +1243,20 @@ static int
 mount_local_removexattr(const char *path, const char *name)
 {
   int r;
+  guestfs_h *h;
   DECL_G ();
   DEBUG_CALL ("%s, %s", path, name);
 
   if (g->ml_read_only) return -EROFS;
 
-  dir_cache_invalidate (g, path);
-
-  r = guestfs_lremovexattr (g, name, path);
+  h = get_handle (g);
+  r = guestfs_lremovexattr (h, name, path);
   if (r == -1)
-    RETURN_ERRNO;
+    r = fuse_errno (h);
+  invalidate (g, path);
+  put_handle (g, h);
 
-  return 0;
+  return r;
 }
 
 static int
@@ -952,6 +1302,301 @@ static struct fuse_operations mount_local_operations = {
   .flush        = mount_local_flush,
 };
 
+static void
+create_pool (guestfs_h *g)
+{
+  struct mount_local_pool *pool;
+
+  pool = safe_calloc (g, 1, sizeof *pool);
+  pthread_mutex_init (&pool->cache_lock, NULL);
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->cond, NULL);
+  pool->free_handles = safe_malloc (g, sizeof (guestfs_h *));
+  pool->free_handles[0] = g;
+  pool->nr_free = 1;
+  g->ml_pool = pool;
+}
+
+static void
+free_pool (guestfs_h *g)
+{
+  struct mount_local_pool *pool = g->ml_pool;
+  size_t i;
+
+  if (pool == NULL)
+    return;
+
+  for (i = 0; i < pool->nr_helpers; ++i)
+    guestfs_close (pool->helpers[i]);
+  free (pool->helpers);
+  free (pool->free_handles);
+  pthread_mutex_destroy (&pool->cache_lock);
+  pthread_mutex_destroy (&pool->lock);
+  pthread_cond_destroy (&pool->cond);
+  free (pool);
+  g->ml_pool = NULL;
+}
+
+/* The settings of the main handle which the helper appliances copy.
+ * This is collected before launching the helpers, because the main
+ * handle must not be used from the launch threads.
+ */
+struct helper_config {
+  char *backend;
+  char **backend_settings;
+  char *hv;
+  char *path;
+  char *append;
+  char *tmpdir;
+  char *cachedir;
+  int memsize;
+  int smp;
+  int verbose;
+  size_t nr_drives;
+  char **drive_paths;
+  char **drive_formats;         /* Elements may be NULL. */
+  char **mountpoints;           /* Pairs of mountable, mountpoint. */
+};
+
+static void
+free_helper_config (struct helper_config *config)
+{
+  size_t i;
+
+  free (config->backend);
+  guestfs_int_free_string_list (config->backend_settings);
+  free (config->hv);
+  free (config->path);
+  free (config->append);
+  free (config->tmpdir);
+  free (config->cachedir);
+  for (i = 0; i < config->nr_drives; ++i) {
+    free (config->drive_paths[i]);
+    free (config->drive_formats[i]);
+  }
+  free (config->drive_paths);
+  free (config->drive_formats);
+  guestfs_int_free_string_list (config->mountpoints);
+  free (config);
+}
+
+static int
+compare_mountpoint_len (const void *av, const void *bv)
+{
+  const char *const *a = av;
+  const char *const *b = bv;
+
+  /* Each element is a pair, and the mountpoint is the second string. */
+  return (int) strlen (a[1]) - (int) strlen (b[1]);
+}
+
+/* Returns NULL if the helpers cannot be used with these drives.
+ *
+ * The helpers add the disk images read-only, so they cannot see
+ * anything the main handle has written to its overlays (or, with
+ * some cache modes, to the images).  Different handles would then
+ * return different data for the same request.  So the helpers are
+ * only used if nothing has been written to the drives since launch,
+ * and every filesystem is mounted read-only so nothing will be.
+ */
+static struct helper_config *
+make_helper_config (guestfs_h *g)
+{
+  struct helper_config *config;
+  struct drive *drv;
+  size_t i, n;
+  int r;
+
+  ITER_DRIVES (g, i, drv) {
+    if (drv->src.protocol != drive_protocol_file) {
+      debug (g, "mount_local: not launching extra appliances because drive %zu is not a local file", i);
+      return NULL;
+    }
+  }
+  for (i = 0; i < g->nr_drives; ++i) {
+    if (g->drives[i] == NULL) {
+      debug (g, "mount_local: not launching extra appliances because drives were removed");
+      return NULL;
+    }
+  }
+
+  r = guestfs_internal_devices_written (g);
+  if (r != 0) {
+    debug (g, "mount_local: not launching extra appliances because the drives have been written to");
+    return NULL;
+  }
+
+  config = safe_calloc (g, 1, sizeof *config);
+  config->mountpoints = guestfs_mountpoints (g);
+  if (config->mountpoints == NULL) {
+    free (config);
+    return NULL;
+  }
+  for (i = 0; config->mountpoints[i] != NULL; i += 2) {
+    CLEANUP_FREE_STATVFS struct guestfs_statvfs *st =
+      guestfs_statvfs (g, config->mountpoints[i+1]);
+
+    if (st == NULL || !(st->flag & ST_RDONLY)) {
+      debug (g, "mount_local: not launching extra appliances because %s is not mounted read-only",
+             config->mountpoints[i+1]);
+      guestfs_int_free_string_list (config->mountpoints);
+      free (config);
+      return NULL;
+    }
+  }
+  /* Mount parent directories before the filesystems mounted on them. */
+  n = guestfs_int_count_strings (config->mountpoints) / 2;
+  qsort (config->mountpoints, n, 2 * sizeof (char *), compare_mountpoint_len);
+
+  config->backend = safe_strdup (g, g->backend);
+  config->backend_settings =
+    g->backend_settings ? guestfs_int_copy_string_list (g->backend_settings)
+    : safe_calloc (g, 1, sizeof (char *));
+  config->hv = safe_strdup (g, g->hv);
+  config->path = safe_strdup (g, g->path);
+  config->append = g->append ? safe_strdup (g, g->append) : NULL;
+  config->tmpdir = guestfs_get_tmpdir (g);
+  config->cachedir = guestfs_get_cachedir (g);
+  config->memsize = g->memsize;
+  config->smp = g->smp;
+  config->verbose = g->verbose;
+  config->nr_drives = g->nr_drives;
+  config->drive_paths = safe_calloc (g, g->nr_drives, sizeof (char *));
+  config->drive_formats = safe_calloc (g, g->nr_drives, sizeof (char *));
+  ITER_DRIVES (g, i, drv) {
+    config->drive_paths[i] = safe_strdup (g, drv->src.u.path);
+    if (drv->src.format)
+      config->drive_formats[i] = safe_strdup (g, drv->src.format);
+  }
+
+  return config;
+}
+
+/* Create and launch a helper handle, and mount the same filesystems
+ * as the main handle.  Runs in a thread, so errors are not reported
+ * anywhere: NULL just means there is one helper fewer.
+ */
+static void *
+launch_helper (void *configv)
+{
+  const struct helper_config *config = configv;
+  guestfs_h *h;
+  size_t i;
+
+  h = guestfs_create_flags (GUESTFS_CREATE_NO_ENVIRONMENT |
+                            GUESTFS_CREATE_NO_CLOSE_ON_EXIT);
+  if (h == NULL)
+    return NULL;
+
+  guestfs_set_error_handler (h, NULL, NULL);
+
+  if (guestfs_set_backend (h, config->backend) == -1 ||
+      guestfs_set_backend_settings (h, config->backend_settings) == -1 ||
+      guestfs_set_hv (h, config->hv) == -1 ||
+      guestfs_set_path (h, config->path) == -1 ||
+      guestfs_set_append (h, config->append) == -1 ||
+      guestfs_set_tmpdir (h, config->tmpdir) == -1 ||
+      guestfs_set_cachedir (h, config->cachedir) == -1 ||
+      guestfs_set_memsize (h, config->memsize) == -1 ||
+      guestfs_set_smp (h, config->smp) == -1 ||
+      guestfs_set_verbose (h, config->verbose) == -1)
+    goto error;
+
+  /* Adding the drives in the same order gives the same device names. */
+  for (i = 0; i < config->nr_drives; ++i) {
+    if (config->drive_formats[i]) {
+      if (guestfs_add_drive_opts (h, config->drive_paths[i],
+                                  GUESTFS_ADD_DRIVE_OPTS_READONLY, 1,
+                                  GUESTFS_ADD_DRIVE_OPTS_FORMAT,
+                                  config->drive_formats[i],
+                                  -1) == -1)
+        goto error;
+    }
+    else {
+      if (guestfs_add_drive_opts (h, config->drive_paths[i],
+                                  GUESTFS_ADD_DRIVE_OPTS_READONLY, 1,
+                                  -1) == -1)
+        goto error;
+    }
+  }
+
+  if (guestfs_launch (h) == -1)
+    goto error;
+
+  for (i = 0; config->mountpoints[i] != NULL; i += 2) {
+    if (guestfs_mount_ro (h, config->mountpoints[i],
+                          config->mountpoints[i+1]) == -1)
+      goto error;
+  }
+
+  return h;
+
+ error:
+  guestfs_close (h);
+  return NULL;
+}
+
+/* Launch up to g->ml_appliances - 1 helper handles in parallel and
+ * add them to the pool.  Failures only mean fewer helpers.
+ */
+static void
+launch_helpers (guestfs_h *g)
+{
+  struct mount_local_pool *pool = g->ml_pool;
+  struct helper_config *config;
+  const size_t n = g->ml_appliances - 1;
+  pthread_t *threads;
+  bool *started;
+  size_t i;
+  int err;
+
+  /* The helpers read the disk images, so make sure they see any
+   * changes made by the main handle.
+   */
+  if (guestfs_sync (g) == -1)
+    return;
+
+  config = make_helper_config (g);
+  if (config == NULL)
+    return;
+
+  debug (g, "mount_local: launching %zu extra appliances", n);
+
+  threads = safe_calloc (g, n, sizeof (pthread_t));
+  started = safe_calloc (g, n, sizeof (bool));
+  pool->helpers = safe_calloc (g, n, sizeof (guestfs_h *));
+  pool->free_handles = safe_realloc (g, pool->free_handles,
+                                     (n + 1) * sizeof (guestfs_h *));
+
+  for (i = 0; i < n; ++i) {
+    err = pthread_create (&threads[i], NULL, launch_helper, config);
+    if (err != 0)
+      debug (g, "mount_local: pthread_create: %s", strerror (err));
+    else
+      started[i] = true;
+  }
+
+  for (i = 0; i < n; ++i) {
+    void *h;
+
+    if (!started[i])
+      continue;
+    pthread_join (threads[i], &h);
+    if (h == NULL) {
+      debug (g, "mount_local: extra appliance %zu could not be launched", i);
+      continue;
+    }
+    pool->helpers[pool->nr_helpers++] = h;
+    pool->free_handles[pool->nr_free++] = h;
+  }
+
+  debug (g, "mount_local: %zu extra appliances launched", pool->nr_helpers);
+
+  free (threads);
+  free (started);
+  free_helper_config (config);
+}
+
 int
 guestfs_impl_mount_local (guestfs_h *g, const char *localmountpoint,
                       const struct guestfs_mount_local_argv *optargs)
@@ -982,10 +1627,33 @@ guestfs_impl_mount_local (guestfs_h *g, const char *localmountpoint,
     g->ml_debug_calls = optargs->debugcalls;
   else
     g->ml_debug_calls = 0;
+  if (optargs->bitmask & GUESTFS_MOUNT_LOCAL_READCACHESIZE_BITMASK) {
+    if (optargs->readcachesize < 0) {
+      error (g, _("readcachesize cannot be negative"));
+      return -1;
+    }
+    g->ml_read_cache_size = (size_t) optargs->readcachesize * 1024 * 1024;
+  }
+  else
+    g->ml_read_cache_size = 64 * 1024 * 1024;
+  if (optargs->bitmask & GUESTFS_MOUNT_LOCAL_APPLIANCES_BITMASK) {
+    if (optargs->appliances < 1) {
+      error (g, _("appliances must be at least 1"));
+      return -1;
+    }
+    g->ml_appliances = optargs->appliances;
+  }
+  else
+    g->ml_appliances = 1;
 
-  /* Initialize the directory caches in the handle. */
+  /* Initialize the directory and read caches in the handle. */
   if (init_dir_caches (g) == -1)
     return -1;
+  if (init_read_cache (g) == -1) {
+    free_dir_caches (g);
+    return -1;
+  }
+  create_pool (g);
 
   /* Create the FUSE 'args'. */
   /* XXX we don't have a program name */
@@ -1071,10 +1739,16 @@ guestfs_impl_mount_local_run (guestfs_h *g)
     return -1;
   }
 
+  if (g->ml_appliances > 1 && g->ml_read_only)
+    launch_helpers (g);
+
   debug (g, "%s: entering fuse_loop", __func__);
 
   /* Enter the main loop. */
-  r = fuse_loop (g->fuse);
+  if (g->ml_appliances > 1)
+    r = fuse_loop_mt (g->fuse);
+  else
+    r = fuse_loop (g->fuse);
   if (r != 0)
     perrorf (g, _("fuse_loop: %s"), g->localmountpoint);
 
@@ -1098,6 +1772,8 @@ guestfs_int_free_fuse (guestfs_h *g)
     fuse_destroy (g->fuse);     /* also closes the channel */
   g->fuse = NULL;
   free_dir_caches (g);
+  free_read_cache (g);
+  free_pool (g);
 }
 
 int
@@ -1494,6 +2170,307 @@ dir_cache_invalidate (guestfs_h *g, const char *path)
   gen_remove (g->lsc_ht, path, lsc_free);
   gen_remove (g->xac_ht, path, xac_free);
   gen_remove (g->rlc_ht, path, rlc_free);
+  read_cache_invalidate (g, path);
+}
+
+/* Functions handling the read cache.
+ *
+ * Without this, every FUSE read (usually 128K) is a guestfs_pread
+ * round trip, and the daemon has to open the file each time, so
+ * sequential reads are much slower than guestfs_download.
+ *
+ * File data is cached in blocks of RC_BLOCK_SIZE bytes, keyed by
+ * pathname and block number.  On a miss, the missing blocks of the
+ * request plus the read-ahead window (see mount_local_read) are
+ * fetched with a single guestfs_pread.  The least recently used
+ * blocks are evicted when the cache grows over ml_read_cache_size.
+ *
+ * Like the directory cache, entries expire after the cache timeout.
+ * Blocks of a file are also dropped when the file is changed through
+ * the mountpoint (dir_cache_invalidate).
+ */
+
+#define RC_BLOCK_SIZE (128 * 1024)
+
+struct rc_block {
+  struct entry_common c;
+  uint64_t blocknr;
+  struct rc_block *prev, *next; /* LRU list, most recently used first */
+  size_t len;                   /* < RC_BLOCK_SIZE means end of file */
+  char data[];
+};
+
+static size_t
+rc_hash (void const *x, size_t table_size)
+{
+  struct rc_block const *p = x;
+  return (hash_pjw (p->c.pathname, table_size) + p->blocknr) % table_size;
+}
+
+static bool
+rc_compare (void const *x, void const *y)
+{
+  struct rc_block const *a = x;
+  struct rc_block const *b = y;
+  return a->blocknr == b->blocknr && STREQ (a->c.pathname, b->c.pathname);
+}
+
+static int
+init_read_cache (guestfs_h *g)
+{
+  g->rc_lru_first = g->rc_lru_last = NULL;
+  g->rc_size = 0;
+
+  if (g->ml_read_cache_size == 0)
+    return 0;
+
+  /* The blocks are freed by free_read_cache, not by the hash table. */
+  g->rc_ht = hash_initialize (1024, NULL, rc_hash, rc_compare, NULL);
+  if (!g->rc_ht) {
+    error (g, _("could not initialize read cache hashtable"));
+    return -1;
+  }
+  return 0;
+}
+
+static void
+rc_unlink (guestfs_h *g, struct rc_block *b)
+{
+  if (b->prev)
+    b->prev->next = b->next;
+  else
+    g->rc_lru_first = b->next;
+  if (b->next)
+    b->next->prev = b->prev;
+  else
+    g->rc_lru_last = b->prev;
+  b->prev = b->next = NULL;
+}
+
+static void
+rc_link_first (guestfs_h *g, struct rc_block *b)
+{
+  b->prev = NULL;
+  b->next = g->rc_lru_first;
+  if (g->rc_lru_first)
+    g->rc_lru_first->prev = b;
+  else
+    g->rc_lru_last = b;
+  g->rc_lru_first = b;
+}
+
+static void
+rc_remove (guestfs_h *g, struct rc_block *b)
+{
+  hash_delete (g->rc_ht, b);
+  rc_unlink (g, b);
+  g->rc_size -= sizeof *b + b->len;
+  free (b->c.pathname);
+  free (b);
+}
+
+static void
+free_read_cache (guestfs_h *g)
+{
+  while (g->rc_lru_first)
+    rc_remove (g, g->rc_lru_first);
+  if (g->rc_ht)
+    hash_free (g->rc_ht);
+  g->rc_ht = NULL;
+}
+
+static void
+read_cache_invalidate (guestfs_h *g, const char *path)
+{
+  struct rc_block *b, *next;
+
+  for (b = g->rc_lru_first; b != NULL; b = next) {
+    next = b->next;
+    if (STREQ (b->c.pathname, path))
+      rc_remove (g, b);
+  }
+}
+
+/* Look up a block, and make it the most recently used. */
+static struct rc_block *
+rc_lookup (guestfs_h *g, const char *path, uint64_t blocknr, time_t now)
+{
+  const struct rc_block key = {
+    .c.pathname = (char *) path, .blocknr = blocknr
+  };
+  struct rc_block *b;
+
+  b = hash_lookup (g->rc_ht, &key);
+  if (b == NULL)
+    return NULL;
+  if (b->c.timeout < now) {
+    rc_remove (g, b);
+    return NULL;
+  }
+
+  rc_unlink (g, b);
+  rc_link_first (g, b);
+  return b;
+}
+
+static struct rc_block *
+rc_insert (guestfs_h *g, const char *path, uint64_t blocknr, time_t now,
+           const char *data, size_t len)
+{
+  struct rc_block *b, *old;
+
+  b = malloc (sizeof *b + len);
+  if (b == NULL) {
+    perrorf (g, "malloc");
+    return NULL;
+  }
+  b->c.pathname = strdup (path);
+  if (b->c.pathname == NULL) {
+    perrorf (g, "strdup");
+    free (b);
+    return NULL;
+  }
+  b->c.timeout = now + g->ml_dir_cache_timeout;
+  b->blocknr = blocknr;
+  b->len = len;
+  memcpy (b->data, data, len);
+
+  old = hash_lookup (g->rc_ht, b);
+  if (old)
+    rc_remove (g, old);
+
+  if (hash_insert (g->rc_ht, b) == NULL) {
+    perrorf (g, "hash_insert");
+    free (b->c.pathname);
+    free (b);
+    return NULL;
+  }
+  rc_link_first (g, b);
+  g->rc_size += sizeof *b + len;
+
+  /* Evict the least recently used blocks, but never the new one. */
+  while (g->rc_size > g->ml_read_cache_size && g->rc_lru_last != b)
+    rc_remove (g, g->rc_lru_last);
+
+  return b;
+}
+
+/* Fetch block 'blocknr' and up to nr_blocks-1 following blocks which
+ * are not already cached, and add them to the cache.  Returns the
+ * data read, starting with block 'blocknr', which the caller must
+ * free.  On error, returns NULL and sets *err.
+ *
+ * This must be called without holding cache_lock.
+ */
+static char *
+rc_fetch (guestfs_h *g, struct open_file *of, const char *path,
+          uint64_t blocknr, size_t nr_blocks, time_t now, size_t *rsize_r,
+          int *err)
+{
+  char *r;
+  size_t rsize, i, n;
+  guestfs_h *h;
+
+  /* Don't fetch again blocks that we have. */
+  lock_caches (g);
+  for (n = 1; n < nr_blocks; ++n) {
+    const struct rc_block key = {
+      .c.pathname = (char *) path, .blocknr = blocknr + n
+    };
+    if (hash_lookup (g->rc_ht, &key) != NULL)
+      break;
+  }
+  unlock_caches (g);
+
+  h = get_file_handle (g, of);
+  r = file_pread (g, h, of, path, n * RC_BLOCK_SIZE,
+                  blocknr * RC_BLOCK_SIZE, &rsize);
+  if (r == NULL) {
+    *err = fuse_errno (h);
+    put_handle (g, h);
+    return NULL;
+  }
+
+  /* Split the data into blocks.  A short block (maybe empty) marks
+   * the end of the file, and nothing after it is cached.
+   */
+  if (rsize / RC_BLOCK_SIZE < n)
+    n = rsize / RC_BLOCK_SIZE + 1;
+
+  /* The blocks are inserted before giving back the handle (see
+   * get_handle).  Insert the first block last, so that it is the
+   * most recently used.
+   */
+  lock_caches (g);
+  for (i = n; i-- > 0; )
+    rc_insert (g, path, blocknr + i, now, r + i * RC_BLOCK_SIZE,
+               MIN (RC_BLOCK_SIZE, rsize - i * RC_BLOCK_SIZE));
+  unlock_caches (g);
+  put_handle (g, h);
+
+  *rsize_r = rsize;
+  return r;
+}
+
+/* Read through the cache.  'readahead' is the number of extra bytes
+ * to fetch after the request.  Returns the number of bytes read
+ * (less than 'size' only at the end of the file), or -errno on
+ * error.
+ */
+static ssize_t
+read_cache_read (guestfs_h *g, struct open_file *of, const char *path,
+                 char *buf, size_t size, off_t offset, size_t readahead)
+{
+  const time_t now = time (NULL);
+  size_t done = 0;
+
+  while (done < size) {
+    const uint64_t pos = offset + done;
+    const uint64_t blocknr = pos / RC_BLOCK_SIZE;
+    const size_t blockoff = pos % RC_BLOCK_SIZE;
+    struct rc_block *b;
+    char *r;
+    size_t len, n;
+    int err;
+
+    /* Copy out of the block while holding the lock, as another thread
+     * could evict it.
+     */
+    lock_caches (g);
+    b = rc_lookup (g, path, blocknr, now);
+    if (b) {
+      len = b->len;
+      n = len > blockoff ? MIN (len - blockoff, size - done) : 0;
+      memcpy (buf + done, &b->data[blockoff], n);
+    }
+    unlock_caches (g);
+
+    if (b == NULL) {
+      const uint64_t end = offset + size + readahead;
+      size_t nr_blocks = (end - blocknr * RC_BLOCK_SIZE + RC_BLOCK_SIZE - 1)
+        / RC_BLOCK_SIZE;
+
+      nr_blocks = MIN (nr_blocks, MAX_READAHEAD / RC_BLOCK_SIZE);
+      r = rc_fetch (g, of, path, blocknr, nr_blocks, now, &len, &err);
+      if (r == NULL) {
+        if (done > 0)
+          break;
+        return err;
+      }
+      len = MIN (RC_BLOCK_SIZE, len);
+      n = len > blockoff ? MIN (len - blockoff, size - done) : 0;
+      memcpy (buf + done, &r[blockoff], n);
+      free (r);
+    }
+
+    if (n == 0)                 /* end of file */
+      break;
+    done += n;
+    if (len < RC_BLOCK_SIZE)
+      break;
+  }
+
+  return done;
 }
 
 #else /* !HAVE_FUSE */
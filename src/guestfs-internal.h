@@ -142,11 +142,13 @@
 #define VIRTIO_SCSI "virtio-scsi-pci"
 #define VIRTIO_SERIAL "virtio-serial-pci"
 #define VIRTIO_NET "virtio-net-pci"
+#define VIRTIO_BALLOON "virtio-balloon-pci"
 #else /* ARM */
 #define VIRTIO_BLK "virtio-blk-device"
 #define VIRTIO_SCSI "virtio-scsi-device"
 #define VIRTIO_SERIAL "virtio-serial-device"
 #define VIRTIO_NET "virtio-net-device"
+#define VIRTIO_BALLOON "virtio-balloon-device"
 #endif /* ARM */
 
 /* Machine types.  XXX Make these configurable. */
@@ -261,6 +263,17 @@ struct drive {
    */
   char *overlay;
 
+  /* If the overlay may be reused after the appliance is shut down
+   * (see guestfs_set_reuse_overlays), a key identifying the source
+   * drive, and the initial contents of the overlay so it can be reset.
+   * Trailing zeroes are not stored in 'overlay_data', but the overlay
+   * is 'overlay_size' bytes long.
+   */
+  char *overlay_key;
+  char *overlay_data;
+  size_t overlay_data_len;
+  size_t overlay_size;
+
   /* Various per-drive flags. */
   bool readonly;
   char *iface;
@@ -303,6 +316,7 @@ struct backend_ops {
   /* Miscellaneous. */
   int (*get_pid) (guestfs_h *g, void *data);
   int (*max_disks) (guestfs_h *g, void *data);
+  int64_t (*get_rss) (guestfs_h *g, void *data);
 
   /* Hotplugging drives. */
   int (*hot_add_drive) (guestfs_h *g, void *data, struct drive *drv, size_t drv_index);
@@ -352,6 +366,14 @@ struct connection_ops {
   int (*can_read_data) (guestfs_h *g, struct connection *);
 };
 
+/* The end of one launch phase, see guestfs_int_launch_timing.  The
+ * first entry has phase == NULL and records the start of launch.
+ */
+struct launch_timing {
+  const char *phase;            /* Static string. */
+  struct timeval t;
+};
+
 /* Stack of old error handlers. */
 struct error_cb_stack {
   struct error_cb_stack   *next;
@@ -374,10 +396,16 @@ struct guestfs_h
   bool enable_network;          /* Enable the network. */
   bool selinux;                 /* selinux enabled? */
   bool pgroup;                  /* Create process group for children? */
+  bool inspect_cache;           /* Use the inspection cache? */
+  bool reuse_overlays;          /* Keep overlays across relaunch? */
   bool close_on_exit;           /* Is this handle on the atexit list? */
 
   int smp;                      /* If > 1, -smp flag passed to hv. */
   int memsize;			/* Size of RAM (megabytes). */
+  bool smp_set;                 /* Set by the caller (not planned)? */
+  bool memsize_set;
+  char *workload;               /* See guestfs_set_workload, or NULL. */
+  int launch_pool;              /* Size of the launch pool, 0 = unused. */
 
   char *path;			/* Path to the appliance. */
   char *hv;			/* Hypervisor (HV) binary. */
@@ -411,6 +439,12 @@ struct guestfs_h
   for (i = 0; i < (g)->nr_drives; ++i)    \
     if (((drv) = (g)->drives[i]) != NULL)
 
+  /* Overlays of read-only drives kept from before the last shutdown,
+   * which can be used again if the same drives are added.  See
+   * guestfs_set_reuse_overlays and drives.c.
+   */
+  struct spare_overlay *spare_overlays;
+
   /* Backend.  NB: Use guestfs_int_set_backend to change the backend. */
   char *backend;                /* The full string, always non-NULL. */
   char *backend_arg;            /* Pointer to the argument part. */
@@ -449,6 +483,10 @@ struct guestfs_h
    */
   struct inspect_fs *fses;
   size_t nr_fses;
+  /* Key for the inspection cache (see inspect-cache.c), or NULL if
+   * the cache is not being used.
+   */
+  char *inspect_cache_key;
 
   /* Private data area. */
   struct hash_table *pda;
@@ -460,6 +498,13 @@ struct guestfs_h
   int user_cancel;
 
   struct timeval launch_t;      /* The time that we called guestfs_launch. */
+  struct launch_timing *launch_timings; /* See guestfs_get_launch_timings. */
+  size_t nr_launch_timings;
+  /* The end of the console output seen so far during launch, so that
+   * launch sentinels split between two log messages are still found.
+   */
+  char launch_log_tail[32];
+  size_t launch_log_tail_len;
 
   /* Used by bindtests. */
   FILE *test_fp;
@@ -476,9 +521,36 @@ struct guestfs_h
 #define QEMU_IMG_INFO_NEW_PARSER 1
 #define QEMU_IMG_INFO_OLD_PARSER 2
 
+  /* If the appliance came from the launch pool, the handle which
+   * launched it.  It owns the appliance's temporary files and is
+   * closed when the appliance is shut down.  See launch-pool.c.
+   */
+  struct guestfs_h *pool_donor;
+
+  /* Shared lock on the cached supermin appliance, held during launch
+   * so it is not removed before the backend has opened it, or -1.
+   * See src/appliance.c.
+   */
+  int appliance_lock_fd;
+
   /*** Protocol. ***/
   struct connection *conn;              /* Connection to appliance. */
   int msg_next_serial;
+  size_t chunk_size;                    /* Negotiated file chunk size. */
+  int sparse_transfers;                 /* Daemon understands hole chunks. */
+
+  /* Pipelined requests, see guestfs_int_send_async in proto.c. */
+  size_t nr_async_in_flight;            /* Sent but reply not yet read. */
+  struct pending_reply *pending_replies; /* Read but not yet collected. */
+
+  /* Call statistics, see call-stats.c.  Both are allocated on first
+   * use.
+   */
+  struct call_stats **call_stats;       /* Indexed by proc_nr. */
+  struct call_start *call_starts;       /* Calls waiting for a reply. */
+  int call_file_proc;                   /* Call sending/receiving files. */
+  int64_t call_file_start_us;
+  int64_t call_file_us;                 /* Time recorded at the reply. */
 
 #if HAVE_FUSE
   /**** Used by the mount-local APIs. ****/
@@ -488,6 +560,12 @@ struct guestfs_h
   Hash_table *lsc_ht, *xac_ht, *rlc_ht; /* Directory cache. */
   int ml_read_only;                     /* If mounted read-only. */
   int ml_debug_calls;        /* Extra debug info on each FUSE call. */
+  size_t ml_read_cache_size;            /* Read cache limit in bytes. */
+  Hash_table *rc_ht;                    /* Read cache, see fuse.c. */
+  struct rc_block *rc_lru_first, *rc_lru_last;
+  size_t rc_size;                       /* Bytes in the read cache. */
+  int ml_appliances;                    /* Appliances serving requests. */
+  struct mount_local_pool *ml_pool;     /* Handles and locks, see fuse.c */
 #endif
 
 #ifdef HAVE_LIBVIRT
@@ -727,7 +805,10 @@ extern void guestfs_int_cleanup_free_stringsbuf (struct stringsbuf *sb);
 
 /* proto.c */
 extern int guestfs_int_send (guestfs_h *g, int proc_nr, uint64_t progress_hint, uint64_t optargs_bitmask, xdrproc_t xdrp, char *args);
-extern int guestfs_int_recv (guestfs_h *g, const char *fn, struct guestfs_message_header *hdr, struct guestfs_message_error *err, xdrproc_t xdrp, char *ret);
+extern int guestfs_int_recv (guestfs_h *g, const char *fn, int serial, struct guestfs_message_header *hdr, struct guestfs_message_error *err, xdrproc_t xdrp, char *ret);
+extern int guestfs_int_send_async (guestfs_h *g, int proc_nr, xdrproc_t xdrp, char *args);
+extern int guestfs_int_recv_async (guestfs_h *g, const char *fn, int serial, struct guestfs_message_header *hdr, struct guestfs_message_error *err, xdrproc_t xdrp, char *ret);
+extern void guestfs_int_free_pending_replies (guestfs_h *g);
 extern int guestfs_int_recv_discard (guestfs_h *g, const char *fn);
 extern int guestfs_int_send_file (guestfs_h *g, const char *filename);
 extern int guestfs_int_recv_file (guestfs_h *g, const char *filename);
@@ -735,6 +816,16 @@ extern int guestfs_int_recv_from_daemon (guestfs_h *g, uint32_t *size_rtn, void
 extern void guestfs_int_progress_message_callback (guestfs_h *g, const struct guestfs_progress *message);
 extern void guestfs_int_log_message_callback (guestfs_h *g, const char *buf, size_t len);
 
+/* call-stats.c */
+extern void guestfs_int_call_stats_send (guestfs_h *g, int proc_nr, int serial, size_t len);
+extern void guestfs_int_call_stats_reply (guestfs_h *g, int proc_nr, int serial, size_t len);
+extern void guestfs_int_call_stats_file_data (guestfs_h *g, size_t sent, size_t received);
+extern void guestfs_int_call_stats_file_done (guestfs_h *g);
+extern void guestfs_int_free_call_stats (guestfs_h *g);
+
+/* proc-names.c (generated) */
+extern const char *const guestfs_int_proc_names[];
+
 /* conn-socket.c */
 extern struct connection *guestfs_int_new_conn_socket_listening (guestfs_h *g, int daemon_accept_sock, int console_sock);
 extern struct connection *guestfs_int_new_conn_socket_connected (guestfs_h *g, int daemon_sock, int console_sock);
@@ -749,22 +840,37 @@ extern int guestfs_int_set_env_tmpdir (guestfs_h *g, const char *tmpdir);
 extern int guestfs_int_lazy_make_tmpdir (guestfs_h *g);
 extern void guestfs_int_remove_tmpdir (guestfs_h *g);
 extern void guestfs_int_recursive_remove_dir (guestfs_h *g, const char *dir);
+extern char *guestfs_int_make_cache_subdir (guestfs_h *g, const char *name, mode_t mode);
 
 /* drives.c */
 extern size_t guestfs_int_checkpoint_drives (guestfs_h *g);
 extern void guestfs_int_rollback_drives (guestfs_h *g, size_t);
 extern void guestfs_int_add_dummy_appliance_drive (guestfs_h *g);
 extern void guestfs_int_free_drives (guestfs_h *g);
+extern void guestfs_int_free_spare_overlays (guestfs_h *g);
 extern const char *guestfs_int_drive_protocol_to_string (enum drive_protocol protocol);
 
+/* create.c */
+extern int guestfs_int_create_qcow2_overlay (guestfs_h *g, const char *overlay, const char *backingfile, const char *backingformat);
+extern int64_t guestfs_int_get_virtual_size (const char *filename, const char *format);
+
+/* resources.c */
+extern void guestfs_int_plan_resources (guestfs_h *g);
+
+/* launch-pool.c */
+extern int guestfs_int_launch_from_pool (guestfs_h *g);
+
 /* appliance.c */
 extern int guestfs_int_build_appliance (guestfs_h *g, char **kernel, char **dtb, char **initrd, char **appliance);
+extern void guestfs_int_unlock_appliance (guestfs_h *g);
 extern int guestfs_int_get_uefi (guestfs_h *g, char **code, char **vars);
 
 /* launch.c */
 extern int64_t guestfs_int_timeval_diff (const struct timeval *x, const struct timeval *y);
+extern void guestfs_int_launch_timing (guestfs_h *g, const char *phase);
 extern void guestfs_int_print_timestamped_message (guestfs_h *g, const char *fs, ...) __attribute__((format (printf,2,3)));
 extern void guestfs_int_launch_send_progress (guestfs_h *g, int perdozen);
+extern int64_t guestfs_int_get_process_rss (guestfs_h *g, pid_t pid);
 extern char *guestfs_int_appliance_command_line (guestfs_h *g, const char *appliance_dev, int flags);
 #define APPLIANCE_COMMAND_LINE_IS_TCG 1
 const char *guestfs_int_get_cpu_model (int kvm);
@@ -777,11 +883,20 @@ extern char *guestfs_int_download_to_tmp (guestfs_h *g, struct inspect_fs *fs, c
 extern struct inspect_fs *guestfs_int_search_for_root (guestfs_h *g, const char *root);
 extern int guestfs_int_is_partition (guestfs_h *g, const char *partition);
 
+/* inspect-cache.c */
+extern char *guestfs_int_inspect_cache_key (guestfs_h *g);
+extern int guestfs_int_inspect_cache_load (guestfs_h *g);
+extern void guestfs_int_inspect_cache_save (guestfs_h *g);
+extern struct guestfs_application2_list *guestfs_int_inspect_cache_load_applications (guestfs_h *g, struct inspect_fs *fs);
+extern void guestfs_int_inspect_cache_save_applications (guestfs_h *g, struct inspect_fs *fs, struct guestfs_application2_list *apps);
+
 /* inspect-fs.c */
 extern int guestfs_int_is_file_nocase (guestfs_h *g, const char *);
 extern int guestfs_int_is_dir_nocase (guestfs_h *g, const char *);
+extern char **guestfs_int_probe_filesystems (guestfs_h *g, char *const *fses);
 extern int guestfs_int_check_for_filesystem_on (guestfs_h *g,
-                                              const char *mountable);
+                                                const char *mountable,
+                                                const char *probe);
 extern int guestfs_int_parse_unsigned_int (guestfs_h *g, const char *str);
 extern int guestfs_int_parse_unsigned_int_ignore_trailing (guestfs_h *g, const char *str);
 extern int guestfs_int_parse_major_minor (guestfs_h *g, struct inspect_fs *fs);
@@ -805,6 +920,7 @@ extern int guestfs_int_check_coreos_usr (guestfs_h *g, struct inspect_fs *fs);
 extern char *guestfs_int_case_sensitive_path_silently (guestfs_h *g, const char *);
 extern char * guestfs_int_get_windows_systemroot (guestfs_h *g);
 extern int guestfs_int_check_windows_root (guestfs_h *g, struct inspect_fs *fs, char *windows_systemroot);
+extern char *guestfs_int_hivex_entry_utf8 (guestfs_h *g, const struct guestfs_hivex_entry *entry);
 
 /* inspect-fs-cd.c */
 extern int guestfs_int_check_installer_root (guestfs_h *g, struct inspect_fs *fs);
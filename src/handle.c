@@ -87,6 +87,7 @@ guestfs_create_flags (unsigned flags, ...)
   g->state = CONFIG;
 
   g->conn = NULL;
+  g->appliance_lock_fd = -1;
 
   guestfs_int_init_error_handler (g);
   g->abort_cb = abort;
@@ -203,6 +204,17 @@ parse_environment (guestfs_h *g,
     guestfs_set_verbose (g, b);
   }
 
+  str = do_getenv (data, "LIBGUESTFS_INSPECT_CACHE");
+  if (str) {
+    b = guestfs_int_is_true (str);
+    if (b == -1) {
+      error (g, _("%s=%s: non-boolean value"),
+             "LIBGUESTFS_INSPECT_CACHE", str);
+      return -1;
+    }
+    guestfs_set_inspect_cache (g, b);
+  }
+
   str = do_getenv (data, "LIBGUESTFS_TMPDIR");
   if (str && STRNEQ (str, "")) {
     if (guestfs_set_tmpdir (g, str) == -1)
@@ -363,7 +375,10 @@ guestfs_close (guestfs_h *g)
 #endif
 
   guestfs_int_free_inspect_info (g);
+  free (g->inspect_cache_key);
+  free (g->launch_timings);
   guestfs_int_free_drives (g);
+  guestfs_int_free_spare_overlays (g);
 
   for (hp = g->hv_params; hp; hp = hp_next) {
     free (hp->hv_param);
@@ -389,6 +404,8 @@ guestfs_close (guestfs_h *g)
   free (g->backend_data);
   guestfs_int_free_string_list (g->backend_settings);
   free (g->append);
+  free (g->workload);
+  guestfs_int_free_call_stats (g);
   free (g);
 }
 
@@ -453,6 +470,15 @@ shutdown_backend (guestfs_h *g, int check_for_errors)
     g->conn = NULL;
   }
 
+  /* If the appliance came from the launch pool, this removes its
+   * temporary files.
+   */
+  if (g->pool_donor) {
+    guestfs_close (g->pool_donor);
+    g->pool_donor = NULL;
+  }
+
+  guestfs_int_free_pending_replies (g);
   guestfs_int_free_drives (g);
 
   g->state = CONFIG;
@@ -581,6 +607,7 @@ guestfs_impl_set_memsize (guestfs_h *g, int memsize)
     return -1;
   }
   g->memsize = memsize;
+  g->memsize_set = true;
   return 0;
 }
 
@@ -869,6 +896,78 @@ guestfs_impl_get_pgroup (guestfs_h *g)
   return g->pgroup;
 }
 
+int
+guestfs_impl_set_launch_pool (guestfs_h *g, int size)
+{
+  if (size < 0) {
+    error (g, _("launch pool size cannot be negative"));
+    return -1;
+  }
+  g->launch_pool = size;
+  return 0;
+}
+
+int
+guestfs_impl_get_launch_pool (guestfs_h *g)
+{
+  return g->launch_pool;
+}
+
+int
+guestfs_impl_set_inspect_cache (guestfs_h *g, int v)
+{
+  g->inspect_cache = !!v;
+  return 0;
+}
+
+int
+guestfs_impl_get_inspect_cache (guestfs_h *g)
+{
+  return g->inspect_cache;
+}
+
+int
+guestfs_impl_set_reuse_overlays (guestfs_h *g, int v)
+{
+  g->reuse_overlays = !!v;
+  if (!g->reuse_overlays)
+    guestfs_int_free_spare_overlays (g);
+  return 0;
+}
+
+int
+guestfs_impl_get_reuse_overlays (guestfs_h *g)
+{
+  return g->reuse_overlays;
+}
+
+int
+guestfs_impl_set_workload (guestfs_h *g, const char *workload)
+{
+  if (STREQ (workload, "")) {
+    free (g->workload);
+    g->workload = NULL;
+    return 0;
+  }
+
+  if (STRNEQ (workload, "inspection") &&
+      STRNEQ (workload, "copy") &&
+      STRNEQ (workload, "mkfs")) {
+    error (g, _("unknown workload '%s'"), workload);
+    return -1;
+  }
+
+  free (g->workload);
+  g->workload = safe_strdup (g, workload);
+  return 0;
+}
+
+char *
+guestfs_impl_get_workload (guestfs_h *g)
+{
+  return safe_strdup (g, g->workload ? g->workload : "");
+}
+
 int
 guestfs_impl_set_smp (guestfs_h *g, int v)
 {
@@ -877,6 +976,7 @@ guestfs_impl_set_smp (guestfs_h *g, int v)
     return -1;
   } else if (v >= 1) {
     g->smp = v;
+    g->smp_set = true;
     return 0;
   } else {
     error (g, "invalid smp parameter: %d", v);
@@ -134,6 +134,10 @@ guestfs_impl_inspect_list_applications2 (guestfs_h *g, const char *root)
   if (!fs)
     return NULL;
 
+  ret = guestfs_int_inspect_cache_load_applications (g, fs);
+  if (ret != NULL)
+    return ret;
+
   /* Presently we can only list applications for installed disks.  It
    * is possible in future to get lists of packages from installers.
    */
@@ -196,6 +200,7 @@ guestfs_impl_inspect_list_applications2 (guestfs_h *g, const char *root)
   }
 
   sort_applications (ret);
+  guestfs_int_inspect_cache_save_applications (g, fs, ret);
 
   return ret;
 }
@@ -721,14 +726,77 @@ list_applications_windows (guestfs_h *g, struct inspect_fs *fs)
   return ret;
 }
 
+/* Add the application described by the values of one Uninstall
+ * subkey, if it has a DisplayName value.  See also:
+ * http://nsis.sourceforge.net/Add_uninstall_information_to_Add/Remove_Programs#Optional_values
+ */
+static void
+add_application_from_values (guestfs_h *g,
+                             struct guestfs_application2_list *apps,
+                             const char *name,
+                             const struct guestfs_hivex_entry *values,
+                             size_t nr_values)
+{
+  const struct guestfs_hivex_entry *display_name_v = NULL,
+    *version_v = NULL, *install_path_v = NULL, *publisher_v = NULL,
+    *url_v = NULL, *comments_v = NULL;
+  CLEANUP_FREE char *display_name = NULL, *version = NULL,
+    *install_path = NULL, *publisher = NULL, *url = NULL, *comments = NULL;
+  size_t i;
+
+  for (i = 0; i < nr_values; ++i) {
+    const struct guestfs_hivex_entry *v = &values[i];
+    const char *key = v->hivex_entry_key;
+
+    if (!display_name_v && STRCASEEQ (key, "DisplayName"))
+      display_name_v = v;
+    else if (!version_v && STRCASEEQ (key, "DisplayVersion"))
+      version_v = v;
+    else if (!install_path_v && STRCASEEQ (key, "InstallLocation"))
+      install_path_v = v;
+    else if (!publisher_v && STRCASEEQ (key, "Publisher"))
+      publisher_v = v;
+    else if (!url_v && STRCASEEQ (key, "URLInfoAbout"))
+      url_v = v;
+    else if (!comments_v && STRCASEEQ (key, "Comments"))
+      comments_v = v;
+  }
+
+  if (display_name_v == NULL)
+    return;
+
+  display_name = guestfs_int_hivex_entry_utf8 (g, display_name_v);
+  if (display_name == NULL)
+    return;
+  if (version_v)
+    version = guestfs_int_hivex_entry_utf8 (g, version_v);
+  if (install_path_v)
+    install_path = guestfs_int_hivex_entry_utf8 (g, install_path_v);
+  if (publisher_v)
+    publisher = guestfs_int_hivex_entry_utf8 (g, publisher_v);
+  if (url_v)
+    url = guestfs_int_hivex_entry_utf8 (g, url_v);
+  if (comments_v)
+    comments = guestfs_int_hivex_entry_utf8 (g, comments_v);
+
+  add_application (g, apps, name, display_name, 0,
+                   version ? : "",
+                   "", "",
+                   install_path ? : "",
+                   publisher ? : "",
+                   url ? : "",
+                   comments ? : "");
+}
+
 static void
 list_applications_windows_from_path (guestfs_h *g,
                                      struct guestfs_application2_list *apps,
                                      const char **path, size_t path_len)
 {
+  CLEANUP_FREE_HIVEX_ENTRY_LIST struct guestfs_hivex_entry_list *entries = NULL;
   CLEANUP_FREE_HIVEX_NODE_LIST struct guestfs_hivex_node_list *children = NULL;
   int64_t node;
-  size_t i;
+  size_t i, j;
 
   node = guestfs_hivex_root (g);
 
@@ -738,56 +806,54 @@ list_applications_windows_from_path (guestfs_h *g,
   if (node == 0)
     return;
 
+  /* Try to get the child nodes and all their values in one call.
+   * Each node is followed by its values.
+   */
+  guestfs_push_error_handler (g, NULL, NULL);
+  entries = guestfs_hivex_node_get_subtree (g, node, 1);
+  guestfs_pop_error_handler (g);
+
+  if (entries != NULL) {
+    for (i = 0; i < entries->len; i = j) {
+      for (j = i+1;
+           j < entries->len && entries->val[j].hivex_entry_valueh != 0;
+           ++j)
+        ;
+
+      /* Skip the Uninstall node itself.  Use the node name as a proxy
+       * for the package name in Linux.  The display name is not
+       * language-independent, so it cannot be used.
+       */
+      if (i > 0)
+        add_application_from_values (g, apps,
+                                     entries->val[i].hivex_entry_path,
+                                     &entries->val[i+1], j - (i+1));
+    }
+    return;
+  }
+
+  /* With very many applications the reply can exceed the maximum
+   * message size, so get the values of each child node separately.
+   */
   children = guestfs_hivex_node_children (g, node);
   if (children == NULL)
     return;
 
-  /* Consider any child node that has a DisplayName key.
-   * See also:
-   * http://nsis.sourceforge.net/Add_uninstall_information_to_Add/Remove_Programs#Optional_values
-   */
   for (i = 0; i < children->len; ++i) {
     int64_t child = children->val[i].hivex_node_h;
-    int64_t value;
-    CLEANUP_FREE char *name = NULL, *display_name = NULL, *version = NULL,
-      *install_path = NULL, *publisher = NULL, *url = NULL, *comments = NULL;
+    CLEANUP_FREE char *name = NULL;
+    CLEANUP_FREE_HIVEX_ENTRY_LIST struct guestfs_hivex_entry_list *values =
+      NULL;
 
-    /* Use the node name as a proxy for the package name in Linux.  The
-     * display name is not language-independent, so it cannot be used.
-     */
     name = guestfs_hivex_node_name (g, child);
     if (name == NULL)
       continue;
+    values = guestfs_hivex_node_get_subtree (g, child, 0);
+    if (values == NULL || values->len == 0)
+      continue;
 
-    value = guestfs_hivex_node_get_value (g, child, "DisplayName");
-    if (value) {
-      display_name = guestfs_hivex_value_utf8 (g, value);
-      if (display_name) {
-        value = guestfs_hivex_node_get_value (g, child, "DisplayVersion");
-        if (value)
-          version = guestfs_hivex_value_utf8 (g, value);
-        value = guestfs_hivex_node_get_value (g, child, "InstallLocation");
-        if (value)
-          install_path = guestfs_hivex_value_utf8 (g, value);
-        value = guestfs_hivex_node_get_value (g, child, "Publisher");
-        if (value)
-          publisher = guestfs_hivex_value_utf8 (g, value);
-        value = guestfs_hivex_node_get_value (g, child, "URLInfoAbout");
-        if (value)
-          url = guestfs_hivex_value_utf8 (g, value);
-        value = guestfs_hivex_node_get_value (g, child, "Comments");
-        if (value)
-          comments = guestfs_hivex_value_utf8 (g, value);
-
-        add_application (g, apps, name, display_name, 0,
-                         version ? : "",
-                         "", "",
-                         install_path ? : "",
-                         publisher ? : "",
-                         url ? : "",
-                         comments ? : "");
-      }
-    }
+    add_application_from_values (g, apps, name,
+                                 &values->val[1], values->len - 1);
   }
 }
 
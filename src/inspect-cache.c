@@ -0,0 +1,584 @@
+/* libguestfs
+ * Copyright (C) 2015 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* Persistent cache of inspection results (see guestfs_set_inspect_cache).
+ *
+ * The cache key is a SHA-256 hash of the libguestfs version and, for
+ * each drive, its path, format, readonly flag, size, device and inode
+ * numbers, mtime and ctime (with nanoseconds) and the first
+ * HEADER_SIZE bytes of the file.  Results are
+ * stored in $cachedir/.guestfs-$UID/inspect/KEY (the struct inspect_fs
+ * array) and KEY.apps.N (the applications in root filesystem N).
+ *
+ * The files use a simple text format: integers are written in
+ * decimal on a line of their own, strings are written as
+ * "LENGTH:BYTES\n", and NULL strings as "-\n".
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "sha256.h"
+
+#include "guestfs.h"
+#include "guestfs-internal.h"
+#include "guestfs-internal-actions.h"
+
+#define CACHE_MAGIC "libguestfs inspection cache 1"
+
+/* How much of the start of each drive is included in the key. */
+#define HEADER_SIZE 65536
+
+/* Sanity limits when reading cache files. */
+#define MAX_STRING (1024 * 1024)
+#define MAX_COUNT 1000000
+
+/* Compute the cache key for the drives currently added to the
+ * handle.  Returns NULL if the drives cannot be cached (eg. they
+ * are not all local files).
+ */
+char *
+guestfs_int_inspect_cache_key (guestfs_h *g)
+{
+  struct sha256_ctx ctx;
+  unsigned char digest[32];
+  CLEANUP_FREE char *buf = NULL;
+  struct drive *drv;
+  size_t i, n = 0;
+  char *ret;
+
+  buf = safe_malloc (g, HEADER_SIZE);
+
+  sha256_init_ctx (&ctx);
+  sha256_process_bytes (CACHE_MAGIC "\n" PACKAGE_VERSION "\n",
+                        strlen (CACHE_MAGIC "\n" PACKAGE_VERSION "\n"), &ctx);
+
+  ITER_DRIVES (g, i, drv) {
+    CLEANUP_FREE char *rec = NULL;
+    struct stat statbuf;
+    ssize_t r;
+    int fd;
+
+    if (drv->src.protocol != drive_protocol_file) {
+      debug (g, "inspect cache: drive %zu is not a local file", i);
+      return NULL;
+    }
+
+    fd = open (drv->src.u.path, O_RDONLY|O_CLOEXEC);
+    if (fd == -1 || fstat (fd, &statbuf) == -1 ||
+        !S_ISREG (statbuf.st_mode)) {
+      debug (g, "inspect cache: %s is not a regular file", drv->src.u.path);
+      if (fd >= 0)
+        close (fd);
+      return NULL;
+    }
+    r = read (fd, buf, HEADER_SIZE);
+    close (fd);
+    if (r == -1) {
+      debug (g, "inspect cache: read: %s: %m", drv->src.u.path);
+      return NULL;
+    }
+
+    /* Include the nanoseconds, since the image may be changed and
+     * inspected again within the same second.
+     */
+    rec = safe_asprintf (g, "%zu\n%s\n%s\n%d\n%" PRIi64 "\n"
+                         "%" PRIu64 "\n%" PRIu64 "\n"
+                         "%" PRIi64 ".%09ld\n%" PRIi64 ".%09ld\n",
+                         i, drv->src.u.path,
+                         drv->src.format ? drv->src.format : "",
+                         (int) drv->readonly,
+                         (int64_t) statbuf.st_size,
+                         (uint64_t) statbuf.st_dev,
+                         (uint64_t) statbuf.st_ino,
+                         (int64_t) statbuf.st_mtime,
+                         (long) statbuf.st_mtim.tv_nsec,
+                         (int64_t) statbuf.st_ctime,
+                         (long) statbuf.st_ctim.tv_nsec);
+    sha256_process_bytes (rec, strlen (rec), &ctx);
+    sha256_process_bytes (buf, r, &ctx);
+    n++;
+  }
+
+  if (n == 0)
+    return NULL;
+
+  sha256_finish_ctx (&ctx, digest);
+
+  ret = safe_malloc (g, 2 * sizeof digest + 1);
+  for (i = 0; i < sizeof digest; ++i)
+    sprintf (&ret[2*i], "%02x", digest[i]);
+  return ret;
+}
+
+/* Open a cache file for reading.  'suffix' is appended to the key. */
+static FILE *
+open_cache_file (guestfs_h *g, const char *suffix)
+{
+  CLEANUP_FREE char *dir = NULL, *path = NULL;
+
+  dir = guestfs_int_make_cache_subdir (g, "inspect", 0700);
+  if (dir == NULL)
+    return NULL;
+
+  path = safe_asprintf (g, "%s/%s%s", dir, g->inspect_cache_key, suffix);
+  return fopen (path, "re");
+}
+
+/* Writing cache files.  Errors are picked up by ferror/fclose. */
+static void
+put_int (FILE *fp, int64_t v)
+{
+  fprintf (fp, "%" PRIi64 "\n", v);
+}
+
+static void
+put_string (FILE *fp, const char *str)
+{
+  if (str == NULL)
+    fputs ("-\n", fp);
+  else {
+    fprintf (fp, "%zu:", strlen (str));
+    fputs (str, fp);
+    fputc ('\n', fp);
+  }
+}
+
+static void
+put_strings (FILE *fp, char *const *strs)
+{
+  size_t i;
+
+  if (strs == NULL) {
+    put_int (fp, -1);
+    return;
+  }
+  put_int (fp, guestfs_int_count_strings (strs));
+  for (i = 0; strs[i] != NULL; ++i)
+    put_string (fp, strs[i]);
+}
+
+typedef void (*cache_writer) (guestfs_h *g, FILE *fp, void *opaque);
+
+/* Write a cache file atomically.  Errors are ignored (apart from a
+ * debug message), since the cache is only an optimization.
+ */
+static void
+save_cache_file (guestfs_h *g, const char *suffix,
+                 cache_writer writer, void *opaque)
+{
+  CLEANUP_FREE char *dir = NULL, *path = NULL, *tmp = NULL;
+  FILE *fp;
+  int fd, r;
+
+  dir = guestfs_int_make_cache_subdir (g, "inspect", 0700);
+  if (dir == NULL)
+    return;
+
+  path = safe_asprintf (g, "%s/%s%s", dir, g->inspect_cache_key, suffix);
+  tmp = safe_asprintf (g, "%s.XXXXXX", path);
+
+  fd = mkstemp (tmp);
+  if (fd == -1) {
+    debug (g, "inspect cache: mkstemp: %s: %m", tmp);
+    return;
+  }
+  fp = fdopen (fd, "w");
+  if (fp == NULL) {
+    debug (g, "inspect cache: fdopen: %m");
+    close (fd);
+    unlink (tmp);
+    return;
+  }
+
+  fputs (CACHE_MAGIC "\n", fp);
+  writer (g, fp, opaque);
+
+  r = ferror (fp);
+  if (fclose (fp) == EOF)
+    r = -1;
+  if (r != 0 || rename (tmp, path) == -1) {
+    debug (g, "inspect cache: could not write %s: %m", path);
+    unlink (tmp);
+    return;
+  }
+
+  debug (g, "inspect cache: saved %s", path);
+}
+
+/* Reading cache files.  After any error, 'err' is set and all
+ * further reads return 0 or NULL.
+ */
+struct reader {
+  guestfs_h *g;
+  FILE *fp;
+  int err;
+};
+
+static int64_t
+get_int (struct reader *r)
+{
+  int64_t v;
+
+  if (r->err)
+    return 0;
+  if (fscanf (r->fp, "%" SCNi64, &v) != 1 || fgetc (r->fp) != '\n') {
+    r->err = 1;
+    return 0;
+  }
+  return v;
+}
+
+static char *
+get_string (struct reader *r)
+{
+  size_t len;
+  char *str;
+  int c;
+
+  if (r->err)
+    return NULL;
+
+  c = fgetc (r->fp);
+  if (c == '-') {
+    if (fgetc (r->fp) != '\n')
+      r->err = 1;
+    return NULL;
+  }
+  if (c == EOF || ungetc (c, r->fp) == EOF ||
+      fscanf (r->fp, "%zu", &len) != 1 || fgetc (r->fp) != ':' ||
+      len > MAX_STRING) {
+    r->err = 1;
+    return NULL;
+  }
+
+  str = safe_malloc (r->g, len + 1);
+  if (fread (str, 1, len, r->fp) != len || fgetc (r->fp) != '\n') {
+    free (str);
+    r->err = 1;
+    return NULL;
+  }
+  str[len] = '\0';
+  return str;
+}
+
+static char **
+get_strings (struct reader *r)
+{
+  int64_t i, n;
+  char **strs;
+
+  n = get_int (r);
+  if (r->err || n < 0 || n > MAX_COUNT)
+    return NULL;
+
+  strs = safe_calloc (r->g, n + 1, sizeof (char *));
+  for (i = 0; i < n; ++i) {
+    strs[i] = get_string (r);
+    if (strs[i] == NULL) {
+      r->err = 1;
+      guestfs_int_free_string_list (strs);
+      return NULL;
+    }
+  }
+  return strs;
+}
+
+static int
+check_magic (struct reader *r)
+{
+  char line[sizeof CACHE_MAGIC + 1];
+
+  if (fgets (line, sizeof line, r->fp) == NULL ||
+      STRNEQ (line, CACHE_MAGIC "\n"))
+    r->err = 1;
+  return r->err ? -1 : 0;
+}
+
+static void
+write_fses (guestfs_h *g, FILE *fp, void *opaque)
+{
+  size_t i, j;
+
+  put_int (fp, g->nr_fses);
+  for (i = 0; i < g->nr_fses; ++i) {
+    const struct inspect_fs *fs = &g->fses[i];
+
+    put_int (fp, fs->is_root);
+    put_string (fp, fs->mountable);
+    put_int (fp, fs->type);
+    put_int (fp, fs->distro);
+    put_int (fp, fs->package_format);
+    put_int (fp, fs->package_management);
+    put_string (fp, fs->product_name);
+    put_string (fp, fs->product_variant);
+    put_int (fp, fs->major_version);
+    put_int (fp, fs->minor_version);
+    put_string (fp, fs->arch);
+    put_string (fp, fs->hostname);
+    put_string (fp, fs->windows_systemroot);
+    put_string (fp, fs->windows_current_control_set);
+    put_strings (fp, fs->drive_mappings);
+    put_int (fp, fs->format);
+    put_int (fp, fs->is_live_disk);
+    put_int (fp, fs->is_netinst_disk);
+    put_int (fp, fs->is_multipart_disk);
+    put_int (fp, fs->nr_fstab);
+    for (j = 0; j < fs->nr_fstab; ++j) {
+      put_string (fp, fs->fstab[j].mountable);
+      put_string (fp, fs->fstab[j].mountpoint);
+    }
+  }
+}
+
+/* Save the inspection results in the handle to the cache. */
+void
+guestfs_int_inspect_cache_save (guestfs_h *g)
+{
+  if (g->inspect_cache_key == NULL)
+    return;
+
+  save_cache_file (g, "", write_fses, NULL);
+}
+
+/* Load inspection results from the cache into the handle.  Returns
+ * 0 if found, or -1 if not (without setting an error).
+ */
+int
+guestfs_int_inspect_cache_load (guestfs_h *g)
+{
+  struct reader r = { .g = g };
+  int64_t n, nr_fstab;
+  size_t i, j;
+
+  if (g->inspect_cache_key == NULL)
+    return -1;
+
+  r.fp = open_cache_file (g, "");
+  if (r.fp == NULL)
+    return -1;
+
+  n = 0;
+  if (check_magic (&r) == 0) {
+    n = get_int (&r);
+    if (n < 0 || n > MAX_COUNT)
+      r.err = 1;
+  }
+  if (r.err) {
+    fclose (r.fp);
+    return -1;
+  }
+
+  guestfs_int_free_inspect_info (g);
+  g->fses = safe_calloc (g, n > 0 ? n : 1, sizeof (struct inspect_fs));
+
+  /* nr_fses counts the filled-in entries, so that they can be freed
+   * by guestfs_int_free_inspect_info if the file is truncated.
+   */
+  for (i = 0; !r.err && i < (size_t) n; ++i) {
+    struct inspect_fs *fs = &g->fses[i];
+
+    g->nr_fses = i + 1;
+    fs->is_root = get_int (&r);
+    fs->mountable = get_string (&r);
+    fs->type = get_int (&r);
+    fs->distro = get_int (&r);
+    fs->package_format = get_int (&r);
+    fs->package_management = get_int (&r);
+    fs->product_name = get_string (&r);
+    fs->product_variant = get_string (&r);
+    fs->major_version = get_int (&r);
+    fs->minor_version = get_int (&r);
+    fs->arch = get_string (&r);
+    fs->hostname = get_string (&r);
+    fs->windows_systemroot = get_string (&r);
+    fs->windows_current_control_set = get_string (&r);
+    fs->drive_mappings = get_strings (&r);
+    fs->format = get_int (&r);
+    fs->is_live_disk = get_int (&r);
+    fs->is_netinst_disk = get_int (&r);
+    fs->is_multipart_disk = get_int (&r);
+    nr_fstab = get_int (&r);
+    if (nr_fstab < 0 || nr_fstab > MAX_COUNT)
+      r.err = 1;
+    if (!r.err && nr_fstab > 0) {
+      fs->fstab = safe_calloc (g, nr_fstab, sizeof (struct inspect_fstab_entry));
+      for (j = 0; !r.err && j < (size_t) nr_fstab; ++j) {
+        fs->nr_fstab = j + 1;
+        fs->fstab[j].mountable = get_string (&r);
+        fs->fstab[j].mountpoint = get_string (&r);
+      }
+    }
+    if (fs->mountable == NULL)
+      r.err = 1;
+  }
+  fclose (r.fp);
+
+  if (r.err) {
+    debug (g, "inspect cache: ignoring corrupt cache file");
+    guestfs_int_free_inspect_info (g);
+    return -1;
+  }
+
+  return 0;
+}
+
+static void
+write_applications (guestfs_h *g, FILE *fp, void *appsv)
+{
+  const struct guestfs_application2_list *apps = appsv;
+  size_t i;
+
+  put_int (fp, apps->len);
+  for (i = 0; i < apps->len; ++i) {
+    const struct guestfs_application2 *app = &apps->val[i];
+
+    put_string (fp, app->app2_name);
+    put_string (fp, app->app2_display_name);
+    put_int (fp, app->app2_epoch);
+    put_string (fp, app->app2_version);
+    put_string (fp, app->app2_release);
+    put_string (fp, app->app2_arch);
+    put_string (fp, app->app2_install_path);
+    put_string (fp, app->app2_trans_path);
+    put_string (fp, app->app2_publisher);
+    put_string (fp, app->app2_url);
+    put_string (fp, app->app2_source_package);
+    put_string (fp, app->app2_summary);
+    put_string (fp, app->app2_description);
+    put_string (fp, app->app2_spare1);
+    put_string (fp, app->app2_spare2);
+    put_string (fp, app->app2_spare3);
+    put_string (fp, app->app2_spare4);
+  }
+}
+
+static char *
+apps_suffix (guestfs_h *g, struct inspect_fs *fs)
+{
+  return safe_asprintf (g, ".apps.%zu", (size_t) (fs - g->fses));
+}
+
+/* Save the list of applications in 'fs' to the cache. */
+void
+guestfs_int_inspect_cache_save_applications (guestfs_h *g,
+                                             struct inspect_fs *fs,
+                                             struct guestfs_application2_list *apps)
+{
+  CLEANUP_FREE char *suffix = NULL;
+
+  if (g->inspect_cache_key == NULL)
+    return;
+
+  suffix = apps_suffix (g, fs);
+  save_cache_file (g, suffix, write_applications, apps);
+}
+
+/* Load the list of applications in 'fs' from the cache.  Returns
+ * NULL if not found (without setting an error).
+ */
+struct guestfs_application2_list *
+guestfs_int_inspect_cache_load_applications (guestfs_h *g,
+                                             struct inspect_fs *fs)
+{
+  CLEANUP_FREE char *suffix = NULL;
+  struct reader r = { .g = g };
+  struct guestfs_application2_list *ret;
+  int64_t n;
+  size_t i;
+
+  if (g->inspect_cache_key == NULL)
+    return NULL;
+
+  suffix = apps_suffix (g, fs);
+  r.fp = open_cache_file (g, suffix);
+  if (r.fp == NULL)
+    return NULL;
+
+  n = 0;
+  if (check_magic (&r) == 0) {
+    n = get_int (&r);
+    if (n < 0 || n > MAX_COUNT)
+      r.err = 1;
+  }
+  if (r.err) {
+    fclose (r.fp);
+    return NULL;
+  }
+
+  ret = safe_malloc (g, sizeof *ret);
+  ret->len = 0;
+  ret->val = safe_calloc (g, n > 0 ? n : 1, sizeof (struct guestfs_application2));
+
+  for (i = 0; !r.err && i < (size_t) n; ++i) {
+    struct guestfs_application2 *app = &ret->val[i];
+
+    ret->len = i + 1;
+    app->app2_name = get_string (&r);
+    app->app2_display_name = get_string (&r);
+    app->app2_epoch = get_int (&r);
+    app->app2_version = get_string (&r);
+    app->app2_release = get_string (&r);
+    app->app2_arch = get_string (&r);
+    app->app2_install_path = get_string (&r);
+    app->app2_trans_path = get_string (&r);
+    app->app2_publisher = get_string (&r);
+    app->app2_url = get_string (&r);
+    app->app2_source_package = get_string (&r);
+    app->app2_summary = get_string (&r);
+    app->app2_description = get_string (&r);
+    app->app2_spare1 = get_string (&r);
+    app->app2_spare2 = get_string (&r);
+    app->app2_spare3 = get_string (&r);
+    app->app2_spare4 = get_string (&r);
+  }
+  fclose (r.fp);
+
+  /* The strings in the API struct must not be NULL. */
+  for (i = 0; !r.err && i < ret->len; ++i) {
+    struct guestfs_application2 *app = &ret->val[i];
+
+    if (!app->app2_name || !app->app2_display_name ||
+        !app->app2_version || !app->app2_release || !app->app2_arch ||
+        !app->app2_install_path || !app->app2_trans_path ||
+        !app->app2_publisher || !app->app2_url ||
+        !app->app2_source_package || !app->app2_summary ||
+        !app->app2_description || !app->app2_spare1 ||
+        !app->app2_spare2 || !app->app2_spare3 || !app->app2_spare4)
+      r.err = 1;
+  }
+
+  if (r.err) {
+    debug (g, "inspect cache: ignoring corrupt cache file");
+    guestfs_free_application2_list (ret);
+    return NULL;
+  }
+
+  debug (g, "inspect cache: loaded applications for %s", fs->mountable);
+  return ret;
+}
@@ -283,7 +283,7 @@ check_windows_software_registry (guestfs_h *g, struct inspect_fs *fs)
   const char *hivepath[] =
     { "Microsoft", "Windows NT", "CurrentVersion" };
   size_t i;
-  CLEANUP_FREE_HIVEX_VALUE_LIST struct guestfs_hivex_value_list *values = NULL;
+  CLEANUP_FREE_HIVEX_ENTRY_LIST struct guestfs_hivex_entry_list *values = NULL;
 
   if (guestfs_hivex_open (g, software_path,
                           GUESTFS_HIVEX_OPEN_VERBOSE, g->verbose, -1) == -1)
@@ -301,21 +301,25 @@ check_windows_software_registry (guestfs_h *g, struct inspect_fs *fs)
     goto out;
   }
 
-  values = guestfs_hivex_node_values (g, node);
+  /* Get all the values in one call. */
+  values = guestfs_hivex_node_get_subtree (g, node, 0);
+  if (values == NULL)
+    goto out;
 
   for (i = 0; i < values->len; ++i) {
-    int64_t value = values->val[i].hivex_value_h;
-    CLEANUP_FREE char *key = guestfs_hivex_value_key (g, value);
-    if (key == NULL)
-      goto out;
+    const struct guestfs_hivex_entry *value = &values->val[i];
+    const char *key = value->hivex_entry_key;
+
+    if (value->hivex_entry_valueh == 0) /* the node itself */
+      continue;
 
     if (STRCASEEQ (key, "ProductName")) {
-      fs->product_name = guestfs_hivex_value_utf8 (g, value);
+      fs->product_name = guestfs_int_hivex_entry_utf8 (g, value);
       if (!fs->product_name)
         goto out;
     }
     else if (STRCASEEQ (key, "CurrentVersion")) {
-      CLEANUP_FREE char *version = guestfs_hivex_value_utf8 (g, value);
+      CLEANUP_FREE char *version = guestfs_int_hivex_entry_utf8 (g, value);
       if (!version)
         goto out;
       char *major, *minor;
@@ -333,7 +337,7 @@ check_windows_software_registry (guestfs_h *g, struct inspect_fs *fs)
       }
     }
     else if (STRCASEEQ (key, "InstallationType")) {
-      fs->product_variant = guestfs_hivex_value_utf8 (g, value);
+      fs->product_variant = guestfs_int_hivex_entry_utf8 (g, value);
       if (!fs->product_variant)
         goto out;
     }
@@ -371,8 +375,8 @@ check_windows_system_registry (guestfs_h *g, struct inspect_fs *fs)
 
   int ret = -1;
   int64_t root, node, value;
-  CLEANUP_FREE_HIVEX_VALUE_LIST struct guestfs_hivex_value_list *values = NULL;
-  CLEANUP_FREE_HIVEX_VALUE_LIST struct guestfs_hivex_value_list *values2 = NULL;
+  CLEANUP_FREE_HIVEX_ENTRY_LIST struct guestfs_hivex_entry_list *values = NULL;
+  CLEANUP_FREE_HIVEX_ENTRY_LIST struct guestfs_hivex_entry_list *values2 = NULL;
   int32_t dword;
   size_t i, count;
   CLEANUP_FREE void *buf = NULL;
@@ -428,18 +432,18 @@ check_windows_system_registry (guestfs_h *g, struct inspect_fs *fs)
     /* Not found: skip getting drive letter mappings (RHBZ#803664). */
     goto skip_drive_letter_mappings;
 
-  values = guestfs_hivex_node_values (g, node);
+  values = guestfs_hivex_node_get_subtree (g, node, 0);
+  if (values == NULL)
+    goto out;
 
   /* Count how many DOS drive letter mappings there are.  This doesn't
    * ignore removable devices, so it overestimates, but that doesn't
    * matter because it just means we'll allocate a few bytes extra.
    */
   for (i = count = 0; i < values->len; ++i) {
-    CLEANUP_FREE char *key =
-      guestfs_hivex_value_key (g, values->val[i].hivex_value_h);
-    if (key == NULL)
-      goto out;
-    if (STRCASEEQLEN (key, "\\DosDevices\\", 12) &&
+    const char *key = values->val[i].hivex_entry_key;
+    if (values->val[i].hivex_entry_valueh != 0 &&
+        STRCASEEQLEN (key, "\\DosDevices\\", 12) &&
         c_isalpha (key[12]) && key[13] == ':')
       count++;
   }
@@ -447,21 +451,18 @@ check_windows_system_registry (guestfs_h *g, struct inspect_fs *fs)
   fs->drive_mappings = safe_calloc (g, 2*count + 1, sizeof (char *));
 
   for (i = count = 0; i < values->len; ++i) {
-    int64_t v = values->val[i].hivex_value_h;
-    CLEANUP_FREE char *key = guestfs_hivex_value_key (g, v);
-    if (key == NULL)
-      goto out;
-    if (STRCASEEQLEN (key, "\\DosDevices\\", 12) &&
+    const struct guestfs_hivex_entry *v = &values->val[i];
+    const char *key = v->hivex_entry_key;
+    if (v->hivex_entry_valueh != 0 &&
+        STRCASEEQLEN (key, "\\DosDevices\\", 12) &&
         c_isalpha (key[12]) && key[13] == ':') {
       /* Get the binary value.  Is it a fixed disk? */
-      CLEANUP_FREE char *blob = NULL;
+      const char *blob = v->hivex_entry_value;
       char *device;
-      size_t len;
-      int64_t type;
+      size_t len = v->hivex_entry_value_len;
+      int64_t type = v->hivex_entry_type;
 
-      type = guestfs_hivex_value_type (g, v);
-      blob = guestfs_hivex_value_value (g, v, &len);
-      if (blob != NULL && type == 3 && len == 12) {
+      if (type == 3 && len == 12) {
         /* Try to map the blob to a known disk and partition. */
         device = map_registry_disk_blob (g, blob);
         if (device != NULL) {
@@ -490,18 +491,18 @@ check_windows_system_registry (guestfs_h *g, struct inspect_fs *fs)
     goto out;
   }
 
-  values2 = guestfs_hivex_node_values (g, node);
+  values2 = guestfs_hivex_node_get_subtree (g, node, 0);
   if (values2 == NULL)
     goto out;
 
   for (i = 0; i < values2->len; ++i) {
-    int64_t v = values2->val[i].hivex_value_h;
-    CLEANUP_FREE char *key = guestfs_hivex_value_key (g, v);
-    if (key == NULL)
-      goto out;
+    const struct guestfs_hivex_entry *v = &values2->val[i];
 
-    if (STRCASEEQ (key, "Hostname")) {
-      fs->hostname = guestfs_hivex_value_utf8 (g, v);
+    if (v->hivex_entry_valueh == 0) /* the node itself */
+      continue;
+
+    if (STRCASEEQ (v->hivex_entry_key, "Hostname")) {
+      fs->hostname = guestfs_int_hivex_entry_utf8 (g, v);
       if (!fs->hostname)
         goto out;
     }
@@ -615,6 +616,23 @@ guestfs_impl_hivex_value_utf8 (guestfs_h *g, int64_t valueh)
   return ret;
 }
 
+/* The same for a value returned by guestfs_hivex_node_get_subtree. */
+char *
+guestfs_int_hivex_entry_utf8 (guestfs_h *g,
+                              const struct guestfs_hivex_entry *entry)
+{
+  char *ret;
+
+  ret = utf16_to_utf8 (entry->hivex_entry_value,
+                       entry->hivex_entry_value_len);
+  if (ret == NULL) {
+    perrorf (g, "hivex: conversion of registry value to UTF8 failed");
+    return NULL;
+  }
+
+  return ret;
+}
+
 static char *
 utf16_to_utf8 (/* const */ char *input, size_t len)
 {
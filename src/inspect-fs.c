@@ -44,23 +44,281 @@
 
 COMPILE_REGEXP (re_major_minor, "(\\d+)\\.(\\d+)", 0)
 
-static int check_filesystem (guestfs_h *g, const char *mountable,
+/* The filesystem being checked, and the results of probing it with
+ * guestfs_int_probe_filesystems.
+ */
+struct probe {
+  const char *mountable;
+  const char *vfs_type;
+  const char *types;            /* NULL if we have no probe results. */
+  int mounted;                  /* Mounted on / yet? */
+};
+
+static int check_filesystem (guestfs_h *g, struct probe *p,
                              const struct guestfs_internal_mountable *m,
                              int whole_device);
 static void extend_fses (guestfs_h *g);
 static int get_partition_context (guestfs_h *g, const char *partition, int *partnum_ret, int *nr_partitions_ret);
 
+/* Paths tested by check_filesystem.  guestfs_int_probe_filesystems
+ * asks the daemon to look these up on all filesystems at once, so
+ * that most filesystems never need to be mounted on / here.
+ */
+static const char *probe_paths[] = {
+  "/bin", "/etc", "/share", "/local", "/log", "/run", "/spool", "/root",
+  "/home", "/usr", "/usr/bin", "/share/coreos", "/EFI/BOOT", "/.disk",
+  "/grub/menu.lst", "/grub/grub.conf", "/grub2/grub.cfg",
+  "/etc/freebsd-update.conf", "/etc/fstab", "/etc/release",
+  "/etc/motd", "/etc/version", "/etc/coreos/update.conf",
+  "/netbsd", "/bsd", "/hurd/console", "/hurd/hello", "/hurd/null",
+  "/service/vm", "/isolinux/isolinux.cfg", "/images/install.img",
+  "/.discinfo", "/i386/txtsetup.sif", "/amd64/txtsetup.sif",
+  "/freedos/freedos.ico", "/boot/loader.rc",
+  NULL
+};
+
+/* Paths tested case-insensitively.  The systemroot locations must
+ * match guestfs_int_get_windows_systemroot.
+ */
+static const char *probe_nocase_paths[] = {
+  "/System Volume Information", "/Program Files",
+  "/FDOS", "/FDOS/FREEDOS.BSS",
+  "/boot.ini",
+#define SYSTEMROOT_PATHS(root) \
+  root "/system32", root "/system32/config", root "/system32/cmd.exe"
+  SYSTEMROOT_PATHS ("/windows"),
+  SYSTEMROOT_PATHS ("/winnt"),
+  SYSTEMROOT_PATHS ("/win32"),
+  SYSTEMROOT_PATHS ("/win"),
+  SYSTEMROOT_PATHS ("/reactos"),
+#undef SYSTEMROOT_PATHS
+  NULL
+};
+
+#define NR_PROBE_PATHS (sizeof probe_paths / sizeof probe_paths[0] - 1)
+#define NR_PROBE_NOCASE_PATHS \
+  (sizeof probe_nocase_paths / sizeof probe_nocase_paths[0] - 1)
+
+/* Ask the daemon to mount each filesystem returned by
+ * guestfs_list_filesystems and look up the probe paths on it.  This
+ * happens in parallel in the daemon.  Returns a list with one string
+ * per filesystem (see guestfs_internal_probe_filesystems), or NULL if
+ * the daemon doesn't support this, in which case each filesystem is
+ * checked in the ordinary way.
+ */
+char **
+guestfs_int_probe_filesystems (guestfs_h *g, char *const *fses)
+{
+  size_t i, n = guestfs_int_count_strings (fses) / 2;
+  CLEANUP_FREE char **mountables = NULL, **vfstypes = NULL;
+  char **ret;
+
+  mountables = safe_malloc (g, (n+1) * sizeof (char *));
+  vfstypes = safe_malloc (g, (n+1) * sizeof (char *));
+  for (i = 0; i < n; ++i) {
+    mountables[i] = fses[2*i];
+    vfstypes[i] = fses[2*i+1];
+  }
+  mountables[n] = vfstypes[n] = NULL;
+
+  guestfs_push_error_handler (g, NULL, NULL);
+  ret = guestfs_internal_probe_filesystems (g, mountables, vfstypes,
+                                            (char **) probe_paths,
+                                            (char **) probe_nocase_paths);
+  guestfs_pop_error_handler (g);
+
+  if (ret == NULL) {
+    debug (g, "daemon cannot probe filesystems, checking them one at a time");
+    return NULL;
+  }
+
+  /* Check the reply is sane. */
+  if (guestfs_int_count_strings (ret) != n)
+    goto bad;
+  for (i = 0; i < n; ++i)
+    if (ret[i][0] != '\0' &&
+        strlen (ret[i]) != NR_PROBE_PATHS + NR_PROBE_NOCASE_PATHS)
+      goto bad;
+
+  return ret;
+
+ bad:
+  debug (g, "internal_probe_filesystems returned unexpected results");
+  guestfs_int_free_string_list (ret);
+  return NULL;
+}
+
+/* Mount the filesystem being checked read-only on /, if it is not
+ * mounted already.  Errors are ignored, but -1 is returned if the
+ * filesystem cannot be mounted.
+ */
+static int
+mount_fs (guestfs_h *g, struct probe *p)
+{
+  int r;
+
+  if (p->mounted)
+    return 0;
+
+  guestfs_push_error_handler (g, NULL, NULL);
+  if (p->vfs_type && STREQ (p->vfs_type, "ufs")) { /* Hack for the *BSDs. */
+    /* FreeBSD fs is a variant of ufs called ufs2 ... */
+    r = guestfs_mount_vfs (g, "ro,ufstype=ufs2", "ufs", p->mountable, "/");
+    if (r == -1)
+      /* while NetBSD and OpenBSD use another variant labeled 44bsd */
+      r = guestfs_mount_vfs (g, "ro,ufstype=44bsd", "ufs", p->mountable, "/");
+  } else {
+    r = guestfs_mount_ro (g, p->mountable, "/");
+  }
+  guestfs_pop_error_handler (g);
+  if (r == -1)
+    return -1;
+
+  p->mounted = 1;
+  return 0;
+}
+
+/* Return the probed type character for 'path', or 0 if we have to
+ * look at the filesystem itself.
+ */
+static char
+probe_lookup (struct probe *p, const char *path, int nocase)
+{
+  size_t i;
+  char c;
+
+  if (p->types == NULL)
+    return 0;
+
+  if (!nocase) {
+    for (i = 0; i < NR_PROBE_PATHS; ++i)
+      if (STREQ (probe_paths[i], path)) {
+        c = p->types[i];
+        return c == '?' ? 0 : c;
+      }
+  }
+  else {
+    for (i = 0; i < NR_PROBE_NOCASE_PATHS; ++i)
+      if (STREQ (probe_nocase_paths[i], path)) {
+        c = p->types[NR_PROBE_PATHS + i];
+        return c == '?' ? 0 : c;
+      }
+  }
+
+  return 0;
+}
+
+/* These work like guestfs_is_file etc, but use the probe results if
+ * possible, and otherwise mount the filesystem first.  If the probe
+ * found a symlink, only is_symlink uses the result: the others ask
+ * the filesystem, so they give the same answer as before the probe
+ * existed.
+ */
+static int
+is_file (guestfs_h *g, struct probe *p, const char *path)
+{
+  char c = probe_lookup (p, path, 0);
+
+  if (c && c != 'l')
+    return c == 'f';
+  if (mount_fs (g, p) == -1)
+    return 0;
+  return guestfs_is_file (g, path);
+}
+
+static int
+is_dir (guestfs_h *g, struct probe *p, const char *path)
+{
+  char c = probe_lookup (p, path, 0);
+
+  if (c && c != 'l')
+    return c == 'd';
+  if (mount_fs (g, p) == -1)
+    return 0;
+  return guestfs_is_dir (g, path);
+}
+
+static int
+is_symlink (guestfs_h *g, struct probe *p, const char *path)
+{
+  char c = probe_lookup (p, path, 0);
+
+  if (c)
+    return c == 'l';
+  if (mount_fs (g, p) == -1)
+    return 0;
+  return guestfs_is_symlink (g, path);
+}
+
+static int
+is_file_nocase (guestfs_h *g, struct probe *p, const char *path)
+{
+  char c = probe_lookup (p, path, 1);
+
+  if (c && c != 'l')
+    return c == 'f';
+  if (mount_fs (g, p) == -1)
+    return 0;
+  return guestfs_int_is_file_nocase (g, path);
+}
+
+static int
+is_dir_nocase (guestfs_h *g, struct probe *p, const char *path)
+{
+  char c = probe_lookup (p, path, 1);
+
+  if (c && c != 'l')
+    return c == 'd';
+  if (mount_fs (g, p) == -1)
+    return 0;
+  return guestfs_int_is_dir_nocase (g, path);
+}
+
+/* Could guestfs_int_get_windows_systemroot find anything?  If so,
+ * mount the filesystem so that it can be called.
+ */
+static int
+maybe_windows (guestfs_h *g, struct probe *p)
+{
+  size_t i;
+  int r = 0;
+
+  if (p->types == NULL)
+    r = 1;
+  else if (is_file_nocase (g, p, "/boot.ini"))
+    r = 1;
+  else {
+    for (i = 0; i < NR_PROBE_NOCASE_PATHS; ++i) {
+      const char *path = probe_nocase_paths[i];
+      const char *suffix = strstr (path, "/system32/cmd.exe");
+
+      if (suffix && suffix[strlen ("/system32/cmd.exe")] == '\0' &&
+          is_file_nocase (g, p, path)) {
+        r = 1;
+        break;
+      }
+    }
+  }
+
+  return r && mount_fs (g, p) == 0;
+}
+
 /* Find out if 'device' contains a filesystem.  If it does, add
  * another entry in g->fses.
+ *
+ * 'probe' is the result of guestfs_int_probe_filesystems for this
+ * filesystem, or NULL if not available.
  */
 int
-guestfs_int_check_for_filesystem_on (guestfs_h *g, const char *mountable)
+guestfs_int_check_for_filesystem_on (guestfs_h *g, const char *mountable,
+                                     const char *probe)
 {
   CLEANUP_FREE char *vfs_type = NULL;
   int is_swap, r;
   struct inspect_fs *fs;
   CLEANUP_FREE_INTERNAL_MOUNTABLE struct guestfs_internal_mountable *m = NULL;
   int whole_device = 0;
+  struct probe p = { .mountable = mountable, .types = probe };
 
   /* Get vfs-type in order to check if it's a Linux(?) swap device.
    * If there's an error we should ignore it, so to do that we have to
@@ -109,33 +367,32 @@ guestfs_int_check_for_filesystem_on (guestfs_h *g, const char *mountable)
     g->nr_fses--;
   }
 
-  /* Try mounting the device.  As above, ignore errors. */
-  guestfs_push_error_handler (g, NULL, NULL);
-  if (vfs_type && STREQ (vfs_type, "ufs")) { /* Hack for the *BSDs. */
-    /* FreeBSD fs is a variant of ufs called ufs2 ... */
-    r = guestfs_mount_vfs (g, "ro,ufstype=ufs2", "ufs", mountable, "/");
-    if (r == -1)
-      /* while NetBSD and OpenBSD use another variant labeled 44bsd */
-      r = guestfs_mount_vfs (g, "ro,ufstype=44bsd", "ufs", mountable, "/");
-  } else {
-    r = guestfs_mount_ro (g, mountable, "/");
+  p.vfs_type = vfs_type;
+
+  /* If we have probe results, the daemon has already tried to mount
+   * the filesystem, and we only mount it on / if the checks below
+   * need more than the probe results.  Otherwise try mounting the
+   * device now.  As above, ignore errors.
+   */
+  if (p.types) {
+    if (STREQ (p.types, ""))
+      return 0;
   }
-  guestfs_pop_error_handler (g);
-  if (r == -1)
+  else if (mount_fs (g, &p) == -1)
     return 0;
 
   /* Do the rest of the checks. */
-  r = check_filesystem (g, mountable, m, whole_device);
+  r = check_filesystem (g, &p, m, whole_device);
 
   /* Unmount the filesystem. */
-  if (guestfs_umount_all (g) == -1)
+  if (p.mounted && guestfs_umount_all (g) == -1)
     return -1;
 
   return r;
 }
 
 static int
-check_filesystem (guestfs_h *g, const char *mountable,
+check_filesystem (guestfs_h *g, struct probe *p,
                   const struct guestfs_internal_mountable *m,
                   int whole_device)
 {
@@ -154,23 +411,25 @@ check_filesystem (guestfs_h *g, const char *mountable,
 
   struct inspect_fs *fs = &g->fses[g->nr_fses-1];
 
-  fs->mountable = safe_strdup (g, mountable);
+  fs->mountable = safe_strdup (g, p->mountable);
 
   /* Optimize some of the tests by avoiding multiple tests of the same thing. */
-  int is_dir_etc = guestfs_is_dir (g, "/etc") > 0;
-  int is_dir_bin = guestfs_is_dir (g, "/bin") > 0;
-  int is_dir_share = guestfs_is_dir (g, "/share") > 0;
+  int is_dir_etc = is_dir (g, p, "/etc") > 0;
+  int is_dir_bin = is_dir (g, p, "/bin") > 0;
+  int is_dir_share = is_dir (g, p, "/share") > 0;
 
   /* Grub /boot? */
-  if (guestfs_is_file (g, "/grub/menu.lst") > 0 ||
-      guestfs_is_file (g, "/grub/grub.conf") > 0 ||
-      guestfs_is_file (g, "/grub2/grub.cfg") > 0)
+  if (is_file (g, p, "/grub/menu.lst") > 0 ||
+      is_file (g, p, "/grub/grub.conf") > 0 ||
+      is_file (g, p, "/grub2/grub.cfg") > 0)
     ;
   /* FreeBSD root? */
   else if (is_dir_etc &&
            is_dir_bin &&
-           guestfs_is_file (g, "/etc/freebsd-update.conf") > 0 &&
-           guestfs_is_file (g, "/etc/fstab") > 0) {
+           is_file (g, p, "/etc/freebsd-update.conf") > 0 &&
+           is_file (g, p, "/etc/fstab") > 0) {
+    if (mount_fs (g, p) == -1)
+      return 0;
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_freebsd_root (g, fs) == -1)
@@ -179,9 +438,11 @@ check_filesystem (guestfs_h *g, const char *mountable,
   /* NetBSD root? */
   else if (is_dir_etc &&
            is_dir_bin &&
-           guestfs_is_file (g, "/netbsd") > 0 &&
-           guestfs_is_file (g, "/etc/fstab") > 0 &&
-           guestfs_is_file (g, "/etc/release") > 0) {
+           is_file (g, p, "/netbsd") > 0 &&
+           is_file (g, p, "/etc/fstab") > 0 &&
+           is_file (g, p, "/etc/release") > 0) {
+    if (mount_fs (g, p) == -1)
+      return 0;
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_netbsd_root (g, fs) == -1)
@@ -190,18 +451,22 @@ check_filesystem (guestfs_h *g, const char *mountable,
   /* OpenBSD root? */
   else if (is_dir_etc &&
            is_dir_bin &&
-           guestfs_is_file (g, "/bsd") > 0 &&
-           guestfs_is_file (g, "/etc/fstab") > 0 &&
-           guestfs_is_file (g, "/etc/motd") > 0) {
+           is_file (g, p, "/bsd") > 0 &&
+           is_file (g, p, "/etc/fstab") > 0 &&
+           is_file (g, p, "/etc/motd") > 0) {
+    if (mount_fs (g, p) == -1)
+      return 0;
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_openbsd_root (g, fs) == -1)
       return -1;
   }
   /* Hurd root? */
-  else if (guestfs_is_file (g, "/hurd/console") > 0 &&
-           guestfs_is_file (g, "/hurd/hello") > 0 &&
-           guestfs_is_file (g, "/hurd/null") > 0) {
+  else if (is_file (g, p, "/hurd/console") > 0 &&
+           is_file (g, p, "/hurd/hello") > 0 &&
+           is_file (g, p, "/hurd/null") > 0) {
+    if (mount_fs (g, p) == -1)
+      return 0;
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED; /* XXX could be more specific */
     if (guestfs_int_check_hurd_root (g, fs) == -1)
@@ -210,9 +475,11 @@ check_filesystem (guestfs_h *g, const char *mountable,
   /* Minix root? */
   else if (is_dir_etc &&
            is_dir_bin &&
-           guestfs_is_file (g, "/service/vm") > 0 &&
-           guestfs_is_file (g, "/etc/fstab") > 0 &&
-           guestfs_is_file (g, "/etc/version") > 0) {
+           is_file (g, p, "/service/vm") > 0 &&
+           is_file (g, p, "/etc/fstab") > 0 &&
+           is_file (g, p, "/etc/version") > 0) {
+    if (mount_fs (g, p) == -1)
+      return 0;
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_minix_root (g, fs) == -1)
@@ -221,9 +488,11 @@ check_filesystem (guestfs_h *g, const char *mountable,
   /* Linux root? */
   else if (is_dir_etc &&
            (is_dir_bin ||
-            (guestfs_is_symlink (g, "/bin") > 0 &&
-             guestfs_is_dir (g, "/usr/bin") > 0)) &&
-           guestfs_is_file (g, "/etc/fstab") > 0) {
+            (is_symlink (g, p, "/bin") > 0 &&
+             is_dir (g, p, "/usr/bin") > 0)) &&
+           is_file (g, p, "/etc/fstab") > 0) {
+    if (mount_fs (g, p) == -1)
+      return 0;
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_linux_root (g, fs) == -1)
@@ -231,10 +500,12 @@ check_filesystem (guestfs_h *g, const char *mountable,
   }
   /* CoreOS root? */
   else if (is_dir_etc &&
-           guestfs_is_dir (g, "/root") > 0 &&
-           guestfs_is_dir (g, "/home") > 0 &&
-           guestfs_is_dir (g, "/usr") > 0 &&
-           guestfs_is_file (g, "/etc/coreos/update.conf") > 0) {
+           is_dir (g, p, "/root") > 0 &&
+           is_dir (g, p, "/home") > 0 &&
+           is_dir (g, p, "/usr") > 0 &&
+           is_file (g, p, "/etc/coreos/update.conf") > 0) {
+    if (mount_fs (g, p) == -1)
+      return 0;
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     if (guestfs_int_check_coreos_root (g, fs) == -1)
@@ -244,31 +515,34 @@ check_filesystem (guestfs_h *g, const char *mountable,
   else if (is_dir_etc &&
            is_dir_bin &&
            is_dir_share &&
-           guestfs_is_dir (g, "/local") == 0 &&
-           guestfs_is_file (g, "/etc/fstab") == 0)
+           is_dir (g, p, "/local") == 0 &&
+           is_file (g, p, "/etc/fstab") == 0)
     ;
   /* Linux /usr? */
   else if (is_dir_etc &&
            is_dir_bin &&
            is_dir_share &&
-           guestfs_is_dir (g, "/local") > 0 &&
-           guestfs_is_file (g, "/etc/fstab") == 0)
+           is_dir (g, p, "/local") > 0 &&
+           is_file (g, p, "/etc/fstab") == 0)
     ;
   /* CoreOS /usr? */
   else if (is_dir_bin &&
            is_dir_share &&
-           guestfs_is_dir (g, "/local") > 0 &&
-           guestfs_is_dir (g, "/share/coreos") > 0) {
+           is_dir (g, p, "/local") > 0 &&
+           is_dir (g, p, "/share/coreos") > 0) {
+    if (mount_fs (g, p) == -1)
+      return 0;
     if (guestfs_int_check_coreos_usr (g, fs) == -1)
       return -1;
   }
   /* Linux /var? */
-  else if (guestfs_is_dir (g, "/log") > 0 &&
-           guestfs_is_dir (g, "/run") > 0 &&
-           guestfs_is_dir (g, "/spool") > 0)
+  else if (is_dir (g, p, "/log") > 0 &&
+           is_dir (g, p, "/run") > 0 &&
+           is_dir (g, p, "/spool") > 0)
     ;
   /* Windows root? */
-  else if ((windows_systemroot = guestfs_int_get_windows_systemroot (g)) != NULL)
+  else if (maybe_windows (g, p) &&
+           (windows_systemroot = guestfs_int_get_windows_systemroot (g)) != NULL)
   {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
@@ -276,15 +550,15 @@ check_filesystem (guestfs_h *g, const char *mountable,
       return -1;
   }
   /* Windows volume with installed applications (but not root)? */
-  else if (guestfs_int_is_dir_nocase (g, "/System Volume Information") > 0 &&
-           guestfs_int_is_dir_nocase (g, "/Program Files") > 0)
+  else if (is_dir_nocase (g, p, "/System Volume Information") > 0 &&
+           is_dir_nocase (g, p, "/Program Files") > 0)
     ;
   /* Windows volume (but not root)? */
-  else if (guestfs_int_is_dir_nocase (g, "/System Volume Information") > 0)
+  else if (is_dir_nocase (g, p, "/System Volume Information") > 0)
     ;
   /* FreeDOS? */
-  else if (guestfs_int_is_dir_nocase (g, "/FDOS") > 0 &&
-           guestfs_int_is_file_nocase (g, "/FDOS/FREEDOS.BSS") > 0) {
+  else if (is_dir_nocase (g, p, "/FDOS") > 0 &&
+           is_file_nocase (g, p, "/FDOS/FREEDOS.BSS") > 0) {
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLED;
     fs->type = OS_TYPE_DOS;
@@ -304,15 +578,17 @@ check_filesystem (guestfs_h *g, const char *mountable,
    * first partition (eg. bootable USB key).
    */
   else if ((whole_device || (partnum == 1 && nr_partitions == 1)) &&
-           (guestfs_is_file (g, "/isolinux/isolinux.cfg") > 0 ||
-            guestfs_is_dir (g, "/EFI/BOOT") > 0 ||
-            guestfs_is_file (g, "/images/install.img") > 0 ||
-            guestfs_is_dir (g, "/.disk") > 0 ||
-            guestfs_is_file (g, "/.discinfo") > 0 ||
-            guestfs_is_file (g, "/i386/txtsetup.sif") > 0 ||
-            guestfs_is_file (g, "/amd64/txtsetup.sif") > 0 ||
-            guestfs_is_file (g, "/freedos/freedos.ico") > 0 ||
-            guestfs_is_file (g, "/boot/loader.rc") > 0)) {
+           (is_file (g, p, "/isolinux/isolinux.cfg") > 0 ||
+            is_dir (g, p, "/EFI/BOOT") > 0 ||
+            is_file (g, p, "/images/install.img") > 0 ||
+            is_dir (g, p, "/.disk") > 0 ||
+            is_file (g, p, "/.discinfo") > 0 ||
+            is_file (g, p, "/i386/txtsetup.sif") > 0 ||
+            is_file (g, p, "/amd64/txtsetup.sif") > 0 ||
+            is_file (g, p, "/freedos/freedos.ico") > 0 ||
+            is_file (g, p, "/boot/loader.rc") > 0)) {
+    if (mount_fs (g, p) == -1)
+      return 0;
     fs->is_root = 1;
     fs->format = OS_FORMAT_INSTALLER;
     if (guestfs_int_check_installer_root (g, fs) == -1)
@@ -49,10 +49,31 @@ char **
 guestfs_impl_inspect_os (guestfs_h *g)
 {
   CLEANUP_FREE_STRING_LIST char **fses = NULL;
+  CLEANUP_FREE_STRING_LIST char **probes = NULL;
   char **fs, **ret;
+  size_t i;
 
   /* Remove any information previously stored in the handle. */
   guestfs_int_free_inspect_info (g);
+  free (g->inspect_cache_key);
+  g->inspect_cache_key = NULL;
+
+  /* If the drives have been inspected before, the cache has the
+   * answer and we don't need to look at the filesystems at all.  This
+   * also works before the appliance has been launched.
+   */
+  if (g->inspect_cache) {
+    g->inspect_cache_key = guestfs_int_inspect_cache_key (g);
+    if (guestfs_int_inspect_cache_load (g) == 0) {
+      debug (g, "inspect_os: using cached results (%s)",
+             g->inspect_cache_key);
+      if (g->state == READY && guestfs_umount_all (g) == -1) {
+        guestfs_int_free_inspect_info (g);
+        return NULL;
+      }
+      goto out;
+    }
+  }
 
   if (guestfs_umount_all (g) == -1)
     return NULL;
@@ -64,8 +85,14 @@ guestfs_impl_inspect_os (guestfs_h *g)
   fses = guestfs_list_filesystems (g);
   if (fses == NULL) return NULL;
 
-  for (fs = fses; *fs; fs += 2) {
-    if (guestfs_int_check_for_filesystem_on (g, *fs)) {
+  /* Probe all the filesystems at once first.  This lets us skip
+   * mounting most non-root filesystems.
+   */
+  probes = guestfs_int_probe_filesystems (g, fses);
+
+  for (fs = fses, i = 0; *fs; fs += 2, ++i) {
+    if (guestfs_int_check_for_filesystem_on (g, *fs,
+                                             probes ? probes[i] : NULL)) {
       guestfs_int_free_inspect_info (g);
       return NULL;
     }
@@ -83,6 +110,9 @@ guestfs_impl_inspect_os (guestfs_h *g)
    */
   check_for_duplicated_bsd_root (g);
 
+  guestfs_int_inspect_cache_save (g);
+
+ out:
   /* At this point we have, in the handle, a list of all filesystems
    * found and data about each one.  Now we assemble the list of
    * filesystems which are root devices and return that to the user.
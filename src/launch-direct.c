@@ -42,6 +42,7 @@
 
 #include "cloexec.h"
 #include "ignore-value.h"
+#include "sha256.h"
 
 #include "guestfs.h"
 #include "guestfs-internal.h"
@@ -78,7 +79,6 @@ create_cow_overlay_direct (guestfs_h *g, void *datav, struct drive *drv)
 {
   char *overlay;
   CLEANUP_FREE char *backing_drive = NULL;
-  struct guestfs_disk_create_argv optargs;
 
   backing_drive = guestfs_int_drive_source_qemu_param (g, &drv->src);
   if (!backing_drive)
@@ -89,14 +89,8 @@ create_cow_overlay_direct (guestfs_h *g, void *datav, struct drive *drv)
 
   overlay = safe_asprintf (g, "%s/overlay%d", g->tmpdir, ++g->unique);
 
-  optargs.bitmask = GUESTFS_DISK_CREATE_BACKINGFILE_BITMASK;
-  optargs.backingfile = backing_drive;
-  if (drv->src.format) {
-    optargs.bitmask |= GUESTFS_DISK_CREATE_BACKINGFORMAT_BITMASK;
-    optargs.backingformat = drv->src.format;
-  }
-
-  if (guestfs_disk_create_argv (g, overlay, "qcow2", -1, &optargs) == -1) {
+  if (guestfs_int_create_qcow2_overlay (g, overlay, backing_drive,
+                                        drv->src.format) == -1) {
     free (overlay);
     return NULL;
   }
@@ -286,6 +280,7 @@ launch_direct (guestfs_h *g, void *datav, const char *arg)
   TRACE0 (launch_build_appliance_end);
 
   guestfs_int_launch_send_progress (g, 3);
+  guestfs_int_launch_timing (g, "appliance");
 
   if (g->verbose)
     guestfs_int_print_timestamped_message (g, "begin testing qemu features");
@@ -293,6 +288,7 @@ launch_direct (guestfs_h *g, void *datav, const char *arg)
   /* Get qemu help text and version. */
   if (qemu_supports (g, data, NULL) == -1)
     goto cleanup0;
+  guestfs_int_launch_timing (g, "qemu_probe");
 
   /* Using virtio-serial, we need to create a local Unix domain socket
    * for qemu to connect to.
@@ -626,6 +622,18 @@ launch_direct (guestfs_h *g, void *datav, const char *arg)
     ADD_CMDLINE (VIRTIO_NET ",netdev=usernet");
   }
 
+  /* Memory balloon with free page reporting (qemu >= 5.1), so that
+   * memory which the idle appliance frees is returned to the host
+   * (see daemon/balloon.c).  There is no monitor to inflate the
+   * balloon with, so without free page reporting it is not added.
+   */
+  if ((data->qemu_version_major > 5 ||
+       (data->qemu_version_major == 5 && data->qemu_version_minor >= 1)) &&
+      qemu_supports_device (g, data, VIRTIO_BALLOON)) {
+    ADD_CMDLINE ("-device");
+    ADD_CMDLINE (VIRTIO_BALLOON ",free-page-reporting=on");
+  }
+
   ADD_CMDLINE ("-append");
   flags = 0;
   if (!has_kvm || force_tcg)
@@ -726,6 +734,7 @@ launch_direct (guestfs_h *g, void *datav, const char *arg)
 
   /* Parent (library). */
   data->pid = r;
+  guestfs_int_launch_timing (g, "qemu_exec");
 
   /* Fork the recovery process off which will kill qemu if the parent
    * process fails to do so (eg. if the parent segfaults).
@@ -954,6 +963,8 @@ print_qemu_command_line (guestfs_h *g, char **argv)
 
 static void parse_qemu_version (guestfs_h *g, struct backend_direct_data *data);
 static void read_all (guestfs_h *g, void *retv, const char *buf, size_t len);
+static int read_qemu_cache (guestfs_h *g, struct backend_direct_data *data);
+static void write_qemu_cache (guestfs_h *g, struct backend_direct_data *data);
 
 /* Test qemu binary (or wrapper) runs, and do 'qemu -help' and
  * 'qemu -version' so we know what options this qemu supports and
@@ -974,6 +985,11 @@ test_qemu (guestfs_h *g, struct backend_direct_data *data)
   free (data->qemu_devices);
   data->qemu_devices = NULL;
 
+  if (read_qemu_cache (g, data) == 0) {
+    parse_qemu_version (g, data);
+    return 0;
+  }
+
   guestfs_int_cmd_add_arg (cmd1, g->hv);
   guestfs_int_cmd_add_arg (cmd1, "-display");
   guestfs_int_cmd_add_arg (cmd1, "none");
@@ -1015,6 +1031,8 @@ test_qemu (guestfs_h *g, struct backend_direct_data *data)
   if (r == -1 || !WIFEXITED (r) || WEXITSTATUS (r) != 0)
     goto error;
 
+  write_qemu_cache (g, data);
+
   return 0;
 
  error:
@@ -1025,6 +1043,175 @@ test_qemu (guestfs_h *g, struct backend_direct_data *data)
   return -1;
 }
 
+/* The output of test_qemu is cached in
+ * $cachedir/.guestfs-$UID/qemu.d/HASH, where HASH is the SHA-256 of
+ * the qemu binary path.  The file starts with the libguestfs version
+ * and the size, mtime, ctime and inode of the qemu binary, so the
+ * cache is invalidated when either of them changes.  Then follow the
+ * three outputs, each as a line "LENGTH" (-1 for NULL) and the bytes.
+ */
+#define QEMU_CACHE_MAGIC "libguestfs qemu cache 1 " PACKAGE_VERSION
+
+static char *
+qemu_cache_file (guestfs_h *g, char **stamp_r)
+{
+  CLEANUP_FREE char *dir = NULL;
+  struct sha256_ctx ctx;
+  unsigned char digest[32];
+  char hash[2 * sizeof digest + 1];
+  struct stat statbuf;
+  size_t i;
+
+  /* A relative name would be looked up in $PATH when qemu is run. */
+  if (g->hv[0] != '/' || stat (g->hv, &statbuf) == -1)
+    return NULL;
+
+  dir = guestfs_int_make_cache_subdir (g, "qemu.d", 0755);
+  if (dir == NULL)
+    return NULL;
+
+  sha256_init_ctx (&ctx);
+  sha256_process_bytes (g->hv, strlen (g->hv), &ctx);
+  sha256_finish_ctx (&ctx, digest);
+  for (i = 0; i < sizeof digest; ++i)
+    sprintf (&hash[2*i], "%02x", digest[i]);
+
+  *stamp_r = safe_asprintf (g, "%s\n%s\n%" PRIi64 " %" PRIi64 " %" PRIi64
+                            " %" PRIu64 "\n",
+                            QEMU_CACHE_MAGIC, g->hv,
+                            (int64_t) statbuf.st_size,
+                            (int64_t) statbuf.st_mtime,
+                            (int64_t) statbuf.st_ctime,
+                            (uint64_t) statbuf.st_ino);
+  return safe_asprintf (g, "%s/%s", dir, hash);
+}
+
+static char *
+read_qemu_cache_string (guestfs_h *g, FILE *fp, int *err)
+{
+  int64_t len;
+  char *str;
+
+  if (*err)
+    return NULL;
+  if (fscanf (fp, "%" SCNi64, &len) != 1 || fgetc (fp) != '\n' ||
+      len < -1 || len > 16 * 1024 * 1024) {
+    *err = 1;
+    return NULL;
+  }
+  if (len == -1)
+    return NULL;
+
+  str = safe_malloc (g, len + 1);
+  if (fread (str, 1, len, fp) != (size_t) len) {
+    free (str);
+    *err = 1;
+    return NULL;
+  }
+  str[len] = '\0';
+  return str;
+}
+
+/* Returns 0 if the cached outputs were loaded into 'data', or -1 if
+ * the cache is missing or stale (this is not an error).
+ */
+static int
+read_qemu_cache (guestfs_h *g, struct backend_direct_data *data)
+{
+  CLEANUP_FREE char *stamp = NULL, *path = NULL, *buf = NULL;
+  FILE *fp;
+  size_t len;
+  int err = 0;
+
+  path = qemu_cache_file (g, &stamp);
+  if (path == NULL)
+    return -1;
+
+  fp = fopen (path, "re");
+  if (fp == NULL)
+    return -1;
+
+  len = strlen (stamp);
+  buf = safe_malloc (g, len);
+  if (fread (buf, 1, len, fp) != len || memcmp (buf, stamp, len) != 0) {
+    debug (g, "qemu cache: %s is stale", path);
+    fclose (fp);
+    return -1;
+  }
+
+  data->qemu_help = read_qemu_cache_string (g, fp, &err);
+  data->qemu_version = read_qemu_cache_string (g, fp, &err);
+  data->qemu_devices = read_qemu_cache_string (g, fp, &err);
+  fclose (fp);
+
+  if (err || data->qemu_help == NULL || data->qemu_devices == NULL) {
+    debug (g, "qemu cache: ignoring corrupt cache file %s", path);
+    free (data->qemu_help);
+    data->qemu_help = NULL;
+    free (data->qemu_version);
+    data->qemu_version = NULL;
+    free (data->qemu_devices);
+    data->qemu_devices = NULL;
+    return -1;
+  }
+
+  debug (g, "qemu cache: using cached qemu capabilities from %s", path);
+  return 0;
+}
+
+static void
+write_qemu_cache_string (FILE *fp, const char *str)
+{
+  if (str == NULL)
+    fputs ("-1\n", fp);
+  else {
+    fprintf (fp, "%zu\n", strlen (str));
+    fputs (str, fp);
+  }
+}
+
+/* Save the outputs in 'data' to the cache.  Errors are ignored, since
+ * the cache is only an optimization.
+ */
+static void
+write_qemu_cache (guestfs_h *g, struct backend_direct_data *data)
+{
+  CLEANUP_FREE char *stamp = NULL, *path = NULL, *tmp = NULL;
+  FILE *fp;
+  int fd, r;
+
+  path = qemu_cache_file (g, &stamp);
+  if (path == NULL)
+    return;
+
+  tmp = safe_asprintf (g, "%s.XXXXXX", path);
+  fd = mkstemp (tmp);
+  if (fd == -1) {
+    debug (g, "qemu cache: mkstemp: %s: %m", tmp);
+    return;
+  }
+  fp = fdopen (fd, "w");
+  if (fp == NULL) {
+    debug (g, "qemu cache: fdopen: %m");
+    close (fd);
+    unlink (tmp);
+    return;
+  }
+
+  fputs (stamp, fp);
+  write_qemu_cache_string (fp, data->qemu_help);
+  write_qemu_cache_string (fp, data->qemu_version);
+  write_qemu_cache_string (fp, data->qemu_devices);
+
+  r = ferror (fp);
+  if (fclose (fp) == EOF)
+    r = -1;
+  if (r != 0 || rename (tmp, path) == -1) {
+    debug (g, "qemu cache: could not write %s: %m", path);
+    unlink (tmp);
+  }
+}
+
 /* Parse data->qemu_version (if not NULL) into the major and minor
  * version of qemu, but don't fail if parsing is not possible.
  */
@@ -1523,6 +1710,19 @@ get_pid_direct (guestfs_h *g, void *datav)
   }
 }
 
+static int64_t
+get_rss_direct (guestfs_h *g, void *datav)
+{
+  struct backend_direct_data *data = datav;
+
+  if (data->pid <= 0) {
+    error (g, "get_appliance_rss: no qemu subprocess");
+    return -1;
+  }
+
+  return guestfs_int_get_process_rss (g, data->pid);
+}
+
 /* Maximum number of disks. */
 static int
 max_disks_direct (guestfs_h *g, void *datav)
@@ -1542,6 +1742,7 @@ static struct backend_ops backend_direct_ops = {
   .shutdown = shutdown_direct,
   .get_pid = get_pid_direct,
   .max_disks = max_disks_direct,
+  .get_rss = get_rss_direct,
 };
 
 void
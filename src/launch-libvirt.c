@@ -143,6 +143,7 @@ struct backend_libvirt_data {
   char *network_bridge;
   char name[DOMAIN_NAME_LEN];   /* random name */
   bool is_kvm;                  /* false = qemu, true = kvm (from capabilities)*/
+  unsigned long libvirt_version; /* libvirt version */
   unsigned long qemu_version;   /* qemu version (from libvirt) */
   struct secret *secrets;       /* list of secrets */
   size_t nr_secrets;
@@ -191,21 +192,14 @@ make_qcow2_overlay (guestfs_h *g, const char *backing_drive,
                     const char *format)
 {
   char *overlay;
-  struct guestfs_disk_create_argv optargs;
 
   if (guestfs_int_lazy_make_tmpdir (g) == -1)
     return NULL;
 
   overlay = safe_asprintf (g, "%s/overlay%d", g->tmpdir, ++g->unique);
 
-  optargs.bitmask = GUESTFS_DISK_CREATE_BACKINGFILE_BITMASK;
-  optargs.backingfile = backing_drive;
-  if (format) {
-    optargs.bitmask |= GUESTFS_DISK_CREATE_BACKINGFORMAT_BITMASK;
-    optargs.backingformat = format;
-  }
-
-  if (guestfs_disk_create_argv (g, overlay, "qcow2", -1, &optargs) == -1) {
+  if (guestfs_int_create_qcow2_overlay (g, overlay, backing_drive,
+                                        format) == -1) {
     free (overlay);
     return NULL;
   }
@@ -298,6 +292,7 @@ launch_libvirt (guestfs_h *g, void *datav, const char *libvirt_uri)
            MIN_LIBVIRT_MAJOR, MIN_LIBVIRT_MINOR, MIN_LIBVIRT_MICRO);
     return -1;
   }
+  data->libvirt_version = version;
 
   guestfs_int_launch_send_progress (g, 0);
   TRACE0 (launch_libvirt_start);
@@ -370,6 +365,7 @@ launch_libvirt (guestfs_h *g, void *datav, const char *libvirt_uri)
 
   if (parse_capabilities (g, capabilities_xml, data) == -1)
     goto cleanup;
+  guestfs_int_launch_timing (g, "qemu_probe");
 
   /* UEFI code and variables, on architectures where that is required. */
   if (guestfs_int_get_uefi (g, &data->uefi_code, &data->uefi_vars) == -1)
@@ -405,6 +401,7 @@ launch_libvirt (guestfs_h *g, void *datav, const char *libvirt_uri)
 
   guestfs_int_launch_send_progress (g, 3);
   TRACE0 (launch_build_libvirt_appliance_end);
+  guestfs_int_launch_timing (g, "appliance");
 
   /* Note that appliance can be NULL if using the old-style appliance. */
   if (appliance) {
@@ -414,6 +411,7 @@ launch_libvirt (guestfs_h *g, void *datav, const char *libvirt_uri)
   }
 
   TRACE0 (launch_build_libvirt_qcow2_overlay_end);
+  guestfs_int_launch_timing (g, "overlay");
 
   /* Using virtio-serial, we need to create a local Unix domain socket
    * for qemu to connect to.
@@ -561,6 +559,7 @@ launch_libvirt (guestfs_h *g, void *datav, const char *libvirt_uri)
   }
 
   g->state = LAUNCHING;
+  guestfs_int_launch_timing (g, "qemu_exec");
 
   /* Wait for console socket to be opened (by qemu). */
   r = accept4 (console_sock, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
@@ -1345,6 +1344,17 @@ construct_libvirt_xml_devices (guestfs_h *g,
       } end_element ();
     }
 
+    /* Memory balloon.  With free page reporting (libvirt >= 6.9,
+     * qemu >= 5.1), memory which the idle appliance frees is returned
+     * to the host (see daemon/balloon.c).
+     */
+    start_element ("memballoon") {
+      attribute ("model", "virtio");
+      if (params->data->libvirt_version >= 6009000 &&
+          params->data->qemu_version >= 5001000)
+        attribute ("freePageReporting", "on");
+    } end_element ();
+
   } end_element (); /* </devices> */
 
   return 0;
@@ -2129,6 +2139,34 @@ max_disks_libvirt (guestfs_h *g, void *datav)
   return 255;
 }
 
+/* The RSS of the qemu process, which libvirt reports in kilobytes. */
+static int64_t
+get_rss_libvirt (guestfs_h *g, void *datav)
+{
+  struct backend_libvirt_data *data = datav;
+  virDomainMemoryStatStruct stats[VIR_DOMAIN_MEMORY_STAT_NR];
+  int i, n;
+
+  if (!data->dom) {
+    error (g, "%s: dom == NULL", __func__);
+    return -1;
+  }
+
+  n = virDomainMemoryStats (data->dom, stats, VIR_DOMAIN_MEMORY_STAT_NR, 0);
+  if (n == -1) {
+    libvirt_error (g, _("could not get memory statistics of libvirt domain"));
+    return -1;
+  }
+
+  for (i = 0; i < n; ++i) {
+    if (stats[i].tag == VIR_DOMAIN_MEMORY_STAT_RSS)
+      return (int64_t) stats[i].val * 1024;
+  }
+
+  NOT_SUPPORTED (g, -1,
+                 _("libvirt did not report the RSS of the appliance"));
+}
+
 static xmlChar *construct_libvirt_xml_hot_add_disk (guestfs_h *g, const struct backend_libvirt_data *data, struct drive *drv, size_t drv_index);
 
 /* Hot-add a drive.  Note the appliance is up when this is called. */
@@ -2258,6 +2296,7 @@ static struct backend_ops backend_libvirt_ops = {
   .launch = launch_libvirt,
   .shutdown = shutdown_libvirt,
   .max_disks = max_disks_libvirt,
+  .get_rss = get_rss_libvirt,
   .hot_add_drive = hot_add_drive_libvirt,
   .hot_remove_drive = hot_remove_drive_libvirt,
 };
@@ -0,0 +1,406 @@
+/* libguestfs
+ * Copyright (C) 2015 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* Pool of pre-launched appliances (see guestfs_set_launch_pool).
+ *
+ * The pool is shared by all handles in the process.  Each entry is a
+ * private handle which has been launched with no drives, and the
+ * configuration it was launched with (as a string, the "key").  When
+ * a handle with the same configuration and no drives is launched, it
+ * takes over the running appliance from the private handle.  The
+ * private handle is kept until the appliance is shut down, since it
+ * owns the temporary files (eg. the appliance overlay).
+ *
+ * Handles which have drives are launched in the normal way.  The
+ * appliance drive of a pooled appliance is the first disk, so their
+ * drives would get different device names depending on whether the
+ * pool had an appliance ready.  Drives hot-added after launch get
+ * the same names either way.
+ *
+ * Appliances are launched by background threads, so the pool is
+ * refilled while the handle which emptied it is being used.  Entries
+ * whose appliance is still being launched have h == NULL.
+ *
+ * Since this relies on hotplugging, it only works with backends which
+ * support it (at present only libvirt).
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "guestfs.h"
+#include "guestfs-internal.h"
+#include "guestfs-internal-actions.h"
+
+/* The settings which are copied to the pool handles. */
+struct pool_config {
+  char *key;
+  char *backend;
+  char **backend_settings;
+  char *hv;
+  char *path;
+  char *append;
+  char *tmpdir;
+  char *cachedir;
+  int memsize;
+  int smp;
+  bool enable_network;
+  bool selinux;
+};
+
+struct pool_entry {
+  struct pool_entry *next;
+  struct pool_config *config;
+  guestfs_h *h;                 /* NULL while launching. */
+};
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static struct pool_entry *pool = NULL;
+static size_t nr_launching = 0;
+static bool atexit_handler_set = false;
+static bool exiting = false;
+
+static void
+free_config (struct pool_config *config)
+{
+  if (config == NULL)
+    return;
+
+  free (config->key);
+  free (config->backend);
+  guestfs_int_free_string_list (config->backend_settings);
+  free (config->hv);
+  free (config->path);
+  free (config->append);
+  free (config->tmpdir);
+  free (config->cachedir);
+  free (config);
+}
+
+static struct pool_config *
+make_config (guestfs_h *g)
+{
+  struct pool_config *config;
+  CLEANUP_FREE char *settings = NULL;
+
+  config = safe_calloc (g, 1, sizeof *config);
+  config->backend = safe_strdup (g, g->backend);
+  config->backend_settings =
+    g->backend_settings ? guestfs_int_copy_string_list (g->backend_settings)
+    : safe_calloc (g, 1, sizeof (char *));
+  config->hv = safe_strdup (g, g->hv);
+  config->path = safe_strdup (g, g->path);
+  config->append = g->append ? safe_strdup (g, g->append) : NULL;
+  config->tmpdir = guestfs_get_tmpdir (g);
+  config->cachedir = guestfs_get_cachedir (g);
+  config->memsize = g->memsize;
+  config->smp = g->smp;
+  config->enable_network = g->enable_network;
+  config->selinux = g->selinux;
+
+  settings = guestfs_int_join_strings ("\n", config->backend_settings);
+  config->key = safe_asprintf (g, "%s\n%s\n%s\n%s\n%s\n%s\n%s\n%d %d %d %d",
+                               config->backend, settings,
+                               config->hv, config->path,
+                               config->append ? config->append : "",
+                               config->tmpdir, config->cachedir,
+                               config->memsize, config->smp,
+                               (int) config->enable_network,
+                               (int) config->selinux);
+  return config;
+}
+
+static struct pool_config *
+copy_config (guestfs_h *g, const struct pool_config *config)
+{
+  struct pool_config *ret;
+
+  ret = safe_malloc (g, sizeof *ret);
+  *ret = *config;
+  ret->key = safe_strdup (g, config->key);
+  ret->backend = safe_strdup (g, config->backend);
+  ret->backend_settings =
+    guestfs_int_copy_string_list (config->backend_settings);
+  ret->hv = safe_strdup (g, config->hv);
+  ret->path = safe_strdup (g, config->path);
+  ret->append = config->append ? safe_strdup (g, config->append) : NULL;
+  ret->tmpdir = safe_strdup (g, config->tmpdir);
+  ret->cachedir = safe_strdup (g, config->cachedir);
+  return ret;
+}
+
+/* Create and launch a pool handle.  Runs in a background thread, so
+ * errors are not reported anywhere: a NULL return just means this
+ * pool entry is lost.
+ */
+static guestfs_h *
+launch_pool_handle (const struct pool_config *config)
+{
+  guestfs_h *h;
+
+  h = guestfs_create_flags (GUESTFS_CREATE_NO_ENVIRONMENT |
+                            GUESTFS_CREATE_NO_CLOSE_ON_EXIT);
+  if (h == NULL)
+    return NULL;
+
+  guestfs_set_error_handler (h, NULL, NULL);
+
+  if (guestfs_set_backend (h, config->backend) == -1 ||
+      guestfs_set_backend_settings (h, config->backend_settings) == -1 ||
+      guestfs_set_hv (h, config->hv) == -1 ||
+      guestfs_set_path (h, config->path) == -1 ||
+      guestfs_set_append (h, config->append) == -1 ||
+      guestfs_set_tmpdir (h, config->tmpdir) == -1 ||
+      guestfs_set_cachedir (h, config->cachedir) == -1 ||
+      guestfs_set_memsize (h, config->memsize) == -1 ||
+      guestfs_set_smp (h, config->smp) == -1 ||
+      guestfs_set_network (h, config->enable_network) == -1)
+    goto error;
+  h->selinux = config->selinux;
+
+  if (guestfs_launch (h) == -1)
+    goto error;
+
+  return h;
+
+ error:
+  guestfs_close (h);
+  return NULL;
+}
+
+static void
+remove_entry (struct pool_entry *entry)
+{
+  struct pool_entry **pp;
+
+  for (pp = &pool; *pp != NULL; pp = &(*pp)->next) {
+    if (*pp == entry) {
+      *pp = entry->next;
+      break;
+    }
+  }
+  free_config (entry->config);
+  free (entry);
+}
+
+static void *
+launch_thread (void *entryv)
+{
+  struct pool_entry *entry = entryv;
+  guestfs_h *h;
+
+  h = launch_pool_handle (entry->config);
+
+  pthread_mutex_lock (&pool_lock);
+  if (h != NULL && exiting) {
+    /* The program is exiting, so throw the appliance away again.  The
+     * atexit handler waits for us.
+     */
+    pthread_mutex_unlock (&pool_lock);
+    guestfs_close (h);
+    h = NULL;
+    pthread_mutex_lock (&pool_lock);
+  }
+  if (h != NULL)
+    entry->h = h;
+  else
+    remove_entry (entry);
+  nr_launching--;
+  pthread_cond_broadcast (&pool_cond);
+  pthread_mutex_unlock (&pool_lock);
+
+  return NULL;
+}
+
+/* Start a background launch.  Called with pool_lock held. */
+static void
+start_launch (guestfs_h *g, const struct pool_config *config)
+{
+  struct pool_entry *entry;
+  pthread_attr_t attr;
+  pthread_t thread;
+  int err;
+
+  entry = safe_calloc (g, 1, sizeof *entry);
+  entry->config = copy_config (g, config);
+  entry->next = pool;
+  pool = entry;
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  err = pthread_create (&thread, &attr, launch_thread, entry);
+  pthread_attr_destroy (&attr);
+  if (err != 0) {
+    debug (g, "launch pool: pthread_create: %s", strerror (err));
+    remove_entry (entry);
+    return;
+  }
+  nr_launching++;
+}
+
+/* Wait for background launches to finish and shut down the unused
+ * appliances when the program exits.  This is registered after the
+ * atexit handler in handle.c, so it runs first.
+ */
+static void
+close_pool (void)
+{
+  struct pool_entry *entries;
+
+  pthread_mutex_lock (&pool_lock);
+  exiting = true;
+  while (nr_launching > 0)
+    pthread_cond_wait (&pool_cond, &pool_lock);
+  entries = pool;
+  pool = NULL;
+  pthread_mutex_unlock (&pool_lock);
+
+  while (entries != NULL) {
+    struct pool_entry *next = entries->next;
+
+    guestfs_close (entries->h);
+    free_config (entries->config);
+    free (entries);
+    entries = next;
+  }
+}
+
+/* Take over the running appliance in 'h'. */
+static void
+adopt_appliance (guestfs_h *g, guestfs_h *h)
+{
+  void *data;
+
+  debug (g, "launch pool: using pre-launched appliance from handle %p", h);
+
+  data = g->backend_data;
+  g->backend_data = h->backend_data;
+  h->backend_data = data;
+
+  g->conn = h->conn;
+  h->conn = NULL;
+  g->msg_next_serial = h->msg_next_serial;
+  g->chunk_size = h->chunk_size;
+  g->sparse_transfers = h->sparse_transfers;
+
+  /* This contains the slot used by the appliance drive.  'g' has no
+   * drives (see guestfs_int_launch_from_pool).
+   */
+  free (g->drives);
+  g->drives = h->drives;
+  g->nr_drives = h->nr_drives;
+  h->drives = NULL;
+  h->nr_drives = 0;
+
+  h->state = CONFIG;
+  g->state = READY;
+  g->pool_donor = h;
+
+  guestfs_int_launch_timing (g, "pool");
+  guestfs_int_call_callbacks_void (g, GUESTFS_EVENT_LAUNCH_DONE);
+}
+
+/* Called from guestfs_launch when the launch pool is enabled.
+ * Returns 0 if the handle now has a running appliance, or 1 if the
+ * pool could not be used and the caller should launch a new
+ * appliance as usual.  If the handle could use the pool, the pool is
+ * refilled in the background.
+ */
+int
+guestfs_int_launch_from_pool (guestfs_h *g)
+{
+  struct pool_config *config;
+  struct pool_entry *entry;
+  guestfs_h *h = NULL;
+  size_t count;
+
+  if (!g->backend_ops->hot_add_drive) {
+    debug (g, "launch pool: the %s backend does not support hotplugging",
+           g->backend);
+    return 1;
+  }
+  if (g->hv_params != NULL) {
+    debug (g, "launch pool: not used because of guestfs_config parameters");
+    return 1;
+  }
+  if (g->verbose) {
+    debug (g, "launch pool: not used in verbose mode");
+    return 1;
+  }
+  if (g->nr_drives > 0) {
+    debug (g, "launch pool: not used because drives were added before launch");
+    return 1;
+  }
+
+  config = make_config (g);
+
+  pthread_mutex_lock (&pool_lock);
+
+  if (!atexit_handler_set) {
+    atexit (close_pool);
+    atexit_handler_set = true;
+  }
+
+  /* Take a launched appliance if there is one.  If there are only
+   * appliances still being launched, wait for the first of them,
+   * since it has a head start over launching a new one.
+   */
+  for (;;) {
+    bool launching = false;
+
+    for (entry = pool; entry != NULL; entry = entry->next) {
+      if (STRNEQ (entry->config->key, config->key))
+        continue;
+      if (entry->h != NULL) {
+        h = entry->h;
+        remove_entry (entry);
+        break;
+      }
+      launching = true;
+    }
+    if (h != NULL || !launching)
+      break;
+    pthread_cond_wait (&pool_cond, &pool_lock);
+  }
+
+  /* Refill the pool. */
+  count = 0;
+  for (entry = pool; entry != NULL; entry = entry->next)
+    if (STREQ (entry->config->key, config->key))
+      count++;
+  for (; count < (size_t) g->launch_pool; ++count)
+    start_launch (g, config);
+
+  pthread_mutex_unlock (&pool_lock);
+
+  free_config (config);
+
+  if (h == NULL) {
+    debug (g, "launch pool: no appliance available yet");
+    return 1;
+  }
+
+  adopt_appliance (g, h);
+  return 0;
+}
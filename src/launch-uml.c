@@ -588,6 +588,19 @@ get_pid_uml (guestfs_h *g, void *datav)
   }
 }
 
+static int64_t
+get_rss_uml (guestfs_h *g, void *datav)
+{
+  struct backend_uml_data *data = datav;
+
+  if (data->pid <= 0) {
+    error (g, "get_appliance_rss: no vmlinux subprocess");
+    return -1;
+  }
+
+  return guestfs_int_get_process_rss (g, data->pid);
+}
+
 /* UML appears to use a single major, and puts ubda at minor 0 with
  * each partition at minors 1-15, ubdb at minor 16, etc.  So the
  * maximum is 256/16 = 16.  However one disk is used by the appliance,
@@ -607,6 +620,7 @@ static struct backend_ops backend_uml_ops = {
   .shutdown = shutdown_uml,
   .get_pid = get_pid_uml,
   .max_disks = max_disks_uml,
+  .get_rss = get_rss_uml,
 };
 
 void
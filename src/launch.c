@@ -44,10 +44,14 @@ static struct backend {
 } *backends = NULL;
 
 static mode_t get_umask (guestfs_h *g);
+static void negotiate_chunk_size (guestfs_h *g);
+static void negotiate_sparse_transfers (guestfs_h *g);
 
 int
 guestfs_impl_launch (guestfs_h *g)
 {
+  int r;
+
   /* Configured? */
   if (g->state != CONFIG) {
     error (g, _("the libguestfs handle has already been launched"));
@@ -58,6 +62,13 @@ guestfs_impl_launch (guestfs_h *g)
   gettimeofday (&g->launch_t, NULL);
   TRACE0 (launch_start);
 
+  free (g->launch_timings);
+  g->launch_timings = safe_malloc (g, sizeof (struct launch_timing));
+  g->launch_timings[0].phase = NULL;
+  g->launch_timings[0].t = g->launch_t;
+  g->nr_launch_timings = 1;
+  g->launch_log_tail_len = 0;
+
   /* Make the temporary directory. */
   if (guestfs_int_lazy_make_tmpdir (g) == -1)
     return -1;
@@ -69,6 +80,11 @@ guestfs_impl_launch (guestfs_h *g)
   if (chmod (g->tmpdir, 0755) == -1)
     warning (g, "chmod: %s: %m (ignored)", g->tmpdir);
 
+  /* Any overlays kept from before the last shutdown which weren't
+   * used for the drives added since then are no longer needed.
+   */
+  guestfs_int_free_spare_overlays (g);
+
   /* Some common debugging information. */
   if (g->verbose) {
     CLEANUP_FREE_VERSION struct guestfs_version *v =
@@ -89,13 +105,170 @@ guestfs_impl_launch (guestfs_h *g)
     debug (g, "launch: euid=%d", geteuid ());
   }
 
+  /* Size the appliance for the workload and drives. */
+  guestfs_int_plan_resources (g);
+
+  /* Use a pre-launched appliance if there is one. */
+  if (g->launch_pool > 0) {
+    if (guestfs_int_launch_from_pool (g) == 0)
+      return 0;
+  }
+
+  /* Until we have talked to the daemon, only use the chunk size
+   * which every daemon understands.
+   */
+  g->chunk_size = GUESTFS_DEFAULT_CHUNK_SIZE;
+  g->sparse_transfers = 0;
+
   /* Launch the appliance. */
-  if (g->backend_ops->launch (g, g->backend_data, g->backend_arg) == -1)
+  r = g->backend_ops->launch (g, g->backend_data, g->backend_arg);
+  guestfs_int_unlock_appliance (g);
+  if (r == -1)
     return -1;
 
+  negotiate_chunk_size (g);
+  negotiate_sparse_transfers (g);
+  guestfs_int_launch_timing (g, "negotiate");
+
   return 0;
 }
 
+/* Ask the daemon to use larger file transfer chunks.  Uploads and
+ * downloads are split into chunks, and each chunk costs an XDR
+ * encode/decode and at least one round of reads and writes on both
+ * sides, so larger chunks greatly improve throughput.
+ *
+ * Old daemons don't implement internal_set_chunk_size.  In that case
+ * the call fails (silently) and we keep using the default size.
+ *
+ * The "chunk_size" backend setting can be used to request a smaller
+ * size, which is mainly useful for benchmarking.
+ */
+static void
+negotiate_chunk_size (guestfs_h *g)
+{
+  CLEANUP_FREE char *setting = NULL;
+  int wanted = GUESTFS_MAX_CHUNK_SIZE;
+  int r;
+
+  guestfs_push_error_handler (g, NULL, NULL);
+  setting = guestfs_get_backend_setting (g, "chunk_size");
+  guestfs_pop_error_handler (g);
+
+  if (setting) {
+    if (sscanf (setting, "%d", &wanted) != 1 ||
+        wanted < GUESTFS_DEFAULT_CHUNK_SIZE ||
+        wanted > GUESTFS_MAX_CHUNK_SIZE) {
+      warning (g, _("chunk_size=%s: invalid chunk size, using the default"),
+               setting);
+      wanted = GUESTFS_MAX_CHUNK_SIZE;
+    }
+  }
+
+  if (wanted == GUESTFS_DEFAULT_CHUNK_SIZE)
+    return;
+
+  guestfs_push_error_handler (g, NULL, NULL);
+  r = guestfs_internal_set_chunk_size (g, wanted);
+  guestfs_pop_error_handler (g);
+
+  if (r == -1) {
+    debug (g, "daemon does not support chunk size negotiation, "
+           "using %d byte chunks", GUESTFS_DEFAULT_CHUNK_SIZE);
+    return;
+  }
+
+  /* The daemon must never pick a larger chunk size than we asked for. */
+  if (r < GUESTFS_DEFAULT_CHUNK_SIZE || r > wanted) {
+    warning (g, _("daemon returned invalid chunk size %d, ignored"), r);
+    return;
+  }
+
+  g->chunk_size = r;
+  debug (g, "file transfer chunk size is %zu bytes", g->chunk_size);
+}
+
+/* Tell the daemon that we understand hole chunks, so that holes and
+ * runs of zeroes in downloaded files and devices don't have to be
+ * sent over the wire as data.  Once the daemon has agreed, we also
+ * send holes in local files when uploading.
+ *
+ * Old daemons don't implement internal_set_sparse_transfers, and
+ * then all data is sent in full as before.
+ */
+static void
+negotiate_sparse_transfers (guestfs_h *g)
+{
+  int r;
+
+  guestfs_push_error_handler (g, NULL, NULL);
+  r = guestfs_internal_set_sparse_transfers (g);
+  guestfs_pop_error_handler (g);
+
+  if (r == -1) {
+    debug (g, "daemon does not support sparse file transfers");
+    return;
+  }
+
+  g->sparse_transfers = 1;
+}
+
+/* Record that the launch phase 'phase' has just finished.  Each
+ * phase starts where the previous one finished, so together they
+ * cover the whole launch.  'phase' must be a static string.  Phases
+ * which have already been recorded in this launch are ignored, which
+ * makes it safe to call this from places (like the console log
+ * callback) which can see the same event twice.
+ */
+void
+guestfs_int_launch_timing (guestfs_h *g, const char *phase)
+{
+  size_t i;
+
+  if (g->nr_launch_timings == 0) /* not launching */
+    return;
+
+  for (i = 1; i < g->nr_launch_timings; ++i)
+    if (STREQ (g->launch_timings[i].phase, phase))
+      return;
+
+  g->launch_timings =
+    safe_realloc (g, g->launch_timings,
+                  (g->nr_launch_timings + 1) * sizeof (struct launch_timing));
+  g->launch_timings[g->nr_launch_timings].phase = phase;
+  gettimeofday (&g->launch_timings[g->nr_launch_timings].t, NULL);
+  g->nr_launch_timings++;
+
+  if (g->verbose)
+    guestfs_int_print_timestamped_message (g, "launch phase finished: %s",
+                                           phase);
+}
+
+struct guestfs_launch_timing_list *
+guestfs_impl_get_launch_timings (guestfs_h *g)
+{
+  struct guestfs_launch_timing_list *ret;
+  size_t i;
+
+  ret = safe_malloc (g, sizeof *ret);
+  ret->len = g->nr_launch_timings > 0 ? g->nr_launch_timings - 1 : 0;
+  ret->val = safe_calloc (g, ret->len > 0 ? ret->len : 1,
+                          sizeof (struct guestfs_launch_timing));
+
+  for (i = 0; i < ret->len; ++i) {
+    const struct launch_timing *prev = &g->launch_timings[i];
+    const struct launch_timing *lt = &g->launch_timings[i+1];
+
+    ret->val[i].lt_phase = safe_strdup (g, lt->phase);
+    ret->val[i].lt_start =
+      guestfs_int_timeval_diff (&g->launch_timings[0].t, &prev->t) * 1000;
+    ret->val[i].lt_duration =
+      guestfs_int_timeval_diff (&prev->t, &lt->t) * 1000;
+  }
+
+  return ret;
+}
+
 /* launch (of the appliance) generates approximate progress
  * messages.  Currently these are defined as follows:
  *
@@ -180,6 +353,48 @@ guestfs_impl_get_pid (guestfs_h *g)
   return g->backend_ops->get_pid (g, g->backend_data);
 }
 
+int64_t
+guestfs_impl_get_appliance_rss (guestfs_h *g)
+{
+  if (g->state != READY || g->backend_ops == NULL) {
+    error (g, _("get-appliance-rss can only be called after launch"));
+    return -1;
+  }
+
+  if (g->backend_ops->get_rss == NULL)
+    NOT_SUPPORTED (g, -1,
+                   _("the current backend does not support 'get-appliance-rss'"));
+
+  return g->backend_ops->get_rss (g, g->backend_data);
+}
+
+/* Resident set size in bytes of a process on the host, for backends
+ * which run the hypervisor as a subprocess.
+ */
+int64_t
+guestfs_int_get_process_rss (guestfs_h *g, pid_t pid)
+{
+  CLEANUP_FREE char *filename = NULL;
+  FILE *fp;
+  long size, resident;
+  int r;
+
+  filename = safe_asprintf (g, "/proc/%d/statm", (int) pid);
+  fp = fopen (filename, "re");
+  if (fp == NULL) {
+    perrorf (g, "%s", filename);
+    return -1;
+  }
+  r = fscanf (fp, "%ld %ld", &size, &resident);
+  fclose (fp);
+  if (r != 2) {
+    error (g, _("%s: could not parse the file"), filename);
+    return -1;
+  }
+
+  return (int64_t) resident * sysconf (_SC_PAGESIZE);
+}
+
 /* Maximum number of disks. */
 int
 guestfs_impl_max_disks (guestfs_h *g)
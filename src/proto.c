@@ -83,6 +83,16 @@
  * this in the current API, but they would be implemented as a
  * combination of cases (3) and (4).
  *
+ * (6) A pipelined RPC (eg. "lstatns_send" + "lstatns_recv").  The
+ * request is written and the caller gets the serial number back
+ * straight away.  Later the caller collects the reply by serial
+ * number.  Replies that arrive while we are waiting for a different
+ * serial number are kept on the g->pending_replies list until they
+ * are collected.  The sequence of calls is:
+ *
+ *   guestfs_int_send_async  (possibly multiple times)
+ *   guestfs_int_recv_async  (once per serial number)
+ *
  * All read/write/etc operations are performed using the current
  * connection module (g->conn).  During operations the connection
  * module transparently handles log messages that appear on the
@@ -101,6 +111,7 @@ child_cleanup (guestfs_h *g)
     g->conn = NULL;
   }
   memset (&g->launch_t, 0, sizeof g->launch_t);
+  guestfs_int_free_pending_replies (g);
   guestfs_int_free_drives (g);
   g->state = CONFIG;
   guestfs_int_call_callbacks_void (g, GUESTFS_EVENT_SUBPROCESS_QUIT);
@@ -122,6 +133,46 @@ guestfs_int_progress_message_callback (guestfs_h *g,
                                   array, sizeof array / sizeof array[0]);
 }
 
+/* Does the console output contain 'sentinel', either in 'buf' or
+ * split between the end of the previous log message and 'buf'?
+ */
+static int
+match_launch_sentinel (guestfs_h *g, const char *buf, size_t len,
+                       const char *sentinel)
+{
+  const size_t slen = strlen (sentinel);
+  char join[2 * sizeof g->launch_log_tail];
+  size_t n;
+
+  if (memmem (buf, len, sentinel, slen) != NULL)
+    return 1;
+
+  n = MIN (len, slen - 1);
+  memcpy (join, g->launch_log_tail, g->launch_log_tail_len);
+  memcpy (join + g->launch_log_tail_len, buf, n);
+  return memmem (join, g->launch_log_tail_len + n, sentinel, slen) != NULL;
+}
+
+/* Keep the end of the console output for match_launch_sentinel. */
+static void
+save_launch_log_tail (guestfs_h *g, const char *buf, size_t len)
+{
+  const size_t max = sizeof g->launch_log_tail;
+  size_t keep;
+
+  if (len >= max) {
+    memcpy (g->launch_log_tail, buf + len - max, max);
+    g->launch_log_tail_len = max;
+    return;
+  }
+
+  keep = MIN (g->launch_log_tail_len, max - len);
+  memmove (g->launch_log_tail,
+           g->launch_log_tail + g->launch_log_tail_len - keep, keep);
+  memcpy (g->launch_log_tail + keep, buf, len);
+  g->launch_log_tail_len = keep + len;
+}
+
 /* Connection modules call us back here when they get a log message. */
 void
 guestfs_int_log_message_callback (guestfs_h *g, const char *buf, size_t len)
@@ -129,22 +180,30 @@ guestfs_int_log_message_callback (guestfs_h *g, const char *buf, size_t len)
   /* Send the log message upwards to anyone who is listening. */
   guestfs_int_call_callbacks_message (g, GUESTFS_EVENT_APPLIANCE, buf, len);
 
-  /* This is used to generate launch progress messages.  See comment
-   * above guestfs_int_launch_send_progress.
+  /* This is used to generate launch progress messages and to split
+   * the appliance boot into the launch phases.  See comment above
+   * guestfs_int_launch_send_progress.  The sentinels are plain lines
+   * printed on the console, so they are found however the daemon is
+   * run (eg. under valgrind).
    */
   if (g->state == LAUNCHING) {
-    const char *sentinel;
-    size_t slen;
-
-    sentinel = "Linux version"; /* kernel up */
-    slen = strlen (sentinel);
-    if (memmem (buf, len, sentinel, slen) != NULL)
+    /* kernel up */
+    if (match_launch_sentinel (g, buf, len, "Linux version")) {
       guestfs_int_launch_send_progress (g, 6);
+      guestfs_int_launch_timing (g, "firmware");
+    }
 
-    sentinel = "Starting /init script"; /* /init running */
-    slen = strlen (sentinel);
-    if (memmem (buf, len, sentinel, slen) != NULL)
+    /* /init running */
+    if (match_launch_sentinel (g, buf, len, "Starting /init script")) {
       guestfs_int_launch_send_progress (g, 9);
+      guestfs_int_launch_timing (g, "kernel");
+    }
+
+    /* /init is about to run the daemon */
+    if (match_launch_sentinel (g, buf, len, "Starting the daemon"))
+      guestfs_int_launch_timing (g, "init");
+
+    save_launch_log_tail (g, buf, len);
   }
 }
 
@@ -271,16 +330,19 @@ guestfs_int_send (guestfs_h *g, int proc_nr,
   xdr_uint32_t (&xdr, &len);
 
   /* Look for stray daemon cancellation messages from earlier calls
-   * and ignore them.
+   * and ignore them.  If there are pipelined requests in flight then
+   * the read side contains their replies, so we must not touch it.
    */
-  r = check_daemon_socket (g);
-  /* r == -2 (cancellation) is ignored */
-  if (r == -1)
-    return -1;
-  if (r == 0) {
-    guestfs_int_unexpected_close_error (g);
-    child_cleanup (g);
-    return -1;
+  if (g->nr_async_in_flight == 0) {
+    r = check_daemon_socket (g);
+    /* r == -2 (cancellation) is ignored */
+    if (r == -1)
+      return -1;
+    if (r == 0) {
+      guestfs_int_unexpected_close_error (g);
+      child_cleanup (g);
+      return -1;
+    }
   }
 
   /* Send the message. */
@@ -293,6 +355,8 @@ guestfs_int_send (guestfs_h *g, int proc_nr,
     return -1;
   }
 
+  guestfs_int_call_stats_send (g, proc_nr, serial, msg_out_size);
+
   return serial;
 }
 
@@ -309,10 +373,13 @@ fadvise_sequential (int fd)
 #endif
 }
 
+static int drain_async_replies (guestfs_h *g);
 static int send_file_chunk (guestfs_h *g, int cancel, const char *buf, size_t len);
 static int send_file_data (guestfs_h *g, const char *buf, size_t len);
+static int send_file_hole (guestfs_h *g, uint64_t len);
 static int send_file_cancellation (guestfs_h *g);
 static int send_file_complete (guestfs_h *g);
+static int find_data (guestfs_h *g, int fd, off_t pos, size_t *len_r, uint64_t *hole_r);
 
 /* Send a file.
  * Returns:
@@ -323,11 +390,27 @@ static int send_file_complete (guestfs_h *g);
 int
 guestfs_int_send_file (guestfs_h *g, const char *filename)
 {
-  char buf[GUESTFS_MAX_CHUNK_SIZE];
+  CLEANUP_FREE char *buf = NULL;
   int fd, r = 0, err;
+  int seek_holes = 0;
+  off_t pos = 0;
+  size_t len;
+  uint64_t hole;
+  struct stat statbuf;
 
   g->user_cancel = 0;
 
+  /* The daemon may send a cancellation flag at any point during the
+   * transfer, which send_file_chunk looks for on the read side of the
+   * socket.  Collect the replies to any pipelined requests first so
+   * they cannot be confused with it.
+   */
+  if (drain_async_replies (g) == -1)
+    return -1;
+
+  /* Send chunks of the size negotiated with the daemon at launch. */
+  buf = safe_malloc (g, g->chunk_size);
+
   fd = open (filename, O_RDONLY|O_CLOEXEC);
   if (fd == -1) {
     perrorf (g, "open: %s", filename);
@@ -337,12 +420,40 @@ guestfs_int_send_file (guestfs_h *g, const char *filename)
 
   fadvise_sequential (fd);
 
+  /* If the daemon understands hole chunks, don't send the holes in
+   * sparse local files as data.
+   */
+  if (g->sparse_transfers &&
+      fstat (fd, &statbuf) == 0 && S_ISREG (statbuf.st_mode))
+    seek_holes = 1;
+
   /* Send file in chunked encoding. */
   while (!g->user_cancel) {
-    r = read (fd, buf, sizeof buf);
+    len = g->chunk_size;
+    if (seek_holes) {
+      r = find_data (g, fd, pos, &len, &hole);
+      if (r == -1)
+        break;
+      if (r == 0)
+        seek_holes = 0;         /* SEEK_DATA not supported */
+      else if (hole > 0) {
+        err = send_file_hole (g, hole);
+        if (err < 0) {
+          if (err == -2)        /* daemon sent cancellation */
+            send_file_cancellation (g);
+          close (fd);
+          return err;
+        }
+        pos += hole;
+        continue;
+      }
+    }
+
+    r = read (fd, buf, len);
     if (r == -1 && (errno == EINTR || errno == EAGAIN))
       continue;
     if (r <= 0) break;
+    pos += r;
     err = send_file_data (g, buf, r);
     if (err < 0) {
       if (err == -2)		/* daemon sent cancellation */
@@ -392,6 +503,80 @@ send_file_data (guestfs_h *g, const char *buf, size_t len)
   return send_file_chunk (g, 0, buf, len);
 }
 
+/* Send a hole chunk, which stands for 'len' zero bytes.  Only used
+ * if the daemon agreed to sparse transfers at launch.
+ */
+static int
+send_file_hole (guestfs_h *g, uint64_t len)
+{
+  char buf[8];
+  XDR xdr;
+
+  xdrmem_create (&xdr, buf, sizeof buf, XDR_ENCODE);
+  xdr_uint64_t (&xdr, &len);
+  xdr_destroy (&xdr);
+
+  return send_file_chunk (g, GUESTFS_CHUNK_HOLE, buf, sizeof buf);
+}
+
+/* Look for holes in 'fd' starting at 'pos'.  If 'pos' is in a hole,
+ * '*hole_r' is set to the length of the hole.  Otherwise '*hole_r' is
+ * set to 0 and '*len_r' is reduced (if necessary) so that the next
+ * read stops at the start of the following hole.  In both cases the
+ * file offset is left at the end of the hole, if any.
+ *
+ * Returns 1 if OK, 0 if the filesystem cannot report holes (the
+ * caller should read the rest of the file normally), or -1 on error.
+ */
+static int
+find_data (guestfs_h *g, int fd, off_t pos, size_t *len_r, uint64_t *hole_r)
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+  off_t data, hole;
+  struct stat statbuf;
+
+  *hole_r = 0;
+
+  data = lseek (fd, pos, SEEK_DATA);
+  if (data == -1) {
+    if (errno != ENXIO)
+      goto unsupported;
+    /* No more data, so the file ends with a hole (or we are at EOF). */
+    if (fstat (fd, &statbuf) == -1) {
+      perrorf (g, "fstat");
+      return -1;
+    }
+    data = statbuf.st_size > pos ? statbuf.st_size : pos;
+  }
+
+  if (data > pos) {
+    *hole_r = data - pos;
+    if (lseek (fd, data, SEEK_SET) == -1) {
+      perrorf (g, "lseek");
+      return -1;
+    }
+    return 1;
+  }
+
+  hole = lseek (fd, pos, SEEK_HOLE);
+  if (hole > pos && (uint64_t) (hole - pos) < *len_r)
+    *len_r = hole - pos;
+
+  if (lseek (fd, pos, SEEK_SET) == -1) {
+    perrorf (g, "lseek");
+    return -1;
+  }
+  return 1;
+
+ unsupported:
+#endif
+  if (lseek (fd, pos, SEEK_SET) == -1) {
+    perrorf (g, "lseek");
+    return -1;
+  }
+  return 0;
+}
+
 /* Send a cancellation message. */
 static int
 send_file_cancellation (guestfs_h *g)
@@ -420,8 +605,8 @@ send_file_chunk (guestfs_h *g, int cancel, const char *buf, size_t buflen)
   /* Allocate the chunk buffer.  Don't use the stack to avoid
    * excessive stack usage and unnecessary copies.
    */
-  msg_out = safe_malloc (g, GUESTFS_MAX_CHUNK_SIZE + 4 + 48);
-  xdrmem_create (&xdr, msg_out + 4, GUESTFS_MAX_CHUNK_SIZE + 48, XDR_ENCODE);
+  msg_out = safe_malloc (g, buflen + 4 + 48);
+  xdrmem_create (&xdr, msg_out + 4, buflen + 48, XDR_ENCODE);
 
   /* Serialize the chunk. */
   chunk.cancel = cancel;
@@ -469,6 +654,8 @@ send_file_chunk (guestfs_h *g, int cancel, const char *buf, size_t buflen)
     return -1;
   }
 
+  guestfs_int_call_stats_file_data (g, msg_out_size, 0);
+
   return 0;
 }
 
@@ -530,6 +717,7 @@ recv_from_daemon (guestfs_h *g, uint32_t *size_rtn, void **buf_rtn)
              g->state);
     else {
       g->state = READY;
+      guestfs_int_launch_timing (g, "daemon");
       guestfs_int_call_callbacks_void (g, GUESTFS_EVENT_LAUNCH_DONE);
     }
     debug (g, "recv_from_daemon: received GUESTFS_LAUNCH_FLAG");
@@ -637,20 +825,113 @@ guestfs_int_recv_from_daemon (guestfs_h *g, uint32_t *size_rtn, void **buf_rtn)
   return 0;
 }
 
-/* Receive a reply. */
-int
-guestfs_int_recv (guestfs_h *g, const char *fn,
-                guestfs_message_header *hdr,
-                guestfs_message_error *err,
-                xdrproc_t xdrp, char *ret)
+/* A reply to a pipelined request which was read from the daemon
+ * before the caller asked for it.
+ */
+struct pending_reply {
+  struct pending_reply *next;
+  int serial;
+  uint32_t size;
+  void *buf;
+};
+
+/* Maximum number of pipelined requests which may be waiting for a
+ * reply.  Beyond this, guestfs_int_send_async reads replies into the
+ * pending list before sending more.  This bounds the amount of
+ * unread data in each direction on the socket so that neither side
+ * can block writing while the other is also blocked writing.
+ */
+#define MAX_ASYNC_IN_FLIGHT 64
+
+void
+guestfs_int_free_pending_replies (guestfs_h *g)
+{
+  struct pending_reply *p, *next;
+
+  for (p = g->pending_replies; p != NULL; p = next) {
+    next = p->next;
+    free (p->buf);
+    free (p);
+  }
+  g->pending_replies = NULL;
+  g->nr_async_in_flight = 0;
+}
+
+/* Return the serial number in the header of a reply message, or -1
+ * if the header cannot be parsed.  If proc_rtn is not NULL, the
+ * procedure number is returned there (or -1).
+ */
+static int
+reply_serial_proc (const void *buf, uint32_t size, int *proc_rtn)
 {
   XDR xdr;
-  CLEANUP_FREE void *buf = NULL;
-  uint32_t size;
-  int r;
+  guestfs_message_header hdr;
+  int r = -1;
+
+  if (proc_rtn)
+    *proc_rtn = -1;
+
+  xdrmem_create (&xdr, (char *) buf, size, XDR_DECODE);
+  if (xdr_guestfs_message_header (&xdr, &hdr)) {
+    r = hdr.serial;
+    if (proc_rtn)
+      *proc_rtn = hdr.proc;
+  }
+  xdr_destroy (&xdr);
+
+  return r;
+}
+
+static int
+reply_serial (const void *buf, uint32_t size)
+{
+  return reply_serial_proc (buf, size, NULL);
+}
+
+static void
+add_pending_reply (guestfs_h *g, int serial, uint32_t size, void *buf)
+{
+  struct pending_reply *p, **pp;
+
+  p = safe_malloc (g, sizeof *p);
+  p->next = NULL;
+  p->serial = serial;
+  p->size = size;
+  p->buf = buf;
+
+  /* Keep the list in arrival order. */
+  for (pp = &g->pending_replies; *pp != NULL; pp = &(*pp)->next)
+    ;
+  *pp = p;
+}
+
+static struct pending_reply *
+take_pending_reply (guestfs_h *g, int serial)
+{
+  struct pending_reply *p, **pp;
+
+  for (pp = &g->pending_replies; *pp != NULL; pp = &(*pp)->next) {
+    if ((*pp)->serial == serial) {
+      p = *pp;
+      *pp = p->next;
+      return p;
+    }
+  }
+
+  return NULL;
+}
+
+/* Read the next reply message from the daemon, skipping stray
+ * cancellation flags.
+ */
+static int
+recv_reply_message (guestfs_h *g, const char *fn,
+                    uint32_t *size_rtn, void **buf_rtn)
+{
+  int r, serial, proc_nr;
 
  again:
-  r = guestfs_int_recv_from_daemon (g, &size, &buf);
+  r = guestfs_int_recv_from_daemon (g, size_rtn, buf_rtn);
   if (r == -1)
     return -1;
 
@@ -658,14 +939,56 @@ guestfs_int_recv (guestfs_h *g, const char *fn,
    * of us sending a FileIn parameter to the daemon.  Discard.  The
    * daemon should send us an error message next.
    */
-  if (size == GUESTFS_CANCEL_FLAG)
+  if (*size_rtn == GUESTFS_CANCEL_FLAG)
     goto again;
 
-  if (size == GUESTFS_LAUNCH_FLAG) {
+  if (*size_rtn == GUESTFS_LAUNCH_FLAG) {
     error (g, "%s: received unexpected launch flag from daemon when expecting reply", fn);
     return -1;
   }
 
+  serial = reply_serial_proc (*buf_rtn, *size_rtn, &proc_nr);
+  guestfs_int_call_stats_reply (g, proc_nr, serial, *size_rtn + 4);
+
+  return 0;
+}
+
+/* Read one reply to a pipelined request and put it on the pending
+ * list.
+ */
+static int
+recv_async_reply (guestfs_h *g, const char *fn)
+{
+  void *buf;
+  uint32_t size;
+
+  if (recv_reply_message (g, fn, &size, &buf) == -1)
+    return -1;
+
+  g->nr_async_in_flight--;
+  add_pending_reply (g, reply_serial (buf, size), size, buf);
+  return 0;
+}
+
+static int
+drain_async_replies (guestfs_h *g)
+{
+  while (g->nr_async_in_flight > 0) {
+    if (recv_async_reply (g, "send_file") == -1)
+      return -1;
+  }
+  return 0;
+}
+
+/* Decode a reply message into hdr and either err or ret. */
+static int
+decode_reply (guestfs_h *g, const char *fn, void *buf, uint32_t size,
+              guestfs_message_header *hdr,
+              guestfs_message_error *err,
+              xdrproc_t xdrp, char *ret)
+{
+  XDR xdr;
+
   xdrmem_create (&xdr, buf, size, XDR_DECODE);
 
   if (!xdr_guestfs_message_header (&xdr, hdr)) {
@@ -691,6 +1014,107 @@ guestfs_int_recv (guestfs_h *g, const char *fn,
   return 0;
 }
 
+/* Receive a reply.
+ *
+ * If pipelined requests are in flight, their replies may arrive
+ * before the reply to this request.  Those are matched by serial
+ * number and put on the pending list for guestfs_int_recv_async.
+ */
+int
+guestfs_int_recv (guestfs_h *g, const char *fn, int serial,
+                guestfs_message_header *hdr,
+                guestfs_message_error *err,
+                xdrproc_t xdrp, char *ret)
+{
+  CLEANUP_FREE void *buf = NULL;
+  uint32_t size;
+
+  for (;;) {
+    if (recv_reply_message (g, fn, &size, &buf) == -1)
+      return -1;
+
+    if (g->nr_async_in_flight == 0)
+      break;
+    if (reply_serial (buf, size) == serial)
+      break;
+
+    g->nr_async_in_flight--;
+    add_pending_reply (g, reply_serial (buf, size), size, buf);
+    buf = NULL;
+  }
+
+  return decode_reply (g, fn, buf, size, hdr, err, xdrp, ret);
+}
+
+/* Send a pipelined request.  This is the same as guestfs_int_send,
+ * except that the caller does not read the reply straight away but
+ * collects it later using guestfs_int_recv_async.
+ *
+ * Pipelined requests cannot have FileIn, FileOut or optional
+ * arguments (this is checked by the generator).
+ */
+int
+guestfs_int_send_async (guestfs_h *g, int proc_nr,
+                        xdrproc_t xdrp, char *args)
+{
+  int serial;
+
+  if (!g->conn) {
+    guestfs_int_unexpected_close_error (g);
+    return -1;
+  }
+
+  /* Collect replies that are already waiting, and make room if
+   * there are too many requests in flight.
+   */
+  while (g->nr_async_in_flight > 0 &&
+         (g->nr_async_in_flight >= MAX_ASYNC_IN_FLIGHT ||
+          g->conn->ops->can_read_data (g, g->conn) == 1)) {
+    if (recv_async_reply (g, "send_async") == -1)
+      return -1;
+  }
+
+  serial = guestfs_int_send (g, proc_nr, 0, 0, xdrp, args);
+  if (serial == -1)
+    return -1;
+
+  g->nr_async_in_flight++;
+  return serial;
+}
+
+/* Receive the reply to a pipelined request sent earlier by
+ * guestfs_int_send_async.
+ */
+int
+guestfs_int_recv_async (guestfs_h *g, const char *fn, int serial,
+                        guestfs_message_header *hdr,
+                        guestfs_message_error *err,
+                        xdrproc_t xdrp, char *ret)
+{
+  struct pending_reply *p;
+  CLEANUP_FREE void *buf = NULL;
+  uint32_t size;
+
+  while ((p = take_pending_reply (g, serial)) == NULL) {
+    if (g->nr_async_in_flight == 0) {
+      error (g, _("%s: no reply is pending for serial %d"), fn, serial);
+      return -1;
+    }
+    if (recv_async_reply (g, fn) == -1)
+      return -1;
+  }
+
+  buf = p->buf;
+  size = p->size;
+  free (p);
+
+  /* If the caller passed a serial number returned by a different
+   * guestfs_*_send function, guestfs_int_check_reply_header in the
+   * caller will catch it.
+   */
+  return decode_reply (g, fn, buf, size, hdr, err, xdrp, ret);
+}
+
 /* Same as guestfs_int_recv, but it discards the reply message.
  *
  * Notes (XXX):
@@ -702,7 +1126,7 @@ guestfs_int_recv_discard (guestfs_h *g, const char *fn)
 {
   CLEANUP_FREE void *buf = NULL;
   uint32_t size;
-  int r;
+  int r, serial, proc_nr;
 
  again:
   r = guestfs_int_recv_from_daemon (g, &size, &buf);
@@ -721,6 +1145,9 @@ guestfs_int_recv_discard (guestfs_h *g, const char *fn)
     return -1;
   }
 
+  serial = reply_serial_proc (buf, size, &proc_nr);
+  guestfs_int_call_stats_reply (g, proc_nr, serial, size + 4);
+
   return 0;
 }
 
@@ -744,7 +1171,8 @@ xwrite (int fd, const void *v_buf, size_t len)
   return 0;
 }
 
-static ssize_t receive_file_data (guestfs_h *g, void **buf);
+static ssize_t receive_file_data (guestfs_h *g, void **buf, uint64_t *hole_r);
+static int write_hole (guestfs_h *g, int fd, int seekable, uint64_t len);
 
 /* Returns -1 = error, 0 = EOF, > 0 = more data */
 int
@@ -752,6 +1180,10 @@ guestfs_int_recv_file (guestfs_h *g, const char *filename)
 {
   void *buf;
   int fd, r;
+  int seekable = 0, ends_in_hole = 0;
+  uint64_t hole;
+  struct stat statbuf;
+  off_t pos;
 
   g->user_cancel = 0;
 
@@ -763,8 +1195,12 @@ guestfs_int_recv_file (guestfs_h *g, const char *filename)
     fd = dup (1);
   else if (STREQ (filename, "/dev/stderr"))
     fd = dup (2);
-  else
+  else {
     fd = open (filename, O_WRONLY|O_CREAT|O_TRUNC|O_NOCTTY|O_CLOEXEC, 0666);
+    /* We truncated the file, so holes can be skipped by seeking. */
+    if (fd >= 0 && fstat (fd, &statbuf) == 0 && S_ISREG (statbuf.st_mode))
+      seekable = 1;
+  }
   if (fd == -1) {
     perrorf (g, "%s", filename);
     goto cancel;
@@ -773,14 +1209,25 @@ guestfs_int_recv_file (guestfs_h *g, const char *filename)
   fadvise_sequential (fd);
 
   /* Receive the file in chunked encoding. */
-  while ((r = receive_file_data (g, &buf)) > 0) {
-    if (xwrite (fd, buf, r) == -1) {
-      perrorf (g, "%s: write", filename);
+  while ((r = receive_file_data (g, &buf, &hole)) > 0) {
+    if (hole > 0) {
+      if (write_hole (g, fd, seekable, hole) == -1) {
+        perrorf (g, "%s: write", filename);
+        close (fd);
+        goto cancel;
+      }
+      ends_in_hole = seekable;
+    }
+    else {
+      if (xwrite (fd, buf, r) == -1) {
+        perrorf (g, "%s: write", filename);
+        free (buf);
+        close (fd);
+        goto cancel;
+      }
       free (buf);
-      close (fd);
-      goto cancel;
+      ends_in_hole = 0;
     }
-    free (buf);
 
     if (g->user_cancel) {
       close (fd);
@@ -793,11 +1240,23 @@ guestfs_int_recv_file (guestfs_h *g, const char *filename)
     return -1;
   }
 
+  /* If the file ended with a hole we seeked over, extend it. */
+  if (ends_in_hole) {
+    pos = lseek (fd, 0, SEEK_CUR);
+    if (pos == -1 || ftruncate (fd, pos) == -1) {
+      perrorf (g, "ftruncate: %s", filename);
+      close (fd);
+      return -1;
+    }
+  }
+
   if (close (fd) == -1) {
     perrorf (g, "close: %s", filename);
     return -1;
   }
 
+  guestfs_int_call_stats_file_done (g);
+
   return 0;
 
  cancel: ;
@@ -820,16 +1279,45 @@ guestfs_int_recv_file (guestfs_h *g, const char *filename)
     return -1;
   }
 
-  while (receive_file_data (g, NULL) > 0)
+  while (receive_file_data (g, NULL, NULL) > 0)
     ;                           /* just discard it */
 
   return -1;
 }
 
-/* Receive a chunk of file data. */
+/* Skip over a hole of 'len' bytes in the output file.  If the file
+ * is not seekable, write zeroes instead.
+ */
+static int
+write_hole (guestfs_h *g, int fd, int seekable, uint64_t len)
+{
+  CLEANUP_FREE char *zeroes = NULL;
+  size_t n;
+
+  if (seekable) {
+    if (lseek (fd, len, SEEK_CUR) == -1)
+      return -1;
+    return 0;
+  }
+
+  n = len < g->chunk_size ? len : g->chunk_size;
+  zeroes = safe_calloc (g, 1, n);
+  while (len > 0) {
+    n = len < g->chunk_size ? len : g->chunk_size;
+    if (xwrite (fd, zeroes, n) == -1)
+      return -1;
+    len -= n;
+  }
+  return 0;
+}
+
+/* Receive a chunk of file data.  If the daemon sent a hole chunk,
+ * '*hole_r' is set to the length of the hole and '*buf_r' is not
+ * touched.  Otherwise '*hole_r' is set to 0.
+ */
 /* Returns -1 = error, 0 = EOF, > 0 = more data */
 static ssize_t
-receive_file_data (guestfs_h *g, void **buf_r)
+receive_file_data (guestfs_h *g, void **buf_r, uint64_t *hole_r)
 {
   int r;
   CLEANUP_FREE void *buf = NULL;
@@ -846,6 +1334,8 @@ receive_file_data (guestfs_h *g, void **buf_r)
     return -1;
   }
 
+  guestfs_int_call_stats_file_data (g, 0, len + 4);
+
   memset (&chunk, 0, sizeof chunk);
 
   xdrmem_create (&xdr, buf, len, XDR_DECODE);
@@ -855,6 +1345,27 @@ receive_file_data (guestfs_h *g, void **buf_r)
   }
   xdr_destroy (&xdr);
 
+  if (hole_r)
+    *hole_r = 0;
+
+  if (chunk.cancel == GUESTFS_CHUNK_HOLE) {
+    uint64_t hole = 0;
+    int ok;
+
+    xdrmem_create (&xdr, chunk.data.data_val, chunk.data.data_len,
+                   XDR_DECODE);
+    ok = xdr_uint64_t (&xdr, &hole);
+    xdr_destroy (&xdr);
+    free (chunk.data.data_val);
+    if (!ok || hole == 0) {
+      error (g, _("failed to parse hole in file chunk"));
+      return -1;
+    }
+    if (hole_r)
+      *hole_r = hole;
+    return 1;
+  }
+
   if (chunk.cancel) {
     if (g->user_cancel)
       guestfs_int_error_errno (g, EINTR, _("operation cancelled by user"));
@@ -0,0 +1,270 @@
+/* libguestfs
+ * Copyright (C) 2015 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* Sizing the appliance (memory and vCPUs) for the workload set by
+ * guestfs_set_workload, and estimating how many appliances the host
+ * can run at the same time (guestfs_estimate_max_handles).
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "guestfs.h"
+#include "guestfs-internal.h"
+#include "guestfs-internal-actions.h"
+
+/* Memory used on the host by each appliance on top of the guest RAM:
+ * qemu itself, its page tables, and the host side of the drives and
+ * virtio-serial channel.  This errs on the safe side.
+ */
+#define APPLIANCE_OVERHEAD_MB 150
+
+/* Extra memory for each drive after the first when inspecting.  Each
+ * filesystem examined needs its own metadata in the page cache.
+ */
+#define INSPECTION_MB_PER_DRIVE 32
+#define INSPECTION_MAX_EXTRA_MB 512
+#define INSPECTION_MAX_SMP 4
+
+/* Bulk copies (eg. tar-in, copy-device-to-device) benefit from a
+ * bigger page cache and from running the daemon and the block layer
+ * on separate vCPUs.
+ */
+#define COPY_EXTRA_MB 256
+#define COPY_SMP 2
+
+/* mkfs and fsck need memory in proportion to the size of the
+ * filesystem (bitmaps, inode tables).
+ */
+#define MKFS_MB_PER_TB 128
+#define MKFS_MAX_EXTRA_MB 1024
+
+/* Read a value (in kilobytes) from /proc/meminfo.  Returns -1 if it
+ * is not there.
+ */
+static int64_t
+read_meminfo (const char *name)
+{
+  FILE *fp;
+  char line[256];
+  const size_t len = strlen (name);
+  int64_t ret = -1;
+
+  fp = fopen ("/proc/meminfo", "re");
+  if (fp == NULL)
+    return -1;
+
+  while (fgets (line, sizeof line, fp) != NULL) {
+    if (STREQLEN (line, name, len) && line[len] == ':') {
+      if (sscanf (&line[len+1], "%" SCNi64, &ret) != 1)
+        ret = -1;
+      break;
+    }
+  }
+
+  fclose (fp);
+  return ret;
+}
+
+/* Memory which could be used by new appliances, in megabytes, or -1
+ * if it could not be found.  Old kernels don't have MemAvailable, so
+ * approximate it the way free(1) used to.
+ */
+static int64_t
+get_available_memory (void)
+{
+  int64_t avail, free_kb, buffers, cached;
+
+  avail = read_meminfo ("MemAvailable");
+  if (avail >= 0)
+    return avail / 1024;
+
+  free_kb = read_meminfo ("MemFree");
+  buffers = read_meminfo ("Buffers");
+  cached = read_meminfo ("Cached");
+  if (free_kb >= 0 && buffers >= 0 && cached >= 0)
+    return (free_kb + buffers + cached) / 1024;
+
+#if defined(_SC_AVPHYS_PAGES) && defined(_SC_PAGESIZE)
+  {
+    long pages = sysconf (_SC_AVPHYS_PAGES);
+    long pagesize = sysconf (_SC_PAGESIZE);
+
+    if (pages > 0 && pagesize > 0)
+      return (int64_t) pages * pagesize / (1024 * 1024);
+  }
+#endif
+
+  return -1;
+}
+
+static int64_t
+get_total_memory (void)
+{
+  int64_t total;
+
+  total = read_meminfo ("MemTotal");
+  if (total >= 0)
+    return total / 1024;
+
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+  {
+    long pages = sysconf (_SC_PHYS_PAGES);
+    long pagesize = sysconf (_SC_PAGESIZE);
+
+    if (pages > 0 && pagesize > 0)
+      return (int64_t) pages * pagesize / (1024 * 1024);
+  }
+#endif
+
+  return -1;
+}
+
+/* The size of a drive in bytes, or 0 if it is not a local file or
+ * the size cannot be found.
+ */
+static int64_t
+get_drive_size (struct drive *drv)
+{
+  int64_t size = -1;
+  struct stat statbuf;
+
+  if (drv->src.protocol != drive_protocol_file)
+    return 0;
+
+  if (drv->src.format)
+    size = guestfs_int_get_virtual_size (drv->src.u.path, drv->src.format);
+  if (size == -1 && stat (drv->src.u.path, &statbuf) == 0)
+    size = statbuf.st_size;
+
+  return size > 0 ? size : 0;
+}
+
+/* Work out the memory size and number of vCPUs for the current
+ * workload and drives.  The starting point is the default (or the
+ * value set by the caller), so an unknown or empty workload changes
+ * nothing.
+ */
+static void
+plan_resources (guestfs_h *g, int *memsize_rtn, int *smp_rtn)
+{
+  int memsize = g->memsize_set ? g->memsize : DEFAULT_MEMSIZE;
+  int smp = g->smp_set ? g->smp : 1;
+  int base_memsize = memsize;
+  int extra = 0;
+  size_t i, nr_drives = 0;
+  struct drive *drv;
+  long nr_cpus;
+  int64_t total;
+
+  ITER_DRIVES (g, i, drv)
+    nr_drives++;
+
+  if (g->workload == NULL)
+    ;
+  else if (STREQ (g->workload, "inspection")) {
+    if (nr_drives > 1)
+      extra = MIN (INSPECTION_MAX_EXTRA_MB,
+                   (nr_drives-1) * INSPECTION_MB_PER_DRIVE);
+    smp = MAX (1, MIN (INSPECTION_MAX_SMP, nr_drives));
+  }
+  else if (STREQ (g->workload, "copy")) {
+    extra = COPY_EXTRA_MB;
+    smp = COPY_SMP;
+  }
+  else if (STREQ (g->workload, "mkfs")) {
+    int64_t bytes = 0;
+
+    ITER_DRIVES (g, i, drv)
+      bytes += get_drive_size (drv);
+    extra = MIN (MKFS_MAX_EXTRA_MB,
+                 bytes / (INT64_C(1024)*1024*1024*1024 / MKFS_MB_PER_TB));
+    smp = 1;
+  }
+
+  if (!g->memsize_set && extra > 0) {
+    memsize += extra;
+
+    /* Don't take more than half the host memory, but never go below
+     * what would have been used anyway.
+     */
+    total = get_total_memory ();
+    if (total > 0 && memsize > total / 2)
+      memsize = MAX (base_memsize, total / 2);
+  }
+
+  if (g->smp_set)
+    smp = g->smp;
+  else {
+    nr_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    if (nr_cpus > 0 && smp > nr_cpus)
+      smp = nr_cpus;
+  }
+
+  *memsize_rtn = memsize;
+  *smp_rtn = smp;
+}
+
+/* Called from guestfs_launch, before the backend uses g->memsize and
+ * g->smp.  Values set explicitly by the caller are left alone.  This
+ * is done on every launch, since the drives or the workload may have
+ * changed since the last one.
+ */
+void
+guestfs_int_plan_resources (guestfs_h *g)
+{
+  plan_resources (g, &g->memsize, &g->smp);
+
+  if (g->workload)
+    debug (g, "launch: workload=%s memsize=%d smp=%d",
+           g->workload, g->memsize, g->smp);
+}
+
+int
+guestfs_impl_estimate_max_handles (guestfs_h *g)
+{
+  int memsize, smp;
+  int64_t avail, n;
+
+  plan_resources (g, &memsize, &smp);
+
+  avail = get_available_memory ();
+  if (avail == -1) {
+    debug (g, "estimate_max_handles: cannot read available memory");
+    return 1;
+  }
+
+  n = avail / (memsize + APPLIANCE_OVERHEAD_MB);
+  debug (g, "estimate_max_handles: available=%" PRIi64 "MB "
+         "memsize=%dMB => %" PRIi64, avail, memsize, n);
+
+  if (n < 1)
+    return 1;
+  if (n > INT_MAX)
+    return INT_MAX;
+  return n;
+}
@@ -141,6 +141,39 @@ guestfs_int_lazy_make_tmpdir (guestfs_h *g)
   return 0;
 }
 
+/* Create the subdirectory 'name' of the per-user cache directory
+ * ($cachedir/.guestfs-$UID/name) with permissions 'mode', and make
+ * the same simple checks on it as for the cached appliance.  This is
+ * used by caches which are only an optimization, so if the directory
+ * cannot be used this does not set an error, it just returns NULL.
+ */
+char *
+guestfs_int_make_cache_subdir (guestfs_h *g, const char *name, mode_t mode)
+{
+  CLEANUP_FREE char *cachedir = guestfs_get_cachedir (g);
+  CLEANUP_FREE char *parent = NULL;
+  char *dir;
+  struct stat statbuf;
+  uid_t uid = geteuid ();
+
+  parent = safe_asprintf (g, "%s/.guestfs-%d", cachedir, (int) uid);
+  dir = safe_asprintf (g, "%s/%s", parent, name);
+
+  ignore_value (mkdir (parent, 0755));
+  ignore_value (mkdir (dir, mode));
+
+  if (lstat (dir, &statbuf) == -1 ||
+      statbuf.st_uid != uid ||
+      !S_ISDIR (statbuf.st_mode) ||
+      (statbuf.st_mode & 0022) != 0) {
+    debug (g, "%s is not usable as a cache directory", dir);
+    free (dir);
+    return NULL;
+  }
+
+  return dir;
+}
+
 /* Recursively remove a temporary directory.  If removal fails, just
  * return (it's a temporary directory so it'll eventually be cleaned
  * up by a temp cleaner).  This is done using "rm -rf" because that's
@@ -47,6 +47,7 @@
 static int timeout = DEFAULT_TIMEOUT;
 
 static void set_qemu (guestfs_h *g, const char *path, int use_wrapper);
+static void launch_timings (const char *qemu, int qemu_use_wrapper, int n);
 
 static void
 usage (void)
@@ -61,6 +62,7 @@ usage (void)
             "  --qemu qemu    Specify QEMU binary\n"
             "  --timeout n\n"
             "  -t n           Set launch timeout (default: %d seconds)\n"
+            "  --timings n    Launch n times and print how long each phase took\n"
             "  --version\n"
             "  -V             Display libguestfs version and exit\n"
             ),
@@ -82,6 +84,7 @@ main (int argc, char *argv[])
     { "qemu", 1, 0, 0 },
     { "qemudir", 1, 0, 0 },
     { "timeout", 1, 0, 't' },
+    { "timings", 1, 0, 0 },
     { "version", 0, 0, 'V' },
     { 0, 0, 0, 0 }
   };
@@ -94,6 +97,7 @@ main (int argc, char *argv[])
   guestfs_h *g;
   char *qemu = NULL;
   int qemu_use_wrapper = 0;
+  int timings = 0;
 
   for (;;) {
     c = getopt_long (argc, argv, options, long_options, &option_index);
@@ -109,6 +113,14 @@ main (int argc, char *argv[])
         qemu = optarg;
         qemu_use_wrapper = 1;
       }
+      else if (STREQ (long_options[option_index].name, "timings")) {
+        if (sscanf (optarg, "%d", &timings) != 1 || timings <= 0) {
+          fprintf (stderr,
+                   _("libguestfs-test-tool: invalid number of launches: %s\n"),
+                   optarg);
+          exit (EXIT_FAILURE);
+        }
+      }
       else {
         fprintf (stderr,
                  _("libguestfs-test-tool: unknown long option: %s (%d)\n"),
@@ -162,6 +174,11 @@ main (int argc, char *argv[])
     exit (EXIT_FAILURE);
   }
 
+  if (timings > 0) {
+    launch_timings (qemu, qemu_use_wrapper, timings);
+    exit (EXIT_SUCCESS);
+  }
+
   /* Everyone ignores the documentation, so ... */
   printf ("     ************************************************************\n"
           "     *                    IMPORTANT NOTICE\n"
@@ -319,6 +336,108 @@ main (int argc, char *argv[])
   exit (EXIT_SUCCESS);
 }
 
+#define MAX_PHASES 32
+
+struct phase {
+  char *name;
+  int count;                    /* Number of launches with this phase. */
+  int64_t min, max, total;      /* Microseconds. */
+};
+
+static void
+add_timing (struct phase *phases, size_t *nr_phases,
+            const char *name, int64_t usec)
+{
+  size_t i;
+
+  for (i = 0; i < *nr_phases; ++i)
+    if (STREQ (phases[i].name, name))
+      break;
+  if (i == *nr_phases) {
+    if (*nr_phases == MAX_PHASES)
+      return;
+    phases[i].name = strdup (name);
+    if (phases[i].name == NULL) {
+      perror ("strdup");
+      exit (EXIT_FAILURE);
+    }
+    phases[i].count = 0;
+    phases[i].total = 0;
+    (*nr_phases)++;
+  }
+
+  if (phases[i].count == 0 || usec < phases[i].min)
+    phases[i].min = usec;
+  if (phases[i].count == 0 || usec > phases[i].max)
+    phases[i].max = usec;
+  phases[i].total += usec;
+  phases[i].count++;
+}
+
+/* Launch the appliance 'n' times (not in verbose mode) and print a
+ * table of how long each phase of launch took, using
+ * guestfs_get_launch_timings.
+ */
+static void
+launch_timings (const char *qemu, int qemu_use_wrapper, int n)
+{
+  struct phase phases[MAX_PHASES];
+  size_t nr_phases = 0;
+  size_t i, j;
+  int run;
+
+  for (run = 0; run < n; ++run) {
+    guestfs_h *g;
+    struct guestfs_launch_timing_list *timings;
+    int64_t total = 0;
+
+    g = guestfs_create ();
+    if (g == NULL) {
+      fprintf (stderr,
+               _("libguestfs-test-tool: failed to create libguestfs handle\n"));
+      exit (EXIT_FAILURE);
+    }
+    if (qemu)
+      set_qemu (g, qemu, qemu_use_wrapper);
+    if (guestfs_add_drive_scratch (g, 100*1024*1024, -1) == -1)
+      exit (EXIT_FAILURE);
+
+    alarm (timeout);
+    if (guestfs_launch (g) == -1) {
+      fprintf (stderr,
+               _("libguestfs-test-tool: failed to launch appliance\n"));
+      exit (EXIT_FAILURE);
+    }
+    alarm (0);
+
+    timings = guestfs_get_launch_timings (g);
+    if (timings == NULL)
+      exit (EXIT_FAILURE);
+    for (j = 0; j < timings->len; ++j) {
+      add_timing (phases, &nr_phases,
+                  timings->val[j].lt_phase, timings->val[j].lt_duration);
+      total += timings->val[j].lt_duration;
+    }
+    add_timing (phases, &nr_phases, "total", total);
+    guestfs_free_launch_timing_list (timings);
+
+    if (guestfs_shutdown (g) == -1)
+      exit (EXIT_FAILURE);
+    guestfs_close (g);
+  }
+
+  printf ("%-12s %8s %10s %10s %10s\n",
+          "phase", "launches", "min ms", "mean ms", "max ms");
+  for (i = 0; i < nr_phases; ++i) {
+    printf ("%-12s %8d %10.1f %10.1f %10.1f\n",
+            phases[i].name, phases[i].count,
+            phases[i].min / 1000.0,
+            (double) phases[i].total / phases[i].count / 1000.0,
+            phases[i].max / 1000.0);
+    free (phases[i].name);
+  }
+}
+
 static char qemuwrapper[] = P_tmpdir "/libguestfs-test-tool-wrapper-XXXXXX";
 
 static void
@@ -0,0 +1,171 @@
+/* libguestfs
+ * Copyright (C) 2015 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Stat every file in a large directory, first using ordinary calls
+ * and then using the pipelined variants (guestfs_lstatns_send and
+ * guestfs_lstatns_recv).  Check that both give the same answers and
+ * print how long each method took.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <error.h>
+#include <sys/time.h>
+
+#include "guestfs.h"
+#include "guestfs-internal-frontend.h"
+
+#define NR_FILES 20000
+
+/* Number of pipelined requests outstanding at any time. */
+#define WINDOW 64
+
+static int64_t timeval_diff (const struct timeval *x, const struct timeval *y);
+
+int
+main (int argc, char *argv[])
+{
+  guestfs_h *g;
+  char *skip;
+  CLEANUP_FREE_STRING_LIST char **names = NULL;
+  struct guestfs_statns **serial_st, **pipelined_st;
+  int *serials;
+  size_t i, nr, sent, received;
+  struct timeval start, end;
+  int64_t serial_ms, pipelined_ms;
+
+  /* Allow the test to be skipped by setting an environment variable. */
+  skip = getenv ("SKIP_TEST_PIPELINED_CALLS");
+  if (skip && guestfs_int_is_true (skip) > 0) {
+    fprintf (stderr, "%s: test skipped because environment variable set.\n",
+             argv[0]);
+    exit (77);
+  }
+
+  g = guestfs_create ();
+  if (!g)
+    error (EXIT_FAILURE, errno, "guestfs_create");
+
+  if (guestfs_add_drive_scratch (g, INT64_C(1024)*1024*1024, -1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_mkfs (g, "ext4", "/dev/sda") == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_mount (g, "/dev/sda", "/") == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_mkdir (g, "/dir") == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_fill_dir (g, "/dir", NR_FILES) == -1)
+    exit (EXIT_FAILURE);
+
+  names = guestfs_ls (g, "/dir");
+  if (names == NULL)
+    exit (EXIT_FAILURE);
+  nr = guestfs_int_count_strings (names);
+  if (nr != NR_FILES)
+    error (EXIT_FAILURE, 0, "expected %d files, got %zu", NR_FILES, nr);
+
+  /* Turn the names into absolute paths. */
+  for (i = 0; i < nr; ++i) {
+    char *path;
+
+    if (asprintf (&path, "/dir/%s", names[i]) == -1)
+      error (EXIT_FAILURE, errno, "asprintf");
+    free (names[i]);
+    names[i] = path;
+  }
+
+  serial_st = calloc (nr, sizeof (struct guestfs_statns *));
+  pipelined_st = calloc (nr, sizeof (struct guestfs_statns *));
+  serials = calloc (nr, sizeof (int));
+  if (!serial_st || !pipelined_st || !serials)
+    error (EXIT_FAILURE, errno, "calloc");
+
+  /* Ordinary calls. */
+  gettimeofday (&start, NULL);
+  for (i = 0; i < nr; ++i) {
+    serial_st[i] = guestfs_lstatns (g, names[i]);
+    if (serial_st[i] == NULL)
+      exit (EXIT_FAILURE);
+  }
+  gettimeofday (&end, NULL);
+  serial_ms = timeval_diff (&start, &end);
+
+  /* Pipelined calls, keeping up to WINDOW requests in flight. */
+  gettimeofday (&start, NULL);
+  sent = received = 0;
+  while (received < nr) {
+    while (sent < nr && sent - received < WINDOW) {
+      serials[sent] = guestfs_lstatns_send (g, names[sent]);
+      if (serials[sent] == -1)
+        exit (EXIT_FAILURE);
+      sent++;
+    }
+    pipelined_st[received] = guestfs_lstatns_recv (g, serials[received]);
+    if (pipelined_st[received] == NULL)
+      exit (EXIT_FAILURE);
+    received++;
+  }
+  gettimeofday (&end, NULL);
+  pipelined_ms = timeval_diff (&start, &end);
+
+  for (i = 0; i < nr; ++i) {
+    if (guestfs_compare_statns (serial_st[i], pipelined_st[i]) != 0)
+      error (EXIT_FAILURE, 0, "%s: pipelined result differs", names[i]);
+    guestfs_free_statns (serial_st[i]);
+    guestfs_free_statns (pipelined_st[i]);
+  }
+  free (serial_st);
+  free (pipelined_st);
+
+  /* Collecting a reply twice is an error. */
+  guestfs_push_error_handler (g, NULL, NULL);
+  if (guestfs_lstatns_recv (g, serials[0]) != NULL)
+    error (EXIT_FAILURE, 0, "guestfs_lstatns_recv succeeded twice");
+  guestfs_pop_error_handler (g);
+  free (serials);
+
+  printf ("%zu x lstatns: ordinary %" PRIi64 " ms, "
+          "pipelined %" PRIi64 " ms (window %d)\n",
+          nr, serial_ms, pipelined_ms, WINDOW);
+
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+  guestfs_close (g);
+
+  exit (EXIT_SUCCESS);
+}
+
+/* Compute Y - X and return the result in milliseconds. */
+static int64_t
+timeval_diff (const struct timeval *x, const struct timeval *y)
+{
+  int64_t msec;
+
+  msec = (y->tv_sec - x->tv_sec) * 1000;
+  msec += (y->tv_usec - x->tv_usec) / 1000;
+  return msec;
+}
@@ -0,0 +1,68 @@
+#!/bin/bash -
+# libguestfs
+# Copyright (C) 2015 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Test the overlays of read-only drives, and that they are reset when
+# they are reused after a relaunch (guestfs_set_reuse_overlays).
+
+export LANG=C
+
+set -e
+
+rm -f test-reuse-overlays.img test-reuse-overlays.qcow2
+
+guestfish <<EOF
+disk-create test-reuse-overlays.img raw 10M
+disk-create test-reuse-overlays.qcow2 qcow2 10M
+EOF
+
+expected="5
+false
+true"
+
+for disk in "test-reuse-overlays.img raw" "test-reuse-overlays.qcow2 qcow2"
+do
+    set -- $disk
+
+    output="$(guestfish <<EOF
+set-reuse-overlays true
+add-ro $1 format:$2
+run
+pwrite-device /dev/sda hello 0
+is-zero-device /dev/sda
+shutdown
+add-ro $1 format:$2
+run
+is-zero-device /dev/sda
+EOF
+)"
+
+    if [ "$output" != "$expected" ]; then
+        echo "$0: unexpected output from $1:"
+        echo "$output"
+        exit 1
+    fi
+
+    # The original disk must not have been changed.
+    if [ "$(guestfish --ro -a $1 run : is-zero-device /dev/sda)" != "true" ]
+    then
+        echo "$0: $1 was modified"
+        exit 1
+    fi
+done
+
+rm test-reuse-overlays.img test-reuse-overlays.qcow2
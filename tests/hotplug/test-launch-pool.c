@@ -0,0 +1,168 @@
+/* libguestfs
+ * Copyright (C) 2015 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Launch a series of short-lived handles, first in the normal way
+ * and then using the launch pool (guestfs_set_launch_pool), and
+ * hot-add a drive to each.  Check that the drive has the same name
+ * in both cases, and print the average time from guestfs_create to
+ * the first call returning.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <error.h>
+#include <sys/time.h>
+
+#include "guestfs.h"
+#include "guestfs-internal-frontend.h"
+
+#define NR_LAUNCHES 5
+
+static const char *disk = "test-launch-pool.img";
+
+static int64_t timeval_diff (const struct timeval *x, const struct timeval *y);
+
+/* Create a handle, launch it, hot-add the disk, check that it can be
+ * read and that it is /dev/sdb (after the appliance disk), and return the time taken in
+ * milliseconds.
+ */
+static int64_t
+run_one (int pool_size)
+{
+  guestfs_h *g;
+  struct timeval start, end;
+  CLEANUP_FREE char *type = NULL;
+  CLEANUP_FREE_STRING_LIST char **devices = NULL;
+
+  gettimeofday (&start, NULL);
+
+  g = guestfs_create ();
+  if (!g)
+    error (EXIT_FAILURE, errno, "guestfs_create");
+  if (guestfs_set_launch_pool (g, pool_size) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_add_drive_opts (g, disk,
+                              GUESTFS_ADD_DRIVE_OPTS_FORMAT, "raw",
+                              GUESTFS_ADD_DRIVE_OPTS_READONLY, 1,
+                              GUESTFS_ADD_DRIVE_OPTS_LABEL, "test",
+                              -1) == -1)
+    exit (EXIT_FAILURE);
+
+  type = guestfs_vfs_type (g, "/dev/disk/guestfs/test");
+  if (type == NULL)
+    exit (EXIT_FAILURE);
+
+  gettimeofday (&end, NULL);
+
+  if (STRNEQ (type, "ext2"))
+    error (EXIT_FAILURE, 0, "unexpected filesystem type '%s'", type);
+
+  devices = guestfs_list_devices (g);
+  if (devices == NULL)
+    exit (EXIT_FAILURE);
+  if (devices[0] == NULL || STRNEQ (devices[0], "/dev/sdb") ||
+      devices[1] != NULL)
+    error (EXIT_FAILURE, 0, "pool size %d: unexpected device names",
+           pool_size);
+
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+  guestfs_close (g);
+
+  return timeval_diff (&start, &end);
+}
+
+int
+main (int argc, char *argv[])
+{
+  guestfs_h *g;
+  char *skip;
+  CLEANUP_FREE char *backend = NULL;
+  int64_t cold_ms = 0, pooled_ms = 0;
+  size_t i;
+
+  /* Allow the test to be skipped by setting an environment variable. */
+  skip = getenv ("SKIP_TEST_LAUNCH_POOL");
+  if (skip && guestfs_int_is_true (skip) > 0) {
+    fprintf (stderr, "%s: test skipped because environment variable set.\n",
+             argv[0]);
+    exit (77);
+  }
+
+  g = guestfs_create ();
+  if (!g)
+    error (EXIT_FAILURE, errno, "guestfs_create");
+
+  /* Only the libvirt backend supports hotplugging. */
+  backend = guestfs_get_backend (g);
+  if (backend == NULL)
+    exit (EXIT_FAILURE);
+  if (STRNEQ (backend, "libvirt") && !STRPREFIX (backend, "libvirt:")) {
+    fprintf (stderr, "%s: test skipped because backend (%s) is not libvirt\n",
+             argv[0], backend);
+    exit (77);
+  }
+
+  if (guestfs_disk_create (g, disk, "raw", INT64_C(64)*1024*1024, -1) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_add_drive (g, disk) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_mkfs (g, "ext2", "/dev/sda") == -1)
+    exit (EXIT_FAILURE);
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+  guestfs_close (g);
+
+  for (i = 0; i < NR_LAUNCHES; ++i)
+    cold_ms += run_one (0);
+
+  /* The first pooled launch fills the pool, so don't count it. */
+  run_one (1);
+  for (i = 0; i < NR_LAUNCHES; ++i)
+    pooled_ms += run_one (1);
+
+  printf ("time to first call: cold %" PRIi64 " ms, "
+          "pooled %" PRIi64 " ms (average of %d launches)\n",
+          cold_ms / NR_LAUNCHES, pooled_ms / NR_LAUNCHES, NR_LAUNCHES);
+
+  unlink (disk);
+
+  exit (EXIT_SUCCESS);
+}
+
+/* Compute Y - X and return the result in milliseconds. */
+static int64_t
+timeval_diff (const struct timeval *x, const struct timeval *y)
+{
+  int64_t msec;
+
+  msec = (y->tv_sec - x->tv_sec) * 1000;
+  msec += (y->tv_usec - x->tv_usec) / 1000;
+  return msec;
+}
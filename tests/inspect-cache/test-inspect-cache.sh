@@ -0,0 +1,96 @@
+#!/bin/bash -
+# libguestfs
+# Copyright (C) 2015 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Test the inspection cache (guestfs_set_inspect_cache): a second
+# inspection of the same image is answered without launching the
+# appliance, and changing the image invalidates the cache.
+
+set -e
+export LANG=C
+
+if [ -n "$SKIP_TEST_INSPECT_CACHE_SH" ]; then
+    echo "$0: skipping test because environment variable is set."
+    exit 77
+fi
+
+if [ "$(guestfish get-backend)" = "uml" ]; then
+    echo "$0: skipping test because uml backend does not support qcow2"
+    exit 77
+fi
+
+if [ ! -s ../guests/fedora.img ]; then
+    echo "$0: skipping test because fedora.img test guest does not exist."
+    exit 77
+fi
+
+rm -f test.qcow2 test.output
+rm -rf cachedir
+
+# Use a private cache directory, so that the test starts with an
+# empty inspection cache.
+mkdir cachedir
+export LIBGUESTFS_CACHEDIR="$(pwd)/cachedir"
+
+guestfish -- \
+  disk-create test.qcow2 qcow2 -1 \
+    backingfile:../guests/fedora.img backingformat:raw
+
+# Fill the cache.
+guestfish --ro -a test.qcow2 <<'EOF' > test.output
+  inspect-cache true
+  run
+  inspect-os
+EOF
+
+if [ "$(cat test.output)" != "/dev/VG/Root" ]; then
+    echo "$0: error #1: unexpected output from inspect-os"
+    cat test.output
+    exit 1
+fi
+
+# A cache hit.  The appliance is not launched, so this can only work
+# if the results come from the cache.
+guestfish --ro -a test.qcow2 <<'EOF' > test.output
+  inspect-cache true
+  inspect-os
+  inspect-get-product-name /dev/VG/Root
+EOF
+
+if [ "$(cat test.output)" != "/dev/VG/Root
+Fedora release 14 (Phony)" ]; then
+    echo "$0: error #2: unexpected output from the inspection cache"
+    cat test.output
+    exit 1
+fi
+
+# Change the image.  This may happen in the same second as the
+# inspection above.
+guestfish -a test.qcow2 -m /dev/VG/Root write /etc/motd "changed"
+
+# Now the cache must miss, and without the appliance inspect-os fails.
+if guestfish --ro -a test.qcow2 <<'EOF' > test.output 2>&1; then
+  inspect-cache true
+  inspect-os
+EOF
+    echo "$0: error #3: the inspection cache was used after the image changed"
+    cat test.output
+    exit 1
+fi
+
+rm test.qcow2 test.output
+rm -r cachedir
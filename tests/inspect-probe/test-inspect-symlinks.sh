@@ -0,0 +1,75 @@
+#!/bin/bash -
+# libguestfs
+# Copyright (C) 2015 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Inspection probes filesystems without following symlinks.  Check
+# that a guest whose /etc/fstab is a symlink is inspected the same way
+# as when each path was tested with guestfs_is_file.
+
+set -e
+export LANG=C
+
+if [ -n "$SKIP_TEST_INSPECT_SYMLINKS_SH" ]; then
+    echo "$0: skipping test because environment variable is set."
+    exit 77
+fi
+
+if [ "$(guestfish get-backend)" = "uml" ]; then
+    echo "$0: skipping test because uml backend does not support qcow2"
+    exit 77
+fi
+
+if [ ! -s ../guests/fedora.img ]; then
+    echo "$0: skipping test because fedora.img test guest does not exist."
+    exit 77
+fi
+
+rm -f test-symlinks.qcow2 test-symlinks.output
+
+guestfish -- \
+  disk-create test-symlinks.qcow2 qcow2 -1 \
+    backingfile:../guests/fedora.img backingformat:raw
+
+# Replace /etc/fstab with a symlink to the real file, and find out
+# what guestfs_is_file says about it.
+is_file="$(guestfish -a test-symlinks.qcow2 -m /dev/VG/Root <<'EOF'
+  mv /etc/fstab /etc/fstab.real
+  ln-s fstab.real /etc/fstab
+  is-file /etc/fstab
+EOF
+)"
+
+case "$is_file" in
+    true) expected="/dev/VG/Root" ;;
+    false) expected="" ;;
+    *)
+        echo "$0: unexpected output from is-file: $is_file"
+        exit 1
+esac
+
+guestfish --ro -a test-symlinks.qcow2 <<'EOF' > test-symlinks.output
+  run
+  inspect-os
+EOF
+
+if [ "$(cat test-symlinks.output)" != "$expected" ]; then
+    echo "$0: unexpected output from inspect-os (expected '$expected'):"
+    cat test-symlinks.output
+    exit 1
+fi
+
+rm test-symlinks.qcow2 test-symlinks.output
@@ -0,0 +1,86 @@
+#!/bin/bash -
+# libguestfs
+# Copyright (C) 2015 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Test that an LV can be used straight after launch, before any call
+# which lists LVM devices, and that deactivating volume groups first
+# is not undone.  The daemon only activates volume groups the first
+# time a call needs them.
+
+set -e
+
+if [ -n "$SKIP_TEST_LVM_ACTIVATION_SH" ]; then
+    echo "$0: skipping test because environment variable is set."
+    exit 77
+fi
+
+rm -f test-lvm-activation.img
+
+guestfish <<'EOF'
+sparse test-lvm-activation.img 100M
+run
+part-disk /dev/sda mbr
+pvcreate /dev/sda1
+vgcreate VG /dev/sda1
+lvcreate LV VG 64
+mkfs ext2 /dev/VG/LV
+mount /dev/VG/LV /
+write /hello "hello, world"
+EOF
+
+# In a new appliance, the first call uses the LV.
+actual=$(guestfish -a test-lvm-activation.img <<'EOF'
+run
+mount /dev/VG/LV /
+cat /hello
+EOF
+)
+
+if [ "$actual" != "hello, world" ]; then
+    echo "$0: unexpected output reading the LV:"
+    echo "$actual"
+    exit 1
+fi
+
+# Also check the /dev/mapper name.
+actual=$(guestfish -a test-lvm-activation.img <<'EOF'
+run
+blockdev-getsize64 /dev/mapper/VG-LV
+EOF
+)
+
+if [ "$actual" != "67108864" ]; then
+    echo "$0: unexpected size of /dev/mapper/VG-LV: $actual"
+    exit 1
+fi
+
+# Volume groups deactivated by the first call must stay deactivated
+# when LVM devices are listed.
+actual=$(guestfish -a test-lvm-activation.img <<'EOF'
+run
+vg-activate-all false
+list-dm-devices
+EOF
+)
+
+if [ "$actual" != "" ]; then
+    echo "$0: volume groups were activated again after vg-activate-all false:"
+    echo "$actual"
+    exit 1
+fi
+
+rm test-lvm-activation.img
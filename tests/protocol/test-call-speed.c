@@ -0,0 +1,102 @@
+/* libguestfs
+ * Copyright (C) 2015 Red Hat Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Benchmark the library <-> daemon protocol: the time taken by a
+ * small call (one short request and reply), and the throughput of
+ * calls with large replies.  Nearly all of the time is spent in the
+ * protocol and the socket code (src/conn-socket.c), not in the
+ * daemon.
+ *
+ * This is not run by default.  Use 'make check-slow'.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "guestfs.h"
+
+#define NR_SMALL_CALLS 20000
+#define NR_LARGE_CALLS 500
+#define LARGE_SIZE (1024 * 1024)
+
+static double
+elapsed (const struct timeval *start)
+{
+  struct timeval end;
+
+  gettimeofday (&end, NULL);
+  return (end.tv_sec - start->tv_sec) +
+    (end.tv_usec - start->tv_usec) / 1000000.;
+}
+
+int
+main (int argc, char *argv[])
+{
+  guestfs_h *g;
+  struct timeval start;
+  double secs;
+  char *buf;
+  size_t i, size;
+
+  g = guestfs_create ();
+  if (g == NULL) {
+    perror ("guestfs_create");
+    exit (EXIT_FAILURE);
+  }
+
+  if (guestfs_add_drive_scratch (g, INT64_C (1024*1024*1024), -1) == -1)
+    exit (EXIT_FAILURE);
+
+  if (guestfs_launch (g) == -1)
+    exit (EXIT_FAILURE);
+
+  /* Small calls. */
+  gettimeofday (&start, NULL);
+  for (i = 0; i < NR_SMALL_CALLS; ++i) {
+    if (guestfs_blockdev_getsize64 (g, "/dev/sda") == -1)
+      exit (EXIT_FAILURE);
+  }
+  secs = elapsed (&start);
+  printf ("%d small calls: %.3f s, %.1f us per call\n",
+          NR_SMALL_CALLS, secs, secs * 1000000. / NR_SMALL_CALLS);
+
+  /* Calls with large replies. */
+  gettimeofday (&start, NULL);
+  for (i = 0; i < NR_LARGE_CALLS; ++i) {
+    buf = guestfs_pread_device (g, "/dev/sda", LARGE_SIZE,
+                                (int64_t) i * LARGE_SIZE, &size);
+    if (buf == NULL)
+      exit (EXIT_FAILURE);
+    free (buf);
+  }
+  secs = elapsed (&start);
+  printf ("%d calls reading %d bytes: %.3f s, %.1f MB/s\n",
+          NR_LARGE_CALLS, LARGE_SIZE, secs,
+          (double) NR_LARGE_CALLS * LARGE_SIZE / (1024 * 1024) / secs);
+
+  if (guestfs_shutdown (g) == -1)
+    exit (EXIT_FAILURE);
+
+  guestfs_close (g);
+
+  exit (EXIT_SUCCESS);
+}
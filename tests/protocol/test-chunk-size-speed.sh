@@ -0,0 +1,54 @@
+#!/bin/bash -
+# libguestfs
+# Copyright (C) 2015 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Benchmark file transfers using the old fixed chunk size and the
+# negotiated (large) chunk size, and report the throughput of each.
+# This is not run by default.  Use 'make check-slow'.
+
+set -e
+
+size_mb=1024
+
+rm -f chunk-size-speed.img
+truncate -s ${size_mb}M chunk-size-speed.img
+
+for chunk_size in 8192 1048576; do
+    rm -f chunk-size-speed.out
+
+    guestfish > chunk-size-speed.out <<EOF
+set-backend-setting chunk_size $chunk_size
+scratch ${size_mb}M
+run
+time download /dev/sda /dev/null
+time upload chunk-size-speed.img /dev/sda
+EOF
+
+    cat chunk-size-speed.out
+
+    # Both transfers move exactly size_mb megabytes.
+    awk -v chunk_size=$chunk_size -v size_mb=$size_mb '
+      /^elapsed time:/ {
+        n++
+        op = (n == 1) ? "download" : "upload"
+        secs = $3
+        if (secs <= 0) secs = 0.01
+        printf "%s: chunk_size %d: %.1f MB/s\n", op, chunk_size, size_mb / secs
+      }' < chunk-size-speed.out
+done
+
+rm -f chunk-size-speed.out chunk-size-speed.img
@@ -0,0 +1,76 @@
+#!/bin/bash -
+# libguestfs
+# Copyright (C) 2015 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Check that the direct backend reuses the cached output of qemu
+# -help and -device ?, and probes qemu again when the qemu binary
+# changes.
+
+if [ -n "$SKIP_QEMU_CACHE_SH" ]; then
+    echo "$0: test skipped because environment variable is set."
+    exit 77
+fi
+
+# The cache is only used by the direct backend.
+if [ "$(guestfish get-backend)" != "direct" ]; then
+    echo "$0: skipping test because it is only applicable to the direct backend."
+    exit 77
+fi
+
+set -e
+
+real_hv="$(guestfish get-hv)"
+hv="$(pwd)/qemu-cache-hv.sh"
+
+rm -f qemu-cache.out "$hv"
+
+# Use a wrapper for qemu, so that the test can change it.
+cat > "$hv" <<EOF
+#!/bin/sh -
+exec "$real_hv" "\$@"
+EOF
+chmod +x "$hv"
+export LIBGUESTFS_HV="$hv"
+
+# Remove any cache file left over from an earlier run.  The file is
+# named after the SHA-256 hash of the qemu path.
+cachedir="$(guestfish get-cachedir)/.guestfs-$(id -u)/qemu.d"
+rm -f "$cachedir/$(printf %s "$hv" | sha256sum | awk '{print $1}')"
+
+# Launch the appliance and check if the cache was used.
+check ()
+{
+    guestfish -v -a /dev/null run > qemu-cache.out 2>&1
+    if grep -sq "qemu cache: using cached qemu capabilities" qemu-cache.out
+    then used=yes; else used=no; fi
+    if [ "$used" != "$1" ]; then
+        echo "$0: $2: expected cache used = $1, but was $used"
+        cat qemu-cache.out
+        exit 1
+    fi
+}
+
+check no "first launch"
+check yes "second launch"
+
+# Change the qemu binary (its size and times change).
+echo "# changed" >> "$hv"
+
+check no "launch after changing qemu"
+check yes "second launch after changing qemu"
+
+rm qemu-cache.out "$hv"
@@ -0,0 +1,95 @@
+#!/usr/bin/perl
+# libguestfs
+# Copyright (C) 2015 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Compare vfs_statvfs, which reads the filesystem metadata without
+# mounting, against mount_ro + statvfs.
+
+use strict;
+use warnings;
+
+use Sys::Guestfs;
+
+exit 77 if $ENV{SKIP_TEST_VFS_STATVFS_PL};
+
+# Filesystem type, and the features needed to create and mount it.
+my @filesystems = (
+    [ "ext2",  [] ],
+    [ "ext4",  [] ],
+    [ "xfs",   [ "xfs" ] ],
+    [ "btrfs", [ "btrfs" ] ],
+    [ "ntfs",  [ "ntfs3g", "ntfsprogs" ] ],
+    # Not read directly, so this tests the fallback to mounting.
+    [ "vfat",  [] ],
+);
+
+# The numbers read from the metadata may differ slightly from the
+# kernel's, eg. because of XFS per-AG reservations.
+my $tolerance = 0.02;
+
+my $g = Sys::Guestfs->new ();
+
+$g->add_drive_scratch (1024*1024*1024);
+$g->launch ();
+
+$g->part_disk ("/dev/sda", "mbr");
+
+sub check
+{
+    my $fs = shift;
+    my $field = shift;
+    my $direct = shift;
+    my $mounted = shift;
+
+    # Compare bytes, since the block sizes may differ.
+    my $d = $direct->{$field} * $direct->{frsize};
+    my $m = $mounted->{$field} * $mounted->{frsize};
+    my $size = $mounted->{blocks} * $mounted->{frsize};
+
+    die "$fs: $field: vfs_statvfs returned $d bytes, statvfs returned $m bytes"
+        if abs ($d - $m) > $size * $tolerance;
+}
+
+foreach (@filesystems) {
+    my ($fs, $features) = @$_;
+
+    unless ($g->feature_available ($features)) {
+        warn "$0: skipping $fs because it is not available\n";
+        next;
+    }
+
+    $g->mkfs ($fs, "/dev/sda1");
+
+    # Use some of the space.
+    $g->mount ("/dev/sda1", "/");
+    $g->fill (0, 100*1024*1024, "/file");
+    $g->mkdir ("/dir");
+    $g->touch ("/dir/file$_") foreach (1..100);
+    $g->umount_all ();
+
+    my %direct = $g->vfs_statvfs ("/dev/sda1");
+
+    $g->mount_ro ("/dev/sda1", "/");
+    my %mounted = $g->statvfs ("/");
+    $g->umount_all ();
+
+    check ($fs, "blocks", \%direct, \%mounted);
+    check ($fs, "bfree", \%direct, \%mounted);
+}
+
+$g->shutdown ();
+$g->close ();
@@ -0,0 +1,181 @@
+#!/usr/bin/perl
+# libguestfs
+# Copyright (C) 2015 Red Hat Inc.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Compare the output of walk_out against lstatnslist, lxattrlist and
+# readlink on the same tree.
+
+use strict;
+use warnings;
+
+use Sys::Guestfs;
+
+exit 77 if $ENV{SKIP_TEST_WALK_OUT_PL};
+
+my $g = Sys::Guestfs->new ();
+
+$g->add_drive_scratch (100*1024*1024);
+$g->launch ();
+
+unless ($g->feature_available (["linuxxattrs"])) {
+    warn "$0: skipping test because linuxxattrs is not available\n";
+    exit 77;
+}
+
+$g->part_disk ("/dev/sda", "mbr");
+$g->mkfs ("ext4", "/dev/sda1");
+# So that walking the tree doesn't change the atimes.
+$g->mount_options ("noatime", "/dev/sda1", "/");
+
+$g->mkdir ("/dir");
+$g->write ("/dir/file", "hello\n");
+$g->setxattr ("user.foo", "bar", 3, "/dir/file");
+$g->setxattr ("user.empty", "", 0, "/dir/file");
+$g->mkdir ("/dir/sub");
+$g->setxattr ("user.sub", "subdir", 6, "/dir/sub");
+$g->touch ("/dir/sub/file2");
+$g->mknod_c (0777, 1, 3, "/dir/sub/null");
+# The links must not pick up the extended attributes of their targets.
+$g->ln_s ("sub", "/dir/link");
+$g->ln_s ("/dir/sub", "/dir/sub/abslink");
+$g->ln_s ("nowhere", "/dir/sub/dangling");
+$g->setxattr ("user.top", "top", 3, "/dir");
+
+my $tmpfile = "test-walk-out.tmp";
+$g->walk_out ("/dir", $tmpfile);
+
+open my $fh, "<", $tmpfile or die "$tmpfile: $!";
+binmode $fh;
+my $data = do { local $/; <$fh> };
+close $fh;
+unlink $tmpfile;
+
+my $pos = 0;
+
+sub get_string
+{
+    my $i = index ($data, "\0", $pos);
+    die "unterminated string at offset $pos" if $i == -1;
+    my $s = substr ($data, $pos, $i - $pos);
+    $pos = $i + 1;
+    return $s;
+}
+
+sub get_uint32
+{
+    die "truncated record at offset $pos" if $pos + 4 > length $data;
+    my $v = unpack ("N", substr ($data, $pos, 4));
+    $pos += 4;
+    return $v;
+}
+
+sub get_int64
+{
+    die "truncated record at offset $pos" if $pos + 8 > length $data;
+    my $v = unpack ("q>", substr ($data, $pos, 8));
+    $pos += 8;
+    return $v;
+}
+
+my @fields = qw(st_dev st_ino st_mode st_nlink st_uid st_gid st_rdev
+                st_size st_blksize st_blocks
+                st_atime_sec st_atime_nsec st_mtime_sec st_mtime_nsec
+                st_ctime_sec st_ctime_nsec);
+
+my @records;
+while ($pos < length $data) {
+    my %r;
+    $r{path} = get_string ();
+    $r{stat}{$_} = get_int64 () foreach (@fields);
+    my $n = get_uint32 ();
+    for (1..$n) {
+        my $name = get_string ();
+        my $len = get_uint32 ();
+        $r{xattrs}{$name} = substr ($data, $pos, $len);
+        $pos += $len;
+    }
+    $r{link} = get_string ();
+    $r{csum} = get_string ();
+    push @records, \%r;
+}
+
+# The first record is the directory itself, followed by everything
+# under it in pre-order.
+my @paths = map { $_->{path} } @records;
+die "walk_out: first record is '$paths[0]'" unless $paths[0] eq "";
+shift @paths;
+my @expected = ("file", "link", "sub",
+                "sub/abslink", "sub/dangling", "sub/file2", "sub/null");
+die "walk_out: got paths @paths, expected @expected"
+    unless "@paths" eq "@expected";
+
+# Group the records by directory, so that each directory can be
+# checked with one call to lstatnslist and lxattrlist.
+my %dirs;
+foreach my $r (@records) {
+    my ($dir, $name);
+    if ($r->{path} eq "") {
+        ($dir, $name) = ("/", "dir");
+    } elsif ($r->{path} =~ m{^(.*)/([^/]+)$}) {
+        ($dir, $name) = ("/dir/$1", $2);
+    } else {
+        ($dir, $name) = ("/dir", $r->{path});
+    }
+    push @{$dirs{$dir}}, [ $name, $r ];
+}
+
+foreach my $dir (sort keys %dirs) {
+    my @names = map { $_->[0] } @{$dirs{$dir}};
+    my @stats = $g->lstatnslist ($dir, \@names);
+    my @xattrs = $g->lxattrlist ($dir, \@names);
+
+    foreach (@{$dirs{$dir}}) {
+        my ($name, $r) = @$_;
+        my $path = "$dir/$name";
+
+        my $st = shift @stats;
+        foreach my $field (@fields) {
+            die "$path: $field: walk_out returned $r->{stat}{$field}, ",
+                "lstatnslist returned $st->{$field}"
+                unless $r->{stat}{$field} == $st->{$field};
+        }
+
+        # lxattrlist returns a header entry with the count for each
+        # name, followed by the attributes themselves.
+        my $header = shift @xattrs;
+        die "$path: bad lxattrlist header" unless $header->{attrname} eq "";
+        my %x;
+        for (1..$header->{attrval}) {
+            my $xa = shift @xattrs;
+            $x{$xa->{attrname}} = $xa->{attrval};
+        }
+        my $got = join ",", map { "$_=$r->{xattrs}{$_}" } sort keys %{$r->{xattrs}};
+        my $exp = join ",", map { "$_=$x{$_}" } sort keys %x;
+        die "$path: walk_out returned xattrs '$got', lxattrlist returned '$exp'"
+            unless $got eq $exp;
+
+        my $link = "";
+        $link = $g->readlink ($path) if ($st->{st_mode} & 0170000) == 0120000;
+        die "$path: walk_out returned link '$r->{link}', expected '$link'"
+            unless $r->{link} eq $link;
+
+        die "$path: unexpected checksum" unless $r->{csum} eq "";
+    }
+}
+
+$g->shutdown ();
+$g->close ();
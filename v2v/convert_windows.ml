@@ -580,34 +580,33 @@ echo uninstalling Xen PV driver
     try
       let node = get_node root ["Microsoft"; "Windows"; "CurrentVersion"] in
       let append = encode_utf16le ";%SystemRoot%\\Drivers\\VirtIO" in
-      let values = Array.to_list (g#hivex_node_values node) in
+      (* Get the keys, types and data of all values in one call. *)
+      let values = Array.to_list (g#hivex_node_get_subtree node 0) in
       let rec loop = function
         | [] -> () (* DevicePath not found -- ignore this case *)
-        | { G.hivex_value_h = valueh } :: values ->
-          let key = g#hivex_value_key valueh in
-          if key <> "DevicePath" then
-            loop values
-          else (
-            let data = g#hivex_value_value valueh in
-            let len = String.length data in
-            let t = g#hivex_value_type valueh in
-
-            (* Only add the appended path if it doesn't exist already. *)
-            if string_find data append = -1 then (
-              (* Remove the explicit [\0\0] at the end of the string.
-               * This is the UTF-16LE NUL-terminator.
-               *)
-              let data =
-                if len >= 2 && String.sub data (len-2) 2 = "\000\000" then
-                  String.sub data 0 (len-2)
-                else
-                  data in
-
-              (* Append the path and the explicit NUL. *)
-              let data = data ^ append ^ "\000\000" in
-
-              g#hivex_node_set_value node key t data
-            )
+        | { G.hivex_entry_valueh = 0L } :: values -> (* the node itself *)
+          loop values
+        | { G.hivex_entry_key = key } :: values when key <> "DevicePath" ->
+          loop values
+        | { G.hivex_entry_key = key; hivex_entry_type = t;
+            hivex_entry_value = data } :: _ ->
+          let len = String.length data in
+
+          (* Only add the appended path if it doesn't exist already. *)
+          if string_find data append = -1 then (
+            (* Remove the explicit [\0\0] at the end of the string.
+             * This is the UTF-16LE NUL-terminator.
+             *)
+            let data =
+              if len >= 2 && String.sub data (len-2) 2 = "\000\000" then
+                String.sub data 0 (len-2)
+              else
+                data in
+
+            (* Append the path and the explicit NUL. *)
+            let data = data ^ append ^ "\000\000" in
+
+            g#hivex_node_set_value node key t data
           )
       in
       loop values